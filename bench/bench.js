@@ -0,0 +1,330 @@
+// Benchmarks gumbo.parse() over the documents in corpus.js.  Run with
+// `npm run bench`, which exposes the garbage collector so that memory can be
+// measured; see the README for the options.
+//
+// The overall figures come from parses without stats, since collecting them
+// slows the C parse down.  A separate run with stats splits each parse into the
+// C parse, as timed by the parser's own stats, and the conversion of the tree
+// into JS objects, which is everything else.  Garbage collection can only
+// happen during conversion, since the C parse never touches the V8 heap.
+
+var gumbo = require('../gumbo');
+var corpus = require('./corpus');
+var compare = require('./compare');
+var childProcess = require('child_process');
+var fs = require('fs');
+var os = require('os');
+var path = require('path');
+
+var perfHooks = null;
+try {
+    perfHooks = require('perf_hooks');
+} catch (e) {
+    // Older nodes can't report GC time.
+}
+
+
+function parseArgs(argv) {
+    var args = {
+        minTime: 1000,
+        minIterations: 5,
+        only: null,
+        out: null,
+        compare: null
+    };
+    for (var i = 0; i < argv.length; i++) {
+        switch (argv[i]) {
+        case '--time':
+            args.minTime = Number(argv[++i]);
+            break;
+        case '--iterations':
+            args.minIterations = Number(argv[++i]);
+            break;
+        case '--only':
+            args.only = argv[++i].split(',');
+            break;
+        case '--out':
+            args.out = argv[++i];
+            break;
+        case '--compare':
+            args.compare = argv[++i];
+            break;
+        default:
+            throw new Error('Unknown argument ' + argv[i]);
+        }
+    }
+    return args;
+}
+
+
+function elapsedMs(start) {
+    var diff = process.hrtime(start);
+    return diff[0] * 1e3 + diff[1] / 1e6;
+}
+
+
+function percentile(sorted, p) {
+    var index = Math.min(sorted.length - 1,
+                         Math.floor(sorted.length * p / 100));
+    return sorted[index];
+}
+
+
+function summarize(samples) {
+    var sorted = samples.slice().sort(function(a, b) { return a - b; });
+    var total = 0;
+    for (var i = 0; i < sorted.length; i++) {
+        total += sorted[i];
+    }
+    return {
+        mean: total / sorted.length,
+        p50: percentile(sorted, 50),
+        p99: percentile(sorted, 99),
+        min: sorted[0],
+        max: sorted[sorted.length - 1]
+    };
+}
+
+
+function collectGarbage() {
+    if (global.gc) {
+        global.gc();
+    }
+}
+
+
+// Adds up GC pauses reported between start() and stop().  The entries are
+// delivered asynchronously, so stop() takes a callback.
+function GcTimer() {
+    this.total = 0;
+    this.count = 0;
+    this.observer = null;
+    if (perfHooks && perfHooks.PerformanceObserver) {
+        var timer = this;
+        this.observer = new perfHooks.PerformanceObserver(function(list) {
+            if (!timer.running) {
+                return;
+            }
+            list.getEntries().forEach(function(entry) {
+                timer.total += entry.duration;
+                timer.count++;
+            });
+        });
+        this.observer.observe({entryTypes: ['gc']});
+    }
+}
+
+GcTimer.prototype.start = function() {
+    this.total = 0;
+    this.count = 0;
+    this.running = true;
+};
+
+GcTimer.prototype.close = function() {
+    if (this.observer) {
+        this.observer.disconnect();
+    }
+};
+
+GcTimer.prototype.stop = function(callback) {
+    var timer = this;
+    setImmediate(function() {
+        timer.running = false;
+        callback(timer.observer ? {ms: timer.total, count: timer.count}
+                                : null);
+    });
+};
+
+
+// Measures the memory that a converted tree keeps alive, and the C parser's
+// own peak, from a single parse.
+function measureMemory(html) {
+    collectGarbage();
+    var before = process.memoryUsage();
+    var document = gumbo.parse(html, {stats: true});
+    collectGarbage();
+    var after = process.memoryUsage();
+    var result = {
+        cPeakBytes: document.stats.peakBytes,
+        heapUsedDelta: after.heapUsed - before.heapUsed,
+        rssDelta: after.rss - before.rss,
+        exact: !!global.gc
+    };
+    // Keep the tree alive until the second reading.
+    document = null;
+    return result;
+}
+
+
+// Splits parses into the C parse and the conversion, from a run of its own
+// with stats on.
+function measureSplit(html, args) {
+    var parses = [];
+    var conversions = [];
+    var started = process.hrtime();
+    while (parses.length < args.minIterations ||
+           elapsedMs(started) < args.minTime) {
+        var start = process.hrtime();
+        var document = gumbo.parse(html, {stats: true});
+        var total = elapsedMs(start);
+        var parse = Math.min(total, document.stats.totalTime);
+        parses.push(parse);
+        conversions.push(total - parse);
+    }
+    return {parse: summarize(parses), conversion: summarize(conversions)};
+}
+
+
+function runOne(entry, args, gcTimer, callback) {
+    var html = entry.html;
+    var bytes = Buffer.byteLength(html, 'utf-8');
+
+    // Warm up, so that the first (cold) parse doesn't skew the percentiles.
+    for (var i = 0; i < 2; i++) {
+        gumbo.parse(html);
+    }
+
+    var memory = measureMemory(html);
+    var split = measureSplit(html, args);
+
+    var totals = [];
+    collectGarbage();
+    gcTimer.start();
+    var started = process.hrtime();
+    while (totals.length < args.minIterations ||
+           elapsedMs(started) < args.minTime) {
+        var start = process.hrtime();
+        gumbo.parse(html);
+        totals.push(elapsedMs(start));
+    }
+    var iterations = totals.length;
+
+    gcTimer.stop(function(gc) {
+        var total = summarize(totals);
+        var parse = split.parse;
+        var conversion = split.conversion;
+        callback({
+            bytes: bytes,
+            iterations: iterations,
+            throughputMBps: bytes / 1e6 / (total.mean / 1e3),
+            parseThroughputMBps: bytes / 1e6 / (parse.mean / 1e3),
+            totalMs: total,
+            parseMs: parse,
+            conversionMs: conversion,
+            conversionGc: gc && {
+                ms: gc.ms,
+                perIterationMs: gc.ms / iterations,
+                count: gc.count
+            },
+            memory: memory
+        });
+    });
+}
+
+
+function pad(text, width) {
+    text = String(text);
+    while (text.length < width) {
+        text = ' ' + text;
+    }
+    return text;
+}
+
+
+function report(name, result) {
+    console.log(
+        pad(name, 10) +
+        pad((result.bytes / 1024).toFixed(1) + 'KB', 11) +
+        pad(result.throughputMBps.toFixed(1) + 'MB/s', 12) +
+        pad(result.parseThroughputMBps.toFixed(1) + 'MB/s', 12) +
+        pad(result.totalMs.p50.toFixed(3), 10) +
+        pad(result.totalMs.p99.toFixed(3), 10) +
+        pad(result.parseMs.p50.toFixed(3), 10) +
+        pad(result.conversionMs.p50.toFixed(3), 10) +
+        pad(result.conversionGc ?
+            result.conversionGc.perIterationMs.toFixed(3) : '-', 9) +
+        pad((result.memory.heapUsedDelta / 1024).toFixed(0) + 'KB', 11) +
+        pad((result.memory.rssDelta / 1024).toFixed(0) + 'KB', 11) +
+        pad((result.memory.cPeakBytes / 1024).toFixed(0) + 'KB', 11));
+}
+
+
+function gitCommit() {
+    try {
+        return childProcess.execSync('git rev-parse --short HEAD', {
+            cwd: __dirname,
+            encoding: 'utf-8',
+            stdio: ['ignore', 'pipe', 'ignore']
+        }).trim();
+    } catch (e) {
+        return null;
+    }
+}
+
+
+function main() {
+    var args = parseArgs(process.argv.slice(2));
+    var entries = corpus.load().filter(function(entry) {
+        return !args.only || args.only.indexOf(entry.name) != -1;
+    });
+    if (!global.gc) {
+        console.log('Run with --expose-gc (as `npm run bench` does) for ' +
+                    'accurate memory figures.');
+    }
+
+    console.log(
+        pad('document', 10) + pad('size', 11) + pad('total', 12) +
+        pad('C parse', 12) + pad('p50 ms', 10) + pad('p99 ms', 10) +
+        pad('C p50', 10) + pad('JS p50', 10) + pad('GC ms', 9) +
+        pad('heapUsed', 11) + pad('RSS', 11) + pad('C peak', 11));
+
+    var commit = gitCommit();
+    var results = {
+        commit: commit,
+        date: new Date().toISOString(),
+        node: process.version,
+        platform: process.platform + '-' + process.arch,
+        cpu: os.cpus().length ? os.cpus()[0].model : null,
+        documents: {}
+    };
+    var gcTimer = new GcTimer();
+
+    var index = 0;
+    function next() {
+        if (index == entries.length) {
+            gcTimer.close();
+            finish(args, results);
+            return;
+        }
+        var entry = entries[index++];
+        runOne(entry, args, gcTimer, function(result) {
+            results.documents[entry.name] = result;
+            report(entry.name, result);
+            next();
+        });
+    }
+    next();
+}
+
+
+function finish(args, results) {
+    var out = args.out;
+    if (!out) {
+        var dir = path.join(__dirname, 'results');
+        if (!fs.existsSync(dir)) {
+            fs.mkdirSync(dir);
+        }
+        out = path.join(dir, (results.commit || 'results') + '.json');
+    }
+    fs.writeFileSync(out, JSON.stringify(results, null, 2) + '\n');
+    console.log('\nWrote ' + out);
+
+    if (args.compare) {
+        var baseline = JSON.parse(fs.readFileSync(args.compare, 'utf-8'));
+        console.log('');
+        compare.print(baseline, results);
+    }
+}
+
+
+main();
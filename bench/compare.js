@@ -0,0 +1,81 @@
+// Compares two sets of results written by bench.js:
+//
+//   node bench/compare.js bench/results/OLD.json bench/results/NEW.json
+
+var fs = require('fs');
+
+
+// The figures worth diffing, and whether bigger is better for each.
+var METRICS = [
+    {name: 'total MB/s', get: function(r) { return r.throughputMBps; },
+     higherIsBetter: true},
+    {name: 'C MB/s', get: function(r) { return r.parseThroughputMBps; },
+     higherIsBetter: true},
+    {name: 'p50 ms', get: function(r) { return r.totalMs.p50; }},
+    {name: 'p99 ms', get: function(r) { return r.totalMs.p99; }},
+    {name: 'JS p50 ms', get: function(r) { return r.conversionMs.p50; }},
+    {name: 'GC ms', get: function(r) {
+        return r.conversionGc ? r.conversionGc.perIterationMs : null;
+    }},
+    {name: 'heapUsed', get: function(r) { return r.memory.heapUsedDelta; }},
+    {name: 'C peak', get: function(r) { return r.memory.cPeakBytes; }}
+];
+
+
+function pad(text, width) {
+    text = String(text);
+    while (text.length < width) {
+        text = ' ' + text;
+    }
+    return text;
+}
+
+
+function change(before, after, higherIsBetter) {
+    if (before == null || after == null || before === 0) {
+        return '-';
+    }
+    var percent = (after - before) / before * 100;
+    var better = higherIsBetter ? percent > 0 : percent < 0;
+    return (percent >= 0 ? '+' : '') + percent.toFixed(1) + '%' +
+        (Math.abs(percent) >= 5 ? (better ? ' (better)' : ' (worse)') : '');
+}
+
+
+function print(baseline, current) {
+    console.log('Comparing ' + (baseline.commit || '?') + ' -> ' +
+                (current.commit || '?'));
+    var header = pad('document', 10);
+    METRICS.forEach(function(metric) {
+        header += pad(metric.name, 20);
+    });
+    console.log(header);
+    Object.keys(current.documents).forEach(function(name) {
+        var before = baseline.documents[name];
+        var after = current.documents[name];
+        if (!before) {
+            return;
+        }
+        var line = pad(name, 10);
+        METRICS.forEach(function(metric) {
+            line += pad(change(metric.get(before), metric.get(after),
+                               metric.higherIsBetter), 20);
+        });
+        console.log(line);
+    });
+}
+
+
+if (require.main === module) {
+    if (process.argv.length != 4) {
+        console.error('Usage: node bench/compare.js BASELINE.json CURRENT.json');
+        process.exit(2);
+    }
+    print(JSON.parse(fs.readFileSync(process.argv[2], 'utf-8')),
+          JSON.parse(fs.readFileSync(process.argv[3], 'utf-8')));
+}
+
+
+module.exports = {
+    print: print
+};
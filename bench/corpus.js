@@ -0,0 +1,43 @@
+var fs = require('fs');
+var path = require('path');
+
+
+function read(name) {
+    return fs.readFileSync(path.join(__dirname, 'corpus', name), 'utf-8');
+}
+
+
+function repeat(text, count) {
+    return new Array(count + 1).join(text);
+}
+
+
+// The benchmark documents.  The checked-in pages cover the common shapes of
+// real-world HTML; the rest are built from them (or from scratch) so that the
+// repository doesn't have to carry megabytes of fixtures.
+function load() {
+    var article = read('article.html');
+    var body = article.slice(article.indexOf('<body'),
+                             article.lastIndexOf('</body>'));
+
+    var deep = '';
+    for (var i = 0; i < 2000; i++) {
+        deep += '<div class="level-' + i + '">' + i + ' ';
+    }
+
+    return [
+        {name: 'small', html: read('small.html')},
+        {name: 'medium', html: article},
+        {name: 'huge', html: article.replace('</body>',
+                                             repeat(body, 300) + '</body>')},
+        {name: 'entities', html: read('entities.html')},
+        {name: 'scripts', html: read('scripts.html')},
+        {name: 'tables', html: read('tables.html')},
+        {name: 'deep', html: '<!DOCTYPE html><body>' + deep}
+    ];
+}
+
+
+module.exports = {
+    load: load
+};
@@ -3,6 +3,10 @@
     {
       "target_name": "gumbo",
       "sources": [ "gumbo.cc" ],
+      "cflags_cc": [ "-std=c++11" ],
+      "xcode_settings": {
+        "OTHER_CPLUSPLUSFLAGS": [ "-std=c++11" ]
+      },
       "dependencies": [
         'deps/gumbo-parser/gumbo-parser.gyp:gumbo'
       ]
@@ -0,0 +1,438 @@
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Microbenchmarks for the hot paths of the library: the tokenizer in each of
+// its main states, character references, UTF-8 decoding, tag lookup, vectors
+// and the whole parse.  Each benchmark reports time per byte of input (where
+// that makes sense), time per operation, and cycles per operation, where an
+// operation is a token for the tokenizer and the parser.  Cycles are read from
+// the timestamp counter where there is one, so they're reference cycles rather
+// than core cycles; turn off frequency scaling for stable numbers.
+//
+// Usage: gumbo_benchmark [--min-time-ms N] [--filter SUBSTRING] [FILE...]
+// Any files given are parsed as extra full-parse benchmarks.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#define GUMBO_HAVE_RDTSC 1
+#elif (defined(__GNUC__) || defined(__clang__)) && \
+    (defined(__x86_64__) || defined(__i386__))
+#include <x86intrin.h>
+#define GUMBO_HAVE_RDTSC 1
+#endif
+
+#include "char_ref.h"
+#include "error.h"
+#include "gumbo.h"
+#include "parser.h"
+#include "tokenizer.h"
+#include "tokenizer_states.h"
+#include "utf8.h"
+#include "util.h"
+#include "vector.h"
+
+namespace {
+
+// Results are folded into this so that the compiler can't drop the work.
+volatile uint64_t sink;
+
+uint64_t ReadCycles() {
+#ifdef GUMBO_HAVE_RDTSC
+  return __rdtsc();
+#else
+  return 0;
+#endif
+}
+
+// A GumboParser with just enough set up for the tokenizer and its helpers,
+// the same way the unit tests do it.
+class ParserFixture {
+ public:
+  ParserFixture() : options_(kGumboDefaultOptions) {
+    parser_._options = &options_;
+    parser_._allocated_bytes = 0;
+    parser_._stats = NULL;
+    parser_._profile = NULL;
+    parser_._parser_state = NULL;
+    parser_._tokenizer_state = NULL;
+    parser_._output = static_cast<GumboOutput*>(gumbo_parser_allocate(
+        &parser_, sizeof(GumboOutput), GUMBO_ALLOCATION_OTHER));
+    gumbo_init_errors(&parser_);
+  }
+
+  ~ParserFixture() {
+    gumbo_destroy_errors(&parser_);
+    gumbo_parser_deallocate(&parser_, parser_._output);
+  }
+
+  // Throws away any parse errors, so that they don't pile up over iterations.
+  void ClearErrors() {
+    gumbo_destroy_errors(&parser_);
+    gumbo_init_errors(&parser_);
+  }
+
+  GumboParser* parser() { return &parser_; }
+
+ private:
+  GumboOptions options_;
+  GumboParser parser_;
+};
+
+// One benchmark.  Run() does a single iteration and returns the number of
+// operations it performed; bytes is the input size of one iteration, or 0 if
+// time per byte isn't meaningful.
+class Benchmark {
+ public:
+  Benchmark(const std::string& name, size_t bytes)
+      : name_(name), bytes_(bytes) {}
+  virtual ~Benchmark() {}
+
+  virtual uint64_t Run() = 0;
+
+  const std::string& name() const { return name_; }
+  size_t bytes() const { return bytes_; }
+
+ private:
+  std::string name_;
+  size_t bytes_;
+};
+
+// Lexes input to the end, starting in the given tokenizer state.
+class LexBenchmark : public Benchmark {
+ public:
+  LexBenchmark(const std::string& name, const std::string& input,
+               GumboTokenizerEnum state)
+      : Benchmark(name, input.size()), input_(input), state_(state) {}
+
+  virtual uint64_t Run() {
+    GumboParser* parser = fixture_.parser();
+    gumbo_tokenizer_state_init(parser, input_.data(), input_.size());
+    gumbo_tokenizer_set_state(parser, state_);
+    uint64_t tokens = 0;
+    GumboToken token;
+    do {
+      gumbo_lex(parser, &token);
+      sink += token.type;
+      gumbo_token_destroy(parser, &token);
+      ++tokens;
+    } while (token.type != GUMBO_TOKEN_EOF);
+    gumbo_tokenizer_state_destroy(parser);
+    fixture_.ClearErrors();
+    return tokens;
+  }
+
+ private:
+  ParserFixture fixture_;
+  std::string input_;
+  GumboTokenizerEnum state_;
+};
+
+// Consumes each of a list of character references, which all start with '&'.
+class CharRefBenchmark : public Benchmark {
+ public:
+  CharRefBenchmark(const std::string& name,
+                   const std::vector<std::string>& refs)
+      : Benchmark(name, TotalSize(refs)), refs_(refs) {}
+
+  virtual uint64_t Run() {
+    GumboParser* parser = fixture_.parser();
+    for (size_t i = 0; i < refs_.size(); ++i) {
+      Utf8Iterator iter;
+      OneOrTwoCodepoints output;
+      utf8iterator_init(parser, refs_[i].data(), refs_[i].size(), &iter);
+      consume_char_ref(parser, &iter, ' ', false, &output);
+      sink += output.first;
+    }
+    fixture_.ClearErrors();
+    return refs_.size();
+  }
+
+ private:
+  static size_t TotalSize(const std::vector<std::string>& refs) {
+    size_t size = 0;
+    for (size_t i = 0; i < refs.size(); ++i) {
+      size += refs[i].size();
+    }
+    return size;
+  }
+
+  ParserFixture fixture_;
+  std::vector<std::string> refs_;
+};
+
+// Decodes input one code point at a time.
+class Utf8Benchmark : public Benchmark {
+ public:
+  Utf8Benchmark(const std::string& name, const std::string& input)
+      : Benchmark(name, input.size()), input_(input) {}
+
+  virtual uint64_t Run() {
+    Utf8Iterator iter;
+    utf8iterator_init(fixture_.parser(), input_.data(), input_.size(), &iter);
+    uint64_t code_points = 0;
+    while (utf8iterator_current(&iter) != -1) {
+      sink += utf8iterator_current(&iter);
+      utf8iterator_next(&iter);
+      ++code_points;
+    }
+    fixture_.ClearErrors();
+    return code_points;
+  }
+
+ private:
+  ParserFixture fixture_;
+  std::string input_;
+};
+
+// Looks up each of a list of tag names.
+class TagEnumBenchmark : public Benchmark {
+ public:
+  TagEnumBenchmark(const std::string& name,
+                   const std::vector<std::string>& names)
+      : Benchmark(name, 0), names_(names) {}
+
+  virtual uint64_t Run() {
+    for (size_t i = 0; i < names_.size(); ++i) {
+      sink += gumbo_tag_enum(names_[i].c_str());
+    }
+    return names_.size();
+  }
+
+ private:
+  std::vector<std::string> names_;
+};
+
+// Fills a vector from empty, the way child and attribute lists are built.
+class VectorAddBenchmark : public Benchmark {
+ public:
+  VectorAddBenchmark(const std::string& name, int count)
+      : Benchmark(name, 0), count_(count) {}
+
+  virtual uint64_t Run() {
+    GumboParser* parser = fixture_.parser();
+    GumboVector vector;
+    gumbo_vector_init(parser, 0, &vector);
+    for (int i = 0; i < count_; ++i) {
+      gumbo_vector_add(parser, &vector, &vector);
+    }
+    sink += vector.length;
+    gumbo_vector_destroy(parser, &vector);
+    return count_;
+  }
+
+ private:
+  ParserFixture fixture_;
+  int count_;
+};
+
+// Parses a whole document with the default options.  The operation count is
+// the number of tokens, taken from the parse stats of a first run.
+class ParseBenchmark : public Benchmark {
+ public:
+  ParseBenchmark(const std::string& name, const std::string& input)
+      : Benchmark(name, input.size()), input_(input), tokens_(0) {
+    GumboOptions options = kGumboDefaultOptions;
+    options.collect_stats = true;
+    GumboOutput* output = gumbo_parse_with_options(
+        &options, input_.data(), input_.size());
+    const GumboParseStats* stats = output->stats;
+    tokens_ = stats->doctype_tokens + stats->start_tag_tokens +
+        stats->end_tag_tokens + stats->comment_tokens +
+        stats->whitespace_tokens + stats->character_tokens +
+        stats->null_tokens;
+    gumbo_destroy_output(&options, output);
+  }
+
+  virtual uint64_t Run() {
+    GumboOutput* output = gumbo_parse_with_options(
+        &kGumboDefaultOptions, input_.data(), input_.size());
+    sink += output->root->v.element.children.length;
+    gumbo_destroy_output(&kGumboDefaultOptions, output);
+    return tokens_;
+  }
+
+ private:
+  std::string input_;
+  uint64_t tokens_;
+};
+
+std::string Repeat(const std::string& text, int count) {
+  std::string result;
+  result.reserve(text.size() * count);
+  for (int i = 0; i < count; ++i) {
+    result += text;
+  }
+  return result;
+}
+
+// A page-like document that mixes the common kinds of markup.
+std::string SyntheticPage() {
+  return "<!DOCTYPE html><html><head><title>Benchmark &amp; page</title>"
+      "<style>body { margin: 0 } p > a { color: #333 }</style></head><body>" +
+      Repeat(
+          "<div class=\"item\" id=item><h2><a href=\"/item?id=1&amp;x=2\">"
+          "Item title</a></h2><p>Some <b>bold</b> and <i>italic</i> text, a "
+          "<span title='tip'>tooltip</span> and an entity &eacute;.</p>"
+          "<ul><li>one<li>two<li>three</ul><!-- separator --></div>\n", 200) +
+      "<script>for (var i = 0; i < 10; i++) { x += '<p>'; }</script>"
+      "</body></html>";
+}
+
+void AddBenchmarks(std::vector<Benchmark*>* benchmarks) {
+  const std::string text = Repeat(
+      "The quick brown fox jumps over the lazy dog, again and again. ", 1000);
+  benchmarks->push_back(new LexBenchmark("lex/data", text, GUMBO_LEX_DATA));
+  benchmarks->push_back(new LexBenchmark(
+      "lex/tags",
+      Repeat("<a href=\"/path/to/page\" class=link data-id='42'>x</a>", 1000),
+      GUMBO_LEX_DATA));
+  benchmarks->push_back(new LexBenchmark(
+      "lex/comments", Repeat("<!-- a comment with some text in it -->", 1000),
+      GUMBO_LEX_DATA));
+  benchmarks->push_back(new LexBenchmark(
+      "lex/char_refs", Repeat("caf&eacute; &amp; cr&egrave;me &#233;&#xE9; ",
+                              1000),
+      GUMBO_LEX_DATA));
+  benchmarks->push_back(new LexBenchmark(
+      "lex/rcdata", Repeat("a < b &amp;&amp; c > d in a textarea ", 1000),
+      GUMBO_LEX_RCDATA));
+  benchmarks->push_back(new LexBenchmark(
+      "lex/rawtext", Repeat("p > a { color: #333; margin: 0 1px } ", 1000),
+      GUMBO_LEX_RAWTEXT));
+  benchmarks->push_back(new LexBenchmark(
+      "lex/script", Repeat("if (a < b && c > d) { s += '</p>'; } ", 1000),
+      GUMBO_LEX_SCRIPT));
+  benchmarks->push_back(
+      new LexBenchmark("lex/plaintext", text, GUMBO_LEX_PLAINTEXT));
+
+  std::vector<std::string> refs;
+  const char* kRefs[] = {
+    "&amp;", "&lt;", "&nbsp;", "&eacute;", "&notin;", "&zwnj;", "&AMP;",
+    "&CounterClockwiseContourIntegral;", "&#169;", "&#x263A;", "&#128512;",
+    "&copy"
+  };
+  for (int i = 0; i < 100; ++i) {
+    for (size_t j = 0; j < sizeof(kRefs) / sizeof(kRefs[0]); ++j) {
+      refs.push_back(kRefs[j]);
+    }
+  }
+  benchmarks->push_back(new CharRefBenchmark("consume_char_ref", refs));
+
+  benchmarks->push_back(new Utf8Benchmark("utf8/ascii", text));
+  benchmarks->push_back(new Utf8Benchmark(
+      "utf8/mixed",
+      Repeat("Gr\xc3\xbc\xc3\x9f" "e, \xe4\xb8\x96\xe7\x95\x8c "
+             "\xf0\x9f\x98\x80 caf\xc3\xa9 ", 1000)));
+
+  std::vector<std::string> names;
+  const char* kTagNames[] = {
+    "a", "div", "span", "p", "li", "td", "tr", "img", "blockquote",
+    "figcaption", "foreignobject", "my-widget", "x"
+  };
+  for (int i = 0; i < 100; ++i) {
+    for (size_t j = 0; j < sizeof(kTagNames) / sizeof(kTagNames[0]); ++j) {
+      names.push_back(kTagNames[j]);
+    }
+  }
+  benchmarks->push_back(new TagEnumBenchmark("gumbo_tag_enum", names));
+
+  benchmarks->push_back(new VectorAddBenchmark("gumbo_vector_add/4", 4));
+  benchmarks->push_back(new VectorAddBenchmark("gumbo_vector_add/1000", 1000));
+
+  benchmarks->push_back(new ParseBenchmark("parse/synthetic", SyntheticPage()));
+}
+
+void RunBenchmark(Benchmark* benchmark, uint64_t min_time_ns) {
+  // One untimed run to warm caches and the allocator.
+  benchmark->Run();
+
+  uint64_t iterations = 0;
+  uint64_t operations = 0;
+  uint64_t start_cycles = ReadCycles();
+  uint64_t start = gumbo_monotonic_time_ns();
+  uint64_t elapsed;
+  do {
+    operations += benchmark->Run();
+    ++iterations;
+    elapsed = gumbo_monotonic_time_ns() - start;
+  } while (elapsed < min_time_ns);
+  uint64_t cycles = ReadCycles() - start_cycles;
+
+  char per_byte[32] = "-";
+  if (benchmark->bytes() > 0) {
+    snprintf(per_byte, sizeof(per_byte), "%.3f",
+             (double) elapsed / (iterations * benchmark->bytes()));
+  }
+  char per_op_cycles[32] = "-";
+  if (cycles > 0) {
+    snprintf(per_op_cycles, sizeof(per_op_cycles), "%.1f",
+             (double) cycles / operations);
+  }
+  printf("%-24s %10llu %12s %12.2f %14s\n", benchmark->name().c_str(),
+         (unsigned long long) iterations, per_byte,
+         (double) elapsed / operations, per_op_cycles);
+  fflush(stdout);
+}
+
+std::string ReadFile(const char* filename) {
+  std::ifstream in(filename, std::ios::in | std::ios::binary);
+  if (!in) {
+    fprintf(stderr, "Can't read %s\n", filename);
+    exit(EXIT_FAILURE);
+  }
+  std::ostringstream contents;
+  contents << in.rdbuf();
+  return contents.str();
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  uint64_t min_time_ns = 500 * 1000000ULL;
+  const char* filter = NULL;
+  std::vector<Benchmark*> benchmarks;
+  AddBenchmarks(&benchmarks);
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "--min-time-ms") == 0 && i + 1 < argc) {
+      min_time_ns = strtoull(argv[++i], NULL, 10) * 1000000ULL;
+    } else if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc) {
+      filter = argv[++i];
+    } else if (argv[i][0] == '-') {
+      fprintf(stderr, "Usage: %s [--min-time-ms N] [--filter SUBSTRING] "
+              "[FILE...]\n", argv[0]);
+      return EXIT_FAILURE;
+    } else {
+      benchmarks.push_back(new ParseBenchmark(
+          std::string("parse/") + argv[i], ReadFile(argv[i])));
+    }
+  }
+
+  printf("%-24s %10s %12s %12s %14s\n", "benchmark", "iterations",
+         "ns/byte", "ns/op", "cycles/op");
+  for (size_t i = 0; i < benchmarks.size(); ++i) {
+    if (!filter || benchmarks[i]->name().find(filter) != std::string::npos) {
+      RunBenchmark(benchmarks[i], min_time_ns);
+    }
+    delete benchmarks[i];
+  }
+  return EXIT_SUCCESS;
+}
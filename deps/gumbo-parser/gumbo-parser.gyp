@@ -1,5 +1,11 @@
 {
-  'variables': { 'target_arch%': 'ia32' },
+  'variables': {
+    'target_arch%': 'ia32',
+    # Set to 1 (e.g. node-gyp rebuild -- -Dgumbo_profile=1) to build with
+    # GUMBO_PROFILE, which profiles every parse by tokenizer state and
+    # insertion mode.
+    'gumbo_profile%': 0,
+  },
   'target_defaults': {
     'default_configuration': 'Debug',
     'configurations': {
@@ -38,8 +44,12 @@
        'sources': [
             'src/attribute.c',
             'src/char_ref.c',
+            'src/compact.c',
             'src/error.c',
             'src/parser.c',
+            'src/profile.c',
+            'src/selector.c',
+            'src/serialize.c',
             'src/string_buffer.c',
             'src/string_piece.c',
             'src/tag.c',
@@ -51,7 +61,21 @@
        'conditions': [
            ['OS=="linux"', {
              'cflags': ['-std=gnu99']
-           }, {}]
+           }, {}],
+           ['gumbo_profile==1', {
+             'defines': [ 'GUMBO_PROFILE' ],
+           }],
+       ],
+    },
+    {
+       # Not built by the node binding; build it explicitly to measure the
+       # library's hot paths.
+       'target_name': 'gumbo_benchmark',
+       'type': 'executable',
+       'dependencies': [ 'gumbo' ],
+       'include_dirs': [ 'src' ],
+       'sources': [
+            'benchmarks/benchmark.cc',
        ],
     },
 
@@ -28,6 +28,13 @@ are exported from this module.  They include:
   soup = gumbo.soup_parse(text, **options)
 
   It will give you back a soup object like BeautifulSoup.BeautifulSoup(text).
+
+Both adapters build their trees with the gumbo._gumbo extension module when
+it's been built (setup.py builds it).  That walks the parse tree in C rather
+than through a CTypes proxy for every field, and releases the GIL while
+parsing.  Its options
+are tab_stop, stop_on_first_error, max_errors, max_nodes, max_tree_depth,
+max_parse_time_ms and max_allocated_bytes, as in GumboOptions.
 """
 
 from gumbo.gumboc import *
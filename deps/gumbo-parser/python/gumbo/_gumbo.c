@@ -0,0 +1,587 @@
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// The gumbo._gumbo extension module, which parses and builds html5lib or
+// BeautifulSoup trees directly from the C parse tree.  The ctypes bindings in
+// gumboc.py make a proxy object for every field of every node the adapters
+// touch, which costs far more than the parse itself; this walks the tree once
+// in C and only calls back into Python to build the result.  The GIL is
+// released while parsing.
+//
+// html5lib_adapter.py and soup_adapter.py use this when it's been built, and
+// fall back on gumboc otherwise.
+
+#include <Python.h>
+
+#include <string.h>
+
+#include "gumbo.h"
+
+#if PY_MAJOR_VERSION >= 3
+#define STRING_FROM_STRING PyUnicode_FromString
+#else
+#define STRING_FROM_STRING PyString_FromString
+#endif
+
+// Indexed by GumboNamespaceEnum; these match html5lib.constants.namespaces.
+static const char* kNamespaceUrls[] = {
+  "http://www.w3.org/1999/xhtml",
+  "http://www.w3.org/2000/svg",
+  "http://www.w3.org/1998/Math/MathML",
+};
+
+// Indexed by GumboAttributeNamespaceEnum.
+static const char* kAttributeNamespacePrefixes[] = {
+  NULL, "xlink", "xml", "xmlns",
+};
+static const char* kAttributeNamespaceUrls[] = {
+  NULL,
+  "http://www.w3.org/1999/xlink",
+  "http://www.w3.org/XML/1998/namespace",
+  "http://www.w3.org/2000/xmlns",
+};
+
+static PyObject* decode(const char* data, size_t length) {
+  return PyUnicode_DecodeUTF8(data ? data : "", length, "replace");
+}
+
+static PyObject* decode_piece(const GumboStringPiece* piece) {
+  return decode(piece->data, piece->length);
+}
+
+// Returns the element's tag name as html5lib and BeautifulSoup expect it: the
+// normalized name for known tags, the case-corrected name for SVG, and the
+// lowercased source name for anything else.
+static PyObject* get_tag_name(const GumboElement* element) {
+  GumboStringPiece original = element->original_tag;
+  gumbo_tag_from_original_text(&original);
+  if (element->tag_namespace == GUMBO_NAMESPACE_SVG) {
+    const char* svg_name = gumbo_normalize_svg_tagname(&original);
+    if (svg_name) {
+      return STRING_FROM_STRING(svg_name);
+    }
+  }
+  if (element->tag != GUMBO_TAG_UNKNOWN) {
+    return STRING_FROM_STRING(gumbo_normalized_tagname(element->tag));
+  }
+  PyObject* name = decode_piece(&original);
+  if (!name) {
+    return NULL;
+  }
+  PyObject* lower = PyObject_CallMethod(name, "lower", NULL);
+  Py_DECREF(name);
+  return lower;
+}
+
+static PyObject* get_text(const GumboNode* node) {
+  return decode(node->v.text.text, node->v.text.text_length);
+}
+
+static PyObject* get_attribute_name(const GumboAttribute* attribute) {
+  return decode(attribute->name, strlen(attribute->name));
+}
+
+static PyObject* get_attribute_value(const GumboAttribute* attribute) {
+  return decode(attribute->value, attribute->value_length);
+}
+
+// Parses text (bytes, or a unicode string, which is encoded as UTF-8) with the
+// options in kwargs, releasing the GIL while the parser runs.  On success,
+// *input holds a reference to the bytes parsed, which the tree may point into.
+static GumboOutput* parse(
+    PyObject* text, PyObject* kwargs, GumboOptions* options,
+    PyObject** input) {
+  static char* kKeywords[] = {
+    "tab_stop", "stop_on_first_error", "max_errors", "max_nodes",
+    "max_tree_depth", "max_parse_time_ms", "max_allocated_bytes", NULL
+  };
+  *options = kGumboDefaultOptions;
+  // Nothing here reads the errors, and each recorded one keeps a copy of the
+  // stack of open elements.
+  options->max_errors = 0;
+  // The input is kept alive until the tree has been converted.
+  options->borrow_input_strings = true;
+  int stop_on_first_error = options->stop_on_first_error;
+  Py_ssize_t max_allocated_bytes = options->max_allocated_bytes;
+  PyObject* no_args = PyTuple_New(0);
+  if (!no_args) {
+    return NULL;
+  }
+  int ok = PyArg_ParseTupleAndKeywords(
+      no_args, kwargs, "|iiiiiin", kKeywords, &options->tab_stop,
+      &stop_on_first_error, &options->max_errors, &options->max_nodes,
+      &options->max_tree_depth, &options->max_parse_time_ms,
+      &max_allocated_bytes);
+  Py_DECREF(no_args);
+  if (!ok) {
+    return NULL;
+  }
+  options->stop_on_first_error = stop_on_first_error != 0;
+  options->max_allocated_bytes = (size_t) max_allocated_bytes;
+
+  if (PyUnicode_Check(text)) {
+    *input = PyUnicode_AsUTF8String(text);
+    if (!*input) {
+      return NULL;
+    }
+  } else if (PyBytes_Check(text)) {
+    Py_INCREF(text);
+    *input = text;
+  } else {
+    PyErr_SetString(PyExc_TypeError, "Gumbo parses str or bytes");
+    return NULL;
+  }
+
+  const char* buffer = PyBytes_AS_STRING(*input);
+  size_t length = PyBytes_GET_SIZE(*input);
+  GumboOutput* output;
+  Py_BEGIN_ALLOW_THREADS
+  output = gumbo_parse_with_options(options, buffer, length);
+  Py_END_ALLOW_THREADS
+  return output;
+}
+
+// Calls method on object with the given (new) argument references, which may
+// be NULL if making them failed, and discards the result.  Returns false if
+// that failed.
+static bool call_method(
+    PyObject* object, const char* method, PyObject* arg1, PyObject* arg2) {
+  PyObject* result = NULL;
+  if (arg1 && (arg2 || !PyErr_Occurred())) {
+    PyObject* callable = PyObject_GetAttrString(object, method);
+    if (callable) {
+      result = PyObject_CallFunctionObjArgs(callable, arg1, arg2, NULL);
+      Py_DECREF(callable);
+    }
+  }
+  Py_XDECREF(arg1);
+  Py_XDECREF(arg2);
+  Py_XDECREF(result);
+  return result != NULL;
+}
+
+// Steals a reference to value.
+static bool set_item(PyObject* dict, const char* key, PyObject* value) {
+  if (!value) {
+    return false;
+  }
+  int result = PyDict_SetItemString(dict, key, value);
+  Py_DECREF(value);
+  return result == 0;
+}
+
+// The {'name', 'namespace', 'data'} token that html5lib's tree builders take
+// for an element.
+static PyObject* html5lib_element_token(const GumboElement* element) {
+  PyObject* attributes = PyDict_New();
+  if (!attributes) {
+    return NULL;
+  }
+  for (unsigned int i = 0; i < element->attributes.length; ++i) {
+    const GumboAttribute* attribute = element->attributes.data[i];
+    PyObject* key;
+    if (attribute->attr_namespace == GUMBO_ATTR_NAMESPACE_NONE) {
+      key = get_attribute_name(attribute);
+    } else {
+      // html5lib keys namespaced attributes by (prefix, name, namespace), with
+      // no prefix for xmlns itself.
+      const char* prefix =
+          strcmp(attribute->name, "xmlns") ?
+          kAttributeNamespacePrefixes[attribute->attr_namespace] : NULL;
+      key = Py_BuildValue(
+          "(zNs)", prefix, get_attribute_name(attribute),
+          kAttributeNamespaceUrls[attribute->attr_namespace]);
+    }
+    PyObject* value = get_attribute_value(attribute);
+    int result = key && value ? PyDict_SetItem(attributes, key, value) : -1;
+    Py_XDECREF(key);
+    Py_XDECREF(value);
+    if (result < 0) {
+      Py_DECREF(attributes);
+      return NULL;
+    }
+  }
+
+  PyObject* token = PyDict_New();
+  if (!token ||
+      !set_item(token, "name", get_tag_name(element)) ||
+      !set_item(token, "namespace",
+                STRING_FROM_STRING(kNamespaceUrls[element->tag_namespace])) ||
+      PyDict_SetItemString(token, "data", attributes) < 0) {
+    Py_XDECREF(token);
+    Py_DECREF(attributes);
+    return NULL;
+  }
+  Py_DECREF(attributes);
+  return token;
+}
+
+static PyObject* html5lib_data_token(const GumboNode* node) {
+  PyObject* token = PyDict_New();
+  if (token && !set_item(token, "data", get_text(node))) {
+    Py_DECREF(token);
+    return NULL;
+  }
+  return token;
+}
+
+static bool html5lib_insert_doctype(
+    PyObject* treebuilder, const GumboDocument* document) {
+  if (!document->has_doctype) {
+    // Mimic html5lib: no doctype token, no doctype node.
+    return true;
+  }
+  PyObject* token = PyDict_New();
+  if (!token ||
+      !set_item(token, "name",
+                decode(document->name, strlen(document->name))) ||
+      !set_item(token, "publicId",
+                decode(document->public_identifier,
+                       strlen(document->public_identifier))) ||
+      !set_item(token, "systemId",
+                decode(document->system_identifier,
+                       strlen(document->system_identifier)))) {
+    Py_XDECREF(token);
+    return false;
+  }
+  return call_method(treebuilder, "insertDoctype", token, NULL);
+}
+
+static bool html5lib_pop_open_element(PyObject* treebuilder) {
+  PyObject* open_elements =
+      PyObject_GetAttrString(treebuilder, "openElements");
+  if (!open_elements) {
+    return false;
+  }
+  PyObject* popped = PyObject_CallMethod(open_elements, "pop", NULL);
+  Py_DECREF(open_elements);
+  Py_XDECREF(popped);
+  return popped != NULL;
+}
+
+// Inserts the subtree under root (the <html> element) in document order.  The
+// tree is walked through parent pointers rather than recursively, so that
+// deeply nested documents can't overflow the stack.
+static bool html5lib_insert_tree(PyObject* treebuilder, const GumboNode* root) {
+  if (!call_method(treebuilder, "insertRoot",
+                   html5lib_element_token(&root->v.element), NULL)) {
+    return false;
+  }
+  const GumboNode* node = root;
+  while (true) {
+    const GumboVector* children = node->type == GUMBO_NODE_ELEMENT ?
+        &node->v.element.children : NULL;
+    if (children && children->length > 0) {
+      node = children->data[0];
+    } else {
+      // Close elements until there's a next sibling to move on to.
+      while (true) {
+        if (node->type == GUMBO_NODE_ELEMENT &&
+            !html5lib_pop_open_element(treebuilder)) {
+          return false;
+        }
+        if (node == root) {
+          return true;
+        }
+        const GumboVector* siblings = &node->parent->v.element.children;
+        if (node->index_within_parent + 1 < siblings->length) {
+          node = siblings->data[node->index_within_parent + 1];
+          break;
+        }
+        node = node->parent;
+      }
+    }
+
+    bool ok;
+    switch (node->type) {
+      case GUMBO_NODE_ELEMENT:
+        ok = call_method(treebuilder, "insertElementNormal",
+                         html5lib_element_token(&node->v.element), NULL);
+        break;
+      case GUMBO_NODE_COMMENT:
+        ok = call_method(
+            treebuilder, "insertComment", html5lib_data_token(node), NULL);
+        break;
+      default:
+        ok = call_method(treebuilder, "insertText", get_text(node), NULL);
+        break;
+    }
+    if (!ok) {
+      return false;
+    }
+  }
+}
+
+PyDoc_STRVAR(build_html5lib_doc,
+"build_html5lib(text, treebuilder, **options)\n\n"
+"Parses text and builds the result with an html5lib TreeBuilder, as\n"
+"html5lib's parser would.  Get the tree from treebuilder.getDocument().\n"
+"options may be tab_stop, stop_on_first_error, max_errors, max_nodes,\n"
+"max_tree_depth, max_parse_time_ms and max_allocated_bytes, as in\n"
+"GumboOptions; a limit that's hit truncates the tree.");
+
+static PyObject* build_html5lib(
+    PyObject* self, PyObject* args, PyObject* kwargs) {
+  PyObject* text;
+  PyObject* treebuilder;
+  if (!PyArg_ParseTuple(args, "OO:build_html5lib", &text, &treebuilder)) {
+    return NULL;
+  }
+  GumboOptions options;
+  PyObject* input = NULL;
+  GumboOutput* output = parse(text, kwargs, &options, &input);
+  if (!output) {
+    return NULL;
+  }
+
+  bool ok = html5lib_insert_doctype(
+      treebuilder, &output->document->v.document);
+  const GumboVector* children = &output->document->v.document.children;
+  PyObject* document = NULL;
+  for (unsigned int i = 0; ok && i < children->length; ++i) {
+    const GumboNode* child = children->data[i];
+    if (child->type == GUMBO_NODE_COMMENT) {
+      if (!document) {
+        document = PyObject_GetAttrString(treebuilder, "document");
+      }
+      Py_XINCREF(document);
+      ok = document && call_method(treebuilder, "insertComment",
+                                   html5lib_data_token(child), document);
+    } else if (child->type == GUMBO_NODE_ELEMENT) {
+      ok = html5lib_insert_tree(treebuilder, child);
+    }
+  }
+  Py_XDECREF(document);
+  gumbo_destroy_output(&options, output);
+  Py_DECREF(input);
+  if (!ok) {
+    return NULL;
+  }
+  Py_RETURN_NONE;
+}
+
+// The BeautifulSoup classes a tree is built from.
+typedef struct {
+  PyObject* soup;
+  PyObject* tag_class;
+  // Indexed by GumboNodeType; NULL for documents and elements.
+  PyObject* string_classes[GUMBO_NODE_WHITESPACE + 1];
+} SoupBuilder;
+
+// Steals a reference to value.
+static bool set_attribute(PyObject* object, const char* name, PyObject* value) {
+  if (!value) {
+    return false;
+  }
+  int result = PyObject_SetAttrString(object, name, value);
+  Py_DECREF(value);
+  return result == 0;
+}
+
+static bool soup_add_position(
+    PyObject* tag, const char* line, const char* column, const char* offset,
+    const GumboSourcePosition* position) {
+  return set_attribute(tag, line, PyLong_FromLong(position->line)) &&
+         set_attribute(tag, column, PyLong_FromLong(position->column)) &&
+         set_attribute(tag, offset, PyLong_FromLong(position->offset));
+}
+
+static PyObject* soup_new_tag(
+    const SoupBuilder* builder, const GumboElement* element) {
+  PyObject* attributes = PyList_New(element->attributes.length);
+  if (!attributes) {
+    return NULL;
+  }
+  for (unsigned int i = 0; i < element->attributes.length; ++i) {
+    const GumboAttribute* attribute = element->attributes.data[i];
+    PyObject* pair = Py_BuildValue(
+        "(NN)", get_attribute_name(attribute), get_attribute_value(attribute));
+    if (!pair) {
+      Py_DECREF(attributes);
+      return NULL;
+    }
+    PyList_SET_ITEM(attributes, i, pair);
+  }
+  PyObject* name = get_tag_name(element);
+  PyObject* tag = name ? PyObject_CallFunctionObjArgs(
+      builder->tag_class, builder->soup, name, attributes, NULL) : NULL;
+  Py_XDECREF(name);
+  Py_DECREF(attributes);
+  if (!tag) {
+    return NULL;
+  }
+
+  const GumboStringPiece* original_tag = &element->original_tag;
+  const GumboStringPiece* original_end_tag = &element->original_end_tag;
+  if (!set_attribute(tag, "original", PyBytes_FromStringAndSize(
+          original_tag->data, original_tag->length)) ||
+      !soup_add_position(tag, "line", "col", "offset", &element->start_pos) ||
+      !soup_add_position(
+          tag, "end_line", "end_col", "end_offset", &element->end_pos) ||
+      !set_attribute(tag, "original_end_tag", PyBytes_FromStringAndSize(
+          original_end_tag->data, original_end_tag->length))) {
+    Py_DECREF(tag);
+    return NULL;
+  }
+  return tag;
+}
+
+static PyObject* soup_new_node(
+    const SoupBuilder* builder, const GumboNode* node) {
+  if (node->type == GUMBO_NODE_ELEMENT) {
+    return soup_new_tag(builder, &node->v.element);
+  }
+  PyObject* text = get_text(node);
+  if (!text) {
+    return NULL;
+  }
+  PyObject* string = PyObject_CallFunctionObjArgs(
+      builder->string_classes[node->type], text, NULL);
+  Py_DECREF(text);
+  return string;
+}
+
+// Builds the tag for root and everything under it.  Each node is appended to
+// its parent once its own subtree is complete, as BeautifulSoup's parser does.
+// The tags still being filled in are kept on a list rather than the C stack,
+// so that deeply nested documents can't overflow it.
+static PyObject* soup_build_tree(
+    const SoupBuilder* builder, const GumboNode* root) {
+  PyObject* open_tags = PyList_New(0);
+  if (!open_tags) {
+    return NULL;
+  }
+  PyObject* result = NULL;
+  const GumboNode* node = root;
+  PyObject* object = soup_new_node(builder, node);
+  while (object) {
+    const GumboVector* children = node->type == GUMBO_NODE_ELEMENT ?
+        &node->v.element.children : NULL;
+    if (children && children->length > 0) {
+      int pushed = PyList_Append(open_tags, object);
+      Py_DECREF(object);
+      if (pushed < 0) {
+        break;
+      }
+      node = children->data[0];
+      object = soup_new_node(builder, node);
+      continue;
+    }
+
+    // object is complete; append it, and any parents it completes, until
+    // there's a next sibling to move on to.
+    while (node != root) {
+      Py_ssize_t depth = PyList_GET_SIZE(open_tags);
+      PyObject* parent = PyList_GET_ITEM(open_tags, depth - 1);
+      if (!call_method(parent, "append", object, NULL)) {
+        object = NULL;
+        break;
+      }
+      const GumboVector* siblings = &node->parent->v.element.children;
+      if (node->index_within_parent + 1 < siblings->length) {
+        node = siblings->data[node->index_within_parent + 1];
+        object = soup_new_node(builder, node);
+        break;
+      }
+      node = node->parent;
+      object = parent;
+      Py_INCREF(object);
+      if (PySequence_DelItem(open_tags, depth - 1) < 0) {
+        Py_DECREF(object);
+        object = NULL;
+        break;
+      }
+    }
+    if (node == root && object) {
+      result = object;
+      break;
+    }
+  }
+  Py_DECREF(open_tags);
+  return result;
+}
+
+PyDoc_STRVAR(build_soup_doc,
+"build_soup(text, BeautifulSoup, **options)\n\n"
+"Parses text and returns a BeautifulSoup object for it, built from the\n"
+"classes in the given BeautifulSoup module.  Tags also get the original\n"
+"source text and the line, col, offset, end_line, end_col and end_offset\n"
+"of their start and end tags.  options are as for build_html5lib.");
+
+static PyObject* build_soup(PyObject* self, PyObject* args, PyObject* kwargs) {
+  PyObject* text;
+  PyObject* module;
+  if (!PyArg_ParseTuple(args, "OO:build_soup", &text, &module)) {
+    return NULL;
+  }
+  SoupBuilder builder;
+  memset(&builder, 0, sizeof(builder));
+  PyObject* navigable_string =
+      PyObject_GetAttrString(module, "NavigableString");
+  PyObject* cdata = PyObject_GetAttrString(module, "CData");
+  PyObject* comment = PyObject_GetAttrString(module, "Comment");
+  builder.tag_class = PyObject_GetAttrString(module, "Tag");
+  builder.soup = PyObject_CallMethod(module, "BeautifulSoup", NULL);
+  builder.string_classes[GUMBO_NODE_TEXT] = navigable_string;
+  builder.string_classes[GUMBO_NODE_CDATA] = cdata;
+  builder.string_classes[GUMBO_NODE_COMMENT] = comment;
+  builder.string_classes[GUMBO_NODE_WHITESPACE] = navigable_string;
+
+  PyObject* result = NULL;
+  if (navigable_string && cdata && comment && builder.tag_class &&
+      builder.soup) {
+    GumboOptions options;
+    PyObject* input = NULL;
+    GumboOutput* output = parse(text, kwargs, &options, &input);
+    if (output) {
+      PyObject* root = soup_build_tree(&builder, output->root);
+      if (root && call_method(builder.soup, "append", root, NULL)) {
+        result = builder.soup;
+        Py_INCREF(result);
+      }
+      gumbo_destroy_output(&options, output);
+      Py_DECREF(input);
+    }
+  }
+  Py_XDECREF(navigable_string);
+  Py_XDECREF(cdata);
+  Py_XDECREF(comment);
+  Py_XDECREF(builder.tag_class);
+  Py_XDECREF(builder.soup);
+  return result;
+}
+
+static PyMethodDef kMethods[] = {
+  {"build_html5lib", (PyCFunction) build_html5lib,
+   METH_VARARGS | METH_KEYWORDS, build_html5lib_doc},
+  {"build_soup", (PyCFunction) build_soup,
+   METH_VARARGS | METH_KEYWORDS, build_soup_doc},
+  {NULL, NULL, 0, NULL}
+};
+
+PyDoc_STRVAR(module_doc,
+"Builds html5lib and BeautifulSoup trees straight from Gumbo's parse tree.");
+
+#if PY_MAJOR_VERSION >= 3
+static struct PyModuleDef kModule = {
+  PyModuleDef_HEAD_INIT, "_gumbo", module_doc, -1, kMethods,
+  NULL, NULL, NULL, NULL
+};
+
+PyMODINIT_FUNC PyInit__gumbo(void) {
+  return PyModule_Create(&kModule);
+}
+#else
+PyMODINIT_FUNC init_gumbo(void) {
+  Py_InitModule3("_gumbo", kMethods, module_doc);
+}
+#endif
@@ -0,0 +1,161 @@
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+#
+
+"""Tests for the _gumbo extension module.
+
+These build trees through stand-ins that record what they're given, so they
+need neither html5lib nor BeautifulSoup; the adapter tests cover those.
+"""
+
+import types
+import unittest
+
+import _gumbo
+
+
+class RecordingTreeBuilder(object):
+  def __init__(self):
+    self.calls = []
+    self.openElements = []
+    self.document = 'document'
+
+  def insertDoctype(self, token):
+    self.calls.append(('doctype', token))
+
+  def insertRoot(self, token):
+    self.calls.append(('root', token['name']))
+    self.openElements.append(token)
+
+  def insertElementNormal(self, token):
+    self.calls.append(('element', token['name'], token['namespace'],
+                       token['data']))
+    self.openElements.append(token)
+
+  def insertComment(self, token, parent=None):
+    self.calls.append(('comment', token['data'], parent))
+
+  def insertText(self, text):
+    self.calls.append(('text', text))
+
+
+class FakeNode(object):
+  def __init__(self, *args):
+    self.args = args
+    self.contents = []
+
+  def append(self, child):
+    self.contents.append(child)
+
+
+class FakeText(type(u'')):
+  pass
+
+
+def fake_soup_module():
+  module = types.ModuleType('BeautifulSoup')
+  module.BeautifulSoup = type('BeautifulSoup', (FakeNode,), {})
+  module.Tag = type('Tag', (FakeNode,), {})
+  module.NavigableString = type('NavigableString', (FakeText,), {})
+  module.CData = type('CData', (FakeText,), {})
+  module.Comment = type('Comment', (FakeText,), {})
+  return module
+
+
+class Html5libTest(unittest.TestCase):
+  def testBuildsInDocumentOrder(self):
+    builder = RecordingTreeBuilder()
+    _gumbo.build_html5lib(
+        b'<!DOCTYPE html><!--before--><p class=x>One<b>two</b></p>'
+        b'<svg><foreignObject xlink:href=y></svg><my-Tag>&amp;', builder)
+    svg = 'http://www.w3.org/2000/svg'
+    html = 'http://www.w3.org/1999/xhtml'
+    self.assertEqual([
+        ('doctype', {'name': u'html', 'publicId': u'', 'systemId': u''}),
+        ('comment', u'before', 'document'),
+        ('root', 'html'),
+        ('element', 'head', html, {}),
+        ('element', 'body', html, {}),
+        ('element', 'p', html, {u'class': u'x'}),
+        ('text', u'One'),
+        ('element', 'b', html, {}),
+        ('text', u'two'),
+        ('element', 'svg', svg, {}),
+        ('element', 'foreignObject', svg,
+         {('xlink', u'href', 'http://www.w3.org/1999/xlink'): u'y'}),
+        ('element', u'my-tag', html, {}),
+        ('text', u'&'),
+        ], builder.calls)
+    # Every element inserted was popped again.
+    self.assertEqual([], builder.openElements)
+
+  def testUnicodeInput(self):
+    builder = RecordingTreeBuilder()
+    _gumbo.build_html5lib(u'<p>caf\xe9', builder)
+    self.assertEqual(('text', u'caf\xe9'), builder.calls[-1])
+
+  def testDeepNesting(self):
+    builder = RecordingTreeBuilder()
+    _gumbo.build_html5lib(b'<div>' * 100000, builder)
+    self.assertEqual(100003, len(builder.calls))
+    self.assertEqual([], builder.openElements)
+
+  def testOptions(self):
+    builder = RecordingTreeBuilder()
+    _gumbo.build_html5lib(b'<div>' * 100, builder, max_nodes=10)
+    self.assertTrue(len(builder.calls) < 20)
+    self.assertRaises(TypeError, _gumbo.build_html5lib, b'', builder, foo=1)
+    self.assertRaises(TypeError, _gumbo.build_html5lib, 42, builder)
+
+  def testErrorsPropagate(self):
+    class FailingTreeBuilder(RecordingTreeBuilder):
+      def insertText(self, text):
+        raise ValueError(text)
+    self.assertRaises(ValueError, _gumbo.build_html5lib, b'<p>x',
+                      FailingTreeBuilder())
+
+
+class SoupTest(unittest.TestCase):
+  def testBuildsTree(self):
+    module = fake_soup_module()
+    soup = _gumbo.build_soup(b'<p id=1>a<!--b--><i>c</i></p>', module)
+    self.assertTrue(isinstance(soup, module.BeautifulSoup))
+    html = soup.contents[0]
+    self.assertEqual((soup, u'html', []), html.args)
+    head, body = html.contents
+    self.assertEqual(u'head', head.args[1])
+    p = body.contents[0]
+    self.assertEqual((soup, u'p', [(u'id', u'1')]), p.args)
+    self.assertEqual(b'<p id=1>', p.original)
+    self.assertEqual(b'</p>', p.original_end_tag)
+    self.assertEqual((1, 1, 0), (p.line, p.col, p.offset))
+    self.assertEqual(25, p.end_offset)
+
+    text, comment, i = p.contents
+    self.assertTrue(isinstance(text, module.NavigableString))
+    self.assertEqual(u'a', text)
+    self.assertTrue(isinstance(comment, module.Comment))
+    self.assertEqual(u'b', comment)
+    self.assertEqual([u'c'], i.contents)
+
+  def testDeepNesting(self):
+    soup = _gumbo.build_soup(b'<div>' * 100000, fake_soup_module())
+    node = soup.contents[0].contents[1]
+    depth = 0
+    while node.contents:
+      node = node.contents[0]
+      depth += 1
+    self.assertEqual(100000, depth)
+
+
+if __name__ == '__main__':
+  unittest.main()
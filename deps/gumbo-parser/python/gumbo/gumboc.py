@@ -114,12 +114,22 @@ class AttributeNamespace(Enum):
     return self.URLS[self.value]
 
 
+class StringOwnership(Enum):
+  _values_ = ['OWNED', 'BORROWED', 'STATIC', 'SHARED']
+
+
 class Attribute(ctypes.Structure):
   _fields_ = [
       ('namespace', AttributeNamespace),
       ('name', ctypes.c_char_p),
+      # A GumboAttributeAtom, which isn't mirrored here as an enum.
+      ('atom', ctypes.c_uint),
+      ('name_ownership', StringOwnership),
       ('original_name', StringPiece),
+      # Only null-terminated if value_ownership isn't BORROWED.
       ('value', ctypes.c_char_p),
+      ('value_length', ctypes.c_size_t),
+      ('value_ownership', StringOwnership),
       ('original_value', StringPiece),
       ('name_start', SourcePosition),
       ('name_end', SourcePosition),
@@ -133,7 +143,8 @@ class Vector(ctypes.Structure):
   _fields_ = [
       ('data', _Ptr(ctypes.c_void_p)),
       ('length', ctypes.c_uint),
-      ('capacity', ctypes.c_uint)
+      ('capacity', ctypes.c_uint, 31),
+      ('_is_inline', ctypes.c_uint, 1)
       ]
 
   class Iter(object):
@@ -396,7 +407,10 @@ class Element(ctypes.Structure):
 
 class Text(ctypes.Structure):
   _fields_ = [
+      # Only null-terminated if text_ownership isn't BORROWED.
       ('text', ctypes.c_char_p),
+      ('text_length', ctypes.c_size_t),
+      ('text_ownership', StringOwnership),
       ('original_text', StringPiece),
       ('start_pos', SourcePosition)
       ]
@@ -457,13 +471,19 @@ class Options(ctypes.Structure):
       # function.  Right now these are treated as opaque void pointers.
       ('allocator', ctypes.c_void_p),
       ('deallocator', ctypes.c_void_p),
+      ('userdata', ctypes.c_void_p),
       ('tab_stop', ctypes.c_int),
       ('stop_on_first_error', ctypes.c_bool),
-      ('max_utf8_decode_errors', ctypes.c_int),
-      # The following two options will likely be removed from the C API, and
-      # should be removed from the Python API when that happens too.
-      ('verbatim_mode', ctypes.c_bool),
-      ('preserve_entities', ctypes.c_bool),
+      ('max_errors', ctypes.c_int),
+      ('max_nodes', ctypes.c_int),
+      ('max_tree_depth', ctypes.c_int),
+      ('max_allocated_bytes', ctypes.c_size_t),
+      ('max_parse_time_ms', ctypes.c_int),
+      # Opaque, like the allocator.
+      ('is_cancelled', ctypes.c_void_p),
+      ('collect_stats', ctypes.c_bool),
+      ('borrow_input_strings', ctypes.c_bool),
+      ('reallocator', ctypes.c_void_p),
       ]
 
 
@@ -517,7 +537,7 @@ _tagname = _dll.gumbo_normalized_tagname
 _tagname.argtypes = [Tag]
 _tagname.restype = ctypes.c_char_p
 
-__all__ = ['StringPiece', 'SourcePosition', 'AttributeNamespace', 'Attribute',
-           'Vector', 'AttributeVector', 'NodeVector', 'QuirksMode', 'Document',
-           'Namespace', 'Tag', 'Element', 'Text', 'NodeType', 'Node',
-           'Options', 'Output', 'parse']
+__all__ = ['StringPiece', 'SourcePosition', 'AttributeNamespace',
+           'StringOwnership', 'Attribute', 'Vector', 'AttributeVector',
+           'NodeVector', 'QuirksMode', 'Document', 'Namespace', 'Tag',
+           'Element', 'Text', 'NodeType', 'Node', 'Options', 'Output', 'parse']
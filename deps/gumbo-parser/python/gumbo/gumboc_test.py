@@ -101,6 +101,33 @@ class CtypesTest(unittest.TestCase):
       self.assertEquals('</sarcasm>', str(sarcasm.original_end_tag))
       self.assertEquals('sarcasm', sarcasm.tag_name.decode('utf-8'))
 
+  def testAttributeValue(self):
+    with gumboc.parse('<p title="a &amp; b">x&lt;y</p>') as output:
+      root = output.contents.root.contents
+      p = root.children[1].children[0]
+      title = p.attributes[0]
+      self.assertEquals('title', title.name)
+      self.assertEquals(gumboc.StringOwnership.STATIC, title.name_ownership)
+      self.assertEquals('a & b', title.value)
+      self.assertEquals(5, title.value_length)
+      self.assertEquals(gumboc.StringOwnership.OWNED, title.value_ownership)
+      self.assertEquals('"a &amp; b"', str(title.original_value))
+      text = p.children[0]
+      self.assertEquals('x<y', text.text)
+      self.assertEquals(3, text.text_length)
+      self.assertEquals('x&lt;y', str(text.original_text))
+
+  def testBorrowedStrings(self):
+    with gumboc.parse('<p title=ab>xy</p>', borrow_input_strings=True) as output:
+      root = output.contents.root.contents
+      p = root.children[1].children[0]
+      title = p.attributes[0]
+      self.assertEquals(gumboc.StringOwnership.BORROWED, title.value_ownership)
+      self.assertEquals('ab', title.value[:title.value_length])
+      text = p.children[0]
+      self.assertEquals(gumboc.StringOwnership.BORROWED, text.text_ownership)
+      self.assertEquals('xy', text.text[:text.text_length])
+
   def testEnums(self):
     self.assertEquals(gumboc.Tag.A, gumboc.Tag.A)
     self.assertEquals(hash(gumboc.Tag.A.value), hash(gumboc.Tag.A))
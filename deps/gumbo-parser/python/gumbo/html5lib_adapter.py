@@ -26,6 +26,12 @@ __author__ = 'jdtang@google.com (Jonathan Tang)'
 
 import gumboc
 
+try:
+  import _gumbo
+except ImportError:
+  # The extension module wasn't built; walk the tree through ctypes instead.
+  _gumbo = None
+
 
 # These should match html5lib.constants.namespaces, and be indexed by the enum
 # values of gumboc.Namespace
@@ -106,6 +112,10 @@ class HTMLParser(object):
       # Assume a string.
       text = text_or_file
 
+    if _gumbo:
+      _gumbo.build_html5lib(text, self.tree, **kwargs)
+      return self.tree.getDocument()
+
     with gumboc.parse(text, **kwargs) as output:
       _convert_doctype(self.tree, output.contents.document.contents)
       for node in output.contents.document.contents.children:
@@ -25,6 +25,12 @@ import BeautifulSoup
 
 import gumboc
 
+try:
+  import _gumbo
+except ImportError:
+  # The extension module wasn't built; walk the tree through ctypes instead.
+  _gumbo = None
+
 
 def _utf8(text):
   return text.decode('utf-8', 'replace')
@@ -88,6 +94,9 @@ def _add_node(soup, node):
 
 
 def parse(text, **kwargs):
+  if _gumbo:
+    return _gumbo.build_soup(text, BeautifulSoup, **kwargs)
+
   with gumboc.parse(text, **kwargs) as output:
     soup = BeautifulSoup.BeautifulSoup()
     soup.append(_add_node(soup, output.contents.root.contents))
@@ -1,5 +1,7 @@
 #!/usr/bin/env python
-from setuptools import setup
+import glob
+
+from setuptools import Extension, setup
 
 def readme():
   with open('README.md') as f:
@@ -16,4 +18,11 @@ setup(name='gumbo',
       license='Apache 2.0',
       packages=['gumbo'],
       package_dir={'': 'python'},
-      zip_safe=True)
+      # The library is compiled into the extension module, so it doesn't need
+      # to be installed for the adapters to use it.
+      ext_modules=[Extension(
+          'gumbo._gumbo',
+          sources=['python/gumbo/_gumbo.c'] + sorted(glob.glob('src/*.c')),
+          include_dirs=['src'],
+          extra_compile_args=['-std=gnu99'])],
+      zip_safe=False)
@@ -17,6 +17,8 @@
 #include "attribute.h"
 
 #include <assert.h>
+#include <ctype.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
 #include <strings.h>
@@ -25,8 +27,174 @@
 
 struct _GumboParser;
 
+#define GUMBO_STRING(literal) { literal, sizeof(literal) - 1 }
+
+// NOTE: Keep this in sync with the GumboAttributeAtom enum in the header, and
+// in byte order, since gumbo_attribute_atom does a binary search over it.
+static const GumboStringPiece kGumboAttributeNames[] = {
+  GUMBO_STRING("accept"),
+  GUMBO_STRING("accept-charset"),
+  GUMBO_STRING("accesskey"),
+  GUMBO_STRING("action"),
+  GUMBO_STRING("align"),
+  GUMBO_STRING("alt"),
+  GUMBO_STRING("async"),
+  GUMBO_STRING("autocomplete"),
+  GUMBO_STRING("autofocus"),
+  GUMBO_STRING("background"),
+  GUMBO_STRING("bgcolor"),
+  GUMBO_STRING("border"),
+  GUMBO_STRING("charset"),
+  GUMBO_STRING("checked"),
+  GUMBO_STRING("cite"),
+  GUMBO_STRING("class"),
+  GUMBO_STRING("color"),
+  GUMBO_STRING("cols"),
+  GUMBO_STRING("colspan"),
+  GUMBO_STRING("content"),
+  GUMBO_STRING("contenteditable"),
+  GUMBO_STRING("controls"),
+  GUMBO_STRING("coords"),
+  GUMBO_STRING("crossorigin"),
+  GUMBO_STRING("data"),
+  GUMBO_STRING("datetime"),
+  GUMBO_STRING("defer"),
+  GUMBO_STRING("dir"),
+  GUMBO_STRING("disabled"),
+  GUMBO_STRING("download"),
+  GUMBO_STRING("draggable"),
+  GUMBO_STRING("encoding"),
+  GUMBO_STRING("enctype"),
+  GUMBO_STRING("face"),
+  GUMBO_STRING("for"),
+  GUMBO_STRING("form"),
+  GUMBO_STRING("frameborder"),
+  GUMBO_STRING("headers"),
+  GUMBO_STRING("height"),
+  GUMBO_STRING("hidden"),
+  GUMBO_STRING("high"),
+  GUMBO_STRING("href"),
+  GUMBO_STRING("hreflang"),
+  GUMBO_STRING("http-equiv"),
+  GUMBO_STRING("id"),
+  GUMBO_STRING("integrity"),
+  GUMBO_STRING("itemprop"),
+  GUMBO_STRING("itemscope"),
+  GUMBO_STRING("itemtype"),
+  GUMBO_STRING("label"),
+  GUMBO_STRING("lang"),
+  GUMBO_STRING("list"),
+  GUMBO_STRING("loop"),
+  GUMBO_STRING("low"),
+  GUMBO_STRING("max"),
+  GUMBO_STRING("maxlength"),
+  GUMBO_STRING("media"),
+  GUMBO_STRING("method"),
+  GUMBO_STRING("min"),
+  GUMBO_STRING("multiple"),
+  GUMBO_STRING("muted"),
+  GUMBO_STRING("name"),
+  GUMBO_STRING("nonce"),
+  GUMBO_STRING("novalidate"),
+  GUMBO_STRING("onclick"),
+  GUMBO_STRING("onload"),
+  GUMBO_STRING("open"),
+  GUMBO_STRING("optimum"),
+  GUMBO_STRING("pattern"),
+  GUMBO_STRING("placeholder"),
+  GUMBO_STRING("poster"),
+  GUMBO_STRING("preload"),
+  GUMBO_STRING("prompt"),
+  GUMBO_STRING("readonly"),
+  GUMBO_STRING("rel"),
+  GUMBO_STRING("required"),
+  GUMBO_STRING("reversed"),
+  GUMBO_STRING("role"),
+  GUMBO_STRING("rows"),
+  GUMBO_STRING("rowspan"),
+  GUMBO_STRING("sandbox"),
+  GUMBO_STRING("scope"),
+  GUMBO_STRING("selected"),
+  GUMBO_STRING("shape"),
+  GUMBO_STRING("size"),
+  GUMBO_STRING("sizes"),
+  GUMBO_STRING("span"),
+  GUMBO_STRING("src"),
+  GUMBO_STRING("srcdoc"),
+  GUMBO_STRING("srclang"),
+  GUMBO_STRING("srcset"),
+  GUMBO_STRING("start"),
+  GUMBO_STRING("step"),
+  GUMBO_STRING("style"),
+  GUMBO_STRING("tabindex"),
+  GUMBO_STRING("target"),
+  GUMBO_STRING("title"),
+  GUMBO_STRING("translate"),
+  GUMBO_STRING("type"),
+  GUMBO_STRING("usemap"),
+  GUMBO_STRING("valign"),
+  GUMBO_STRING("value"),
+  GUMBO_STRING("width"),
+  GUMBO_STRING("wrap"),
+  GUMBO_STRING("xmlns"),
+  GUMBO_STRING("xmlns:xlink"),
+  GUMBO_STRING(""),   // GUMBO_ATTR_UNKNOWN
+};
+
+// Compares a (not necessarily lowercase) name against a lowercase atom name, in
+// the manner of strcmp.
+static int compare_attribute_name(
+    const char* name, size_t length, const GumboStringPiece* atom_name) {
+  size_t common = length < atom_name->length ? length : atom_name->length;
+  for (size_t i = 0; i < common; ++i) {
+    int c = tolower((unsigned char) name[i]);
+    if (c != (unsigned char) atom_name->data[i]) {
+      return c - (unsigned char) atom_name->data[i];
+    }
+  }
+  return length < atom_name->length ? -1 : length > atom_name->length;
+}
+
+GumboAttributeAtom gumbo_attribute_atom(const char* name, size_t length) {
+  int low = 0;
+  int high = GUMBO_ATTR_UNKNOWN - 1;
+  while (low <= high) {
+    int mid = (low + high) / 2;
+    int cmp = compare_attribute_name(name, length, &kGumboAttributeNames[mid]);
+    if (cmp == 0) {
+      return mid;
+    } else if (cmp < 0) {
+      high = mid - 1;
+    } else {
+      low = mid + 1;
+    }
+  }
+  return GUMBO_ATTR_UNKNOWN;
+}
+
+const char* gumbo_normalized_attribute_name(GumboAttributeAtom atom) {
+  assert(atom <= GUMBO_ATTR_UNKNOWN);
+  return kGumboAttributeNames[atom].data;
+}
+
+GumboAttribute* gumbo_get_attribute_by_atom(
+    const struct _GumboVector* attributes, GumboAttributeAtom atom) {
+  assert(atom != GUMBO_ATTR_UNKNOWN);
+  for (int i = 0; i < attributes->length; ++i) {
+    GumboAttribute* attr = attributes->data[i];
+    if (attr->atom == atom) {
+      return attr;
+    }
+  }
+  return NULL;
+}
+
 GumboAttribute* gumbo_get_attribute(
     const struct _GumboVector* attributes, const char* name) {
+  GumboAttributeAtom atom = gumbo_attribute_atom(name, strlen(name));
+  if (atom != GUMBO_ATTR_UNKNOWN) {
+    return gumbo_get_attribute_by_atom(attributes, atom);
+  }
   for (int i = 0; i < attributes->length; ++i) {
     GumboAttribute* attr = attributes->data[i];
     if (!strcasecmp(attr->name, name)) {
@@ -36,9 +204,183 @@ GumboAttribute* gumbo_get_attribute(
   return NULL;
 }
 
+// FNV-1a.
+static unsigned int hash_attribute_name(const char* name, size_t length) {
+  unsigned int hash = 2166136261u;
+  for (size_t i = 0; i < length; ++i) {
+    hash ^= (unsigned char) name[i];
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+unsigned int gumbo_attribute_hash(const GumboAttribute* attr) {
+  unsigned int hash = hash_attribute_name(attr->name, strlen(attr->name));
+  // Separate the name from the value, so that "ab=c" and "a=bc" differ.
+  hash = (hash ^ '=') * 16777619u;
+  for (size_t i = 0; i < attr->value_length; ++i) {
+    hash ^= (unsigned char) attr->value[i];
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+void gumbo_attribute_index_init(GumboAttributeIndex* index) {
+  index->_slots = NULL;
+  index->_capacity = 0;
+  index->_count = 0;
+}
+
+void gumbo_attribute_index_clear(GumboAttributeIndex* index) {
+  if (index->_count > 0) {
+    memset(index->_slots, 0, index->_capacity * sizeof(unsigned int));
+    index->_count = 0;
+  }
+}
+
+void gumbo_attribute_index_destroy(
+    struct _GumboParser* parser, GumboAttributeIndex* index) {
+  gumbo_parser_deallocate(parser, index->_slots);
+}
+
+static void insert_into_attribute_index(
+    GumboAttributeIndex* index, const GumboVector* attributes,
+    unsigned int position) {
+  const GumboAttribute* attr = attributes->data[position];
+  unsigned int mask = index->_capacity - 1;
+  unsigned int slot =
+      hash_attribute_name(attr->name, strlen(attr->name)) & mask;
+  while (index->_slots[slot]) {
+    slot = (slot + 1) & mask;
+  }
+  index->_slots[slot] = position + 1;
+}
+
+// Brings the index up to date with any attributes appended to the vector,
+// growing the table to keep it less than half full.
+static void update_attribute_index(
+    struct _GumboParser* parser, GumboAttributeIndex* index,
+    const GumboVector* attributes) {
+  if (attributes->length * 2 >= index->_capacity) {
+    unsigned int capacity = index->_capacity ? index->_capacity : 32;
+    while (attributes->length * 2 >= capacity) {
+      capacity *= 2;
+    }
+    gumbo_parser_deallocate(parser, index->_slots);
+    index->_slots =
+        gumbo_parser_allocate(parser, capacity * sizeof(unsigned int),
+                              GUMBO_ALLOCATION_ATTRIBUTE);
+    memset(index->_slots, 0, capacity * sizeof(unsigned int));
+    index->_capacity = capacity;
+    index->_count = 0;
+  }
+  for (; index->_count < attributes->length; ++index->_count) {
+    insert_into_attribute_index(index, attributes, index->_count);
+  }
+}
+
+int gumbo_attribute_index_find(
+    struct _GumboParser* parser, GumboAttributeIndex* index,
+    const GumboVector* attributes, const char* name, size_t length) {
+  update_attribute_index(parser, index, attributes);
+  unsigned int mask = index->_capacity - 1;
+  for (unsigned int slot = hash_attribute_name(name, length) & mask;
+       index->_slots[slot]; slot = (slot + 1) & mask) {
+    int position = index->_slots[slot] - 1;
+    const GumboAttribute* attr = attributes->data[position];
+    if (strncmp(attr->name, name, length) == 0 && attr->name[length] == '\0') {
+      return position;
+    }
+  }
+  return -1;
+}
+
+// An attribute string shared between clones, preceded by its reference count.
+typedef struct _SharedString {
+  unsigned int refcount;
+  char data[];
+} SharedString;
+
+static SharedString* get_shared_string(const char* str) {
+  return (SharedString*) (str - offsetof(SharedString, data));
+}
+
+// Returns a new reference to *str.  Owned strings are first moved into a
+// SharedString, so each string is copied at most once however many times the
+// attribute is cloned, and attributes that are never cloned pay nothing.
+static const char* share_string(
+    struct _GumboParser* parser, const char** str,
+    GumboStringOwnership* ownership, size_t length) {
+  if (*ownership == GUMBO_STRING_OWNED) {
+    SharedString* shared = gumbo_parser_allocate(
+        parser, offsetof(SharedString, data) + length + 1,
+        GUMBO_ALLOCATION_TEXT);
+    shared->refcount = 1;
+    memcpy(shared->data, *str, length + 1);
+    gumbo_parser_deallocate(parser, (void*) *str);
+    *str = shared->data;
+    *ownership = GUMBO_STRING_SHARED;
+  }
+  if (*ownership == GUMBO_STRING_SHARED) {
+    ++get_shared_string(*str)->refcount;
+  }
+  return *str;
+}
+
+static void release_string(
+    struct _GumboParser* parser, const char* str,
+    GumboStringOwnership ownership) {
+  if (ownership == GUMBO_STRING_OWNED) {
+    gumbo_parser_deallocate(parser, (void*) str);
+  } else if (ownership == GUMBO_STRING_SHARED) {
+    SharedString* shared = get_shared_string(str);
+    if (--shared->refcount == 0) {
+      gumbo_parser_deallocate(parser, shared);
+    }
+  }
+}
+
+GumboAttribute* gumbo_clone_attribute(
+    struct _GumboParser* parser, GumboAttribute* attribute) {
+  GumboAttribute* clone = gumbo_parser_allocate(
+      parser, sizeof(GumboAttribute), GUMBO_ALLOCATION_ATTRIBUTE);
+  *clone = *attribute;
+  clone->name = share_string(
+      parser, &attribute->name, &attribute->name_ownership,
+      strlen(attribute->name));
+  clone->name_ownership = attribute->name_ownership;
+  clone->value = share_string(
+      parser, &attribute->value, &attribute->value_ownership,
+      attribute->value_length);
+  clone->value_ownership = attribute->value_ownership;
+  return clone;
+}
+
+void gumbo_attribute_set_name(
+    struct _GumboParser* parser, GumboAttribute* attribute,
+    GumboAttributeAtom atom, const char* name, size_t length) {
+  assert(atom == gumbo_attribute_atom(name, length));
+  release_string(parser, attribute->name, attribute->name_ownership);
+  attribute->atom = atom;
+  if (atom != GUMBO_ATTR_UNKNOWN &&
+      memcmp(name, kGumboAttributeNames[atom].data, length) == 0) {
+    attribute->name = kGumboAttributeNames[atom].data;
+    attribute->name_ownership = GUMBO_STRING_STATIC;
+  } else {
+    // Either not an atom, or an atom in different case (like the adjusted
+    // SVG and MathML names), which has to keep its own spelling.
+    char* copy =
+        gumbo_parser_allocate(parser, length + 1, GUMBO_ALLOCATION_TEXT);
+    memcpy(copy, name, length);
+    copy[length] = '\0';
+    attribute->name = copy;
+    attribute->name_ownership = GUMBO_STRING_OWNED;
+  }
+}
+
 void gumbo_destroy_attribute(
     struct _GumboParser* parser, GumboAttribute* attribute) {
-  gumbo_parser_deallocate(parser, (void*) attribute->name);
-  gumbo_parser_deallocate(parser, (void*) attribute->value);
+  release_string(parser, attribute->name, attribute->name_ownership);
+  release_string(parser, attribute->value, attribute->value_ownership);
   gumbo_parser_deallocate(parser, (void*) attribute);
 }
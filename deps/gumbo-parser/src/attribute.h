@@ -25,6 +25,52 @@ extern "C" {
 
 struct _GumboParser;
 
+// Gives an attribute a new name of the given length (which needn't be
+// null-terminated), freeing the old one if it was owned.  atom must be the
+// name's atom, which the caller usually already has to hand; atom names are
+// interned rather than copied.
+void gumbo_attribute_set_name(
+    struct _GumboParser* parser, GumboAttribute* attribute,
+    GumboAttributeAtom atom, const char* name, size_t length);
+
+// Hashes an attribute's name and value together.
+unsigned int gumbo_attribute_hash(const GumboAttribute* attr);
+
+// A hash index over the names in a vector of attributes, for finding
+// duplicates in vectors too long to search linearly.  It indexes the vector
+// lazily, so attributes can be appended between lookups.  Names are compared
+// exactly, since the tokenizer has already lowercased them.
+typedef struct _GumboAttributeIndex {
+  // Open-addressed table of (index into the vector + 1), or 0 for an empty
+  // slot.  The capacity is always a power of two.
+  unsigned int* _slots;
+  unsigned int _capacity;
+
+  // The number of attributes from the front of the vector that are indexed.
+  unsigned int _count;
+} GumboAttributeIndex;
+
+void gumbo_attribute_index_init(GumboAttributeIndex* index);
+
+// Empties the index, keeping its capacity, so it can be used for a new vector.
+void gumbo_attribute_index_clear(GumboAttributeIndex* index);
+
+void gumbo_attribute_index_destroy(
+    struct _GumboParser* parser, GumboAttributeIndex* index);
+
+// Returns the position in attributes of the attribute with the given name and
+// length (which needn't be null-terminated), or -1.  attributes must be the
+// same vector that the index was used with since it was last cleared.
+int gumbo_attribute_index_find(
+    struct _GumboParser* parser, GumboAttributeIndex* index,
+    const GumboVector* attributes, const char* name, size_t length);
+
+// Returns a copy of attribute that shares its name and value rather than
+// duplicating them.  Both attributes may be modified or destroyed
+// independently afterwards.
+GumboAttribute* gumbo_clone_attribute(
+    struct _GumboParser* parser, GumboAttribute* attribute);
+
 // Release the memory used for an GumboAttribute, including the attribute
 // itself.
 void gumbo_destroy_attribute(
@@ -0,0 +1,523 @@
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Copies a finished parse tree into a single block of memory, in document
+// order, either as an ordinary GumboOutput or as a GumboPackedTree.  Either
+// way, the copy is made in two passes over the tree that run the same code:
+// the first only adds up the size of everything, and the second, once the
+// block has been allocated, fills it in.
+
+#include <assert.h>
+#include <string.h>
+
+#include "gumbo.h"
+#include "parser.h"
+#include "util.h"
+
+// Everything except strings is aligned to this within the block.
+static const size_t kCompactAlignment = sizeof(void*);
+
+typedef struct _CompactBuffer {
+  // The start of the block, or NULL during the sizing pass.
+  char* data;
+
+  // The number of bytes used (or, when sizing, needed) so far.
+  size_t size;
+} CompactBuffer;
+
+// Reserves space for num_bytes in the buffer, and returns a pointer to it, or
+// NULL when sizing.
+static void* compact_reserve(
+    CompactBuffer* buffer, size_t num_bytes, size_t alignment) {
+  size_t offset = (buffer->size + alignment - 1) & ~(alignment - 1);
+  buffer->size = offset + num_bytes;
+  return buffer->data ? buffer->data + offset : NULL;
+}
+
+// Copies length bytes of str into the buffer with a null terminator.
+static const char* compact_string(
+    CompactBuffer* buffer, const char* str, size_t length) {
+  if (!str) {
+    return NULL;
+  }
+  char* copy = compact_reserve(buffer, length + 1, 1);
+  if (copy) {
+    memcpy(copy, str, length);
+    copy[length] = '\0';
+  }
+  return copy;
+}
+
+// Reserves an exactly-sized array for the contents of vector, and points copy
+// at it (when it isn't NULL).  The caller fills in the elements.
+static void** compact_vector(
+    CompactBuffer* buffer, const GumboVector* vector, GumboVector* copy) {
+  void** data = vector->length == 0 ? NULL : compact_reserve(
+      buffer, sizeof(void*) * vector->length, kCompactAlignment);
+  if (copy) {
+    copy->data = data;
+    copy->length = vector->length;
+    copy->capacity = vector->length;
+    copy->_is_inline = false;
+  }
+  return data;
+}
+
+static void compact_attributes(
+    CompactBuffer* buffer, const GumboVector* attributes, GumboVector* copy) {
+  void** data = compact_vector(buffer, attributes, copy);
+  for (int i = 0; i < attributes->length; ++i) {
+    const GumboAttribute* attr = attributes->data[i];
+    GumboAttribute* attr_copy =
+        compact_reserve(buffer, sizeof(GumboAttribute), kCompactAlignment);
+    if (attr_copy) {
+      *attr_copy = *attr;
+      data[i] = attr_copy;
+    }
+    if (attr->name_ownership != GUMBO_STRING_STATIC) {
+      const char* name =
+          compact_string(buffer, attr->name, strlen(attr->name));
+      if (attr_copy) {
+        attr_copy->name = name;
+        attr_copy->name_ownership = GUMBO_STRING_OWNED;
+      }
+    }
+    const char* value =
+        compact_string(buffer, attr->value, attr->value_length);
+    if (attr_copy) {
+      attr_copy->value = value;
+      attr_copy->value_ownership = GUMBO_STRING_OWNED;
+    }
+  }
+}
+
+// Copies a single node, apart from its children, and returns the copy (or
+// NULL when sizing).  The child arrays are reserved but not filled in.
+static GumboNode* compact_node(
+    CompactBuffer* buffer, const GumboNode* node, GumboNode* parent) {
+  GumboNode* copy =
+      compact_reserve(buffer, sizeof(GumboNode), kCompactAlignment);
+  if (copy) {
+    *copy = *node;
+    copy->parent = parent;
+  }
+  switch (node->type) {
+    case GUMBO_NODE_DOCUMENT:
+      {
+        const GumboDocument* doc = &node->v.document;
+        GumboDocument* doc_copy = copy ? &copy->v.document : NULL;
+        compact_vector(
+            buffer, &doc->children, doc_copy ? &doc_copy->children : NULL);
+        const char* name = compact_string(
+            buffer, doc->name, doc->name ? strlen(doc->name) : 0);
+        const char* public_identifier = compact_string(
+            buffer, doc->public_identifier,
+            doc->public_identifier ? strlen(doc->public_identifier) : 0);
+        const char* system_identifier = compact_string(
+            buffer, doc->system_identifier,
+            doc->system_identifier ? strlen(doc->system_identifier) : 0);
+        if (doc_copy) {
+          doc_copy->name = name;
+          doc_copy->public_identifier = public_identifier;
+          doc_copy->system_identifier = system_identifier;
+        }
+      }
+      break;
+    case GUMBO_NODE_ELEMENT:
+      {
+        const GumboElement* element = &node->v.element;
+        GumboElement* element_copy = copy ? &copy->v.element : NULL;
+        compact_vector(buffer, &element->children,
+                       element_copy ? &element_copy->children : NULL);
+        compact_attributes(buffer, &element->attributes,
+                           element_copy ? &element_copy->attributes : NULL);
+        if (element_copy) {
+          element_copy->_is_open = false;
+        }
+      }
+      break;
+    case GUMBO_NODE_TEXT:
+    case GUMBO_NODE_CDATA:
+    case GUMBO_NODE_COMMENT:
+    case GUMBO_NODE_WHITESPACE:
+      {
+        const char* text = compact_string(
+            buffer, node->v.text.text, node->v.text.text_length);
+        if (copy) {
+          copy->v.text.text = text;
+          copy->v.text.text_ownership = GUMBO_STRING_OWNED;
+        }
+      }
+      break;
+  }
+  return copy;
+}
+
+static const GumboVector* get_children(const GumboNode* node) {
+  if (node->type == GUMBO_NODE_DOCUMENT) {
+    return &node->v.document.children;
+  } else if (node->type == GUMBO_NODE_ELEMENT) {
+    return &node->v.element.children;
+  }
+  return NULL;
+}
+
+// Copies (or sizes) the whole tree in preorder.  This walks the tree through
+// parent pointers rather than recursing, so that deeply nested documents can't
+// overflow the stack.
+static void compact_tree(
+    CompactBuffer* buffer, const GumboOutput* output, GumboOutput* copy) {
+  const GumboNode* node = output->document;
+  // The copy of node's parent, or NULL when sizing.
+  GumboNode* parent = NULL;
+  while (true) {
+    GumboNode* node_copy = compact_node(buffer, node, parent);
+    if (node_copy) {
+      if (parent) {
+        ((GumboVector*) get_children(parent))->data[
+            node->index_within_parent] = node_copy;
+      } else {
+        copy->document = node_copy;
+      }
+      if (node == output->root) {
+        copy->root = node_copy;
+      }
+    }
+
+    const GumboVector* children = get_children(node);
+    if (children && children->length > 0) {
+      parent = node_copy;
+      node = children->data[0];
+      continue;
+    }
+    // Climb until there's a next sibling to move on to.
+    while (node != output->document &&
+           node->index_within_parent ==
+               get_children(node->parent)->length - 1) {
+      node = node->parent;
+      parent = parent ? parent->parent : NULL;
+    }
+    if (node == output->document) {
+      return;
+    }
+    node = get_children(node->parent)->data[node->index_within_parent + 1];
+  }
+}
+
+// Lays out (or sizes) the output struct, stats, profile and tree, returning the
+// copy of the output or NULL when sizing.
+static GumboOutput* compact_output(
+    CompactBuffer* buffer, const GumboOutput* output) {
+  GumboOutput* copy =
+      compact_reserve(buffer, sizeof(GumboOutput), kCompactAlignment);
+  if (copy) {
+    *copy = *output;
+    copy->root = NULL;
+    copy->errors = kGumboEmptyVector;
+    copy->is_compact = true;
+  }
+  if (output->stats) {
+    GumboParseStats* stats = compact_reserve(
+        buffer, sizeof(GumboParseStats), kCompactAlignment);
+    if (copy) {
+      *stats = *output->stats;
+      copy->stats = stats;
+    }
+  }
+  if (output->profile) {
+    GumboProfile* profile = compact_reserve(
+        buffer, sizeof(GumboProfile), kCompactAlignment);
+    if (copy) {
+      *profile = *output->profile;
+      copy->profile = profile;
+    }
+  }
+  compact_tree(buffer, output, copy);
+  return copy;
+}
+
+GumboOutput* gumbo_compact_output(
+    const GumboOptions* options, const GumboOutput* output) {
+  CompactBuffer buffer;
+  buffer.data = NULL;
+  buffer.size = 0;
+  compact_output(&buffer, output);
+  size_t total_size = buffer.size;
+
+  GumboParser parser;
+  parser._options = options;
+  parser._stats = NULL;
+  buffer.data =
+      gumbo_parser_allocate(&parser, total_size, GUMBO_ALLOCATION_OTHER);
+  buffer.size = 0;
+  GumboOutput* copy = compact_output(&buffer, output);
+  assert(buffer.size == total_size);
+  return copy;
+}
+
+typedef struct _PackState {
+  // The arrays being filled in, all NULL during the sizing pass.
+  GumboPackedNode* nodes;
+  GumboPackedElement* elements;
+  GumboPackedText* texts;
+  GumboPackedAttribute* attributes;
+  char* strings;
+
+  // The number of entries used so far in each of the above.
+  uint32_t node_count;
+  uint32_t element_count;
+  uint32_t text_count;
+  uint32_t attribute_count;
+  uint32_t strings_length;
+
+  // The offset in strings of each atom's name, once it has been added, so that
+  // every attribute with a given atom name shares one copy.
+  uint32_t atom_names[GUMBO_ATTR_LAST];
+} PackState;
+
+static void pack_state_init(PackState* state) {
+  memset(state, 0, sizeof(PackState));
+  for (int i = 0; i < GUMBO_ATTR_LAST; ++i) {
+    state->atom_names[i] = GUMBO_PACKED_NONE;
+  }
+}
+
+// Adds length bytes of str to the string pool with a null terminator, and
+// returns its offset.
+static uint32_t pack_string(
+    PackState* state, const char* str, size_t length) {
+  uint32_t offset = state->strings_length;
+  if (state->strings && length > 0) {
+    memcpy(state->strings + offset, str, length);
+  }
+  if (state->strings) {
+    state->strings[offset + length] = '\0';
+  }
+  state->strings_length += length + 1;
+  return offset;
+}
+
+static uint32_t pack_c_string(PackState* state, const char* str) {
+  return str ? pack_string(state, str, strlen(str)) : 0;
+}
+
+static void pack_attributes(
+    PackState* state, const GumboVector* attributes,
+    GumboPackedElement* element) {
+  if (element) {
+    element->first_attribute = state->attribute_count;
+    element->attribute_count = attributes->length;
+  }
+  for (int i = 0; i < attributes->length; ++i) {
+    const GumboAttribute* attr = attributes->data[i];
+    uint32_t name;
+    if (attr->name_ownership == GUMBO_STRING_STATIC) {
+      if (state->atom_names[attr->atom] == GUMBO_PACKED_NONE) {
+        state->atom_names[attr->atom] = pack_c_string(state, attr->name);
+      }
+      name = state->atom_names[attr->atom];
+    } else {
+      name = pack_c_string(state, attr->name);
+    }
+    uint32_t value = pack_string(state, attr->value, attr->value_length);
+    if (state->attributes) {
+      GumboPackedAttribute* packed =
+          &state->attributes[state->attribute_count];
+      packed->name = name;
+      packed->value = value;
+      packed->value_length = attr->value_length;
+      packed->offset = attr->name_start.offset;
+      packed->atom = attr->atom;
+      packed->attr_namespace = attr->attr_namespace;
+    }
+    ++state->attribute_count;
+  }
+}
+
+// Adds a single node, apart from its children, and returns its index.
+static uint32_t pack_node(
+    PackState* state, const GumboNode* node, uint32_t parent) {
+  uint32_t index = state->node_count++;
+  GumboPackedNode* packed = state->nodes ? &state->nodes[index] : NULL;
+  if (packed) {
+    packed->parent = parent;
+    packed->next_sibling = GUMBO_PACKED_NONE;
+    packed->child_count = 0;
+    packed->data = GUMBO_PACKED_NONE;
+    packed->offset = 0;
+    packed->parse_flags = node->parse_flags;
+    packed->type = node->type;
+  }
+  switch (node->type) {
+    case GUMBO_NODE_DOCUMENT:
+      if (packed) {
+        packed->child_count = node->v.document.children.length;
+      }
+      break;
+    case GUMBO_NODE_ELEMENT:
+      {
+        const GumboElement* element = &node->v.element;
+        GumboPackedElement* packed_element = state->elements ?
+            &state->elements[state->element_count] : NULL;
+        if (packed) {
+          packed->child_count = element->children.length;
+          packed->data = state->element_count;
+          packed->offset = element->start_pos.offset;
+          packed_element->original_tag_length = element->original_tag.length;
+          packed_element->end_offset = element->end_pos.offset;
+          packed_element->tag = element->tag;
+          packed_element->tag_namespace = element->tag_namespace;
+        }
+        ++state->element_count;
+        pack_attributes(state, &element->attributes, packed_element);
+      }
+      break;
+    case GUMBO_NODE_TEXT:
+    case GUMBO_NODE_CDATA:
+    case GUMBO_NODE_COMMENT:
+    case GUMBO_NODE_WHITESPACE:
+      {
+        const GumboText* text = &node->v.text;
+        uint32_t text_offset =
+            pack_string(state, text->text, text->text_length);
+        if (packed) {
+          GumboPackedText* packed_text = &state->texts[state->text_count];
+          packed_text->text = text_offset;
+          packed_text->length = text->text_length;
+          packed->data = state->text_count;
+          packed->offset = text->start_pos.offset;
+        }
+        ++state->text_count;
+      }
+      break;
+  }
+  return index;
+}
+
+// Adds (or counts) the whole tree in preorder, walking it iteratively in the
+// same way as compact_tree.  Returns the index of output->root.
+static uint32_t pack_tree(PackState* state, const GumboOutput* output) {
+  const GumboNode* node = output->document;
+  uint32_t root = 0;
+  // The index of node, and of its parent.  Only valid when filling.
+  uint32_t current = GUMBO_PACKED_NONE;
+  uint32_t parent = GUMBO_PACKED_NONE;
+  while (true) {
+    uint32_t previous = current;
+    current = pack_node(state, node, parent);
+    if (state->nodes && previous != GUMBO_PACKED_NONE &&
+        previous != parent) {
+      state->nodes[previous].next_sibling = current;
+    }
+    if (node == output->root) {
+      root = current;
+    }
+
+    const GumboVector* children = get_children(node);
+    if (children && children->length > 0) {
+      parent = current;
+      node = children->data[0];
+      continue;
+    }
+    while (node != output->document &&
+           node->index_within_parent ==
+               get_children(node->parent)->length - 1) {
+      node = node->parent;
+      if (state->nodes) {
+        current = parent;
+        parent = state->nodes[current].parent;
+      }
+    }
+    if (node == output->document) {
+      return root;
+    }
+    node = get_children(node->parent)->data[node->index_within_parent + 1];
+  }
+}
+
+// Adds the doctype strings to the pool.  The empty string always comes first,
+// so that offset 0 can stand in for a missing string.
+static void pack_document(
+    PackState* state, const GumboDocument* doc, GumboPackedTree* tree) {
+  pack_string(state, "", 0);
+  uint32_t name = pack_c_string(state, doc->name);
+  uint32_t public_identifier = pack_c_string(state, doc->public_identifier);
+  uint32_t system_identifier = pack_c_string(state, doc->system_identifier);
+  if (tree) {
+    tree->has_doctype = doc->has_doctype;
+    tree->doctype_name = name;
+    tree->doctype_public_identifier = public_identifier;
+    tree->doctype_system_identifier = system_identifier;
+    tree->doc_type_quirks_mode = doc->doc_type_quirks_mode;
+  }
+}
+
+GumboPackedTree* gumbo_pack_output(
+    const GumboOptions* options, const GumboOutput* output) {
+  PackState state;
+  pack_state_init(&state);
+  pack_document(&state, &output->document->v.document, NULL);
+  pack_tree(&state, output);
+
+  // The arrays all have 4-byte alignment, and the strings go last.
+  size_t nodes_offset = sizeof(GumboPackedTree);
+  size_t elements_offset =
+      nodes_offset + sizeof(GumboPackedNode) * state.node_count;
+  size_t texts_offset =
+      elements_offset + sizeof(GumboPackedElement) * state.element_count;
+  size_t attributes_offset =
+      texts_offset + sizeof(GumboPackedText) * state.text_count;
+  size_t strings_offset =
+      attributes_offset + sizeof(GumboPackedAttribute) * state.attribute_count;
+  size_t total_size = strings_offset + state.strings_length;
+
+  GumboParser parser;
+  parser._options = options;
+  parser._stats = NULL;
+  char* block =
+      gumbo_parser_allocate(&parser, total_size, GUMBO_ALLOCATION_OTHER);
+  // Cleared so that the padding in the records is too, and serialized trees
+  // of the same document come out byte-for-byte the same.
+  memset(block, 0, total_size);
+  GumboPackedTree* tree = (GumboPackedTree*) block;
+  tree->node_count = state.node_count;
+  tree->element_count = state.element_count;
+  tree->text_count = state.text_count;
+  tree->attribute_count = state.attribute_count;
+  tree->strings_length = state.strings_length;
+  tree->status = output->status;
+
+  pack_state_init(&state);
+  state.nodes = (GumboPackedNode*) (block + nodes_offset);
+  state.elements = (GumboPackedElement*) (block + elements_offset);
+  state.texts = (GumboPackedText*) (block + texts_offset);
+  state.attributes = (GumboPackedAttribute*) (block + attributes_offset);
+  state.strings = block + strings_offset;
+  tree->nodes = state.nodes;
+  tree->elements = state.elements;
+  tree->texts = state.texts;
+  tree->attributes = state.attributes;
+  tree->strings = state.strings;
+  pack_document(&state, &output->document->v.document, tree);
+  tree->root = pack_tree(&state, output);
+  assert(state.node_count == tree->node_count);
+  assert(state.strings_length == tree->strings_length);
+  return tree;
+}
+
+void gumbo_destroy_packed_tree(
+    const GumboOptions* options, GumboPackedTree* tree) {
+  GumboParser parser;
+  parser._options = options;
+  parser._stats = NULL;
+  gumbo_parser_deallocate(&parser, tree);
+}
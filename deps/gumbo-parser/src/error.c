@@ -134,11 +134,16 @@ static const char* find_next_newline(
 }
 
 GumboError* gumbo_add_error(GumboParser* parser) {
+  if (parser->_stats) {
+    ++parser->_stats->errors;
+  }
   int max_errors = parser->_options->max_errors;
-  if (max_errors < 0 && parser->_output->errors.length >= max_errors) {
+  if (max_errors >= 0 &&
+      parser->_output->errors.length >= (unsigned int) max_errors) {
     return NULL;
   }
-  GumboError* error = gumbo_parser_allocate(parser, sizeof(GumboError));
+  GumboError* error = gumbo_parser_allocate(
+      parser, sizeof(GumboError), GUMBO_ALLOCATION_ERROR);
   gumbo_vector_add(parser, error, &parser->_output->errors);
   return error;
 }
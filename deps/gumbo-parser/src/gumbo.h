@@ -44,6 +44,7 @@
 
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -117,8 +118,10 @@ bool gumbo_string_equals_ignore_case(
  * a for-loop.
  */
 typedef struct _GumboVector {
-  /** Data elements.  This points to a dynamically-allocated array of capacity
-   * elements, each a void* to the element itself.
+  /** Data elements.  This points to an array of capacity elements, each a
+   * void* to the element itself.  The array is usually dynamically allocated,
+   * but the children and attributes of an element start out in a few slots
+   * allocated along with the node.
    */
   void** data;
 
@@ -126,7 +129,13 @@ typedef struct _GumboVector {
   unsigned int length;
 
   /** Current array capacity. */
-  unsigned int capacity;
+  unsigned int capacity : 31;
+
+  /**
+   * Whether data points to storage that the vector doesn't own, and mustn't
+   * free when it grows or is destroyed.
+   */
+  unsigned int _is_inline : 1;
 } GumboVector;
 
 /** An empty (0-length, 0-capacity) GumboVector. */
@@ -372,6 +381,149 @@ typedef enum _GumboAttributeNamespaceEnum {
   GUMBO_ATTR_NAMESPACE_XMLNS,
 } GumboAttributeNamespaceEnum;
 
+/**
+ * Who owns the memory behind a string in the parse tree.
+ */
+typedef enum _GumboStringOwnership {
+  /** Allocated for this tree, null-terminated, and freed along with it. */
+  GUMBO_STRING_OWNED,
+  /**
+   * Points into the buffer that was parsed, and is only valid for as long as
+   * that is.  It is NOT null-terminated; use the accompanying length.  Only
+   * produced when GumboOptions.borrow_input_strings is set.
+   */
+  GUMBO_STRING_BORROWED,
+  /** A constant string inside the library, shared by every tree. */
+  GUMBO_STRING_STATIC,
+  /**
+   * Like GUMBO_STRING_OWNED, but shared between an attribute and the copies
+   * of it that the parser made when cloning misnested formatting elements.
+   * It is freed along with the last of them.
+   */
+  GUMBO_STRING_SHARED
+} GumboStringOwnership;
+
+/**
+ * An enum for commonly-used attribute names, so that they can be compared as
+ * integers and don't need their own copy of the name.  Like GumboTag, this
+ * ignores namespaces: an xlink:href attribute is GUMBO_ATTR_HREF.
+ *
+ * The constants are in byte order of the names, which kGumboAttributeNames in
+ * attribute.c must follow so that it can be binary-searched.
+ */
+typedef enum _GumboAttributeAtom {
+  GUMBO_ATTR_ACCEPT,
+  GUMBO_ATTR_ACCEPT_CHARSET,
+  GUMBO_ATTR_ACCESSKEY,
+  GUMBO_ATTR_ACTION,
+  GUMBO_ATTR_ALIGN,
+  GUMBO_ATTR_ALT,
+  GUMBO_ATTR_ASYNC,
+  GUMBO_ATTR_AUTOCOMPLETE,
+  GUMBO_ATTR_AUTOFOCUS,
+  GUMBO_ATTR_BACKGROUND,
+  GUMBO_ATTR_BGCOLOR,
+  GUMBO_ATTR_BORDER,
+  GUMBO_ATTR_CHARSET,
+  GUMBO_ATTR_CHECKED,
+  GUMBO_ATTR_CITE,
+  GUMBO_ATTR_CLASS,
+  GUMBO_ATTR_COLOR,
+  GUMBO_ATTR_COLS,
+  GUMBO_ATTR_COLSPAN,
+  GUMBO_ATTR_CONTENT,
+  GUMBO_ATTR_CONTENTEDITABLE,
+  GUMBO_ATTR_CONTROLS,
+  GUMBO_ATTR_COORDS,
+  GUMBO_ATTR_CROSSORIGIN,
+  GUMBO_ATTR_DATA,
+  GUMBO_ATTR_DATETIME,
+  GUMBO_ATTR_DEFER,
+  GUMBO_ATTR_DIR,
+  GUMBO_ATTR_DISABLED,
+  GUMBO_ATTR_DOWNLOAD,
+  GUMBO_ATTR_DRAGGABLE,
+  GUMBO_ATTR_ENCODING,
+  GUMBO_ATTR_ENCTYPE,
+  GUMBO_ATTR_FACE,
+  GUMBO_ATTR_FOR,
+  GUMBO_ATTR_FORM,
+  GUMBO_ATTR_FRAMEBORDER,
+  GUMBO_ATTR_HEADERS,
+  GUMBO_ATTR_HEIGHT,
+  GUMBO_ATTR_HIDDEN,
+  GUMBO_ATTR_HIGH,
+  GUMBO_ATTR_HREF,
+  GUMBO_ATTR_HREFLANG,
+  GUMBO_ATTR_HTTP_EQUIV,
+  GUMBO_ATTR_ID,
+  GUMBO_ATTR_INTEGRITY,
+  GUMBO_ATTR_ITEMPROP,
+  GUMBO_ATTR_ITEMSCOPE,
+  GUMBO_ATTR_ITEMTYPE,
+  GUMBO_ATTR_LABEL,
+  GUMBO_ATTR_LANG,
+  GUMBO_ATTR_LIST,
+  GUMBO_ATTR_LOOP,
+  GUMBO_ATTR_LOW,
+  GUMBO_ATTR_MAX,
+  GUMBO_ATTR_MAXLENGTH,
+  GUMBO_ATTR_MEDIA,
+  GUMBO_ATTR_METHOD,
+  GUMBO_ATTR_MIN,
+  GUMBO_ATTR_MULTIPLE,
+  GUMBO_ATTR_MUTED,
+  GUMBO_ATTR_NAME,
+  GUMBO_ATTR_NONCE,
+  GUMBO_ATTR_NOVALIDATE,
+  GUMBO_ATTR_ONCLICK,
+  GUMBO_ATTR_ONLOAD,
+  GUMBO_ATTR_OPEN,
+  GUMBO_ATTR_OPTIMUM,
+  GUMBO_ATTR_PATTERN,
+  GUMBO_ATTR_PLACEHOLDER,
+  GUMBO_ATTR_POSTER,
+  GUMBO_ATTR_PRELOAD,
+  GUMBO_ATTR_PROMPT,
+  GUMBO_ATTR_READONLY,
+  GUMBO_ATTR_REL,
+  GUMBO_ATTR_REQUIRED,
+  GUMBO_ATTR_REVERSED,
+  GUMBO_ATTR_ROLE,
+  GUMBO_ATTR_ROWS,
+  GUMBO_ATTR_ROWSPAN,
+  GUMBO_ATTR_SANDBOX,
+  GUMBO_ATTR_SCOPE,
+  GUMBO_ATTR_SELECTED,
+  GUMBO_ATTR_SHAPE,
+  GUMBO_ATTR_SIZE,
+  GUMBO_ATTR_SIZES,
+  GUMBO_ATTR_SPAN,
+  GUMBO_ATTR_SRC,
+  GUMBO_ATTR_SRCDOC,
+  GUMBO_ATTR_SRCLANG,
+  GUMBO_ATTR_SRCSET,
+  GUMBO_ATTR_START,
+  GUMBO_ATTR_STEP,
+  GUMBO_ATTR_STYLE,
+  GUMBO_ATTR_TABINDEX,
+  GUMBO_ATTR_TARGET,
+  GUMBO_ATTR_TITLE,
+  GUMBO_ATTR_TRANSLATE,
+  GUMBO_ATTR_TYPE,
+  GUMBO_ATTR_USEMAP,
+  GUMBO_ATTR_VALIGN,
+  GUMBO_ATTR_VALUE,
+  GUMBO_ATTR_WIDTH,
+  GUMBO_ATTR_WRAP,
+  GUMBO_ATTR_XMLNS,
+  GUMBO_ATTR_XMLNS_XLINK,
+  // Used for attributes that aren't in this list.
+  GUMBO_ATTR_UNKNOWN,
+  // A marker value to allow iteration over all atoms.
+  GUMBO_ATTR_LAST
+} GumboAttributeAtom;
+
 /**
  * A struct representing a single attribute on an HTML tag.  This is a
  * name-value pair, but also includes information about source locations and
@@ -392,6 +544,19 @@ typedef struct _GumboAttribute {
    */
   const char* name;
 
+  /**
+   * The attribute name as an atom, or GUMBO_ATTR_UNKNOWN if it isn't one of
+   * the common ones.
+   */
+  GumboAttributeAtom atom;
+
+  /**
+   * GUMBO_STRING_STATIC if name is the library's shared copy of a known atom's
+   * name, otherwise GUMBO_STRING_OWNED (or GUMBO_STRING_SHARED, if the
+   * element has been cloned).
+   */
+  GumboStringOwnership name_ownership;
+
   /**
    * The original text of the attribute name, as a pointer into the original
    * source buffer.
@@ -400,12 +565,19 @@ typedef struct _GumboAttribute {
 
   /**
    * The value of the attribute.  This is in a freshly-allocated buffer to deal
-   * with unescaping, and is null-terminated.  It does not include any quotes
-   * that surround the attribute.  If the attribute has no value (for example,
+   * with unescaping, and is null-terminated, unless value_ownership says that
+   * it was borrowed from the input.  It does not include any quotes that
+   * surround the attribute.  If the attribute has no value (for example,
    * 'selected' on a checkbox), this will be an empty string.
    */
   const char* value;
 
+  /** The length of value, in bytes. */
+  size_t value_length;
+
+  /** Whether value was allocated for this attribute or borrowed. */
+  GumboStringOwnership value_ownership;
+
   /**
    * The original text of the value of the attribute.  This points into the
    * original source buffer.  It includes any quotes that surround the
@@ -441,6 +613,22 @@ typedef struct _GumboAttribute {
 GumboAttribute* gumbo_get_attribute(
     const struct _GumboVector* attrs, const char* name);
 
+/**
+ * Like gumbo_get_attribute, but looks the attribute up by atom, which is just
+ * an integer comparison per attribute.
+ */
+GumboAttribute* gumbo_get_attribute_by_atom(
+    const struct _GumboVector* attrs, GumboAttributeAtom atom);
+
+/**
+ * Returns the atom for an attribute name of the given length (which needn't be
+ * null-terminated), or GUMBO_ATTR_UNKNOWN.  This is case-insensitive.
+ */
+GumboAttributeAtom gumbo_attribute_atom(const char* name, size_t length);
+
+/** Returns the lowercase name of an attribute atom. */
+const char* gumbo_normalized_attribute_name(GumboAttributeAtom atom);
+
 /**
  * Enum denoting the type of node.  This determines the type of the node.v
  * union.
@@ -598,10 +786,18 @@ typedef struct _GumboDocument {
 typedef struct _GumboText {
   /**
    * The text of this node, after entities have been parsed and decoded.  For
-   * comment/cdata nodes, this does not include the comment delimiters.
+   * comment/cdata nodes, this does not include the comment delimiters.  This
+   * is null-terminated unless text_ownership says that it was borrowed from
+   * the input.
    */
   const char* text;
 
+  /** The length of text, in bytes. */
+  size_t text_length;
+
+  /** Whether text was allocated for this node or borrowed. */
+  GumboStringOwnership text_ownership;
+
   /**
    * The original text of this node, as a pointer into the original buffer.  For
    * comment/cdata nodes, this includes the comment delimiters.
@@ -658,6 +854,17 @@ typedef struct _GumboElement {
    * order that they were parsed.  Pointers are owned.
    */
   GumboVector /* GumboAttribute* */ attributes;
+
+  /**
+   * Parser bookkeeping: whether this element is currently on the stack of
+   * open elements, a hash of its attributes used to compare entries in the
+   * list of active formatting elements, and, in a gumbo_parse_matching parse,
+   * where it stands with the selector.  None of these is meaningful once
+   * parsing has finished.
+   */
+  bool _is_open;
+  unsigned char _match_flags;
+  unsigned int _attribute_hash;
 } GumboElement;
 
 /**
@@ -704,6 +911,23 @@ typedef void* (*GumboAllocatorFunction)(void* userdata, size_t size);
  */
 typedef void (*GumboDeallocatorFunction)(void* userdata, void* ptr);
 
+/**
+ * The type for a reallocator function.  Takes the 'userdata' member of the
+ * GumboParser struct as its first argument.  Semantics should be the same as
+ * realloc on blocks returned by the allocator.
+ */
+typedef void* (*GumboReallocatorFunction)(
+    void* userdata, void* ptr, size_t size);
+
+/**
+ * The type for a cancellation check.  Takes the 'userdata' member of the
+ * GumboOptions struct as its argument, and returns true if the parse should be
+ * abandoned.  This is polled periodically from the parse loop, possibly while
+ * another thread is setting the condition, so it should be cheap and
+ * thread-safe (eg. a load of an atomic flag).
+ */
+typedef bool (*GumboCancellationFunction)(void* userdata);
+
 /**
  * Input struct containing configuration options for the parser.
  * These let you specify alternate memory managers, provide different error
@@ -743,11 +967,266 @@ typedef struct _GumboOptions {
    * Default: -1
    */
   int max_errors;
+
+  /**
+   * The maximum number of nodes that the parse may create.  Limits are checked
+   * between tokens, so a single token may take the parse a few nodes past the
+   * limit before it stops.  Set to -1 to disable the limit.
+   * Default: -1
+   */
+  int max_nodes;
+
+  /**
+   * The maximum depth of the stack of open elements, ie. roughly the nesting
+   * depth of the tree.  Set to -1 to disable the limit.
+   * Default: -1
+   */
+  int max_tree_depth;
+
+  /**
+   * The maximum number of bytes that the parse may request from the allocator,
+   * counted cumulatively over the whole parse (memory that's freed again is not
+   * credited back), so this is an upper bound on the parse's peak footprint.
+   * Set to 0 to disable the limit.
+   * Default: 0
+   */
+  size_t max_allocated_bytes;
+
+  /**
+   * A wall-clock budget for the parse, in milliseconds.  Set to -1 to disable
+   * the limit.
+   * Default: -1
+   */
+  int max_parse_time_ms;
+
+  /**
+   * A function polled periodically during the parse; if it returns true the
+   * parse is abandoned.  NULL to disable.
+   * Default: NULL
+   */
+  GumboCancellationFunction is_cancelled;
+
+  /**
+   * Whether to collect a GumboParseStats for the parse, available as
+   * GumboOutput.stats.  This adds a small per-token and per-allocation cost, so
+   * it's off by default.
+   * Default: false
+   */
+  bool collect_stats;
+
+  /**
+   * Whether text nodes and attribute values whose decoded form is identical to
+   * their source text (no entities, carriage returns or NULs) may point
+   * straight into the input buffer instead of being copied.  This saves a
+   * great deal of memory on text-heavy documents, but such strings are not
+   * null-terminated, and the input buffer must outlive the tree.  See
+   * GumboStringOwnership.
+   * Default: false
+   */
+  bool borrow_input_strings;
+
+  /**
+   * A function to grow blocks from the allocator, used for buffers and vectors
+   * so that they can often be extended in place rather than copied.  The
+   * default, realloc, is only used along with the default allocator: anyone
+   * replacing allocator and deallocator should set this to a matching
+   * function too, or leave it alone (or set it to NULL) to have blocks grown by
+   * allocating, copying and freeing.
+   * Default: realloc
+   */
+  GumboReallocatorFunction reallocator;
 } GumboOptions;
 
 /** Default options struct; use this with gumbo_parse_with_options. */
 extern const GumboOptions kGumboDefaultOptions;
 
+/**
+ * How a parse ended.  Anything other than GUMBO_STATUS_OK means that one of
+ * the limits in GumboOptions cut the parse short: the remaining input was
+ * skipped and all open elements were closed, so the tree is well-formed but
+ * covers only a prefix of the document.
+ */
+typedef enum _GumboOutputStatus {
+  GUMBO_STATUS_OK,
+  GUMBO_STATUS_TOO_MANY_NODES,
+  GUMBO_STATUS_TREE_TOO_DEEP,
+  GUMBO_STATUS_TOO_MUCH_MEMORY,
+  GUMBO_STATUS_TIMED_OUT,
+  GUMBO_STATUS_CANCELLED
+} GumboOutputStatus;
+
+/**
+ * Returns a human-readable description of a GumboOutputStatus.  The return
+ * value is static data owned by the library.
+ */
+const char* gumbo_status_to_string(GumboOutputStatus status);
+
+/**
+ * What an allocation was for.  GumboParseStats breaks the parser's memory use
+ * down by these.
+ */
+typedef enum {
+  /** Nodes, including the inline child and attribute slots of elements. */
+  GUMBO_ALLOCATION_NODE,
+  /** GumboAttribute structs, and the index used to find duplicates. */
+  GUMBO_ALLOCATION_ATTRIBUTE,
+  /** Copies of text, names and attribute values. */
+  GUMBO_ALLOCATION_TEXT,
+  /** The storage of vectors (children, attributes, ...) as they grow. */
+  GUMBO_ALLOCATION_VECTOR,
+  /** The tokenizer's growable string buffers. */
+  GUMBO_ALLOCATION_STRING_BUFFER,
+  /** Parse errors. */
+  GUMBO_ALLOCATION_ERROR,
+  /** Everything else: the output struct and the parser's own state. */
+  GUMBO_ALLOCATION_OTHER,
+  /** The number of categories; not a category itself. */
+  GUMBO_ALLOCATION_LAST
+} GumboAllocationCategory;
+
+/** Returns the name of an allocation category, e.g. "string buffer". */
+const char* gumbo_allocation_category_name(GumboAllocationCategory category);
+
+/** Allocator traffic for one GumboAllocationCategory. */
+typedef struct {
+  /** Number of calls made to the allocator (or reallocator). */
+  unsigned int allocations;
+
+  /** Total bytes requested over the whole parse. */
+  size_t bytes_allocated;
+
+  /** The largest number of bytes that were live at any one time. */
+  size_t peak_bytes;
+
+  /** Bytes currently allocated. */
+  size_t current_bytes;
+} GumboAllocationCounts;
+
+/**
+ * Statistics about a single parse, for capacity planning and for working out
+ * why a particular document is slow.  Filled in when
+ * GumboOptions.collect_stats is set.
+ */
+typedef struct _GumboParseStats {
+  /** Wall-clock time spent in the tokenizer, in nanoseconds. */
+  uint64_t tokenizer_time_ns;
+
+  /** Wall-clock time spent in tree construction, in nanoseconds. */
+  uint64_t tree_construction_time_ns;
+
+  /** Wall-clock time for the whole parse, including setup and teardown. */
+  uint64_t total_time_ns;
+
+  /** Number of tokens of each type. */
+  unsigned int doctype_tokens;
+  unsigned int start_tag_tokens;
+  unsigned int end_tag_tokens;
+  unsigned int comment_tokens;
+  unsigned int whitespace_tokens;
+  unsigned int character_tokens;
+  unsigned int null_tokens;
+
+  /**
+   * Number of nodes created, indexed by GumboNodeType.  This includes nodes
+   * cloned by the adoption agency algorithm.
+   */
+  unsigned int nodes[6];
+
+  /** The greatest depth reached by the stack of open elements. */
+  unsigned int max_tree_depth;
+
+  /** Number of calls made to the allocator. */
+  unsigned int allocations;
+
+  /** Total bytes requested from the allocator over the whole parse. */
+  size_t bytes_allocated;
+
+  /** The largest number of bytes that were live at any one time. */
+  size_t peak_bytes;
+
+  /** Bytes currently allocated for the parse and its output. */
+  size_t current_bytes;
+
+  /** Number of parse errors, including any not recorded due to max_errors. */
+  unsigned int errors;
+
+  /** Number of runs of the adoption agency algorithm (misnested tags). */
+  unsigned int adoption_agency_runs;
+
+  /** Number of nodes that were foster-parented out of tables. */
+  unsigned int foster_parent_insertions;
+
+  /** Number of calls to reconstruct the active formatting elements. */
+  unsigned int reconstruct_formatting_calls;
+
+  /**
+   * The allocator traffic above, broken down by what it was for.  The peaks
+   * are per category, so they needn't add up to peak_bytes.  After the parse,
+   * current_bytes is what the output holds on to.
+   */
+  GumboAllocationCounts by_category[GUMBO_ALLOCATION_LAST];
+} GumboParseStats;
+
+/** The number of tokenizer states, for indexing GumboProfile. */
+#define GUMBO_PROFILE_TOKENIZER_STATES 68
+
+/** The number of tree construction insertion modes, for GumboProfile. */
+#define GUMBO_PROFILE_INSERTION_MODES 22
+
+/** How often one part of the parser was entered, and the time spent in it. */
+typedef struct {
+  uint64_t entries;
+
+  /**
+   * Time spent, in CPU timestamp-counter ticks, or in nanoseconds on platforms
+   * without one; see GumboProfile.ticks_are_ns.
+   */
+  uint64_t ticks;
+} GumboProfileCounter;
+
+/**
+ * A profile of where a parse spent its time, broken down by tokenizer state
+ * and by insertion mode.  Only collected by a library built with
+ * GUMBO_PROFILE defined; the counting slows the parse down noticeably, so
+ * it's meant for profiling builds rather than for every parse.
+ */
+typedef struct _GumboProfile {
+  /**
+   * One entry per call to a tokenizer state's handler, which normally
+   * consumes a single character.  Use gumbo_profile_tokenizer_state_name for
+   * the names.
+   */
+  GumboProfileCounter tokenizer_states[GUMBO_PROFILE_TOKENIZER_STATES];
+
+  /**
+   * One entry per token handled in each insertion mode, including tokens
+   * that are reprocessed in another mode.  Use
+   * gumbo_profile_insertion_mode_name for the names.
+   */
+  GumboProfileCounter insertion_modes[GUMBO_PROFILE_INSERTION_MODES];
+
+  /** Tokens handled by the rules for foreign (SVG and MathML) content. */
+  GumboProfileCounter foreign_content;
+
+  /** True if the ticks are nanoseconds rather than timestamp-counter ticks. */
+  bool ticks_are_ns;
+} GumboProfile;
+
+/** Returns the name of a tokenizer state, e.g. "attr value double quoted". */
+const char* gumbo_profile_tokenizer_state_name(int state);
+
+/** Returns the name of an insertion mode, e.g. "in table body". */
+const char* gumbo_profile_insertion_mode_name(int mode);
+
+/**
+ * Writes a plain-text report of the profile, busiest parts first, into
+ * buffer.  Like snprintf, this writes at most size bytes including the
+ * terminating NUL and returns the length the full report would have, so a
+ * return value of size or more means that the report was truncated.
+ */
+size_t gumbo_profile_report(
+    const GumboProfile* profile, char* buffer, size_t size);
+
 /** The output struct containing the results of the parse. */
 typedef struct _GumboOutput {
   /**
@@ -770,6 +1249,35 @@ typedef struct _GumboOutput {
    * reported so we can work out something appropriate for your use-case.
    */
   GumboVector /* GumboError */ errors;
+
+  /**
+   * Whether the parse ran to completion, or which limit stopped it early.
+   */
+  GumboOutputStatus status;
+
+  /**
+   * The number of nodes the parser created, counted as for
+   * GumboOptions.max_nodes, so including any that it later discarded.
+   */
+  unsigned int node_count;
+
+  /**
+   * Statistics about the parse, or NULL unless GumboOptions.collect_stats was
+   * set.  Owned by the output and freed along with it.
+   */
+  GumboParseStats* stats;
+
+  /**
+   * Where the parse spent its time, or NULL unless the library was built with
+   * GUMBO_PROFILE.  Owned by the output and freed along with it.
+   */
+  GumboProfile* profile;
+
+  /**
+   * True if this output was made by gumbo_compact_output, and so lives in a
+   * single block of memory and must not be modified.
+   */
+  bool is_compact;
 } GumboOutput;
 
 /**
@@ -788,10 +1296,433 @@ struct _GumboOutput* gumbo_parse(const char* buffer);
 struct _GumboOutput* gumbo_parse_with_options(
     const GumboOptions* options, const char* buffer, size_t buffer_length);
 
+/**
+ * Parses buffer as a fragment of HTML, the way the contents of an element
+ * with tag context_tag in namespace context_namespace would be parsed when
+ * setting its innerHTML.  The context element decides the initial insertion
+ * mode (so "<td>x" is a cell in the context of a <tr>, but just text in a
+ * <div>), and for <title>, <textarea>, <style>, <script> and the like, the
+ * initial tokenizer state too, so that their text isn't parsed as markup.
+ *
+ * The context element isn't part of the output.  output->root is an <html>
+ * element inserted by the parser, and its children are the fragment's nodes;
+ * no <head> or <body> is implied unless the context calls for them.  The
+ * document node has no doctype.  context_tag must not be GUMBO_TAG_LAST.
+ */
+struct _GumboOutput* gumbo_parse_fragment(
+    const GumboOptions* options, const char* buffer, size_t buffer_length,
+    GumboTag context_tag, GumboNamespaceEnum context_namespace);
+
 /** Release the memory used for the parse tree & parse errors. */
 void gumbo_destroy_output(
     const struct _GumboOptions* options, GumboOutput* output);
 
+/**
+ * Like gumbo_destroy_output, but also checks that everything the parse
+ * allocated has been freed.  Returns the number of bytes that were still
+ * allocated afterwards, which is nonzero only if the library leaked, and if
+ * leaked_by_category isn't NULL, fills it in with the same broken down by
+ * GumboAllocationCategory.  The check needs allocation statistics, so for an
+ * output without them this always returns 0.  (gumbo_destroy_output makes
+ * the same check in debug builds, and asserts that nothing leaked.)
+ */
+size_t gumbo_destroy_output_checked(
+    const struct _GumboOptions* options, GumboOutput* output,
+    size_t leaked_by_category[GUMBO_ALLOCATION_LAST]);
+
+/**
+ * Copies a finished parse tree into a single allocation, for consumers that
+ * walk the whole tree after parsing.  Nodes are laid out in document order,
+ * each followed by its exactly-sized child and attribute arrays and its
+ * strings, so that a full traversal is a mostly sequential scan.  Strings
+ * borrowed from the input are copied too; only the original_* fields still
+ * point into the input buffer.
+ *
+ * The copy is read-only: don't modify it or pass its nodes to
+ * gumbo_destroy_node.  Its errors vector is empty, and its stats (if any) are
+ * a copy of output's.  Free it with gumbo_destroy_output, which releases the
+ * whole block at once.  output itself is unchanged and must still be
+ * destroyed separately.
+ */
+GumboOutput* gumbo_compact_output(
+    const struct _GumboOptions* options, const GumboOutput* output);
+
+/**
+ * The packed tree representation, for documents that are kept in memory long
+ * after parsing.  Nodes are stored in document order in one array and refer to
+ * each other by 32-bit index instead of by pointer; element-only and text-only
+ * data live in separate arrays so that each kind of node only pays for what it
+ * uses; positions are kept as byte offsets into the input; and strings are
+ * offsets into a single pool of null-terminated strings.  There are no child
+ * arrays: a node's first child, if it has any, is the node right after it, and
+ * each node links to its next sibling.
+ */
+
+/** An index meaning "no node" in a GumboPackedTree. */
+#define GUMBO_PACKED_NONE 0xffffffffu
+
+/** A node in a GumboPackedTree. */
+typedef struct _GumboPackedNode {
+  /** The index of the parent node, or GUMBO_PACKED_NONE for the document. */
+  uint32_t parent;
+
+  /** The index of the next sibling, or GUMBO_PACKED_NONE for a last child. */
+  uint32_t next_sibling;
+
+  /** The number of children.  The first child is always the next node. */
+  uint32_t child_count;
+
+  /**
+   * For elements, an index into GumboPackedTree.elements; for text, CDATA,
+   * comment and whitespace nodes, an index into GumboPackedTree.texts.  Unused
+   * for the document node.
+   */
+  uint32_t data;
+
+  /** The offset in the input of the start of the node. */
+  uint32_t offset;
+
+  /** The GumboParseFlags of the node. */
+  uint16_t parse_flags;
+
+  /** The GumboNodeType of the node. */
+  uint8_t type;
+} GumboPackedNode;
+
+/** The element-specific data of a node in a GumboPackedTree. */
+typedef struct _GumboPackedElement {
+  /** The index of the element's first attribute in attributes. */
+  uint32_t first_attribute;
+
+  /** The number of attributes, which follow each other in attributes. */
+  uint32_t attribute_count;
+
+  /**
+   * The length of the original start tag, which begins at the node's offset in
+   * the input, or 0 if the tag was implied.  As with GumboElement.original_tag,
+   * this is how to get at the name of a GUMBO_TAG_UNKNOWN element.
+   */
+  uint32_t original_tag_length;
+
+  /** The offset in the input of the start of the end tag. */
+  uint32_t end_offset;
+
+  /** The GumboTag of the element. */
+  uint16_t tag;
+
+  /** The GumboNamespaceEnum of the element. */
+  uint8_t tag_namespace;
+} GumboPackedElement;
+
+/** The contents of a text, CDATA, comment or whitespace node. */
+typedef struct _GumboPackedText {
+  /** The text, as an offset into GumboPackedTree.strings. */
+  uint32_t text;
+
+  /** The length of the text, in bytes. */
+  uint32_t length;
+} GumboPackedText;
+
+/** An attribute in a GumboPackedTree. */
+typedef struct _GumboPackedAttribute {
+  /** The name, as an offset into GumboPackedTree.strings. */
+  uint32_t name;
+
+  /** The value, as an offset into GumboPackedTree.strings. */
+  uint32_t value;
+
+  /** The length of the value, in bytes. */
+  uint32_t value_length;
+
+  /** The offset in the input of the start of the attribute's name. */
+  uint32_t offset;
+
+  /** The GumboAttributeAtom of the name. */
+  uint16_t atom;
+
+  /** The GumboAttributeNamespaceEnum of the attribute. */
+  uint8_t attr_namespace;
+} GumboPackedAttribute;
+
+/** A whole parse tree in packed form.  Node 0 is the document. */
+typedef struct _GumboPackedTree {
+  const GumboPackedNode* nodes;
+  uint32_t node_count;
+
+  const GumboPackedElement* elements;
+  uint32_t element_count;
+
+  const GumboPackedText* texts;
+  uint32_t text_count;
+
+  const GumboPackedAttribute* attributes;
+  uint32_t attribute_count;
+
+  /** The pool of null-terminated strings that the offsets above refer to. */
+  const char* strings;
+  uint32_t strings_length;
+
+  /** The index of the <html> node. */
+  uint32_t root;
+
+  /**
+   * The doctype, as in GumboDocument.  The name and identifiers are offsets
+   * into strings, and are empty strings if there was no doctype.
+   */
+  bool has_doctype;
+  uint32_t doctype_name;
+  uint32_t doctype_public_identifier;
+  uint32_t doctype_system_identifier;
+  GumboQuirksModeEnum doc_type_quirks_mode;
+
+  /** The GumboOutputStatus of the parse. */
+  GumboOutputStatus status;
+} GumboPackedTree;
+
+/**
+ * Converts a parse tree to packed form, in a single allocation.  output is
+ * unchanged and can be destroyed straight away.  Documents whose input is 4GB
+ * or more, or that would need 4GB or more of strings, aren't supported.
+ */
+GumboPackedTree* gumbo_pack_output(
+    const struct _GumboOptions* options, const GumboOutput* output);
+
+/** Frees a tree returned by gumbo_pack_output. */
+void gumbo_destroy_packed_tree(
+    const struct _GumboOptions* options, GumboPackedTree* tree);
+
+/**
+ * The version of the format written by gumbo_serialize_packed_tree.  Trees
+ * written with any other version are rejected when loaded.
+ */
+#define GUMBO_SERIALIZED_TREE_VERSION 1
+
+/**
+ * Writes a packed tree as one flat block of bytes, suitable for caching on
+ * disk: a header, then the tree's tables exactly as they are in memory, then
+ * its string pool.  If input isn't NULL, the input_length bytes it points to
+ * are stored too, so that the original tags and the names of unknown elements
+ * can still be recovered from the offsets in the tree.
+ *
+ * Returns the number of bytes needed.  Nothing is written unless size is at
+ * least that, so a first call with a NULL buffer can be used to size it.  The
+ * format is only meant to be read back on the same platform: a different
+ * byte order or struct layout is detected and rejected when loading.
+ */
+size_t gumbo_serialize_packed_tree(
+    const GumboPackedTree* tree, const char* input, size_t input_length,
+    void* buffer, size_t size);
+
+/**
+ * Loads a tree written by gumbo_serialize_packed_tree without copying it: the
+ * tables in tree point straight into data, which must stay alive and unchanged
+ * for as long as tree is used, and must be 4-byte aligned (as it is if it's
+ * from malloc or mmap).  If input and input_length aren't NULL, they're set to
+ * the stored input, or to NULL and 0 if there wasn't any.
+ *
+ * Every index and offset is checked before this returns, so a tree loaded from
+ * an untrusted file is safe to walk.  Returns false, leaving tree in an
+ * unspecified state, if the data is truncated, corrupt, from another version
+ * or from an incompatible platform.
+ */
+bool gumbo_deserialize_packed_tree(
+    const void* data, size_t size, GumboPackedTree* tree,
+    const char** input, size_t* input_length);
+
+/**
+ * Scratch state that can be reused across many parses, so that the parser's
+ * internal stacks and buffers keep the capacity they've grown to instead of
+ * being reallocated for every document.  Opaque; a context may only be used
+ * by one parse at a time, so give each thread its own.
+ */
+typedef struct _GumboParserContext GumboParserContext;
+
+/**
+ * Creates a new parser context.  Its memory comes from options' allocator,
+ * and every parse that uses it must have the same allocator and deallocator.
+ */
+GumboParserContext* gumbo_create_parser_context(const GumboOptions* options);
+
+/**
+ * Like gumbo_parse_with_options, but borrows the scratch state from context.
+ * The output doesn't depend on the context and is destroyed the usual way.
+ * Parses with collect_stats set don't reuse the context.
+ */
+struct _GumboOutput* gumbo_parse_with_context(
+    GumboParserContext* context, const GumboOptions* options,
+    const char* buffer, size_t buffer_length);
+
+/** Like gumbo_parse_fragment, but borrows the scratch state from context. */
+struct _GumboOutput* gumbo_parse_fragment_with_context(
+    GumboParserContext* context, const GumboOptions* options,
+    const char* buffer, size_t buffer_length, GumboTag context_tag,
+    GumboNamespaceEnum context_namespace);
+
+/** Releases a parser context and all the memory it has kept hold of. */
+void gumbo_destroy_parser_context(
+    const GumboOptions* options, GumboParserContext* context);
+
+/** The kinds of event delivered by gumbo_tokenize. */
+typedef enum _GumboTokenEventType {
+  GUMBO_TOKEN_EVENT_DOCTYPE,
+  GUMBO_TOKEN_EVENT_START_TAG,
+  GUMBO_TOKEN_EVENT_END_TAG,
+  GUMBO_TOKEN_EVENT_COMMENT,
+  GUMBO_TOKEN_EVENT_TEXT
+} GumboTokenEventType;
+
+/**
+ * A single event from the tokenizer-only API.  Everything reachable from this
+ * struct is owned by the tokenizer and is only valid for the duration of the
+ * callback; copy out anything you need to keep.
+ */
+typedef struct _GumboTokenEvent {
+  /** The kind of event. */
+  GumboTokenEventType type;
+
+  /** The source position of the start of the event. */
+  GumboSourcePosition position;
+
+  /**
+   * The original text of the event, pointing into the input buffer.  For text
+   * events this spans the whole run of characters.
+   */
+  GumboStringPiece original_text;
+
+  /**
+   * For start and end tags, the GumboTag enum of the tag, or GUMBO_TAG_UNKNOWN
+   * for tags that the library doesn't know about.  GUMBO_TAG_UNKNOWN for all
+   * other events.
+   */
+  GumboTag tag;
+
+  /**
+   * For start and end tags, the tag name as it appears in the source (ie. in
+   * its original case), pointing into the input buffer.  Empty otherwise.
+   */
+  GumboStringPiece tag_name;
+
+  /** For start tags, the GumboAttributes of the tag.  NULL otherwise. */
+  const GumboVector* /* GumboAttribute* */ attributes;
+
+  /** For start tags, whether the tag was written as self-closing. */
+  bool is_self_closing;
+
+  /**
+   * The decoded text for text and comment events, and the doctype name for
+   * doctype events.  Always null-terminated; text_length excludes the
+   * terminator.  Empty for tags.
+   */
+  const char* text;
+  size_t text_length;
+
+  /**
+   * For doctype events, the public and system identifiers, or empty strings if
+   * they were absent.  NULL for all other events.
+   */
+  const char* public_identifier;
+  const char* system_identifier;
+} GumboTokenEvent;
+
+/**
+ * The type for a tokenizer callback.  Return false to stop tokenizing; the
+ * remainder of the input is then skipped.
+ */
+typedef bool (*GumboTokenCallback)(
+    const GumboTokenEvent* event, void* userdata);
+
+/**
+ * Runs the HTML5 tokenizer over a buffer without building a parse tree,
+ * invoking callback for each token.  Consecutive character tokens are coalesced
+ * into a single text event, and the tokenizer switches into RCDATA, RAWTEXT,
+ * script data and PLAINTEXT after the corresponding start tags just as the tree
+ * builder would have it do, so the contents of <script>, <style>, <title> etc.
+ * come through as text.  This is considerably cheaper than gumbo_parse for
+ * consumers like link extraction or meta sniffing that only need the tokens.
+ *
+ * Returns true if the whole buffer was tokenized, false if the callback asked
+ * to stop early.
+ */
+bool gumbo_tokenize(const char* buffer, size_t buffer_length,
+                    GumboTokenCallback callback, void* userdata);
+
+/**
+ * Extended version of gumbo_tokenize that takes an explicit options structure.
+ * The userdata member of the options is passed to the allocators, while the
+ * userdata argument is passed to the callback.
+ */
+bool gumbo_tokenize_with_options(
+    const GumboOptions* options, const char* buffer, size_t buffer_length,
+    GumboTokenCallback callback, void* userdata);
+
+/**
+ * A compiled CSS selector, for gumbo_parse_matching.  Opaque.
+ *
+ * The supported syntax is a comma-separated list of complex selectors made of
+ * type selectors (div, *), id and class selectors (#main, .row), and attribute
+ * selectors ([href], [type=text], [class~=a], [lang|=en], [src^="http:"],
+ * [src$=".png"], [title*=x]), joined by the descendant (whitespace) and child
+ * (>) combinators.  Names are matched case-insensitively, ids, classes and
+ * attribute values case-sensitively.  Sibling combinators and pseudo-classes
+ * aren't supported, since whether they match depends on what comes after an
+ * element, and nor are escapes.
+ */
+typedef struct _GumboSelector GumboSelector;
+
+/**
+ * Compiles selector, allocating from options' allocator.  Returns NULL if the
+ * selector is malformed or uses anything unsupported.
+ */
+GumboSelector* gumbo_compile_selector(
+    const GumboOptions* options, const char* selector);
+
+/** Releases a selector made by gumbo_compile_selector. */
+void gumbo_destroy_selector(
+    const GumboOptions* options, GumboSelector* selector);
+
+/**
+ * Returns true if node is an element that selector matches, given its place
+ * in the tree.  This works on any tree, not just during gumbo_parse_matching.
+ */
+bool gumbo_selector_matches(
+    const GumboSelector* selector, const GumboNode* node);
+
+/**
+ * The type for a gumbo_parse_matching callback.  element and its subtree are
+ * only valid for the duration of the callback; copy out anything you need to
+ * keep.  Return false to stop the parse.
+ */
+typedef bool (*GumboMatchCallback)(GumboNode* element, void* userdata);
+
+/**
+ * Parses a buffer the way gumbo_parse_with_options does, but only keeps the
+ * parts of the tree that selector matches, so that extracting a few elements
+ * from a huge document doesn't need memory for all of it.
+ *
+ * Whether an element matches is decided when it's inserted into the tree,
+ * against its ancestors at that point; elements that the tree builder moves
+ * about afterwards (as it does with misnested formatting elements) keep the
+ * verdict.  Once a matching element is closed and everything in it is
+ * finished, callback is called with it.  A match inside another match is
+ * delivered first, and then again as part of the outer one.
+ *
+ * Whenever there's no matching element still to be delivered, the nodes that
+ * are finished are freed as the parse goes, except for a few that the tree
+ * builder may still need (such as the <head> and entries in the list of active
+ * formatting elements), which are set aside until it's done with them.  So
+ * the memory used is roughly proportional to the depth of the document plus
+ * the size of the largest match, rather than the size of the document.
+ *
+ * The output holds whatever is left of the tree at the end, which is usually
+ * little more than the document node and the <html> root; it must still be
+ * destroyed as usual.  If callback asks to stop, the rest of the input is
+ * skipped and the output's status is GUMBO_STATUS_CANCELLED.
+ */
+struct _GumboOutput* gumbo_parse_matching(
+    const GumboOptions* options, const char* buffer, size_t buffer_length,
+    const GumboSelector* selector, GumboMatchCallback callback,
+    void* userdata);
+
 
 #ifdef __cplusplus
 }
@@ -26,8 +26,10 @@
 #include "gumbo.h"
 #include "insertion_mode.h"
 #include "parser.h"
+#include "profile.h"
 #include "tokenizer.h"
 #include "tokenizer_states.h"
+#include "trace.h"
 #include "utf8.h"
 #include "util.h"
 #include "vector.h"
@@ -46,6 +48,10 @@ static void free_wrapper(void* unused, void* ptr) {
   return free(ptr);
 }
 
+static void* realloc_wrapper(void* unused, void* ptr, size_t size) {
+  return realloc(ptr, size);
+}
+
 const GumboOptions kGumboDefaultOptions = {
   &malloc_wrapper,
   &free_wrapper,
@@ -53,8 +59,43 @@ const GumboOptions kGumboDefaultOptions = {
   8,
   false,
   -1,
+  -1,
+  -1,
+  0,
+  -1,
+  NULL,
+  false,
+  false,
+  &realloc_wrapper,
+};
+
+// How many tokens to process between checks of the time budget and the
+// cancellation function, which are too expensive to poll on every token.
+static const int kSlowLimitCheckInterval = 256;
+
+// Attribute vectors at least this long are compared through a hash index
+// rather than by looking up each attribute with a linear search.
+static const int kAttributeIndexThreshold = 16;
+
+// The bits of GumboElement._match_flags, used by gumbo_parse_matching.
+enum {
+  // The selector has been tried against the element.
+  MATCH_FLAG_EVALUATED = 1 << 0,
+  // ...and matched it.
+  MATCH_FLAG_MATCHES = 1 << 1,
+  // The element has been passed to the match callback.
+  MATCH_FLAG_REPORTED = 1 << 2,
+  // The element has left the stack of open elements and is waiting in
+  // _unfinished_elements or _finished_elements for the next safe point.
+  MATCH_FLAG_FINISHING = 1 << 3,
+  // The element has been detached from the tree and is in _parked_nodes.
+  MATCH_FLAG_PARKED = 1 << 4
 };
 
+// The number of parked nodes that triggers the first sweep for ones that can
+// be freed.  Each sweep doubles it for the next, relative to what's left.
+static const unsigned int kParkedSweepThreshold = 64;
+
 static const GumboStringPiece kDoctypeHtml = GUMBO_STRING("html");
 static const GumboStringPiece kPublicIdHtml4_0 = GUMBO_STRING(
     "-//W3C//DTD HTML 4.0//EN");
@@ -340,6 +381,23 @@ typedef struct _TextNodeBufferState {
   GumboNodeType _type;
 } TextNodeBufferState;
 
+// An element that has left the stack of open elements, along with the index it
+// had there.  It's finished, along with everything in it, once the elements
+// that were above it have left the stack too, which is to say once the stack
+// has been no longer than that index.  That's straight away for the current
+// node, but not for one removed from further down.  The index is kept up to
+// date as elements below it are inserted and removed.
+typedef struct {
+  GumboNode* node;
+  unsigned int index;
+} FinishedElement;
+
+typedef struct {
+  FinishedElement* data;
+  unsigned int length;
+  unsigned int capacity;
+} FinishedElementList;
+
 typedef struct _GumboParserState {
   // http://www.whatwg.org/specs/web-apps/current-work/complete/parsing.html#insertion-mode
   GumboInsertionMode _insertion_mode;
@@ -351,13 +409,28 @@ typedef struct _GumboParserState {
   // http://www.whatwg.org/specs/web-apps/current-work/complete/parsing.html#the-stack-of-open-elements
   GumboVector /*GumboNode*/ _open_elements;
 
+  // The number of elements in _open_elements with each tag, so that the scope
+  // checks for a tag that isn't open don't have to walk the whole stack.
+  unsigned int _open_tag_counts[GUMBO_TAG_LAST];
+
   // http://www.whatwg.org/specs/web-apps/current-work/complete/parsing.html#the-list-of-active-formatting-elements
   GumboVector /*GumboNode*/ _active_formatting_elements;
 
+  // The number of entries in _active_formatting_elements with each tag, so
+  // that looking for a tag that isn't in the list doesn't have to scan it.
+  unsigned int _formatting_tag_counts[GUMBO_TAG_LAST];
+
   // http://www.whatwg.org/specs/web-apps/current-work/complete/parsing.html#the-element-pointers
   GumboNode* _head_element;
   GumboNode* _form_element;
 
+  // The context element when parsing a fragment, or NULL for a whole
+  // document.  It's never part of the tree; it only stands in for the bottom
+  // of the stack of open elements when resetting the insertion mode and when
+  // finding the adjusted current node.
+  // http://www.whatwg.org/specs/web-apps/current-work/multipage/the-end.html#fragment-case
+  GumboNode* _fragment_context;
+
   // The flag for when the spec says "Reprocess the current token in..."
   bool _reprocess_current_token;
 
@@ -394,42 +467,108 @@ typedef struct _GumboParserState {
   // flag appropriately.
   bool _closed_body_tag;
   bool _closed_html_tag;
+
+  // The number of nodes created so far, for GumboOptions.max_nodes.
+  unsigned int _node_count;
+
+  // The length of the input, and whether the error__limit tracepoint has
+  // fired yet; only used by the tracepoints in trace.h.
+  size_t _input_length;
+  bool _traced_error_limit;
+
+  // Scratch index for comparing long attribute vectors.
+  GumboAttributeIndex _attribute_index;
+
+  // The selector, callback and userdata of a gumbo_parse_matching parse; all
+  // NULL otherwise.
+  const GumboSelector* _selector;
+  GumboMatchCallback _match_callback;
+  void* _match_userdata;
+
+  // Set once the match callback has asked for the parse to stop.
+  bool _match_stopped;
+
+  // The number of elements that the selector matched that haven't been
+  // passed to the callback yet.  Nothing is freed while this is non-zero.
+  unsigned int _unreported_matches;
+
+  // The elements that have finished since the last safe point, innermost
+  // first.  See process_finished_elements.
+  FinishedElementList _finished_elements;
+  // The elements that have left the stack of open elements but aren't
+  // finished yet, sorted by index, so the ones that a pop finishes are always
+  // at the end.
+  FinishedElementList _unfinished_elements;
+
+  // Finished nodes that the tree builder may still refer to, and which have
+  // been detached from a subtree that was freed.  They're freed themselves
+  // once nothing refers to them, or at the end of the parse.
+  GumboVector /*GumboNode*/ _parked_nodes;
+  unsigned int _parked_sweep_threshold;
 } GumboParserState;
 
-static bool token_has_attribute(const GumboToken* token, const char* name) {
+static bool token_has_attribute(
+    const GumboToken* token, GumboAttributeAtom atom) {
   assert(token->type == GUMBO_TOKEN_START_TAG);
-  return gumbo_get_attribute(&token->v.start_tag.attributes, name) != NULL;
+  return gumbo_get_attribute_by_atom(
+      &token->v.start_tag.attributes, atom) != NULL;
 }
 
 // Checks if the value of the specified attribute is a case-insensitive match
 // for the specified string.
 static bool attribute_matches(
-    const GumboVector* attributes, const char* name, const char* value) {
-  const GumboAttribute* attr = gumbo_get_attribute(attributes, name);
-  return attr ? strcasecmp(value, attr->value) == 0 : false;
+    const GumboVector* attributes, GumboAttributeAtom atom,
+    const char* value) {
+  const GumboAttribute* attr = gumbo_get_attribute_by_atom(attributes, atom);
+  return attr && strlen(value) == attr->value_length &&
+      strncasecmp(value, attr->value, attr->value_length) == 0;
 }
 
 // Checks if the value of the specified attribute is a case-sensitive match
 // for the specified string.
 static bool attribute_matches_case_sensitive(
-    const GumboVector* attributes, const char* name, const char* value) {
-  const GumboAttribute* attr = gumbo_get_attribute(attributes, name);
-  return attr ?  strcmp(value, attr->value) == 0 : false;
+    const GumboVector* attributes, GumboAttributeAtom atom,
+    const char* value) {
+  const GumboAttribute* attr = gumbo_get_attribute_by_atom(attributes, atom);
+  return attr && strlen(value) == attr->value_length &&
+      memcmp(value, attr->value, attr->value_length) == 0;
 }
 
-// Checks if the specified attribute vectors are identical.
+// Returns the attribute in attributes with the same name as attr, if any.  Long
+// vectors are searched through the parser's attribute index, which the caller
+// must have cleared if it was last used with a different vector.
+static GumboAttribute* get_same_attribute(
+    GumboParser* parser, const GumboVector* attributes,
+    const GumboAttribute* attr) {
+  if (attributes->length >= kAttributeIndexThreshold) {
+    int position = gumbo_attribute_index_find(
+        parser, &parser->_parser_state->_attribute_index, attributes,
+        attr->name, strlen(attr->name));
+    return position < 0 ? NULL : attributes->data[position];
+  }
+  return attr->atom == GUMBO_ATTR_UNKNOWN ?
+      gumbo_get_attribute(attributes, attr->name) :
+      gumbo_get_attribute_by_atom(attributes, attr->atom);
+}
+
+// Checks if the specified attribute vectors are identical.  Uses the parser's
+// attribute index for attr2; see get_same_attribute.
 static bool all_attributes_match(
-    const GumboVector* attr1, const GumboVector* attr2) {
-  int num_unmatched_attr2_elements = attr2->length;
+    GumboParser* parser, const GumboVector* attr1, const GumboVector* attr2) {
+  // Names are unique within each vector, so this is implied by the loop below,
+  // but much cheaper.
+  if (attr1->length != attr2->length) {
+    return false;
+  }
   for (int i = 0; i < attr1->length; ++i) {
     const GumboAttribute* attr = attr1->data[i];
-    if (attribute_matches_case_sensitive(attr2, attr->name, attr->value)) {
-      --num_unmatched_attr2_elements;
-    } else {
+    const GumboAttribute* other = get_same_attribute(parser, attr2, attr);
+    if (!other || other->value_length != attr->value_length ||
+        memcmp(other->value, attr->value, attr->value_length) != 0) {
       return false;
     }
   }
-  return num_unmatched_attr2_elements == 0;
+  return true;
 }
 
 static void set_frameset_not_ok(GumboParser* parser) {
@@ -437,8 +576,42 @@ static void set_frameset_not_ok(GumboParser* parser) {
   parser->_parser_state->_frameset_ok = false;
 }
 
+// Most elements have only a few children and attributes, so element nodes are
+// allocated with room for that many straight after the node, and only elements
+// that outgrow it need separately allocated arrays.
+enum {
+  kInlineChildren = 3,
+  kInlineAttributes = 2
+};
+
+typedef struct _ElementNode {
+  GumboNode node;
+  void* children[kInlineChildren];
+  void* attributes[kInlineAttributes];
+} ElementNode;
+
+// Points the children of an element node at its inline slots.  The vector
+// must be empty, or have been moved elsewhere.
+static void init_inline_children(GumboNode* node) {
+  assert(node->type == GUMBO_NODE_ELEMENT);
+  gumbo_vector_init_inline(((ElementNode*) node)->children, kInlineChildren,
+                           &node->v.element.children);
+}
+
+static void init_inline_attributes(GumboNode* node) {
+  assert(node->type == GUMBO_NODE_ELEMENT);
+  gumbo_vector_init_inline(((ElementNode*) node)->attributes,
+                           kInlineAttributes, &node->v.element.attributes);
+}
+
 static GumboNode* create_node(GumboParser* parser, GumboNodeType type) {
-  GumboNode* node = gumbo_parser_allocate(parser, sizeof(GumboNode));
+  GumboNode* node = gumbo_parser_allocate(parser,
+      type == GUMBO_NODE_ELEMENT ? sizeof(ElementNode) : sizeof(GumboNode),
+      GUMBO_ALLOCATION_NODE);
+  ++parser->_parser_state->_node_count;
+  if (parser->_stats) {
+    ++parser->_stats->nodes[type];
+  }
   node->parent = NULL;
   node->index_within_parent = -1;
   node->type = type;
@@ -463,31 +636,70 @@ static GumboNode* new_document_node(GumboParser* parser) {
 }
 
 static void output_init(GumboParser* parser) {
-  GumboOutput* output = gumbo_parser_allocate(parser, sizeof(GumboOutput));
+  GumboOutput* output = gumbo_parser_allocate(
+      parser, sizeof(GumboOutput), GUMBO_ALLOCATION_OTHER);
   output->root = NULL;
+  output->status = GUMBO_STATUS_OK;
+  output->node_count = 0;
+  output->is_compact = false;
+  output->stats = NULL;
+  output->profile = NULL;
   output->document = new_document_node(parser);
   parser->_output = output;
   gumbo_init_errors(parser);
 }
 
-static void parser_state_init(GumboParser* parser) {
-  GumboParserState* parser_state =
-      gumbo_parser_allocate(parser, sizeof(GumboParserState));
+// Returns the parser state to how parser_state_init left it, keeping the
+// capacity of its vectors and buffers.
+static void parser_state_reset(GumboParser* parser) {
+  GumboParserState* parser_state = parser->_parser_state;
   parser_state->_insertion_mode = GUMBO_INSERTION_MODE_INITIAL;
   parser_state->_reprocess_current_token = false;
   parser_state->_frameset_ok = true;
   parser_state->_ignore_next_linefeed = false;
   parser_state->_foster_parent_insertions = false;
   parser_state->_text_node._type = GUMBO_NODE_WHITESPACE;
-  gumbo_string_buffer_init(parser, &parser_state->_text_node._buffer);
-  gumbo_vector_init(parser, 10, &parser_state->_open_elements);
-  gumbo_vector_init(parser, 5, &parser_state->_active_formatting_elements);
+  gumbo_string_buffer_clear(parser, &parser_state->_text_node._buffer);
+  parser_state->_open_elements.length = 0;
+  memset(parser_state->_open_tag_counts, 0,
+         sizeof(parser_state->_open_tag_counts));
+  parser_state->_active_formatting_elements.length = 0;
+  memset(parser_state->_formatting_tag_counts, 0,
+         sizeof(parser_state->_formatting_tag_counts));
   parser_state->_head_element = NULL;
   parser_state->_form_element = NULL;
+  parser_state->_fragment_context = NULL;
   parser_state->_current_token = NULL;
   parser_state->_closed_body_tag = false;
   parser_state->_closed_html_tag = false;
+  parser_state->_node_count = 0;
+  parser_state->_traced_error_limit = false;
+  parser_state->_selector = NULL;
+  parser_state->_match_callback = NULL;
+  parser_state->_match_userdata = NULL;
+  parser_state->_match_stopped = false;
+  parser_state->_unreported_matches = 0;
+  parser_state->_finished_elements.length = 0;
+  parser_state->_unfinished_elements.length = 0;
+  parser_state->_parked_nodes.length = 0;
+  parser_state->_parked_sweep_threshold = kParkedSweepThreshold;
+}
+
+static void parser_state_init(GumboParser* parser) {
+  GumboParserState* parser_state =
+      gumbo_parser_allocate(parser, sizeof(GumboParserState),
+                            GUMBO_ALLOCATION_OTHER);
+  gumbo_string_buffer_init(parser, &parser_state->_text_node._buffer);
+  gumbo_vector_init(parser, 10, &parser_state->_open_elements);
+  gumbo_vector_init(parser, 5, &parser_state->_active_formatting_elements);
+  gumbo_attribute_index_init(&parser_state->_attribute_index);
+  parser_state->_finished_elements.data = NULL;
+  parser_state->_finished_elements.capacity = 0;
+  parser_state->_unfinished_elements.data = NULL;
+  parser_state->_unfinished_elements.capacity = 0;
+  gumbo_vector_init(parser, 0, &parser_state->_parked_nodes);
   parser->_parser_state = parser_state;
+  parser_state_reset(parser);
 }
 
 static void parser_state_destroy(GumboParser* parser) {
@@ -495,6 +707,10 @@ static void parser_state_destroy(GumboParser* parser) {
   gumbo_vector_destroy(parser, &state->_active_formatting_elements);
   gumbo_vector_destroy(parser, &state->_open_elements);
   gumbo_string_buffer_destroy(parser, &state->_text_node._buffer);
+  gumbo_attribute_index_destroy(parser, &state->_attribute_index);
+  gumbo_parser_deallocate(parser, state->_finished_elements.data);
+  gumbo_parser_deallocate(parser, state->_unfinished_elements.data);
+  gumbo_vector_destroy(parser, &state->_parked_nodes);
   gumbo_parser_deallocate(parser, state);
 }
 
@@ -515,6 +731,145 @@ static GumboNode* get_current_node(GumboParser* parser) {
   return open_elements->data[open_elements->length - 1];
 }
 
+// The stack of open elements is only modified through these functions (and
+// pop_current_node), which keep each element's _is_open flag and the
+// _open_tag_counts in sync so is_open_element is O(1).
+static void push_open_element(GumboParser* parser, GumboNode* node) {
+  assert(node->type == GUMBO_NODE_ELEMENT);
+  node->v.element._is_open = true;
+  ++parser->_parser_state->_open_tag_counts[node->v.element.tag];
+  gumbo_vector_add(parser, node, &parser->_parser_state->_open_elements);
+}
+
+static void insert_open_element_at(
+    GumboParser* parser, GumboNode* node, int index) {
+  assert(node->type == GUMBO_NODE_ELEMENT);
+  assert(!node->v.element._is_open);
+  node->v.element._is_open = true;
+  ++parser->_parser_state->_open_tag_counts[node->v.element.tag];
+  gumbo_vector_insert_at(
+      parser, node, index, &parser->_parser_state->_open_elements);
+  // Everything that was at or above index has moved up a slot.
+  FinishedElementList* unfinished =
+      &parser->_parser_state->_unfinished_elements;
+  for (unsigned int i = unfinished->length;
+       i > 0 && unfinished->data[i - 1].index >= (unsigned int) index; --i) {
+    ++unfinished->data[i - 1].index;
+  }
+}
+
+// Makes room for one more entry at position in list, moving the ones from
+// there on up a slot, and returns it.
+static FinishedElement* insert_finished_element(
+    GumboParser* parser, FinishedElementList* list, unsigned int position) {
+  assert(position <= list->length);
+  if (list->length == list->capacity) {
+    unsigned int capacity = list->capacity ? list->capacity * 2 : 16;
+    list->data = gumbo_parser_reallocate(parser, list->data,
+        sizeof(FinishedElement) * list->capacity,
+        sizeof(FinishedElement) * capacity, GUMBO_ALLOCATION_OTHER);
+    list->capacity = capacity;
+  }
+  memmove(&list->data[position + 1], &list->data[position],
+          sizeof(FinishedElement) * (list->length - position));
+  ++list->length;
+  return &list->data[position];
+}
+
+// In a gumbo_parse_matching parse, notes that node has just left the stack of
+// open elements from index, so that it's looked at again at the next safe
+// point once it's finished.  Each element passes through _unfinished_elements
+// at most once, so this is amortized O(1) unless elements keep being removed
+// from under ones that are waiting there.
+static void record_finished_element(
+    GumboParser* parser, GumboNode* node, unsigned int index) {
+  GumboParserState* state = parser->_parser_state;
+  if (!state->_selector) {
+    return;
+  }
+  // If it's already waiting, it was put back on the stack and removed again
+  // before a safe point.
+  bool waiting = node->v.element._match_flags & MATCH_FLAG_FINISHING;
+  node->v.element._match_flags |= MATCH_FLAG_FINISHING;
+  unsigned int stack_length = state->_open_elements.length;
+  FinishedElementList* unfinished = &state->_unfinished_elements;
+  if (index < stack_length) {
+    // Removed from below the current node: everything above it has moved down
+    // a slot.  It goes in below the entries that were above it.
+    unsigned int position = unfinished->length;
+    for (; position > 0 && unfinished->data[position - 1].index > index;
+         --position) {
+      --unfinished->data[position - 1].index;
+    }
+    if (!waiting) {
+      FinishedElement* entry =
+          insert_finished_element(parser, unfinished, position);
+      entry->node = node;
+      entry->index = index;
+    }
+    return;
+  }
+  FinishedElementList* finished = &state->_finished_elements;
+  if (!waiting) {
+    FinishedElement* entry =
+        insert_finished_element(parser, finished, finished->length);
+    entry->node = node;
+    entry->index = index;
+  }
+  // The pop may also have finished elements that were removed from below it.
+  while (unfinished->length > 0 &&
+         unfinished->data[unfinished->length - 1].index >= stack_length) {
+    *insert_finished_element(parser, finished, finished->length) =
+        unfinished->data[--unfinished->length];
+  }
+}
+
+static GumboNode* remove_open_element_at(GumboParser* parser, int index) {
+  GumboNode* node = gumbo_vector_remove_at(
+      parser, index, &parser->_parser_state->_open_elements);
+  assert(node->v.element._is_open);
+  node->v.element._is_open = false;
+  assert(parser->_parser_state->_open_tag_counts[node->v.element.tag] > 0);
+  --parser->_parser_state->_open_tag_counts[node->v.element.tag];
+  record_finished_element(parser, node, index);
+  return node;
+}
+
+// http://www.whatwg.org/specs/web-apps/current-work/multipage/parsing.html#adjusted-current-node
+// The current node, except that it's the context element while a fragment
+// parse has nothing but the <html> element open.
+static GumboNode* get_adjusted_current_node(GumboParser* parser) {
+  GumboParserState* state = parser->_parser_state;
+  if (state->_fragment_context && state->_open_elements.length == 1) {
+    return state->_fragment_context;
+  }
+  return get_current_node(parser);
+}
+
+// Returns the index of node in the stack of open elements, or -1.  Searches
+// from the top of the stack, where the parser's nodes of interest usually are.
+static int get_open_element_index(GumboParser* parser, const GumboNode* node) {
+  assert(node->type == GUMBO_NODE_ELEMENT);
+  if (!node->v.element._is_open) {
+    return -1;
+  }
+  GumboVector* open_elements = &parser->_parser_state->_open_elements;
+  for (int i = open_elements->length - 1; i >= 0; --i) {
+    if (open_elements->data[i] == node) {
+      return i;
+    }
+  }
+  assert(0);
+  return -1;
+}
+
+static void remove_open_element(GumboParser* parser, GumboNode* node) {
+  int index = get_open_element_index(parser, node);
+  if (index != -1) {
+    remove_open_element_at(parser, index);
+  }
+}
+
 // Returns true if the given needle is in the given array of literal
 // GumboStringPieces.  If exact_match is true, this requires that they match
 // exactly; otherwise, this performs a prefix match to check if any of the
@@ -532,7 +887,9 @@ static bool is_in_static_list(
 }
 
 static void set_insertion_mode(GumboParser* parser, GumboInsertionMode mode) {
-  parser->_parser_state->_insertion_mode = mode;
+  GumboParserState* state = parser->_parser_state;
+  state->_insertion_mode = mode;
+  GUMBO_TRACE3(insertion__mode, state->_input_length, state->_node_count, mode);
 }
 
 // http://www.whatwg.org/specs/web-apps/current-work/complete/parsing.html#reset-the-insertion-mode-appropriately
@@ -543,6 +900,12 @@ static void set_insertion_mode(GumboParser* parser, GumboInsertionMode mode) {
 static GumboInsertionMode get_appropriate_insertion_mode(
     const GumboNode* node, bool is_last) {
   assert(node->type == GUMBO_NODE_ELEMENT);
+  // Only HTML elements count: an SVG <title> or a fragment's MathML context
+  // element named <tr> says nothing about the insertion mode.
+  if (node->v.element.tag_namespace != GUMBO_NAMESPACE_HTML) {
+    return is_last ?
+        GUMBO_INSERTION_MODE_IN_BODY : GUMBO_INSERTION_MODE_INITIAL;
+  }
   switch (node->v.element.tag) {
     case GUMBO_TAG_SELECT:
       return GUMBO_INSERTION_MODE_IN_SELECT;
@@ -575,12 +938,17 @@ static GumboInsertionMode get_appropriate_insertion_mode(
   }
 }
 
-// This performs the actual "reset the insertion mode" loop.
+// This performs the actual "reset the insertion mode" loop.  When parsing a
+// fragment, the last node looked at is the context element rather than <html>.
 static void reset_insertion_mode_appropriately(GumboParser* parser) {
-  const GumboVector* open_elements = &parser->_parser_state->_open_elements;
+  const GumboParserState* state = parser->_parser_state;
+  const GumboVector* open_elements = &state->_open_elements;
   for (int i = open_elements->length - 1; i >= 0; --i) {
-    GumboInsertionMode mode =
-        get_appropriate_insertion_mode(open_elements->data[i], i == 0);
+    const GumboNode* node = open_elements->data[i];
+    if (i == 0 && state->_fragment_context) {
+      node = state->_fragment_context;
+    }
+    GumboInsertionMode mode = get_appropriate_insertion_mode(node, i == 0);
     if (mode != GUMBO_INSERTION_MODE_INITIAL) {
       set_insertion_mode(parser, mode);
       return;
@@ -708,9 +1076,9 @@ static bool is_html_integration_point(const GumboNode* node) {
       node->v.element.tag_namespace == GUMBO_NAMESPACE_SVG) ||
       (node_tag_is(node, GUMBO_TAG_ANNOTATION_XML) && (
           attribute_matches(&node->v.element.attributes,
-                            "encoding", "text/html") ||
+                            GUMBO_ATTR_ENCODING, "text/html") ||
           attribute_matches(&node->v.element.attributes,
-                            "encoding", "application/xhtml+xml")));
+                            GUMBO_ATTR_ENCODING, "application/xhtml+xml")));
 }
 
 // Appends a node to the end of its parent, setting the "parent" and
@@ -756,13 +1124,18 @@ static void insert_node(
 // http://www.whatwg.org/specs/web-apps/current-work/complete/tokenization.html#foster-parenting
 static void foster_parent_element(GumboParser* parser, GumboNode* node) {
   GumboVector* open_elements = &parser->_parser_state->_open_elements;
-  assert(open_elements->length > 2);
+  assert(open_elements->length >= 2);
 
   node->parse_flags |= GUMBO_INSERTION_FOSTER_PARENTED;
+  if (parser->_stats) {
+    ++parser->_stats->foster_parent_insertions;
+  }
   GumboNode* foster_parent_element = open_elements->data[0];
   assert(foster_parent_element->type == GUMBO_NODE_ELEMENT);
   assert(node_tag_is(foster_parent_element, GUMBO_TAG_HTML));
-  for (int i = open_elements->length - 1; i > 1; --i) {
+  // In a fragment the table can be right above <html>; in a document there's
+  // always a <body> in between.
+  for (int i = open_elements->length - 1; i > 0; --i) {
     GumboNode* table_element = open_elements->data[i];
     if (node_tag_is(table_element, GUMBO_TAG_TABLE)) {
       foster_parent_element = table_element->parent;
@@ -787,7 +1160,7 @@ static void foster_parent_element(GumboParser* parser, GumboNode* node) {
     }
   }
   if (node->type == GUMBO_NODE_ELEMENT) {
-    gumbo_vector_add(parser, (void*) node, open_elements);
+    push_open_element(parser, node);
   }
   append_node(parser, foster_parent_element, node);
 }
@@ -803,12 +1176,23 @@ static void maybe_flush_text_node_buffer(GumboParser* parser) {
          buffer_state->_type == GUMBO_NODE_TEXT);
   GumboNode* text_node = create_node(parser, buffer_state->_type);
   GumboText* text_node_data = &text_node->v.text;
-  text_node_data->text = gumbo_string_buffer_to_string(
-      parser, &buffer_state->_buffer);
   text_node_data->original_text.data = buffer_state->_start_original_text;
   text_node_data->original_text.length =
       state->_current_token->original_text.data -
       buffer_state->_start_original_text;
+  text_node_data->text_length = buffer_state->_buffer.length;
+  if (parser->_options->borrow_input_strings &&
+      text_node_data->original_text.length == buffer_state->_buffer.length &&
+      memcmp(text_node_data->original_text.data, buffer_state->_buffer.data,
+             buffer_state->_buffer.length) == 0) {
+    // Nothing was decoded or dropped, so the source text will do as it is.
+    text_node_data->text = text_node_data->original_text.data;
+    text_node_data->text_ownership = GUMBO_STRING_BORROWED;
+  } else {
+    text_node_data->text = gumbo_string_buffer_to_string(
+        parser, &buffer_state->_buffer);
+    text_node_data->text_ownership = GUMBO_STRING_OWNED;
+  }
   text_node_data->start_pos = buffer_state->_start_position;
   if (state->_foster_parent_insertions && node_tag_in(
       get_current_node(parser), GUMBO_TAG_TABLE, GUMBO_TAG_TBODY,
@@ -822,8 +1206,7 @@ static void maybe_flush_text_node_buffer(GumboParser* parser) {
   gumbo_debug("Flushing text node buffer of %.*s.\n",
              (int) buffer_state->_buffer.length, buffer_state->_buffer.data);
 
-  gumbo_string_buffer_destroy(parser, &buffer_state->_buffer);
-  gumbo_string_buffer_init(parser, &buffer_state->_buffer);
+  gumbo_string_buffer_clear(parser, &buffer_state->_buffer);
   buffer_state->_type = GUMBO_NODE_WHITESPACE;
   assert(buffer_state->_buffer.length == 0);
 }
@@ -851,6 +1234,11 @@ static GumboNode* pop_current_node(GumboParser* parser) {
     return NULL;
   }
   assert(current_node->type == GUMBO_NODE_ELEMENT);
+  current_node->v.element._is_open = false;
+  assert(state->_open_tag_counts[current_node->v.element.tag] > 0);
+  --state->_open_tag_counts[current_node->v.element.tag];
+  record_finished_element(
+      parser, current_node, state->_open_elements.length);
   bool is_closed_body_or_html_tag =
       (node_tag_is(current_node, GUMBO_TAG_BODY) && state->_closed_body_tag) ||
       (node_tag_is(current_node, GUMBO_TAG_HTML) && state->_closed_html_tag);
@@ -872,6 +1260,8 @@ static void append_comment_node(
   comment->type = GUMBO_NODE_COMMENT;
   comment->parse_flags = GUMBO_INSERTION_NORMAL;
   comment->v.text.text = token->v.text;
+  comment->v.text.text_length = strlen(token->v.text);
+  comment->v.text.text_ownership = GUMBO_STRING_OWNED;
   comment->v.text.original_text = token->original_text;
   comment->v.text.start_pos = token->position;
   append_node(parser, node, comment);
@@ -906,14 +1296,17 @@ void clear_stack_to_table_body_context(GumboParser* parser) {
 static GumboNode* create_element(GumboParser* parser, GumboTag tag) {
   GumboNode* node = create_node(parser, GUMBO_NODE_ELEMENT);
   GumboElement* element = &node->v.element;
-  gumbo_vector_init(parser, 1, &element->children);
-  gumbo_vector_init(parser, 0, &element->attributes);
+  init_inline_children(node);
+  init_inline_attributes(node);
   element->tag = tag;
   element->tag_namespace = GUMBO_NAMESPACE_HTML;
   element->original_tag = kGumboEmptyString;
   element->original_end_tag = kGumboEmptyString;
   element->start_pos = parser->_parser_state->_current_token->position;
   element->end_pos = kGumboEmptySourcePosition;
+  element->_is_open = false;
+  element->_match_flags = 0;
+  element->_attribute_hash = 0;
   return node;
 }
 
@@ -925,8 +1318,14 @@ static GumboNode* create_element_from_token(
 
   GumboNode* node = create_node(parser, GUMBO_NODE_ELEMENT);
   GumboElement* element = &node->v.element;
-  gumbo_vector_init(parser, 1, &element->children);
-  element->attributes = start_tag->attributes;
+  init_inline_children(node);
+  // Take over the token's attributes, unless there aren't any, in which case
+  // the tokenizer won't have allocated anything for them.
+  if (start_tag->attributes.capacity > 0) {
+    element->attributes = start_tag->attributes;
+  } else {
+    init_inline_attributes(node);
+  }
   element->tag = start_tag->tag;
   element->tag_namespace = tag_namespace;
 
@@ -937,6 +1336,9 @@ static GumboNode* create_element_from_token(
   element->start_pos = token->position;
   element->original_end_tag = kGumboEmptyString;
   element->end_pos = kGumboEmptySourcePosition;
+  element->_is_open = false;
+  element->_match_flags = 0;
+  element->_attribute_hash = 0;
 
   // The element takes ownership of the attributes from the token, so any
   // allocated-memory fields should be nulled out.
@@ -944,6 +1346,22 @@ static GumboNode* create_element_from_token(
   return node;
 }
 
+// In a gumbo_parse_matching parse, tries the selector against a newly
+// inserted element.  This is the only time it's tried, so node's ancestors
+// must be in place.
+static void evaluate_match(GumboParser* parser, GumboNode* node) {
+  GumboParserState* state = parser->_parser_state;
+  GumboElement* element = &node->v.element;
+  if (!state->_selector || (element->_match_flags & MATCH_FLAG_EVALUATED)) {
+    return;
+  }
+  element->_match_flags |= MATCH_FLAG_EVALUATED;
+  if (gumbo_selector_matches(state->_selector, node)) {
+    element->_match_flags |= MATCH_FLAG_MATCHES;
+    ++state->_unreported_matches;
+  }
+}
+
 // http://www.whatwg.org/specs/web-apps/current-work/complete/tokenization.html#insert-an-html-element
 static void insert_element(GumboParser* parser, GumboNode* node,
                            bool is_reconstructing_formatting_elements) {
@@ -964,17 +1382,20 @@ static void insert_element(GumboParser* parser, GumboNode* node,
       get_current_node(parser), GUMBO_TAG_TABLE, GUMBO_TAG_TBODY,
       GUMBO_TAG_TFOOT, GUMBO_TAG_THEAD, GUMBO_TAG_TR, GUMBO_TAG_LAST)) {
     foster_parent_element(parser, node);
-    gumbo_vector_add(parser, (void*) node, &state->_open_elements);
-    return;
+  } else {
+    // This is called to insert the root HTML element, but get_current_node
+    // assumes the stack of open elements is non-empty, so we need special
+    // handling for this case.
+    append_node(
+        parser, parser->_output->root ?
+        get_current_node(parser) : parser->_output->document, node);
+  }
+  evaluate_match(parser, node);
+  push_open_element(parser, node);
+  if (parser->_stats &&
+      state->_open_elements.length > parser->_stats->max_tree_depth) {
+    parser->_stats->max_tree_depth = state->_open_elements.length;
   }
-
-  // This is called to insert the root HTML element, but get_current_node
-  // assumes the stack of open elements is non-empty, so we need special
-  // handling for this case.
-  append_node(
-      parser, parser->_output->root ?
-      get_current_node(parser) : parser->_output->document, node);
-  gumbo_vector_add(parser, (void*) node, &state->_open_elements);
 }
 
 // Convenience method that combines create_element_from_token and
@@ -1010,18 +1431,18 @@ static GumboNode* insert_foreign_element(
   assert(token->type == GUMBO_TOKEN_START_TAG);
   GumboNode* element = create_element_from_token(parser, token, tag_namespace);
   insert_element(parser, element, false);
-  if (token_has_attribute(token, "xmlns") &&
+  if (token_has_attribute(token, GUMBO_ATTR_XMLNS) &&
       !attribute_matches_case_sensitive(
-          &token->v.start_tag.attributes, "xmlns",
+          &token->v.start_tag.attributes, GUMBO_ATTR_XMLNS,
           kLegalXmlns[tag_namespace])) {
     // TODO(jdtang): Since there're multiple possible error codes here, we
     // eventually need reason codes to differentiate them.
     add_parse_error(parser, token);
   }
-  if (token_has_attribute(token, "xmlns:xlink") &&
+  if (token_has_attribute(token, GUMBO_ATTR_XMLNS_XLINK) &&
       !attribute_matches_case_sensitive(
           &token->v.start_tag.attributes,
-          "xmlns:xlink", "http://www.w3.org/1999/xlink")) {
+          GUMBO_ATTR_XMLNS_XLINK, "http://www.w3.org/1999/xlink")) {
     add_parse_error(parser, token);
   }
   return element;
@@ -1051,7 +1472,7 @@ static void run_generic_parsing_algorithm(
   gumbo_tokenizer_set_state(parser, lexer_state);
   parser->_parser_state->_original_insertion_mode =
       parser->_parser_state->_insertion_mode;
-  parser->_parser_state->_insertion_mode = GUMBO_INSERTION_MODE_TEXT;
+  set_insertion_mode(parser, GUMBO_INSERTION_MODE_TEXT);
 }
 
 static void acknowledge_self_closing_tag(GumboParser* parser) {
@@ -1062,6 +1483,9 @@ static void acknowledge_self_closing_tag(GumboParser* parser) {
 // elements, and fills in its index if so.
 static bool find_last_anchor_index(GumboParser* parser, int* anchor_index) {
   GumboVector* elements = &parser->_parser_state->_active_formatting_elements;
+  if (parser->_parser_state->_formatting_tag_counts[GUMBO_TAG_A] == 0) {
+    return false;
+  }
   for (int i = elements->length - 1; i >= 0; --i) {
     GumboNode* node = elements->data[i];
     if (node == &kActiveFormattingScopeMarker) {
@@ -1075,17 +1499,76 @@ static bool find_last_anchor_index(GumboParser* parser, int* anchor_index) {
   return false;
 }
 
+// Entries are only added to or removed from the list of active formatting
+// elements through these functions and add_formatting_element, which keep
+// _formatting_tag_counts up to date.  (Replacing an entry with its clone
+// leaves the counts unchanged.)
+static void insert_formatting_element_at(
+    GumboParser* parser, GumboNode* node, int index) {
+  GumboParserState* state = parser->_parser_state;
+  assert(node->type == GUMBO_NODE_ELEMENT);
+  gumbo_vector_insert_at(
+      parser, node, index, &state->_active_formatting_elements);
+  ++state->_formatting_tag_counts[node->v.element.tag];
+}
+
+static GumboNode* remove_formatting_element_at(
+    GumboParser* parser, int index) {
+  GumboParserState* state = parser->_parser_state;
+  GumboNode* node = gumbo_vector_remove_at(
+      parser, index, &state->_active_formatting_elements);
+  if (node != &kActiveFormattingScopeMarker) {
+    assert(state->_formatting_tag_counts[node->v.element.tag] > 0);
+    --state->_formatting_tag_counts[node->v.element.tag];
+  }
+  return node;
+}
+
+// Returns the index of node in the list of active formatting elements, or -1.
+// Searches from the end, since that's where the entries the adoption agency
+// algorithm asks about usually are.
+static int get_formatting_element_index(
+    GumboParser* parser, const GumboNode* node) {
+  GumboParserState* state = parser->_parser_state;
+  assert(node->type == GUMBO_NODE_ELEMENT);
+  if (state->_formatting_tag_counts[node->v.element.tag] == 0) {
+    return -1;
+  }
+  GumboVector* elements = &state->_active_formatting_elements;
+  for (int i = elements->length - 1; i >= 0; --i) {
+    if (elements->data[i] == node) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+// Computes an order-independent hash of an element's attributes, so that
+// elements whose attributes differ can usually be told apart without comparing
+// the attribute vectors.
+static unsigned int hash_attributes(const GumboVector* attributes) {
+  unsigned int hash = attributes->length;
+  for (int i = 0; i < attributes->length; ++i) {
+    hash += gumbo_attribute_hash(attributes->data[i]);
+  }
+  return hash;
+}
+
 // Counts the number of open formatting elements in the list of active
 // formatting elements (after the last active scope marker) that have a specific
 // tag.  If this is > 0, then earliest_matching_index will be filled in with the
-// index of the first such element.
+// index of the first such element.  Since add_formatting_element never lets the
+// list hold more than three identical elements, this stops looking after it
+// has found three.
 static int count_formatting_elements_of_tag(
     GumboParser* parser, const GumboNode* desired_node,
     int* earliest_matching_index) {
   const GumboElement* desired_element = &desired_node->v.element;
   GumboVector* elements = &parser->_parser_state->_active_formatting_elements;
   int num_identical_elements = 0;
-  for (int i = elements->length - 1; i >= 0; --i) {
+  gumbo_attribute_index_clear(&parser->_parser_state->_attribute_index);
+  for (int i = elements->length - 1; i >= 0 && num_identical_elements < 3;
+       --i) {
     GumboNode* node = elements->data[i];
     if (node == &kActiveFormattingScopeMarker) {
       break;
@@ -1094,7 +1577,8 @@ static int count_formatting_elements_of_tag(
     GumboElement* element = &node->v.element;
     if (node_tag_is(node, desired_element->tag) &&
         element->tag_namespace == desired_element->tag_namespace &&
-        all_attributes_match(&element->attributes,
+        element->_attribute_hash == desired_element->_attribute_hash &&
+        all_attributes_match(parser, &element->attributes,
                              &desired_element->attributes)) {
       num_identical_elements++;
       *earliest_matching_index = i;
@@ -1110,9 +1594,13 @@ static void add_formatting_element(GumboParser* parser, const GumboNode* node) {
   GumboVector* elements = &parser->_parser_state->_active_formatting_elements;
   if (node == &kActiveFormattingScopeMarker) {
     gumbo_debug("Adding a scope marker.\n");
-  } else {
-    gumbo_debug("Adding a formatting element.\n");
+    gumbo_vector_add(parser, (void*) node, elements);
+    return;
   }
+  gumbo_debug("Adding a formatting element.\n");
+  // Clones made later by the adoption agency or reconstruction copy this.
+  ((GumboNode*) node)->v.element._attribute_hash =
+      hash_attributes(&node->v.element.attributes);
 
   // Hunt for identical elements.
   int earliest_identical_element = elements->length;
@@ -1123,29 +1611,30 @@ static void add_formatting_element(GumboParser* parser, const GumboNode* node) {
   if (num_identical_elements >= 3) {
     gumbo_debug("Noah's ark clause: removing element at %d.\n",
                 earliest_identical_element);
-    gumbo_vector_remove_at(parser, earliest_identical_element, elements);
+    remove_formatting_element_at(parser, earliest_identical_element);
   }
 
   gumbo_vector_add(parser, (void*) node, elements);
+  ++parser->_parser_state->_formatting_tag_counts[node->v.element.tag];
 }
 
 static bool is_open_element(GumboParser* parser, const GumboNode* node) {
-  GumboVector* open_elements = &parser->_parser_state->_open_elements;
-  for (int i = 0; i < open_elements->length; ++i) {
-    if (open_elements->data[i] == node) {
-      return true;
-    }
-  }
-  return false;
+  assert(node->type == GUMBO_NODE_ELEMENT);
+  return node->v.element._is_open;
 }
 
 // Clones attributes, tags, etc. of a node, but does not copy the content.  The
-// clone shares no structure with the original node: all owned strings and
-// values are fresh copies.
+// clone has its own attribute vector, but the attribute names and values are
+// shared with the original; see gumbo_clone_attribute.
 GumboNode* clone_node(
     GumboParser* parser, const GumboNode* node, GumboParseFlags reason) {
   assert(node->type == GUMBO_NODE_ELEMENT);
-  GumboNode* new_node = gumbo_parser_allocate(parser, sizeof(GumboNode));
+  GumboNode* new_node = gumbo_parser_allocate(
+      parser, sizeof(ElementNode), GUMBO_ALLOCATION_NODE);
+  ++parser->_parser_state->_node_count;
+  if (parser->_stats) {
+    ++parser->_stats->nodes[GUMBO_NODE_ELEMENT];
+  }
   *new_node = *node;
   new_node->parent = NULL;
   new_node->index_within_parent = -1;
@@ -1154,18 +1643,20 @@ GumboNode* clone_node(
   new_node->parse_flags &= ~GUMBO_INSERTION_IMPLICIT_END_TAG;
   new_node->parse_flags |= reason | GUMBO_INSERTION_BY_PARSER;
   GumboElement* element = &new_node->v.element;
-  gumbo_vector_init(parser, 1, &element->children);
+  element->_is_open = false;
+  element->_match_flags = 0;
+  init_inline_children(new_node);
 
   const GumboVector* old_attributes = &node->v.element.attributes;
-  gumbo_vector_init(parser, old_attributes->length, &element->attributes);
+  if (old_attributes->length <= kInlineAttributes) {
+    init_inline_attributes(new_node);
+  } else {
+    gumbo_vector_init(parser, old_attributes->length, &element->attributes);
+  }
   for (int i = 0; i < old_attributes->length; ++i) {
-    const GumboAttribute* old_attr = old_attributes->data[i];
-    GumboAttribute* attr =
-        gumbo_parser_allocate(parser, sizeof(GumboAttribute));
-    *attr = *old_attr;
-    attr->name = gumbo_copy_stringz(parser, old_attr->name);
-    attr->value = gumbo_copy_stringz(parser, old_attr->value);
-    gumbo_vector_add(parser, attr, &element->attributes);
+    gumbo_vector_add(
+        parser, gumbo_clone_attribute(parser, old_attributes->data[i]),
+        &element->attributes);
   }
   return new_node;
 }
@@ -1176,6 +1667,9 @@ GumboNode* clone_node(
 // http://code.google.com/p/html5lib/source/browse/python/html5lib/treebuilders/_base.py
 static void reconstruct_active_formatting_elements(GumboParser* parser) {
   GumboVector* elements = &parser->_parser_state->_active_formatting_elements;
+  if (parser->_stats) {
+    ++parser->_stats->reconstruct_formatting_calls;
+  }
   // Step 1
   if (elements->length == 0) {
     return;
@@ -1228,6 +1722,9 @@ static void clear_active_formatting_elements(GumboParser* parser) {
   const GumboNode* node;
   do {
     node = gumbo_vector_pop(parser, elements);
+    if (node && node != &kActiveFormattingScopeMarker) {
+      --parser->_parser_state->_formatting_tag_counts[node->v.element.tag];
+    }
     ++num_elements_cleared;
   } while(node && node != &kActiveFormattingScopeMarker);
   gumbo_debug("Cleared %d elements from active formatting list.\n",
@@ -1272,6 +1769,19 @@ static GumboQuirksModeEnum compute_quirks_mode(
 static bool has_an_element_in_specific_scope(
     GumboParser* parser, GumboVector* /* GumboTag */ expected, bool negate, ...) {
   GumboVector* open_elements = &parser->_parser_state->_open_elements;
+  // Most checks are for a tag that isn't open at all (a <p> to close before
+  // every block element, say), and would otherwise walk the whole stack.
+  bool any_open = false;
+  for (int j = 0; j < expected->length; ++j) {
+    if (parser->_parser_state->_open_tag_counts[(GumboTag) expected->data[j]]) {
+      any_open = true;
+      break;
+    }
+  }
+  if (!any_open) {
+    return false;
+  }
+
   va_list args;
   va_start(args, negate);
   // va_arg can only run through the list once, so we copy it to an GumboVector
@@ -1610,9 +2120,10 @@ static void merge_attributes(
   const GumboVector* token_attr = &token->v.start_tag.attributes;
   GumboVector* node_attr = &node->v.element.attributes;
 
+  gumbo_attribute_index_clear(&parser->_parser_state->_attribute_index);
   for (int i = 0; i < token_attr->length; ++i) {
     GumboAttribute* attr = token_attr->data[i];
-    if (!gumbo_get_attribute(node_attr, attr->name)) {
+    if (!get_same_attribute(parser, node_attr, attr)) {
       // Ownership of the attribute is transferred by this gumbo_vector_add,
       // so it has to be nulled out of the original token so it doesn't get
       // double-deleted.
@@ -1659,9 +2170,11 @@ static void adjust_foreign_attributes(GumboParser* parser, GumboToken* token) {
     if (!attr) {
       continue;
     }
-    gumbo_parser_deallocate(parser, (void*) attr->name);
     attr->attr_namespace = entry->attr_namespace;
-    attr->name = gumbo_copy_stringz(parser, entry->local_name);
+    size_t length = strlen(entry->local_name);
+    gumbo_attribute_set_name(
+        parser, attr, gumbo_attribute_atom(entry->local_name, length),
+        entry->local_name, length);
   }
 }
 
@@ -1677,8 +2190,9 @@ static void adjust_svg_attributes(GumboParser* parser, GumboToken* token) {
     if (!attr) {
       continue;
     }
-    gumbo_parser_deallocate(parser, (void*) attr->name);
-    attr->name = gumbo_copy_stringz(parser, entry->to.data);
+    gumbo_attribute_set_name(
+        parser, attr, gumbo_attribute_atom(entry->to.data, entry->to.length),
+        entry->to.data, entry->to.length);
   }
 }
 
@@ -1692,8 +2206,10 @@ static void adjust_mathml_attributes(GumboParser* parser, GumboToken* token) {
   if (!attr) {
     return;
   }
-  gumbo_parser_deallocate(parser, (void*) attr->name);
-  attr->name = gumbo_copy_stringz(parser, "definitionURL");
+  GumboStringPiece definition_url = GUMBO_STRING("definitionURL");
+  gumbo_attribute_set_name(
+      parser, attr, GUMBO_ATTR_UNKNOWN, definition_url.data,
+      definition_url.length);
 }
 
 static bool doctype_matches(
@@ -1738,8 +2254,9 @@ static void remove_from_parent(GumboParser* parser, GumboNode* node) {
   }
   assert(node->parent->type == GUMBO_NODE_ELEMENT);
   GumboVector* children = &node->parent->v.element.children;
-  int index = gumbo_vector_index_of(children, node);
-  assert(index != -1);
+  int index = node->index_within_parent;
+  assert(index >= 0 && index < children->length);
+  assert(children->data[index] == node);
 
   gumbo_vector_remove_at(parser, index, children);
   node->parent = NULL;
@@ -1756,11 +2273,23 @@ static bool adoption_agency_algorithm(
     GumboParser* parser, GumboToken* token, GumboTag closing_tag) {
   GumboParserState* state = parser->_parser_state;
   gumbo_debug("Entering adoption agency algorithm.\n");
+  if (parser->_stats) {
+    ++parser->_stats->adoption_agency_runs;
+  }
+  // Every index below is tracked through the algorithm's own modifications
+  // rather than searched for again, so that each pass of the outer loop costs
+  // time proportional to the part of the stack of open elements it walks in
+  // step 5, not to the size of the document.
   // Steps 1-3 & 16:
   for (int i = 0; i < 8; ++i) {
     // Step 4.
     GumboNode* formatting_node = NULL;
+    int formatting_node_index = -1;
     int formatting_node_in_open_elements = -1;
+    if (state->_formatting_tag_counts[closing_tag] == 0) {
+      gumbo_debug("No active formatting elements; aborting.\n");
+      return false;
+    }
     for (int j = state->_active_formatting_elements.length - 1; j >= 0; --j) {
       GumboNode* current_node = state->_active_formatting_elements.data[j];
       if (current_node == &kActiveFormattingScopeMarker) {
@@ -1771,8 +2300,9 @@ static bool adoption_agency_algorithm(
       if (node_tag_is(current_node, closing_tag)) {
         // Found it.
         formatting_node = current_node;
-        formatting_node_in_open_elements = gumbo_vector_index_of(
-            &state->_open_elements, formatting_node);
+        formatting_node_index = j;
+        formatting_node_in_open_elements =
+            get_open_element_index(parser, formatting_node);
         gumbo_debug("Formatting element of tag %s at %d.\n",
                     gumbo_normalized_tagname(closing_tag),
                     formatting_node_in_open_elements);
@@ -1789,8 +2319,7 @@ static bool adoption_agency_algorithm(
 
     if (formatting_node_in_open_elements == -1) {
       gumbo_debug("Formatting node not on stack of open elements.\n");
-      gumbo_vector_remove(parser, formatting_node,
-                          &state->_active_formatting_elements);
+      remove_formatting_element_at(parser, formatting_node_index);
       return false;
     }
 
@@ -1808,6 +2337,7 @@ static bool adoption_agency_algorithm(
 
     // Step 5 & 6.
     GumboNode* furthest_block = NULL;
+    int furthest_block_index = -1;
     for (int j = formatting_node_in_open_elements;
          j < state->_open_elements.length; ++j) {
       assert(j > 0);
@@ -1815,6 +2345,7 @@ static bool adoption_agency_algorithm(
       if (is_special_node(current)) {
         // Step 5.
         furthest_block = current;
+        furthest_block_index = j;
         break;
       }
     }
@@ -1825,8 +2356,7 @@ static bool adoption_agency_algorithm(
       }
       // And the formatting element itself.
       pop_current_node(parser);
-      gumbo_vector_remove(parser, formatting_node,
-                          &state->_active_formatting_elements);
+      remove_formatting_element_at(parser, formatting_node_index);
       return false;
     }
     assert(!node_tag_is(furthest_block, GUMBO_TAG_HTML));
@@ -1836,51 +2366,49 @@ static bool adoption_agency_algorithm(
     // Elements may be moved and reparented by this algorithm, so
     // common_ancestor is not necessarily the same as formatting_node->parent.
     GumboNode* common_ancestor =
-        state->_open_elements.data[gumbo_vector_index_of(
-            &state->_open_elements, formatting_node) - 1];
+        state->_open_elements.data[formatting_node_in_open_elements - 1];
     gumbo_debug("Common ancestor tag = %s, furthest block tag = %s.\n",
                 gumbo_normalized_tagname(common_ancestor->v.element.tag),
                 gumbo_normalized_tagname(furthest_block->v.element.tag));
 
     // Step 8.
-    int bookmark = gumbo_vector_index_of(
-        &state->_active_formatting_elements, formatting_node);;
+    int bookmark = formatting_node_index;
     // Step 9.
     GumboNode* node = furthest_block;
     GumboNode* last_node = furthest_block;
     // Must be stored explicitly, in case node is removed from the stack of open
-    // elements, to handle step 9.4.
-    int saved_node_index = gumbo_vector_index_of(&state->_open_elements, node);
+    // elements, to handle step 9.4.  While node is still open, this is also
+    // its index, since nothing at or below it is removed.
+    int saved_node_index = furthest_block_index;
     assert(saved_node_index > 0);
     // Step 9.1-9.3 & 9.11.
     for (int j = 0; j < 3; ++j) {
       // Step 9.4.
-      int node_index = gumbo_vector_index_of(&state->_open_elements, node);
+      int node_index = saved_node_index;
+      assert(!is_open_element(parser, node) ||
+             state->_open_elements.data[node_index] == node);
       gumbo_debug(
           "Current index: %d, last index: %d.\n", node_index, saved_node_index);
-      if (node_index == -1) {
-        node_index = saved_node_index;
-      }
       saved_node_index = --node_index;
       assert(node_index > 0);
       assert(node_index < state->_open_elements.capacity);
       node = state->_open_elements.data[node_index];
       assert(node->parent);
       // Step 9.5.
-      if (gumbo_vector_index_of(
-          &state->_active_formatting_elements, node) == -1) {
-        gumbo_vector_remove_at(parser, node_index, &state->_open_elements);
+      int formatting_index = get_formatting_element_index(parser, node);
+      if (formatting_index == -1) {
+        remove_open_element_at(parser, node_index);
+        --furthest_block_index;
         continue;
       } else if (node == formatting_node) {
         // Step 9.6.
         break;
       }
       // Step 9.7.
-      int formatting_index = gumbo_vector_index_of(
-          &state->_active_formatting_elements, node);
       node = clone_node(parser, node, GUMBO_INSERTION_ADOPTION_AGENCY_CLONED);
       state->_active_formatting_elements.data[formatting_index] = node;
-      state->_open_elements.data[node_index] = node;
+      remove_open_element_at(parser, node_index);
+      insert_open_element_at(parser, node, node_index);
       // Step 9.8.
       if (last_node == furthest_block) {
         bookmark = formatting_index + 1;
@@ -1909,56 +2437,68 @@ static bool adoption_agency_algorithm(
                   gumbo_normalized_tagname(common_ancestor->v.element.tag));
       append_node(parser, common_ancestor, last_node);
     }
+    // The clones made in step 9 only now have all of their ancestors.
+    for (GumboNode* clone = furthest_block->parent;
+         clone != last_node->parent; clone = clone->parent) {
+      evaluate_match(parser, clone);
+    }
 
     // Step 11.
     GumboNode* new_formatting_node = clone_node(
         parser, formatting_node, GUMBO_INSERTION_ADOPTION_AGENCY_CLONED);
     formatting_node->parse_flags |= GUMBO_INSERTION_IMPLICIT_END_TAG;
 
-    // Step 12.  Instead of appending nodes one-by-one, we swap the children
-    // vector of furthest_block with the empty children of new_formatting_node,
-    // reducing memory traffic and allocations.  We still have to reset their
-    // parent pointers, though.
-    GumboVector temp = new_formatting_node->v.element.children;
-    new_formatting_node->v.element.children =
-        furthest_block->v.element.children;
-    furthest_block->v.element.children = temp;
-
-    temp = new_formatting_node->v.element.children;
-    for (int i = 0; i < temp.length; ++i) {
-      GumboNode* child = temp.data[i];
+    // Step 12.  Instead of appending nodes one-by-one, we hand the children
+    // array of furthest_block over to new_formatting_node, reducing memory
+    // traffic and allocations.  Children that are still in furthest_block's
+    // inline slots have to be copied, and we still have to reset their parent
+    // pointers.
+    GumboVector* old_children = &furthest_block->v.element.children;
+    GumboVector* new_children = &new_formatting_node->v.element.children;
+    assert(new_children->length == 0);
+    if (old_children->_is_inline) {
+      for (int i = 0; i < old_children->length; ++i) {
+        gumbo_vector_add(parser, old_children->data[i], new_children);
+      }
+      old_children->length = 0;
+    } else {
+      gumbo_vector_destroy(parser, new_children);
+      *new_children = *old_children;
+      init_inline_children(furthest_block);
+    }
+
+    for (int i = 0; i < new_children->length; ++i) {
+      GumboNode* child = new_children->data[i];
       child->parent = new_formatting_node;
     }
 
     // Step 13.
     append_node(parser, furthest_block, new_formatting_node);
+    evaluate_match(parser, new_formatting_node);
 
     // Step 14.
-    // If the formatting node was before the bookmark, it may shift over all
-    // indices after it, so we need to explicitly find the index and possibly
-    // adjust the bookmark.
-    int formatting_node_index = gumbo_vector_index_of(
-        &state->_active_formatting_elements, formatting_node);
-    assert(formatting_node_index != -1);
+    // Step 9 only replaces entries in the list of active formatting elements,
+    // so the formatting node is still where step 4 found it.  If it was before
+    // the bookmark, removing it shifts the bookmark down by one.
+    assert(state->_active_formatting_elements.data[formatting_node_index] ==
+           formatting_node);
     if (formatting_node_index < bookmark) {
       --bookmark;
     }
-    gumbo_vector_remove_at(
-        parser, formatting_node_index, &state->_active_formatting_elements);
+    remove_formatting_element_at(parser, formatting_node_index);
     assert(bookmark >= 0);
     assert(bookmark <= state->_active_formatting_elements.length);
-    gumbo_vector_insert_at(parser, new_formatting_node, bookmark,
-                           &state->_active_formatting_elements);
-
-    // Step 15.
-    gumbo_vector_remove(
-        parser, formatting_node, &state->_open_elements);
-    int insert_at = gumbo_vector_index_of(
-        &state->_open_elements, furthest_block) + 1;
-    assert(insert_at >= 0);
+    insert_formatting_element_at(parser, new_formatting_node, bookmark);
+
+    // Step 15.  Step 9 only removed elements between the formatting node and
+    // the furthest block, so the formatting node hasn't moved either.
+    assert(state->_open_elements.data[formatting_node_in_open_elements] ==
+           formatting_node);
+    remove_open_element_at(parser, formatting_node_in_open_elements);
+    int insert_at = furthest_block_index;
+    assert(state->_open_elements.data[insert_at - 1] == furthest_block);
     assert(insert_at <= state->_open_elements.length);
-    gumbo_vector_insert_at(
-        parser, new_formatting_node, insert_at, &state->_open_elements);
+    insert_open_element_at(parser, new_formatting_node, insert_at);
   }
   return true;
 }
@@ -2232,9 +2772,9 @@ static bool handle_after_head(GumboParser* parser, GumboToken* token) {
     // This must be flushed before we push the head element on, as there may be
     // pending character tokens that should be attached to the root.
     maybe_flush_text_node_buffer(parser);
-    gumbo_vector_add(parser, state->_head_element, &state->_open_elements);
+    push_open_element(parser, state->_head_element);
     bool result = handle_in_head(parser, token);
-    gumbo_vector_remove(parser, state->_head_element, &state->_open_elements);
+    remove_open_element(parser, state->_head_element);
     return result;
   } else if (tag_is(token, kStartTag, GUMBO_TAG_HEAD) ||
             (token->type == GUMBO_TOKEN_END_TAG &&
@@ -2251,38 +2791,213 @@ static bool handle_after_head(GumboParser* parser, GumboToken* token) {
   }
 }
 
-static void destroy_node(GumboParser* parser, GumboNode* node) {
-  switch (node->type) {
-    case GUMBO_NODE_DOCUMENT:
-      {
-        GumboDocument* doc = &node->v.document;
-        for (int i = 0; i < doc->children.length; ++i) {
-          destroy_node(parser, doc->children.data[i]);
+// Frees a node along with all of its descendants.  This walks the tree
+// post-order using the parent pointers instead of recursing, so documents with
+// arbitrarily deep nesting are destroyed in constant stack space.  Children
+// are detached from the end of each children vector as they're visited.
+static void destroy_node(GumboParser* parser, GumboNode* root) {
+  GumboNode* node = root;
+  while (node) {
+    GumboVector* children = NULL;
+    if (node->type == GUMBO_NODE_DOCUMENT) {
+      children = &node->v.document.children;
+    } else if (node->type == GUMBO_NODE_ELEMENT) {
+      children = &node->v.element.children;
+    }
+    if (children && children->length > 0) {
+      node = children->data[--children->length];
+      continue;
+    }
+
+    GumboNode* next = (node == root) ? NULL : node->parent;
+    switch (node->type) {
+      case GUMBO_NODE_DOCUMENT:
+        {
+          GumboDocument* doc = &node->v.document;
+          gumbo_parser_deallocate(parser, (void*) doc->children.data);
+          gumbo_parser_deallocate(parser, (void*) doc->name);
+          gumbo_parser_deallocate(parser, (void*) doc->public_identifier);
+          gumbo_parser_deallocate(parser, (void*) doc->system_identifier);
         }
-        gumbo_parser_deallocate(parser, (void*) doc->children.data);
-        gumbo_parser_deallocate(parser, (void*) doc->name);
-        gumbo_parser_deallocate(parser, (void*) doc->public_identifier);
-        gumbo_parser_deallocate(parser, (void*) doc->system_identifier);
-      }
+        break;
+      case GUMBO_NODE_ELEMENT:
+        for (int i = 0; i < node->v.element.attributes.length; ++i) {
+          gumbo_destroy_attribute(parser, node->v.element.attributes.data[i]);
+        }
+        gumbo_vector_destroy(parser, &node->v.element.attributes);
+        gumbo_vector_destroy(parser, &node->v.element.children);
+        break;
+      case GUMBO_NODE_TEXT:
+      case GUMBO_NODE_CDATA:
+      case GUMBO_NODE_COMMENT:
+      case GUMBO_NODE_WHITESPACE:
+        if (node->v.text.text_ownership == GUMBO_STRING_OWNED) {
+          gumbo_parser_deallocate(parser, (void*) node->v.text.text);
+        }
+        break;
+    }
+    gumbo_parser_deallocate(parser, node);
+    node = next;
+  }
+}
+
+// The rest of the tree-trimming for gumbo_parse_matching.  The tree builder
+// only ever adds to the current node (or, when foster parenting, next to an
+// open table), so once an element has left the stack of open elements and
+// everything in it is finished, nothing can be added to it again.  Unless it's
+// part of a match that hasn't been delivered yet, it can then be freed, along
+// with the text and comments before it, as long as the tree builder holds no
+// other reference to anything in it.
+
+// Returns true if the tree builder may still refer to node, so that it mustn't
+// be freed yet.
+static bool is_pinned_element(GumboParser* parser, GumboNode* node) {
+  GumboParserState* state = parser->_parser_state;
+  return node->v.element._is_open ||
+         (node->v.element._match_flags & MATCH_FLAG_FINISHING) ||
+         node == state->_head_element || node == state->_form_element ||
+         get_formatting_element_index(parser, node) != -1;
+}
+
+// Returns the node after node in a pre-order walk of root's subtree, skipping
+// node's own children unless enter is true, or NULL at the end.
+static GumboNode* next_in_subtree(
+    const GumboNode* root, GumboNode* node, bool enter) {
+  if (enter && node->type == GUMBO_NODE_ELEMENT &&
+      node->v.element.children.length > 0) {
+    return node->v.element.children.data[0];
+  }
+  for (; node != root; node = node->parent) {
+    const GumboVector* siblings = &node->parent->v.element.children;
+    if (node->index_within_parent + 1 < siblings->length) {
+      return siblings->data[node->index_within_parent + 1];
+    }
+  }
+  return NULL;
+}
+
+static void unpark_node(GumboParser* parser, GumboNode* node) {
+  GumboVector* parked = &parser->_parser_state->_parked_nodes;
+  for (int i = 0; i < parked->length; ++i) {
+    if (parked->data[i] == node) {
+      parked->data[i] = parked->data[--parked->length];
       break;
-    case GUMBO_NODE_ELEMENT:
-      for (int i = 0; i < node->v.element.attributes.length; ++i) {
-        gumbo_destroy_attribute(parser, node->v.element.attributes.data[i]);
-      }
-      gumbo_parser_deallocate(parser, node->v.element.attributes.data);
-      for (int i = 0; i < node->v.element.children.length; ++i) {
-        destroy_node(parser, node->v.element.children.data[i]);
+    }
+  }
+  node->v.element._match_flags &= ~MATCH_FLAG_PARKED;
+}
+
+// Frees root and its subtree, along with the text and comments before it,
+// unless the tree builder may still refer to it.  Pinned elements in the
+// subtree are detached and parked instead, and nothing is freed if anything in
+// it is still open.
+static void discard_node(GumboParser* parser, GumboNode* root) {
+  if (is_pinned_element(parser, root)) {
+    return;
+  }
+  for (GumboNode* node = next_in_subtree(root, root, true); node;
+       node = next_in_subtree(root, node, true)) {
+    if (node->type == GUMBO_NODE_ELEMENT && node->v.element._is_open) {
+      return;
+    }
+  }
+  GumboNode* node = next_in_subtree(root, root, true);
+  while (node) {
+    if (node->type != GUMBO_NODE_ELEMENT ||
+        !is_pinned_element(parser, node)) {
+      node = next_in_subtree(root, node, true);
+      continue;
+    }
+    GumboNode* parent = node->parent;
+    int index = node->index_within_parent;
+    remove_from_parent(parser, node);
+    node->v.element._match_flags |= MATCH_FLAG_PARKED;
+    gumbo_vector_add(parser, node, &parser->_parser_state->_parked_nodes);
+    // Carry on with whatever followed it.
+    node = index < parent->v.element.children.length ?
+        parent->v.element.children.data[index] :
+        next_in_subtree(root, parent, false);
+  }
+
+  if (root->v.element._match_flags & MATCH_FLAG_PARKED) {
+    unpark_node(parser, root);
+  } else if (root->parent) {
+    GumboVector* siblings = &root->parent->v.element.children;
+    for (int i = root->index_within_parent - 1;
+         i >= 0 && ((GumboNode*) siblings->data[i])->type !=
+             GUMBO_NODE_ELEMENT; --i) {
+      GumboNode* sibling = siblings->data[i];
+      remove_from_parent(parser, sibling);
+      destroy_node(parser, sibling);
+    }
+    remove_from_parent(parser, root);
+  }
+  destroy_node(parser, root);
+}
+
+// Frees the parked nodes that the tree builder is done with.
+static void sweep_parked_nodes(GumboParser* parser) {
+  GumboParserState* state = parser->_parser_state;
+  GumboVector* parked = &state->_parked_nodes;
+  for (int i = 0; i < parked->length;) {
+    GumboNode* node = parked->data[i];
+    if (is_pinned_element(parser, node)) {
+      ++i;
+    } else {
+      // Removes it from parked, moving another node into slot i.
+      discard_node(parser, node);
+    }
+  }
+  state->_parked_sweep_threshold = parked->length * 2 > kParkedSweepThreshold ?
+      parked->length * 2 : kParkedSweepThreshold;
+}
+
+// The safe point of a gumbo_parse_matching parse, between tokens.  Delivers
+// the matches that have finished since the last one, and frees what's
+// finished while there are no matches waiting to be delivered.  Elements are
+// dealt with in the order they finished, so inner matches come first.
+static void process_finished_elements(GumboParser* parser) {
+  GumboParserState* state = parser->_parser_state;
+  if (!state->_selector) {
+    return;
+  }
+  FinishedElementList* finished = &state->_finished_elements;
+  for (unsigned int i = 0; i < finished->length; ++i) {
+    FinishedElement entry = finished->data[i];
+    GumboElement* element = &entry.node->v.element;
+    element->_match_flags &= ~MATCH_FLAG_FINISHING;
+    if (element->_is_open) {
+      // It's been put back on the stack, and will be recorded again when it
+      // leaves.
+      continue;
+    }
+    if ((element->_match_flags & MATCH_FLAG_MATCHES) &&
+        !(element->_match_flags & MATCH_FLAG_REPORTED)) {
+      element->_match_flags |= MATCH_FLAG_REPORTED;
+      assert(state->_unreported_matches > 0);
+      --state->_unreported_matches;
+      if (!state->_match_stopped &&
+          !state->_match_callback(entry.node, state->_match_userdata)) {
+        state->_match_stopped = true;
       }
-      gumbo_parser_deallocate(parser, node->v.element.children.data);
-      break;
-    case GUMBO_NODE_TEXT:
-    case GUMBO_NODE_CDATA:
-    case GUMBO_NODE_COMMENT:
-    case GUMBO_NODE_WHITESPACE:
-      gumbo_parser_deallocate(parser, (void*) node->v.text.text);
-      break;
+    }
+    if (state->_unreported_matches == 0 &&
+        entry.node != parser->_output->root) {
+      discard_node(parser, entry.node);
+    }
+  }
+  finished->length = 0;
+  if (state->_parked_nodes.length >= state->_parked_sweep_threshold) {
+    sweep_parked_nodes(parser);
+  }
+}
+
+// Frees whatever is still parked at the end of a gumbo_parse_matching parse.
+static void destroy_parked_nodes(GumboParser* parser) {
+  GumboVector* parked = &parser->_parser_state->_parked_nodes;
+  while (parked->length > 0) {
+    destroy_node(parser, parked->data[--parked->length]);
   }
-  gumbo_parser_deallocate(parser, node);
 }
 
 // http://www.whatwg.org/specs/web-apps/current-work/complete/tokenization.html#parsing-main-inbody
@@ -2512,7 +3227,7 @@ static bool handle_in_body(GumboParser* parser, GumboToken* token) {
     int index = open_elements->length - 1;
     for (; index >= 0 && open_elements->data[index] != node; --index);
     assert(index >= 0);
-    gumbo_vector_remove_at(parser, index, open_elements);
+    remove_open_element_at(parser, index);
     return result;
   } else if (tag_is(token, kEndTag, GUMBO_TAG_P)) {
     if (!has_an_element_in_button_scope(parser, GUMBO_TAG_P)) {
@@ -2581,10 +3296,8 @@ static bool handle_in_body(GumboParser* parser, GumboToken* token) {
       // we're supposed to do this.  (The conditions where it might not are
       // listed in the spec.)
       if (find_last_anchor_index(parser, &last_a)) {
-        void* last_element = gumbo_vector_remove_at(
-            parser, last_a, &state->_active_formatting_elements);
-        gumbo_vector_remove(
-            parser, last_element, &state->_open_elements);
+        GumboNode* last_element = remove_formatting_element_at(parser, last_a);
+        remove_open_element(parser, last_element);
       }
       success = false;
     }
@@ -2666,7 +3379,8 @@ static bool handle_in_body(GumboParser* parser, GumboToken* token) {
     set_frameset_not_ok(parser);
     return success;
   } else if (tag_is(token, kStartTag, GUMBO_TAG_INPUT)) {
-    if (!attribute_matches(&token->v.start_tag.attributes, "type", "hidden")) {
+    if (!attribute_matches(&token->v.start_tag.attributes,
+                           GUMBO_ATTR_TYPE, "hidden")) {
       // Must be before the element is inserted, as that takes ownership of the
       // token's attribute vector.
       set_frameset_not_ok(parser);
@@ -2700,8 +3414,10 @@ static bool handle_in_body(GumboParser* parser, GumboToken* token) {
     set_frameset_not_ok(parser);
 
     GumboVector* token_attrs = &token->v.start_tag.attributes;
-    GumboAttribute* prompt_attr = gumbo_get_attribute(token_attrs, "prompt");
-    GumboAttribute* action_attr = gumbo_get_attribute(token_attrs, "action");
+    GumboAttribute* prompt_attr =
+        gumbo_get_attribute_by_atom(token_attrs, GUMBO_ATTR_PROMPT);
+    GumboAttribute* action_attr =
+        gumbo_get_attribute_by_atom(token_attrs, GUMBO_ATTR_ACTION);
     GumboAttribute* name_attr = gumbo_get_attribute(token_attrs, "isindex");
 
     GumboNode* form = insert_element_of_tag_type(
@@ -2720,11 +3436,10 @@ static bool handle_in_body(GumboParser* parser, GumboToken* token) {
     text_state->_start_position = token->position;
     text_state->_type = GUMBO_NODE_TEXT;
     if (prompt_attr) {
-      int prompt_attr_length = strlen(prompt_attr->value);
-      gumbo_string_buffer_destroy(parser, &text_state->_buffer);
-      text_state->_buffer.data = gumbo_copy_stringz(parser, prompt_attr->value);
-      text_state->_buffer.length = prompt_attr_length;
-      text_state->_buffer.capacity = prompt_attr_length + 1;
+      GumboStringPiece prompt_text = {
+        prompt_attr->value, prompt_attr->value_length };
+      gumbo_string_buffer_append_string(
+          parser, &prompt_text, &text_state->_buffer);
       gumbo_destroy_attribute(parser, prompt_attr);
     } else {
       GumboStringPiece prompt_text = GUMBO_STRING(
@@ -2748,13 +3463,18 @@ static bool handle_in_body(GumboParser* parser, GumboToken* token) {
     // touching the attributes.
     ignore_token(parser);
 
-    GumboAttribute* name =
-        gumbo_parser_allocate(parser, sizeof(GumboAttribute));
+    GumboAttribute* name = gumbo_parser_allocate(
+        parser, sizeof(GumboAttribute), GUMBO_ALLOCATION_ATTRIBUTE);
     GumboStringPiece name_str = GUMBO_STRING("name");
     GumboStringPiece isindex_str = GUMBO_STRING("isindex");
     name->attr_namespace = GUMBO_ATTR_NAMESPACE_NONE;
-    name->name = gumbo_copy_stringz(parser, "name");
+    name->name = NULL;
+    name->name_ownership = GUMBO_STRING_OWNED;
+    gumbo_attribute_set_name(
+        parser, name, GUMBO_ATTR_NAME, name_str.data, name_str.length);
     name->value = gumbo_copy_stringz(parser, "isindex");
+    name->value_length = isindex_str.length;
+    name->value_ownership = GUMBO_STRING_OWNED;
     name->original_name = name_str;
     name->original_value = isindex_str;
     name->name_start = kGumboEmptySourcePosition;
@@ -2998,7 +3718,7 @@ static bool handle_in_table(GumboParser* parser, GumboToken* token) {
     return handle_in_head(parser, token);
   } else if (tag_is(token, kStartTag, GUMBO_TAG_INPUT) &&
              attribute_matches(&token->v.start_tag.attributes,
-                               "type", "hidden")) {
+                               GUMBO_ATTR_TYPE, "hidden")) {
     add_parse_error(parser, token);
     insert_element_from_token(parser, token);
     pop_current_node(parser);
@@ -3055,7 +3775,7 @@ static bool handle_in_table_text(GumboParser* parser, GumboToken* token) {
     maybe_flush_text_node_buffer(parser);
     state->_foster_parent_insertions = false;
     state->_reprocess_current_token = true;
-    state->_insertion_mode = state->_original_insertion_mode;
+    set_insertion_mode(parser, state->_original_insertion_mode);
     return true;
   }
 }
@@ -3129,8 +3849,10 @@ static bool handle_in_column_group(GumboParser* parser, GumboToken* token) {
              get_current_node(parser) == parser->_output->root) {
     return true;
   } else {
+    // Only possible in a fragment with a <colgroup> context.
     if (get_current_node(parser) == parser->_output->root) {
       add_parse_error(parser, token);
+      ignore_token(parser);
       return false;
     }
     assert(node_tag_is(get_current_node(parser), GUMBO_TAG_COLGROUP));
@@ -3362,7 +4084,10 @@ static bool handle_in_select(GumboParser* parser, GumboToken* token) {
   } else if (tag_is(token, kStartTag, GUMBO_TAG_SELECT)) {
     add_parse_error(parser, token);
     ignore_token(parser);
-    close_current_select(parser);
+    // The <select> may be a fragment's context element, and not on the stack.
+    if (has_an_element_in_select_scope(parser, GUMBO_TAG_SELECT)) {
+      close_current_select(parser);
+    }
     return false;
   } else if (tag_in(token, kStartTag, GUMBO_TAG_INPUT, GUMBO_TAG_KEYGEN,
                     GUMBO_TAG_TEXTAREA, GUMBO_TAG_LAST)) {
@@ -3430,7 +4155,11 @@ static bool handle_after_body(GumboParser* parser, GumboToken* token) {
     ignore_token(parser);
     return false;
   } else if (tag_is(token, kEndTag, GUMBO_TAG_HTML)) {
-    // TODO(jdtang): Handle fragment parsing algorithm case.
+    if (parser->_parser_state->_fragment_context) {
+      add_parse_error(parser, token);
+      ignore_token(parser);
+      return false;
+    }
     set_insertion_mode(parser, GUMBO_INSERTION_MODE_AFTER_AFTER_BODY);
     GumboNode* html = parser->_parser_state->_open_elements.data[0];
     assert(node_tag_is(html, GUMBO_TAG_HTML));
@@ -3471,9 +4200,8 @@ static bool handle_in_frameset(GumboParser* parser, GumboToken* token) {
       return false;
     }
     pop_current_node(parser);
-    // TODO(jdtang): Add a condition to ignore this for the fragment parsing
-    // algorithm.
-    if (!node_tag_is(get_current_node(parser), GUMBO_TAG_FRAMESET)) {
+    if (!parser->_parser_state->_fragment_context &&
+        !node_tag_is(get_current_node(parser), GUMBO_TAG_FRAMESET)) {
       set_insertion_mode(parser, GUMBO_INSERTION_MODE_AFTER_FRAMESET);
     }
     return true;
@@ -3594,8 +4322,18 @@ static const TokenHandler kTokenHandlers[] = {
 };
 
 static bool handle_html_content(GumboParser* parser, GumboToken* token) {
+#ifdef GUMBO_PROFILE
+  GumboInsertionMode mode = parser->_parser_state->_insertion_mode;
+  GumboProfileCounter* counter = parser->_profile ?
+      &parser->_profile->insertion_modes[mode] : NULL;
+  uint64_t start = gumbo_profile_ticks();
+  bool result = kTokenHandlers[mode](parser, token);
+  gumbo_profile_count(counter, start);
+  return result;
+#else
   return kTokenHandlers[parser->_parser_state->_insertion_mode](
       parser, token);
+#endif
 }
 
 // http://www.whatwg.org/specs/web-apps/current-work/complete/tokenization.html#parsing-main-inforeign
@@ -3640,21 +4378,27 @@ static bool handle_in_foreign_content(GumboParser* parser, GumboToken* token) {
              GUMBO_TAG_TABLE, GUMBO_TAG_TT, GUMBO_TAG_U, GUMBO_TAG_UL,
              GUMBO_TAG_VAR, GUMBO_TAG_LAST) ||
      (tag_is(token, kStartTag, GUMBO_TAG_FONT) && (
-         token_has_attribute(token, "color") ||
-         token_has_attribute(token, "face") ||
-         token_has_attribute(token, "size")))) {
+         token_has_attribute(token, GUMBO_ATTR_COLOR) ||
+         token_has_attribute(token, GUMBO_ATTR_FACE) ||
+         token_has_attribute(token, GUMBO_ATTR_SIZE)))) {
     add_parse_error(parser, token);
-    do {
+    while (!(is_mathml_integration_point(get_current_node(parser)) ||
+             is_html_integration_point(get_current_node(parser)) ||
+             get_current_node(parser)->v.element.tag_namespace ==
+             GUMBO_NAMESPACE_HTML)) {
       pop_current_node(parser);
-    } while(!(is_mathml_integration_point(get_current_node(parser)) ||
-              is_html_integration_point(get_current_node(parser)) ||
-              get_current_node(parser)->v.element.tag_namespace ==
-              GUMBO_NAMESPACE_HTML));
+    }
+    if (get_adjusted_current_node(parser) != get_current_node(parser)) {
+      // A fragment in a foreign context element, which is still the adjusted
+      // current node, so reprocessing would come straight back here.
+      handle_html_content(parser, token);
+      return false;
+    }
     parser->_parser_state->_reprocess_current_token = true;
     return false;
   } else if (token->type == GUMBO_TOKEN_START_TAG) {
     const GumboNamespaceEnum current_namespace =
-        get_current_node(parser)->v.element.tag_namespace;
+        get_adjusted_current_node(parser)->v.element.tag_namespace;
     if (current_namespace == GUMBO_NAMESPACE_MATHML) {
       adjust_mathml_attributes(parser, token);
     }
@@ -3743,7 +4487,7 @@ static bool handle_token(GumboParser* parser, GumboToken* token) {
     parser->_parser_state->_closed_html_tag = true;
   }
 
-  const GumboNode* current_node = get_current_node(parser);
+  const GumboNode* current_node = get_adjusted_current_node(parser);
   assert(!current_node || current_node->type == GUMBO_NODE_ELEMENT);
   if (current_node) {
     gumbo_debug("Current node: <%s>.\n",
@@ -3769,7 +4513,17 @@ static bool handle_token(GumboParser* parser, GumboToken* token) {
       token->type == GUMBO_TOKEN_EOF) {
     return handle_html_content(parser, token);
   } else {
+#ifdef GUMBO_PROFILE
+    // Includes any tokens that are passed on to the current insertion mode.
+    GumboProfileCounter* counter = parser->_profile ?
+        &parser->_profile->foreign_content : NULL;
+    uint64_t start = gumbo_profile_ticks();
+    bool result = handle_in_foreign_content(parser, token);
+    gumbo_profile_count(counter, start);
+    return result;
+#else
     return handle_in_foreign_content(parser, token);
+#endif
   }
 }
 
@@ -3778,16 +4532,209 @@ GumboOutput* gumbo_parse(const char* buffer) {
       &kGumboDefaultOptions, buffer, strlen(buffer));
 }
 
-GumboOutput* gumbo_parse_with_options(
-    const GumboOptions* options, const char* buffer, size_t length) {
+static void record_token_stats(GumboParseStats* stats, const GumboToken* token) {
+  switch (token->type) {
+    case GUMBO_TOKEN_DOCTYPE:
+      ++stats->doctype_tokens;
+      break;
+    case GUMBO_TOKEN_START_TAG:
+      ++stats->start_tag_tokens;
+      break;
+    case GUMBO_TOKEN_END_TAG:
+      ++stats->end_tag_tokens;
+      break;
+    case GUMBO_TOKEN_COMMENT:
+      ++stats->comment_tokens;
+      break;
+    case GUMBO_TOKEN_WHITESPACE:
+      ++stats->whitespace_tokens;
+      break;
+    case GUMBO_TOKEN_CHARACTER:
+      ++stats->character_tokens;
+      break;
+    case GUMBO_TOKEN_NULL:
+      ++stats->null_tokens;
+      break;
+    default:
+      break;
+  }
+}
+
+// Checks the resource limits in the parser's options, returning the status that
+// the parse should end with if one of them has been exceeded.
+static GumboOutputStatus check_parse_limits(
+    GumboParser* parser, int loop_count, uint64_t deadline) {
+  const GumboOptions* options = parser->_options;
+  const GumboParserState* state = parser->_parser_state;
+  if (options->max_nodes >= 0 &&
+      state->_node_count > (unsigned int) options->max_nodes) {
+    return GUMBO_STATUS_TOO_MANY_NODES;
+  }
+  if (options->max_tree_depth >= 0 &&
+      state->_open_elements.length > (unsigned int) options->max_tree_depth) {
+    return GUMBO_STATUS_TREE_TOO_DEEP;
+  }
+  if (options->max_allocated_bytes > 0 &&
+      parser->_allocated_bytes > options->max_allocated_bytes) {
+    return GUMBO_STATUS_TOO_MUCH_MEMORY;
+  }
+  if (loop_count % kSlowLimitCheckInterval == 0) {
+    if (deadline && gumbo_monotonic_time_ns() > deadline) {
+      return GUMBO_STATUS_TIMED_OUT;
+    }
+    if (options->is_cancelled && options->is_cancelled(options->userdata)) {
+      return GUMBO_STATUS_CANCELLED;
+    }
+  }
+  if (state->_match_stopped) {
+    return GUMBO_STATUS_CANCELLED;
+  }
+  return GUMBO_STATUS_OK;
+}
+
+const char* gumbo_status_to_string(GumboOutputStatus status) {
+  switch (status) {
+    case GUMBO_STATUS_OK:
+      return "OK";
+    case GUMBO_STATUS_TOO_MANY_NODES:
+      return "Too many nodes";
+    case GUMBO_STATUS_TREE_TOO_DEEP:
+      return "Tree too deep";
+    case GUMBO_STATUS_TOO_MUCH_MEMORY:
+      return "Memory limit exceeded";
+    case GUMBO_STATUS_TIMED_OUT:
+      return "Time limit exceeded";
+    case GUMBO_STATUS_CANCELLED:
+      return "Cancelled";
+    default:
+      return "Unknown status";
+  }
+}
+
+// Scratch state kept alive between parses by a GumboParserContext.
+struct _GumboParserContext {
+  GumboParserState* _parser_state;
+  struct _GumboTokenizerState* _tokenizer_state;
+};
+
+// http://www.whatwg.org/specs/web-apps/current-work/multipage/the-end.html#parsing-html-fragments
+// Sets up a fragment parse: creates the context element, puts the tokenizer in
+// the state the context calls for, inserts the <html> root, and picks the
+// insertion mode.
+static void fragment_parser_init(
+    GumboParser* parser, GumboTag context_tag,
+    GumboNamespaceEnum context_namespace) {
+  GumboParserState* state = parser->_parser_state;
+  // There's no token yet for the new elements to take their position from.
+  GumboToken start;
+  start.position.line = 1;
+  start.position.column = 1;
+  start.position.offset = 0;
+  state->_current_token = &start;
+
+  GumboNode* context = create_element(parser, context_tag);
+  context->v.element.tag_namespace = context_namespace;
+  state->_fragment_context = context;
+
+  if (context_namespace == GUMBO_NAMESPACE_HTML) {
+    switch (context_tag) {
+      case GUMBO_TAG_TITLE:
+      case GUMBO_TAG_TEXTAREA:
+        gumbo_tokenizer_set_state(parser, GUMBO_LEX_RCDATA);
+        break;
+      case GUMBO_TAG_STYLE:
+      case GUMBO_TAG_XMP:
+      case GUMBO_TAG_IFRAME:
+      case GUMBO_TAG_NOEMBED:
+      case GUMBO_TAG_NOFRAMES:
+        gumbo_tokenizer_set_state(parser, GUMBO_LEX_RAWTEXT);
+        break;
+      case GUMBO_TAG_SCRIPT:
+        gumbo_tokenizer_set_state(parser, GUMBO_LEX_SCRIPT);
+        break;
+      case GUMBO_TAG_PLAINTEXT:
+        gumbo_tokenizer_set_state(parser, GUMBO_LEX_PLAINTEXT);
+        break;
+      default:
+        // Including <noscript>, since scripting is always off.
+        break;
+    }
+  }
+
+  parser->_output->root = insert_element_of_tag_type(
+      parser, GUMBO_TAG_HTML, GUMBO_INSERTION_IMPLIED);
+  reset_insertion_mode_appropriately(parser);
+  if (context_tag == GUMBO_TAG_FORM) {
+    state->_form_element = context;
+  }
+  state->_current_token = NULL;
+}
+
+// Does the actual parse, using the scratch state from context if it's
+// non-NULL and allocating (and afterwards freeing) fresh state if not.
+// fragment_tag is GUMBO_TAG_LAST for a whole document, and otherwise the tag
+// of the fragment's context element.  selector is non-NULL for
+// gumbo_parse_matching.
+static GumboOutput* parse_with_context(
+    GumboParserContext* context, const GumboOptions* options,
+    const char* buffer, size_t length, GumboTag fragment_tag,
+    GumboNamespaceEnum fragment_namespace, const GumboSelector* selector,
+    GumboMatchCallback callback, void* userdata) {
+  GUMBO_TRACE2(parse__start, length, 0);
   GumboParser parser;
   parser._options = options;
+  parser._allocated_bytes = 0;
+  parser._stats = NULL;
+  parser._profile = NULL;
+#ifdef GUMBO_PROFILE
+  // Like the stats, allocated while accounting is still off, and not counted
+  // against max_allocated_bytes, so that profiling doesn't change the parse.
+  parser._profile = gumbo_parser_allocate(
+      &parser, sizeof(GumboProfile), GUMBO_ALLOCATION_OTHER);
+  memset(parser._profile, 0, sizeof(GumboProfile));
+  parser._profile->ticks_are_ns = GUMBO_PROFILE_TICKS_ARE_NS;
+  parser._allocated_bytes = 0;
+#endif
+  uint64_t start_time = 0;
+  GumboParseStats* stats = NULL;
+  if (options->collect_stats) {
+    // Allocated before accounting is switched on, so that it's not counted
+    // (and so that it can be freed after everything else).
+    start_time = gumbo_monotonic_time_ns();
+    stats = gumbo_parser_allocate(
+        &parser, sizeof(GumboParseStats), GUMBO_ALLOCATION_OTHER);
+    memset(stats, 0, sizeof(GumboParseStats));
+    parser._stats = stats;
+  }
+  // The parser state comes first so that the document node is counted against
+  // max_nodes like everything else.
+  if (context) {
+    parser._parser_state = context->_parser_state;
+    parser_state_reset(&parser);
+  } else {
+    parser_state_init(&parser);
+  }
   output_init(&parser);
-  gumbo_tokenizer_state_init(&parser, buffer, length);
-  parser_state_init(&parser);
+  parser._output->stats = stats;
+  parser._output->profile = parser._profile;
+  if (context) {
+    parser._tokenizer_state = context->_tokenizer_state;
+    gumbo_tokenizer_state_reset(&parser, buffer, length);
+  } else {
+    gumbo_tokenizer_state_init(&parser, buffer, length);
+  }
 
   GumboParserState* state = parser._parser_state;
+  state->_input_length = length;
+  state->_selector = selector;
+  state->_match_callback = callback;
+  state->_match_userdata = userdata;
+  if (fragment_tag != GUMBO_TAG_LAST) {
+    fragment_parser_init(&parser, fragment_tag, fragment_namespace);
+  }
   gumbo_debug("Parsing %.*s.\n", length, buffer);
+  uint64_t deadline = options->max_parse_time_ms < 0 ? 0 :
+      gumbo_monotonic_time_ns() + options->max_parse_time_ms * 1000000ULL;
 
   // Sanity check so that infinite loops die with an assertion failure instead
   // of hanging the process before we ever get an error.
@@ -3796,14 +4743,25 @@ GumboOutput* gumbo_parse_with_options(
   GumboToken token;
   bool has_error = false;
   do {
+    bool token_error = false;
     if (state->_reprocess_current_token) {
       state->_reprocess_current_token = false;
     } else {
-      GumboNode* current_node = get_current_node(&parser);
+      GumboNode* current_node = get_adjusted_current_node(&parser);
       gumbo_tokenizer_set_is_current_node_foreign(
           &parser, current_node &&
           current_node->v.element.tag_namespace != GUMBO_NAMESPACE_HTML);
-      has_error = !gumbo_lex(&parser, &token) || has_error;
+      if (stats) {
+        uint64_t lex_start = gumbo_monotonic_time_ns();
+        token_error = !gumbo_lex(&parser, &token);
+        stats->tokenizer_time_ns += gumbo_monotonic_time_ns() - lex_start;
+        record_token_stats(stats, &token);
+      } else {
+        token_error = !gumbo_lex(&parser, &token);
+      }
+      if (token.type == GUMBO_TOKEN_EOF) {
+        GUMBO_TRACE2(tokenizer__eof, length, state->_node_count);
+      }
     }
     const char* token_type = "text";
     switch (token.type) {
@@ -3831,7 +4789,16 @@ GumboOutput* gumbo_parse_with_options(
         !(token.type == GUMBO_TOKEN_START_TAG &&
           token.v.start_tag.is_self_closing);
 
-    has_error = !handle_token(&parser, &token) || has_error;
+    if (stats) {
+      uint64_t handle_start = gumbo_monotonic_time_ns();
+      token_error = !handle_token(&parser, &token) || token_error;
+      stats->tree_construction_time_ns +=
+          gumbo_monotonic_time_ns() - handle_start;
+    } else {
+      token_error = !handle_token(&parser, &token) || token_error;
+    }
+
+    process_finished_elements(&parser);
 
     // Check for memory leaks when ownership is transferred from start tag
     // tokens to nodes.
@@ -3848,11 +4815,43 @@ GumboOutput* gumbo_parse_with_options(
 
     ++loop_count;
     assert(loop_count < 1000000000);
+    has_error = has_error || token_error;
+
+#ifdef GUMBO_TRACE_ENABLED
+    if (token_error && !state->_traced_error_limit &&
+        options->max_errors >= 0 &&
+        parser._output->errors.length >= (unsigned int) options->max_errors) {
+      state->_traced_error_limit = true;
+      GUMBO_TRACE3(error__limit, length, state->_node_count,
+                   options->max_errors);
+    }
+#endif
 
+    GumboOutputStatus status = check_parse_limits(&parser, loop_count, deadline);
+    if (status != GUMBO_STATUS_OK) {
+      gumbo_debug("Stopping parse: %s.\n", gumbo_status_to_string(status));
+      GUMBO_TRACE3(limit__hit, length, state->_node_count, status);
+      parser._output->status = status;
+      if (state->_reprocess_current_token) {
+        // Nobody is going to take ownership of this token now.
+        state->_reprocess_current_token = false;
+        gumbo_token_destroy(&parser, &token);
+      }
+      break;
+    }
   } while ((token.type != GUMBO_TOKEN_EOF || state->_reprocess_current_token) &&
            !(options->stop_on_first_error && has_error));
 
   finish_parsing(&parser);
+  if (selector) {
+    process_finished_elements(&parser);
+    destroy_parked_nodes(&parser);
+  }
+  if (state->_fragment_context) {
+    destroy_node(&parser, state->_fragment_context);
+    state->_fragment_context = NULL;
+    state->_form_element = NULL;
+  }
   // For API uniformity reasons, if the doctype still has nulls, convert them to
   // empty strings.
   GumboDocument* doc_type = &parser._output->document->v.document;
@@ -3866,28 +4865,374 @@ GumboOutput* gumbo_parse_with_options(
     doc_type->system_identifier = gumbo_copy_stringz(&parser, "");
   }
 
+  parser._output->node_count = state->_node_count;
+  if (!context) {
+    parser_state_destroy(&parser);
+    gumbo_tokenizer_state_destroy(&parser);
+  }
+  if (stats) {
+    stats->total_time_ns = gumbo_monotonic_time_ns() - start_time;
+  }
+  GUMBO_TRACE3(parse__end, length, parser._output->node_count,
+               parser._output->status);
+  return parser._output;
+}
+
+GumboOutput* gumbo_parse_with_options(
+    const GumboOptions* options, const char* buffer, size_t length) {
+  return parse_with_context(
+      NULL, options, buffer, length, GUMBO_TAG_LAST, GUMBO_NAMESPACE_HTML,
+      NULL, NULL, NULL);
+}
+
+GumboOutput* gumbo_parse_matching(
+    const GumboOptions* options, const char* buffer, size_t length,
+    const GumboSelector* selector, GumboMatchCallback callback,
+    void* userdata) {
+  return parse_with_context(
+      NULL, options, buffer, length, GUMBO_TAG_LAST, GUMBO_NAMESPACE_HTML,
+      selector, callback, userdata);
+}
+
+GumboOutput* gumbo_parse_fragment(
+    const GumboOptions* options, const char* buffer, size_t length,
+    GumboTag context_tag, GumboNamespaceEnum context_namespace) {
+  return gumbo_parse_fragment_with_context(
+      NULL, options, buffer, length, context_tag, context_namespace);
+}
+
+GumboParserContext* gumbo_create_parser_context(const GumboOptions* options) {
+  GumboParser parser;
+  parser._options = options;
+  parser._allocated_bytes = 0;
+  parser._stats = NULL;
+  GumboParserContext* context =
+      gumbo_parser_allocate(&parser, sizeof(GumboParserContext),
+                            GUMBO_ALLOCATION_OTHER);
+  parser_state_init(&parser);
+  gumbo_tokenizer_state_init(&parser, "", 0);
+  context->_parser_state = parser._parser_state;
+  context->_tokenizer_state = parser._tokenizer_state;
+  return context;
+}
+
+GumboOutput* gumbo_parse_with_context(
+    GumboParserContext* context, const GumboOptions* options,
+    const char* buffer, size_t length) {
+  // While statistics are being collected every allocation carries a size
+  // header, which the context's long-lived buffers were allocated without, so
+  // those parses can't share them.
+  return parse_with_context(
+      options->collect_stats ? NULL : context, options, buffer, length,
+      GUMBO_TAG_LAST, GUMBO_NAMESPACE_HTML, NULL, NULL, NULL);
+}
+
+GumboOutput* gumbo_parse_fragment_with_context(
+    GumboParserContext* context, const GumboOptions* options,
+    const char* buffer, size_t length, GumboTag context_tag,
+    GumboNamespaceEnum context_namespace) {
+  // A context tag of GUMBO_TAG_LAST would mean a whole document.
+  assert(context_tag < GUMBO_TAG_LAST);
+  return parse_with_context(
+      context && !options->collect_stats ? context : NULL, options, buffer,
+      length, context_tag, context_namespace, NULL, NULL, NULL);
+}
+
+void gumbo_destroy_parser_context(
+    const GumboOptions* options, GumboParserContext* context) {
+  GumboParser parser;
+  parser._options = options;
+  parser._stats = NULL;
+  parser._parser_state = context->_parser_state;
+  parser._tokenizer_state = context->_tokenizer_state;
   parser_state_destroy(&parser);
   gumbo_tokenizer_state_destroy(&parser);
-  return parser._output;
+  gumbo_parser_deallocate(&parser, context);
 }
 
 void gumbo_destroy_node(GumboOptions* options, GumboNode* node) {
   // Need a dummy GumboParser because the allocator comes along with the
-  // options object.
+  // options object.  This can't be used on trees from a parse that collected
+  // statistics, as there's no way to tell that from the node alone.
   GumboParser parser;
   parser._options = options;
+  parser._stats = NULL;
   destroy_node(&parser, node);
 }
 
-void gumbo_destroy_output(const GumboOptions* options, GumboOutput* output) {
+size_t gumbo_destroy_output_checked(
+    const GumboOptions* options, GumboOutput* output,
+    size_t leaked_by_category[GUMBO_ALLOCATION_LAST]) {
   // Need a dummy GumboParser because the allocator comes along with the
-  // options object.
+  // options object.  If the parse collected statistics, everything was
+  // allocated with accounting headers and must be freed the same way.
+  GumboParseStats* stats = output->stats;
+  GumboProfile* profile = output->profile;
   GumboParser parser;
   parser._options = options;
+  parser._stats = stats;
+  if (leaked_by_category) {
+    memset(leaked_by_category, 0,
+           sizeof(leaked_by_category[0]) * GUMBO_ALLOCATION_LAST);
+  }
+  if (output->is_compact) {
+    // Everything, stats and profile included, is in the one block; see
+    // compact.c.
+    parser._stats = NULL;
+    gumbo_parser_deallocate(&parser, output);
+    return 0;
+  }
   destroy_node(&parser, output->document);
   for (int i = 0; i < output->errors.length; ++i) {
     gumbo_error_destroy(&parser, output->errors.data[i]);
   }
   gumbo_vector_destroy(&parser, &output->errors);
   gumbo_parser_deallocate(&parser, output);
+  parser._stats = NULL;
+  if (profile) {
+    gumbo_parser_deallocate(&parser, profile);
+  }
+  if (!stats) {
+    return 0;
+  }
+  // Everything that the parse allocated has now been freed, so anything still
+  // counted is a leak.
+  size_t leaked = stats->current_bytes;
+  if (leaked_by_category) {
+    for (int i = 0; i < GUMBO_ALLOCATION_LAST; ++i) {
+      leaked_by_category[i] = stats->by_category[i].current_bytes;
+    }
+  }
+  for (int i = 0; i < GUMBO_ALLOCATION_LAST; ++i) {
+    if (stats->by_category[i].current_bytes) {
+      gumbo_debug("Leaked %zu bytes of %s allocations.\n",
+                  stats->by_category[i].current_bytes,
+                  gumbo_allocation_category_name(i));
+    }
+  }
+  gumbo_parser_deallocate(&parser, stats);
+  return leaked;
+}
+
+void gumbo_destroy_output(const GumboOptions* options, GumboOutput* output) {
+  size_t leaked = gumbo_destroy_output_checked(options, output, NULL);
+  assert(leaked == 0);
+  (void) leaked;
+}
+
+// State threaded through gumbo_tokenize_with_options.  Character tokens are
+// buffered here so that they can be delivered to the callback as one run.
+typedef struct {
+  GumboTokenCallback callback;
+  void* userdata;
+  GumboStringBuffer text;
+  GumboSourcePosition text_start_pos;
+  const char* text_start;
+  const char* text_end;
+  // Number of open <svg> and <math> start tags, used to approximate the
+  // tree builder's "current node is foreign" flag, which controls whether
+  // <![CDATA[ sections are recognized.
+  int foreign_depth;
+} TokenizeState;
+
+static void init_token_event(const GumboToken* token, GumboTokenEvent* event) {
+  event->position = token->position;
+  event->original_text = token->original_text;
+  event->tag = GUMBO_TAG_UNKNOWN;
+  event->tag_name = kGumboEmptyString;
+  event->attributes = NULL;
+  event->is_self_closing = false;
+  event->text = "";
+  event->text_length = 0;
+  event->public_identifier = NULL;
+  event->system_identifier = NULL;
+}
+
+// Delivers any buffered character data as a single text event.  Returns the
+// callback's verdict, or true if there was nothing to flush.
+static bool flush_text_event(GumboParser* parser, TokenizeState* state) {
+  if (state->text.length == 0) {
+    return true;
+  }
+  // The buffer isn't null-terminated, but the event contract promises that it
+  // is, so write a terminator just past the end.
+  gumbo_string_buffer_reserve(parser, state->text.length + 1, &state->text);
+  state->text.data[state->text.length] = '\0';
+
+  GumboTokenEvent event;
+  event.type = GUMBO_TOKEN_EVENT_TEXT;
+  event.position = state->text_start_pos;
+  event.original_text.data = state->text_start;
+  event.original_text.length = state->text_end - state->text_start;
+  event.tag = GUMBO_TAG_UNKNOWN;
+  event.tag_name = kGumboEmptyString;
+  event.attributes = NULL;
+  event.is_self_closing = false;
+  event.text = state->text.data;
+  event.text_length = state->text.length;
+  event.public_identifier = NULL;
+  event.system_identifier = NULL;
+  state->text.length = 0;
+  return state->callback(&event, state->userdata);
+}
+
+// Switches the tokenizer into the state that the tree construction stage would
+// select after seeing this start tag, so that raw text and RCDATA elements are
+// tokenized correctly without a tree builder driving the tokenizer.
+static void adjust_tokenizer_state_for_start_tag(
+    GumboParser* parser, TokenizeState* state, const GumboToken* token) {
+  GumboTag tag = token->v.start_tag.tag;
+  if (tag == GUMBO_TAG_SVG || tag == GUMBO_TAG_MATH) {
+    if (!token->v.start_tag.is_self_closing) {
+      ++state->foreign_depth;
+    }
+    return;
+  }
+  if (state->foreign_depth > 0) {
+    // Everything inside foreign content is tokenized as ordinary data.
+    return;
+  }
+  switch (tag) {
+    case GUMBO_TAG_TITLE:
+    case GUMBO_TAG_TEXTAREA:
+      gumbo_tokenizer_set_state(parser, GUMBO_LEX_RCDATA);
+      break;
+    case GUMBO_TAG_STYLE:
+    case GUMBO_TAG_XMP:
+    case GUMBO_TAG_IFRAME:
+    case GUMBO_TAG_NOEMBED:
+    case GUMBO_TAG_NOFRAMES:
+      gumbo_tokenizer_set_state(parser, GUMBO_LEX_RAWTEXT);
+      break;
+    case GUMBO_TAG_SCRIPT:
+      gumbo_tokenizer_set_state(parser, GUMBO_LEX_SCRIPT);
+      break;
+    case GUMBO_TAG_PLAINTEXT:
+      gumbo_tokenizer_set_state(parser, GUMBO_LEX_PLAINTEXT);
+      break;
+    default:
+      break;
+  }
+}
+
+// Converts a single token into a callback invocation (or into buffered text).
+// Takes ownership of the token.  Returns false if the callback asked to stop.
+static bool dispatch_token_event(
+    GumboParser* parser, TokenizeState* state, GumboToken* token) {
+  if (token->type == GUMBO_TOKEN_CHARACTER ||
+      token->type == GUMBO_TOKEN_WHITESPACE) {
+    if (state->text.length == 0) {
+      state->text_start = token->original_text.data;
+      state->text_start_pos = token->position;
+    }
+    state->text_end = token->original_text.data + token->original_text.length;
+    gumbo_string_buffer_append_codepoint(
+        parser, token->v.character, &state->text);
+    return true;
+  }
+  if (token->type == GUMBO_TOKEN_NULL) {
+    // Dropped, as the tree builder does in most insertion modes.
+    return true;
+  }
+
+  bool keep_going = flush_text_event(parser, state);
+  if (!keep_going || token->type == GUMBO_TOKEN_EOF) {
+    gumbo_token_destroy(parser, token);
+    return false;
+  }
+
+  GumboTokenEvent event;
+  init_token_event(token, &event);
+  switch (token->type) {
+    case GUMBO_TOKEN_DOCTYPE: {
+      const GumboTokenDocType* doc_type = &token->v.doc_type;
+      event.type = GUMBO_TOKEN_EVENT_DOCTYPE;
+      event.text = doc_type->name ? doc_type->name : "";
+      event.text_length = strlen(event.text);
+      event.public_identifier =
+          doc_type->public_identifier ? doc_type->public_identifier : "";
+      event.system_identifier =
+          doc_type->system_identifier ? doc_type->system_identifier : "";
+      break;
+    }
+    case GUMBO_TOKEN_START_TAG:
+      event.type = GUMBO_TOKEN_EVENT_START_TAG;
+      event.tag = token->v.start_tag.tag;
+      event.tag_name = token->original_text;
+      gumbo_tag_from_original_text(&event.tag_name);
+      event.attributes = &token->v.start_tag.attributes;
+      event.is_self_closing = token->v.start_tag.is_self_closing;
+      adjust_tokenizer_state_for_start_tag(parser, state, token);
+      break;
+    case GUMBO_TOKEN_END_TAG:
+      event.type = GUMBO_TOKEN_EVENT_END_TAG;
+      event.tag = token->v.end_tag;
+      event.tag_name = token->original_text;
+      gumbo_tag_from_original_text(&event.tag_name);
+      if ((event.tag == GUMBO_TAG_SVG || event.tag == GUMBO_TAG_MATH) &&
+          state->foreign_depth > 0) {
+        --state->foreign_depth;
+      }
+      break;
+    case GUMBO_TOKEN_COMMENT:
+      event.type = GUMBO_TOKEN_EVENT_COMMENT;
+      event.text = token->v.text;
+      event.text_length = strlen(token->v.text);
+      break;
+    default:
+      assert(0);
+  }
+  keep_going = state->callback(&event, state->userdata);
+  gumbo_token_destroy(parser, token);
+  return keep_going;
+}
+
+bool gumbo_tokenize(const char* buffer, size_t length,
+                    GumboTokenCallback callback, void* userdata) {
+  return gumbo_tokenize_with_options(
+      &kGumboDefaultOptions, buffer, length, callback, userdata);
+}
+
+bool gumbo_tokenize_with_options(
+    const GumboOptions* options, const char* buffer, size_t length,
+    GumboTokenCallback callback, void* userdata) {
+  GumboParser parser;
+  parser._options = options;
+  parser._parser_state = NULL;
+  parser._allocated_bytes = 0;
+  parser._stats = NULL;
+  parser._profile = NULL;
+  // The tokenizer reports errors into the output, so it needs one to exist
+  // even though no tree is ever built.
+  GumboOutput output;
+  output.document = NULL;
+  output.root = NULL;
+  parser._output = &output;
+  gumbo_init_errors(&parser);
+  gumbo_tokenizer_state_init(&parser, buffer, length);
+
+  TokenizeState state;
+  state.callback = callback;
+  state.userdata = userdata;
+  gumbo_string_buffer_init(&parser, &state.text);
+  state.text_start = buffer;
+  state.text_end = buffer;
+  state.text_start_pos = kGumboEmptySourcePosition;
+  state.foreign_depth = 0;
+
+  GumboToken token;
+  bool finished = false;
+  bool stopped = false;
+  while (!finished && !stopped) {
+    gumbo_tokenizer_set_is_current_node_foreign(
+        &parser, state.foreign_depth > 0);
+    gumbo_lex(&parser, &token);
+    finished = token.type == GUMBO_TOKEN_EOF;
+    stopped = !dispatch_token_event(&parser, &state, &token) && !finished;
+  }
+
+  gumbo_string_buffer_destroy(&parser, &state.text);
+  gumbo_tokenizer_state_destroy(&parser);
+  gumbo_destroy_errors(&parser);
+  return !stopped;
 }
@@ -20,6 +20,8 @@
 #ifndef GUMBO_PARSER_H_
 #define GUMBO_PARSER_H_
 
+#include <stddef.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -28,6 +30,8 @@ struct _GumboParserState;
 struct _GumboOutput;
 struct _GumboOptions;
 struct _GumboTokenizerState;
+struct _GumboParseStats;
+struct _GumboProfile;
 
 // An overarching struct that's threaded through (nearly) all functions in the
 // library, OOP-style.  This gives each function access to the options and
@@ -48,6 +52,20 @@ typedef struct _GumboParser {
   // The internal parser state.  Initialized on parse start and destroyed on
   // parse end; end-users will never see a non-garbage value in this pointer.
   struct _GumboParserState* _parser_state;
+
+  // The total number of bytes requested through gumbo_parser_allocate since
+  // the parse started, for enforcing GumboOptions.max_allocated_bytes.
+  size_t _allocated_bytes;
+
+  // Statistics for this parse, or NULL if they aren't being collected.  While
+  // this is set, every allocation carries a small header recording its size
+  // so that frees can be credited back; it must therefore stay the same for
+  // the lifetime of everything allocated through this parser.
+  struct _GumboParseStats* _stats;
+
+  // The profile being collected, or NULL.  Only ever set in GUMBO_PROFILE
+  // builds.
+  struct _GumboProfile* _profile;
 } GumboParser;
 
 #ifdef __cplusplus
@@ -0,0 +1,219 @@
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Names for the profile's counters, and the text report.  The counting itself
+// is inlined from profile.h into the tokenizer and parser.
+
+#include "profile.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+
+#include "insertion_mode.h"
+#include "tokenizer_states.h"
+
+// In the order of GumboTokenizerEnum.
+static const char* kTokenizerStateNames[] = {
+  "data",
+  "char ref in data",
+  "rcdata",
+  "char ref in rcdata",
+  "rawtext",
+  "script",
+  "plaintext",
+  "tag open",
+  "end tag open",
+  "tag name",
+  "rcdata lt",
+  "rcdata end tag open",
+  "rcdata end tag name",
+  "rawtext lt",
+  "rawtext end tag open",
+  "rawtext end tag name",
+  "script lt",
+  "script end tag open",
+  "script end tag name",
+  "script escaped start",
+  "script escaped start dash",
+  "script escaped",
+  "script escaped dash",
+  "script escaped dash dash",
+  "script escaped lt",
+  "script escaped end tag open",
+  "script escaped end tag name",
+  "script double escaped start",
+  "script double escaped",
+  "script double escaped dash",
+  "script double escaped dash dash",
+  "script double escaped lt",
+  "script double escaped end",
+  "before attr name",
+  "attr name",
+  "after attr name",
+  "before attr value",
+  "attr value double quoted",
+  "attr value single quoted",
+  "attr value unquoted",
+  "char ref in attr value",
+  "after attr value quoted",
+  "self closing start tag",
+  "bogus comment",
+  "markup declaration",
+  "comment start",
+  "comment start dash",
+  "comment",
+  "comment end dash",
+  "comment end",
+  "comment end bang",
+  "doctype",
+  "before doctype name",
+  "doctype name",
+  "after doctype name",
+  "after doctype public keyword",
+  "before doctype public id",
+  "doctype public id double quoted",
+  "doctype public id single quoted",
+  "after doctype public id",
+  "between doctype public system id",
+  "after doctype system keyword",
+  "before doctype system id",
+  "doctype system id double quoted",
+  "doctype system id single quoted",
+  "after doctype system id",
+  "bogus doctype",
+  "cdata",
+};
+
+// In the order of GumboInsertionMode.
+static const char* kInsertionModeNames[] = {
+  "initial",
+  "before html",
+  "before head",
+  "in head",
+  "in head noscript",
+  "after head",
+  "in body",
+  "text",
+  "in table",
+  "in table text",
+  "in caption",
+  "in column group",
+  "in table body",
+  "in row",
+  "in cell",
+  "in select",
+  "in select in table",
+  "after body",
+  "in frameset",
+  "after frameset",
+  "after after body",
+  "after after frameset",
+};
+
+// Fails to compile if the public counts drift from the internal enums.
+typedef char TokenizerStateCountCheck[
+    GUMBO_PROFILE_TOKENIZER_STATES == GUMBO_LEX_CDATA + 1 &&
+    sizeof(kTokenizerStateNames) / sizeof(kTokenizerStateNames[0]) ==
+        GUMBO_PROFILE_TOKENIZER_STATES ? 1 : -1];
+typedef char InsertionModeCountCheck[
+    GUMBO_PROFILE_INSERTION_MODES ==
+        GUMBO_INSERTION_MODE_AFTER_AFTER_FRAMESET + 1 &&
+    sizeof(kInsertionModeNames) / sizeof(kInsertionModeNames[0]) ==
+        GUMBO_PROFILE_INSERTION_MODES ? 1 : -1];
+
+const char* gumbo_profile_tokenizer_state_name(int state) {
+  if (state < 0 || state >= GUMBO_PROFILE_TOKENIZER_STATES) {
+    return NULL;
+  }
+  return kTokenizerStateNames[state];
+}
+
+const char* gumbo_profile_insertion_mode_name(int mode) {
+  if (mode < 0 || mode >= GUMBO_PROFILE_INSERTION_MODES) {
+    return NULL;
+  }
+  return kInsertionModeNames[mode];
+}
+
+// Like snprintf, but appends to a report that may already have been
+// truncated.  *length is the length the full report would have so far.
+static void append(char* buffer, size_t size, size_t* length,
+                   const char* format, ...) {
+  va_list args;
+  va_start(args, format);
+  size_t remaining = *length < size ? size - *length : 0;
+  int written = vsnprintf(
+      remaining ? buffer + *length : NULL, remaining, format, args);
+  va_end(args);
+  if (written > 0) {
+    *length += written;
+  }
+}
+
+// Appends one section of the report: a heading, then a line for each counter
+// that was entered at all, busiest first.
+static void append_section(
+    const char* heading, const GumboProfileCounter* counters,
+    const char** names, int count, char* buffer, size_t size,
+    size_t* length) {
+  int order[GUMBO_PROFILE_TOKENIZER_STATES];
+  uint64_t total_ticks = 0;
+  int used = 0;
+  for (int i = 0; i < count; ++i) {
+    if (counters[i].entries == 0) {
+      continue;
+    }
+    total_ticks += counters[i].ticks;
+    // Insertion sort, by ticks descending; there are only a few dozen.
+    int j = used++;
+    for (; j > 0 && counters[order[j - 1]].ticks < counters[i].ticks; --j) {
+      order[j] = order[j - 1];
+    }
+    order[j] = i;
+  }
+
+  append(buffer, size, length, "%-34s %12s %14s %10s %7s\n",
+         heading, "entries", "ticks", "per entry", "share");
+  for (int i = 0; i < used; ++i) {
+    const GumboProfileCounter* counter = &counters[order[i]];
+    append(buffer, size, length, "  %-32s %12llu %14llu %10.1f %6.1f%%\n",
+           names[order[i]], (unsigned long long) counter->entries,
+           (unsigned long long) counter->ticks,
+           (double) counter->ticks / counter->entries,
+           total_ticks ? 100.0 * counter->ticks / total_ticks : 0.0);
+  }
+}
+
+size_t gumbo_profile_report(
+    const GumboProfile* profile, char* buffer, size_t size) {
+  size_t length = 0;
+  if (size > 0) {
+    buffer[0] = '\0';
+  }
+  append(buffer, size, &length, "Ticks are %s.\n\n",
+         profile->ticks_are_ns ? "nanoseconds" : "timestamp-counter cycles");
+  append_section("tokenizer state", profile->tokenizer_states,
+                 kTokenizerStateNames, GUMBO_PROFILE_TOKENIZER_STATES,
+                 buffer, size, &length);
+  append(buffer, size, &length, "\n");
+  append_section("insertion mode", profile->insertion_modes,
+                 kInsertionModeNames, GUMBO_PROFILE_INSERTION_MODES,
+                 buffer, size, &length);
+  const GumboProfileCounter* foreign = &profile->foreign_content;
+  if (foreign->entries) {
+    append(buffer, size, &length, "  %-32s %12llu %14llu %10.1f\n",
+           "(foreign content)", (unsigned long long) foreign->entries,
+           (unsigned long long) foreign->ticks,
+           (double) foreign->ticks / foreign->entries);
+  }
+  return length;
+}
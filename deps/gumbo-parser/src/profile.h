@@ -0,0 +1,77 @@
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Helpers for the per-state and per-insertion-mode profile, which is only
+// collected when the library is compiled with -DGUMBO_PROFILE.  Call sites
+// look like:
+//
+//   #ifdef GUMBO_PROFILE
+//     uint64_t start = gumbo_profile_ticks();
+//   #endif
+//     ...
+//   #ifdef GUMBO_PROFILE
+//     gumbo_profile_count(counter, start);
+//   #endif
+
+#ifndef GUMBO_PROFILE_H_
+#define GUMBO_PROFILE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "gumbo.h"
+#include "util.h"
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#define GUMBO_PROFILE_HAS_TSC 1
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define GUMBO_PROFILE_HAS_TSC 1
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// True if gumbo_profile_ticks falls back to nanoseconds.
+#ifdef GUMBO_PROFILE_HAS_TSC
+#define GUMBO_PROFILE_TICKS_ARE_NS false
+#else
+#define GUMBO_PROFILE_TICKS_ARE_NS true
+#endif
+
+// Returns the timestamp counter, which is much cheaper to read than the clock
+// and so can be read around every character.
+static inline uint64_t gumbo_profile_ticks() {
+#ifdef GUMBO_PROFILE_HAS_TSC
+  return __rdtsc();
+#else
+  return gumbo_monotonic_time_ns();
+#endif
+}
+
+// Adds one entry, which started at start, to counter.  counter may be NULL if
+// the parse isn't being profiled (gumbo_tokenize doesn't profile, for one).
+static inline void gumbo_profile_count(
+    GumboProfileCounter* counter, uint64_t start) {
+  if (counter) {
+    ++counter->entries;
+    counter->ticks += gumbo_profile_ticks() - start;
+  }
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // GUMBO_PROFILE_H_
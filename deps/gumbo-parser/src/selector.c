@@ -0,0 +1,535 @@
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Compiling and matching the CSS selectors used by gumbo_parse_matching.  A
+// selector is compiled into flat arrays of compound selectors and of the
+// attribute tests they're made of, and matched right to left, from the element
+// up through its ancestors.
+
+#include <assert.h>
+#include <stdbool.h>
+#include <string.h>
+#include <strings.h>
+
+#include "gumbo.h"
+#include "parser.h"
+#include "util.h"
+
+// How an attribute test compares the attribute's value with its own.
+typedef enum {
+  ATTRIBUTE_EXISTS,       // [name]
+  ATTRIBUTE_EQUALS,       // [name=value], and #id
+  ATTRIBUTE_INCLUDES,     // [name~=value], and .class
+  ATTRIBUTE_DASH_PREFIX,  // [name|=value]
+  ATTRIBUTE_PREFIX,       // [name^=value]
+  ATTRIBUTE_SUFFIX,       // [name$=value]
+  ATTRIBUTE_SUBSTRING     // [name*=value]
+} AttributeOperator;
+
+typedef struct {
+  // The attribute's atom, or GUMBO_ATTR_UNKNOWN, in which case name is its
+  // lowercased name.
+  GumboAttributeAtom atom;
+  const char* name;
+  AttributeOperator op;
+  const char* value;
+  size_t value_length;
+} AttributeTest;
+
+// How a compound selector is joined to the one before it.
+typedef enum {
+  COMBINATOR_NONE,        // It's the first in its complex selector.
+  COMBINATOR_DESCENDANT,
+  COMBINATOR_CHILD
+} Combinator;
+
+typedef struct {
+  Combinator combinator;
+  // The tag of the type selector, or GUMBO_TAG_LAST if there's none or it's *.
+  // For GUMBO_TAG_UNKNOWN, tag_name is the lowercased name.
+  GumboTag tag;
+  const char* tag_name;
+  unsigned int first_test;
+  unsigned int test_count;
+} CompoundSelector;
+
+// The complex selectors of a list follow each other in compounds, each
+// starting with a COMBINATOR_NONE one.
+struct _GumboSelector {
+  CompoundSelector* compounds;
+  unsigned int compound_count;
+  AttributeTest* tests;
+  unsigned int test_count;
+  char* strings;
+};
+
+// The compiler makes two passes over the selector: the first, with selector
+// NULL, only checks it and counts what it needs, and the second fills in the
+// arrays allocated from those counts.
+typedef struct {
+  const char* next;
+  GumboSelector* selector;
+  unsigned int compound_count;
+  unsigned int test_count;
+  size_t strings_length;
+} Compiler;
+
+static bool is_whitespace(char c) {
+  return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\f';
+}
+
+static bool is_name_char(char c) {
+  return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+         (c >= '0' && c <= '9') || c == '-' || c == '_' ||
+         (unsigned char) c >= 0x80;
+}
+
+// Skips whitespace, returning true if there was any.
+static bool skip_whitespace(Compiler* compiler) {
+  const char* start = compiler->next;
+  while (is_whitespace(*compiler->next)) {
+    ++compiler->next;
+  }
+  return compiler->next != start;
+}
+
+// Copies length bytes into the string pool (lowercased if asked to), and
+// returns the copy; NULL in the counting pass.
+static const char* add_string(
+    Compiler* compiler, const char* data, size_t length, bool lowercase) {
+  char* copy = NULL;
+  if (compiler->selector) {
+    copy = compiler->selector->strings + compiler->strings_length;
+    for (size_t i = 0; i < length; ++i) {
+      char c = data[i];
+      copy[i] = lowercase && c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c;
+    }
+    copy[length] = '\0';
+  }
+  compiler->strings_length += length + 1;
+  return copy;
+}
+
+// Reads a name (a tag, id, class or attribute name), setting *length to its
+// length, which is 0 if there isn't one.
+static const char* read_name(Compiler* compiler, size_t* length) {
+  const char* start = compiler->next;
+  while (is_name_char(*compiler->next)) {
+    ++compiler->next;
+  }
+  *length = compiler->next - start;
+  return start;
+}
+
+static AttributeTest* add_test(
+    Compiler* compiler, const char* name, size_t name_length,
+    AttributeOperator op) {
+  AttributeTest* test = NULL;
+  if (compiler->selector) {
+    test = &compiler->selector->tests[compiler->test_count];
+    test->op = op;
+    test->value = NULL;
+    test->value_length = 0;
+  }
+  ++compiler->test_count;
+  const char* copy = add_string(compiler, name, name_length, true);
+  if (test) {
+    test->name = copy;
+    test->atom = gumbo_attribute_atom(copy, name_length);
+  }
+  return test;
+}
+
+static void set_test_value(
+    Compiler* compiler, AttributeTest* test, const char* value,
+    size_t length) {
+  const char* copy = add_string(compiler, value, length, false);
+  if (test) {
+    test->value = copy;
+    test->value_length = length;
+  }
+}
+
+// Reads the part of an attribute selector after the [.
+static bool compile_attribute_test(Compiler* compiler) {
+  skip_whitespace(compiler);
+  size_t name_length;
+  const char* name = read_name(compiler, &name_length);
+  if (name_length == 0) {
+    return false;
+  }
+  skip_whitespace(compiler);
+  if (*compiler->next == ']') {
+    ++compiler->next;
+    add_test(compiler, name, name_length, ATTRIBUTE_EXISTS);
+    return true;
+  }
+
+  AttributeOperator op;
+  switch (*compiler->next) {
+    case '=':
+      op = ATTRIBUTE_EQUALS;
+      break;
+    case '~':
+      op = ATTRIBUTE_INCLUDES;
+      break;
+    case '|':
+      op = ATTRIBUTE_DASH_PREFIX;
+      break;
+    case '^':
+      op = ATTRIBUTE_PREFIX;
+      break;
+    case '$':
+      op = ATTRIBUTE_SUFFIX;
+      break;
+    case '*':
+      op = ATTRIBUTE_SUBSTRING;
+      break;
+    default:
+      return false;
+  }
+  ++compiler->next;
+  if (op != ATTRIBUTE_EQUALS && *compiler->next++ != '=') {
+    return false;
+  }
+  skip_whitespace(compiler);
+
+  const char* value;
+  size_t value_length;
+  char quote = *compiler->next;
+  if (quote == '"' || quote == '\'') {
+    value = ++compiler->next;
+    while (*compiler->next && *compiler->next != quote) {
+      if (*compiler->next == '\\') {
+        return false;
+      }
+      ++compiler->next;
+    }
+    if (!*compiler->next) {
+      return false;
+    }
+    value_length = compiler->next++ - value;
+  } else {
+    value = read_name(compiler, &value_length);
+    if (value_length == 0) {
+      return false;
+    }
+  }
+  skip_whitespace(compiler);
+  if (*compiler->next++ != ']') {
+    return false;
+  }
+  AttributeTest* test = add_test(compiler, name, name_length, op);
+  set_test_value(compiler, test, value, value_length);
+  return true;
+}
+
+// Reads a compound selector: an optional type selector followed by any number
+// of id, class and attribute selectors, at least one of the two.
+static bool compile_compound(Compiler* compiler, Combinator combinator) {
+  CompoundSelector* compound = NULL;
+  if (compiler->selector) {
+    compound = &compiler->selector->compounds[compiler->compound_count];
+    compound->combinator = combinator;
+    compound->tag = GUMBO_TAG_LAST;
+    compound->tag_name = NULL;
+    compound->first_test = compiler->test_count;
+  }
+  ++compiler->compound_count;
+  unsigned int first_test = compiler->test_count;
+
+  bool has_type = false;
+  size_t length;
+  const char* name = read_name(compiler, &length);
+  if (length > 0) {
+    has_type = true;
+    const char* copy = add_string(compiler, name, length, true);
+    if (compound) {
+      compound->tag = gumbo_tag_enum(copy);
+      compound->tag_name = copy;
+    }
+  } else if (*compiler->next == '*') {
+    has_type = true;
+    ++compiler->next;
+  }
+
+  while (true) {
+    char c = *compiler->next;
+    if (c == '#' || c == '.') {
+      ++compiler->next;
+      const char* value = read_name(compiler, &length);
+      if (length == 0) {
+        return false;
+      }
+      AttributeTest* test = c == '#' ?
+          add_test(compiler, "id", 2, ATTRIBUTE_EQUALS) :
+          add_test(compiler, "class", 5, ATTRIBUTE_INCLUDES);
+      set_test_value(compiler, test, value, length);
+    } else if (c == '[') {
+      ++compiler->next;
+      if (!compile_attribute_test(compiler)) {
+        return false;
+      }
+    } else {
+      break;
+    }
+  }
+  if (compound) {
+    compound->test_count = compiler->test_count - first_test;
+  }
+  return has_type || compiler->test_count > first_test;
+}
+
+// Reads a whole selector list.
+static bool compile_selector_list(Compiler* compiler) {
+  skip_whitespace(compiler);
+  while (true) {
+    // A complex selector: compound selectors joined by combinators.
+    if (!compile_compound(compiler, COMBINATOR_NONE)) {
+      return false;
+    }
+    while (true) {
+      bool had_whitespace = skip_whitespace(compiler);
+      char c = *compiler->next;
+      if (c == '>') {
+        ++compiler->next;
+        skip_whitespace(compiler);
+        if (!compile_compound(compiler, COMBINATOR_CHILD)) {
+          return false;
+        }
+      } else if (had_whitespace && c && c != ',') {
+        if (!compile_compound(compiler, COMBINATOR_DESCENDANT)) {
+          return false;
+        }
+      } else {
+        break;
+      }
+    }
+    if (*compiler->next == '\0') {
+      return true;
+    }
+    if (*compiler->next++ != ',') {
+      return false;
+    }
+    skip_whitespace(compiler);
+  }
+}
+
+GumboSelector* gumbo_compile_selector(
+    const GumboOptions* options, const char* text) {
+  Compiler compiler;
+  memset(&compiler, 0, sizeof(compiler));
+  compiler.next = text;
+  if (!compile_selector_list(&compiler)) {
+    return NULL;
+  }
+
+  GumboParser parser;
+  parser._options = options;
+  parser._allocated_bytes = 0;
+  parser._stats = NULL;
+  GumboSelector* selector = gumbo_parser_allocate(
+      &parser, sizeof(GumboSelector), GUMBO_ALLOCATION_OTHER);
+  selector->compound_count = compiler.compound_count;
+  selector->compounds = gumbo_parser_allocate(
+      &parser, sizeof(CompoundSelector) * compiler.compound_count,
+      GUMBO_ALLOCATION_OTHER);
+  selector->test_count = compiler.test_count;
+  selector->tests = gumbo_parser_allocate(
+      &parser, sizeof(AttributeTest) * compiler.test_count,
+      GUMBO_ALLOCATION_OTHER);
+  selector->strings = gumbo_parser_allocate(
+      &parser, compiler.strings_length, GUMBO_ALLOCATION_TEXT);
+
+  memset(&compiler, 0, sizeof(compiler));
+  compiler.next = text;
+  compiler.selector = selector;
+  bool ok = compile_selector_list(&compiler);
+  assert(ok);
+  assert(compiler.compound_count == selector->compound_count);
+  assert(compiler.test_count == selector->test_count);
+  (void) ok;
+  return selector;
+}
+
+void gumbo_destroy_selector(
+    const GumboOptions* options, GumboSelector* selector) {
+  GumboParser parser;
+  parser._options = options;
+  parser._stats = NULL;
+  gumbo_parser_deallocate(&parser, selector->compounds);
+  gumbo_parser_deallocate(&parser, selector->tests);
+  gumbo_parser_deallocate(&parser, selector->strings);
+  gumbo_parser_deallocate(&parser, selector);
+}
+
+// Returns true if the whitespace-separated list in data contains word.
+static bool list_contains(
+    const char* data, size_t length, const char* word, size_t word_length) {
+  size_t i = 0;
+  while (i < length) {
+    while (i < length && is_whitespace(data[i])) {
+      ++i;
+    }
+    size_t start = i;
+    while (i < length && !is_whitespace(data[i])) {
+      ++i;
+    }
+    if (i - start == word_length && i > start &&
+        memcmp(data + start, word, word_length) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static bool matches_test(
+    const AttributeTest* test, const GumboVector* attributes) {
+  const GumboAttribute* attr = NULL;
+  if (test->atom != GUMBO_ATTR_UNKNOWN) {
+    attr = gumbo_get_attribute_by_atom(attributes, test->atom);
+  } else {
+    for (int i = 0; i < attributes->length; ++i) {
+      GumboAttribute* candidate = attributes->data[i];
+      if (!strcasecmp(candidate->name, test->name)) {
+        attr = candidate;
+        break;
+      }
+    }
+  }
+  if (!attr) {
+    return false;
+  }
+
+  const char* value = attr->value;
+  size_t length = attr->value_length;
+  size_t test_length = test->value_length;
+  switch (test->op) {
+    case ATTRIBUTE_EXISTS:
+      return true;
+    case ATTRIBUTE_EQUALS:
+      return length == test_length &&
+             memcmp(value, test->value, length) == 0;
+    case ATTRIBUTE_INCLUDES:
+      return list_contains(value, length, test->value, test_length);
+    case ATTRIBUTE_DASH_PREFIX:
+      return length >= test_length &&
+             memcmp(value, test->value, test_length) == 0 &&
+             (length == test_length || value[test_length] == '-');
+    case ATTRIBUTE_PREFIX:
+      return test_length > 0 && length >= test_length &&
+             memcmp(value, test->value, test_length) == 0;
+    case ATTRIBUTE_SUFFIX:
+      return test_length > 0 && length >= test_length &&
+             memcmp(value + length - test_length, test->value,
+                    test_length) == 0;
+    case ATTRIBUTE_SUBSTRING:
+      if (test_length == 0) {
+        return false;
+      }
+      for (size_t i = 0; i + test_length <= length; ++i) {
+        if (memcmp(value + i, test->value, test_length) == 0) {
+          return true;
+        }
+      }
+      return false;
+  }
+  return false;
+}
+
+static bool matches_compound(
+    const GumboSelector* selector, const CompoundSelector* compound,
+    const GumboElement* element) {
+  if (compound->tag != GUMBO_TAG_LAST) {
+    if (element->tag != compound->tag) {
+      return false;
+    }
+    if (compound->tag == GUMBO_TAG_UNKNOWN) {
+      GumboStringPiece name = element->original_tag;
+      gumbo_tag_from_original_text(&name);
+      if (name.length != strlen(compound->tag_name) ||
+          strncasecmp(name.data, compound->tag_name, name.length) != 0) {
+        return false;
+      }
+    }
+  }
+  for (unsigned int i = 0; i < compound->test_count; ++i) {
+    if (!matches_test(&selector->tests[compound->first_test + i],
+                      &element->attributes)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static const GumboNode* get_parent_element(const GumboNode* node) {
+  const GumboNode* parent = node->parent;
+  return parent && parent->type == GUMBO_NODE_ELEMENT ? parent : NULL;
+}
+
+typedef enum {
+  MATCHED,
+  NOT_MATCHED,
+  // Not matched, and no ancestor further up would do any better either.
+  NOT_MATCHED_GLOBALLY
+} MatchResult;
+
+// Matches compounds[first..last] against node, last first.  When a descendant
+// combinator has been tried against every ancestor without success, trying
+// the compounds to its right at a higher element can't help, so that's
+// reported as NOT_MATCHED_GLOBALLY to cut the search short.  Recursion is only
+// as deep as the selector is long.
+static MatchResult match_complex(
+    const GumboSelector* selector, unsigned int first, unsigned int last,
+    const GumboNode* node) {
+  const CompoundSelector* compound = &selector->compounds[last];
+  if (!matches_compound(selector, compound, &node->v.element)) {
+    return NOT_MATCHED;
+  }
+  if (last == first) {
+    return MATCHED;
+  }
+  const GumboNode* ancestor = get_parent_element(node);
+  if (compound->combinator == COMBINATOR_CHILD) {
+    return ancestor ?
+        match_complex(selector, first, last - 1, ancestor) :
+        NOT_MATCHED_GLOBALLY;
+  }
+  assert(compound->combinator == COMBINATOR_DESCENDANT);
+  for (; ancestor; ancestor = get_parent_element(ancestor)) {
+    MatchResult result = match_complex(selector, first, last - 1, ancestor);
+    if (result != NOT_MATCHED) {
+      return result;
+    }
+  }
+  return NOT_MATCHED_GLOBALLY;
+}
+
+bool gumbo_selector_matches(
+    const GumboSelector* selector, const GumboNode* node) {
+  if (node->type != GUMBO_NODE_ELEMENT) {
+    return false;
+  }
+  unsigned int first = 0;
+  while (first < selector->compound_count) {
+    unsigned int end = first + 1;
+    while (end < selector->compound_count &&
+           selector->compounds[end].combinator != COMBINATOR_NONE) {
+      ++end;
+    }
+    if (match_complex(selector, first, end - 1, node) == MATCHED) {
+      return true;
+    }
+    first = end;
+  }
+  return false;
+}
@@ -0,0 +1,278 @@
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// The on-disk form of a GumboPackedTree.  A serialized tree is a header
+// followed by the node, element, text and attribute tables exactly as they're
+// laid out in memory, then the string pool, then (optionally) the input the
+// tree was parsed from.  Since the packed tables only ever refer to each other
+// by index or offset, loading one is a matter of checking it and pointing a
+// GumboPackedTree at the tables in place.
+
+#include <stdint.h>
+#include <string.h>
+
+#include "gumbo.h"
+
+static const char kMagic[8] = "GUMBOPT";
+
+// Written in the machine's byte order, so that a tree written on a machine
+// with the other one is rejected rather than misread.
+static const uint32_t kByteOrderMark = 0x01020304;
+
+// Every field is 32 bits wide, so there's no padding, and the tables that
+// follow stay 4-byte aligned.
+typedef struct {
+  char magic[8];
+  uint32_t version;
+  uint32_t byte_order;
+
+  // The sizes of the table records, which vary with the compiler's layout.
+  uint32_t node_size;
+  uint32_t element_size;
+  uint32_t text_size;
+  uint32_t attribute_size;
+
+  uint32_t node_count;
+  uint32_t element_count;
+  uint32_t text_count;
+  uint32_t attribute_count;
+  uint32_t strings_length;
+  uint32_t has_input;
+  uint32_t input_length;
+
+  uint32_t root;
+  uint32_t has_doctype;
+  uint32_t doctype_name;
+  uint32_t doctype_public_identifier;
+  uint32_t doctype_system_identifier;
+  uint32_t doc_type_quirks_mode;
+  uint32_t status;
+} SerializedHeader;
+
+// The size of everything after the header.  64-bit arithmetic throughout, so
+// that the counts from a corrupt header can't wrap.
+static uint64_t tables_size(const SerializedHeader* header) {
+  return (uint64_t) header->node_count * sizeof(GumboPackedNode) +
+         (uint64_t) header->element_count * sizeof(GumboPackedElement) +
+         (uint64_t) header->text_count * sizeof(GumboPackedText) +
+         (uint64_t) header->attribute_count * sizeof(GumboPackedAttribute) +
+         header->strings_length + header->input_length;
+}
+
+// Appends length bytes to the output, if it's big enough.
+static char* append(char* out, const void* data, size_t length) {
+  if (out && length > 0) {
+    memcpy(out, data, length);
+  }
+  return out ? out + length : NULL;
+}
+
+size_t gumbo_serialize_packed_tree(
+    const GumboPackedTree* tree, const char* input, size_t input_length,
+    void* buffer, size_t size) {
+  SerializedHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, kMagic, sizeof(kMagic));
+  header.version = GUMBO_SERIALIZED_TREE_VERSION;
+  header.byte_order = kByteOrderMark;
+  header.node_size = sizeof(GumboPackedNode);
+  header.element_size = sizeof(GumboPackedElement);
+  header.text_size = sizeof(GumboPackedText);
+  header.attribute_size = sizeof(GumboPackedAttribute);
+  header.node_count = tree->node_count;
+  header.element_count = tree->element_count;
+  header.text_count = tree->text_count;
+  header.attribute_count = tree->attribute_count;
+  header.strings_length = tree->strings_length;
+  header.has_input = input != NULL;
+  header.input_length = input ? input_length : 0;
+  header.root = tree->root;
+  header.has_doctype = tree->has_doctype;
+  header.doctype_name = tree->doctype_name;
+  header.doctype_public_identifier = tree->doctype_public_identifier;
+  header.doctype_system_identifier = tree->doctype_system_identifier;
+  header.doc_type_quirks_mode = tree->doc_type_quirks_mode;
+  header.status = tree->status;
+
+  size_t total = sizeof(header) + tables_size(&header);
+  if (size < total) {
+    return total;
+  }
+  char* out = buffer;
+  out = append(out, &header, sizeof(header));
+  out = append(out, tree->nodes, sizeof(GumboPackedNode) * tree->node_count);
+  out = append(
+      out, tree->elements, sizeof(GumboPackedElement) * tree->element_count);
+  out = append(out, tree->texts, sizeof(GumboPackedText) * tree->text_count);
+  out = append(out, tree->attributes,
+               sizeof(GumboPackedAttribute) * tree->attribute_count);
+  out = append(out, tree->strings, tree->strings_length);
+  append(out, input, header.input_length);
+  return total;
+}
+
+// True if offset is the start of a string of at least length bytes, plus its
+// terminator, in the pool.
+static bool is_valid_string(
+    const GumboPackedTree* tree, uint32_t offset, uint64_t length) {
+  return (uint64_t) offset + length < tree->strings_length;
+}
+
+// Checks every index and offset in the tables, so that a reader can follow
+// them without bounds checks of its own.  Parents come before their children
+// and siblings after each other, as they do in document order, so walking the
+// tree always terminates; and the parent, child count and sibling links all
+// describe the same tree, so it doesn't matter which of them a reader uses.
+static bool is_valid_tree(
+    const GumboPackedTree* tree, uint32_t input_length, bool has_input) {
+  if (tree->node_count == 0 || tree->root >= tree->node_count ||
+      tree->strings_length == 0 ||
+      tree->strings[tree->strings_length - 1] != '\0' ||
+      !is_valid_string(tree, tree->doctype_name, 0) ||
+      !is_valid_string(tree, tree->doctype_public_identifier, 0) ||
+      !is_valid_string(tree, tree->doctype_system_identifier, 0)) {
+    return false;
+  }
+  // Each node's children are checked by following the sibling links from its
+  // first child, which stops at the first node with another parent, so this
+  // is linear overall.  The chains don't overlap, so once they add up to
+  // every node but the document, each node is on its parent's.
+  uint64_t total_child_count = 0;
+  for (uint32_t i = 0; i < tree->node_count; ++i) {
+    const GumboPackedNode* node = &tree->nodes[i];
+    if ((i == 0) != (node->type == GUMBO_NODE_DOCUMENT) ||
+        (i == 0) != (node->parent == GUMBO_PACKED_NONE) ||
+        (i > 0 && node->parent >= i) ||
+        (node->next_sibling != GUMBO_PACKED_NONE &&
+         (node->next_sibling <= i || node->next_sibling >= tree->node_count)) ||
+        node->child_count >= tree->node_count ||
+        (has_input && node->offset > input_length)) {
+      return false;
+    }
+    uint32_t child = node->child_count > 0 ? i + 1 : GUMBO_PACKED_NONE;
+    for (uint32_t n = 0; n < node->child_count; ++n) {
+      if (child >= tree->node_count || tree->nodes[child].parent != i) {
+        return false;
+      }
+      child = tree->nodes[child].next_sibling;
+    }
+    if (child != GUMBO_PACKED_NONE) {
+      return false;
+    }
+    total_child_count += node->child_count;
+    switch (node->type) {
+      case GUMBO_NODE_DOCUMENT:
+        break;
+      case GUMBO_NODE_ELEMENT: {
+        if (node->data >= tree->element_count) {
+          return false;
+        }
+        const GumboPackedElement* element = &tree->elements[node->data];
+        if ((uint64_t) element->first_attribute + element->attribute_count >
+                tree->attribute_count ||
+            element->tag > GUMBO_TAG_LAST ||
+            element->tag_namespace > GUMBO_NAMESPACE_MATHML ||
+            (has_input &&
+             ((uint64_t) node->offset + element->original_tag_length >
+                  input_length ||
+              element->end_offset > input_length))) {
+          return false;
+        }
+        break;
+      }
+      case GUMBO_NODE_TEXT:
+      case GUMBO_NODE_CDATA:
+      case GUMBO_NODE_COMMENT:
+      case GUMBO_NODE_WHITESPACE: {
+        if (node->child_count > 0 || node->data >= tree->text_count) {
+          return false;
+        }
+        const GumboPackedText* text = &tree->texts[node->data];
+        if (!is_valid_string(tree, text->text, text->length)) {
+          return false;
+        }
+        break;
+      }
+      default:
+        return false;
+    }
+  }
+  if (total_child_count != tree->node_count - 1) {
+    return false;
+  }
+  for (uint32_t i = 0; i < tree->attribute_count; ++i) {
+    const GumboPackedAttribute* attribute = &tree->attributes[i];
+    if (!is_valid_string(tree, attribute->name, 0) ||
+        !is_valid_string(tree, attribute->value, attribute->value_length) ||
+        attribute->atom > GUMBO_ATTR_LAST ||
+        attribute->attr_namespace > GUMBO_ATTR_NAMESPACE_XMLNS) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool gumbo_deserialize_packed_tree(
+    const void* data, size_t size, GumboPackedTree* tree,
+    const char** input, size_t* input_length) {
+  const SerializedHeader* header = data;
+  if (size < sizeof(SerializedHeader) ||
+      (uintptr_t) data % sizeof(uint32_t) != 0 ||
+      memcmp(header->magic, kMagic, sizeof(kMagic)) != 0 ||
+      header->version != GUMBO_SERIALIZED_TREE_VERSION ||
+      header->byte_order != kByteOrderMark ||
+      header->node_size != sizeof(GumboPackedNode) ||
+      header->element_size != sizeof(GumboPackedElement) ||
+      header->text_size != sizeof(GumboPackedText) ||
+      header->attribute_size != sizeof(GumboPackedAttribute) ||
+      header->doc_type_quirks_mode > GUMBO_DOCTYPE_LIMITED_QUIRKS ||
+      header->status > GUMBO_STATUS_CANCELLED ||
+      tables_size(header) > size - sizeof(SerializedHeader)) {
+    return false;
+  }
+
+  const char* next = (const char*) (header + 1);
+  tree->nodes = (const GumboPackedNode*) next;
+  tree->node_count = header->node_count;
+  next += sizeof(GumboPackedNode) * header->node_count;
+  tree->elements = (const GumboPackedElement*) next;
+  tree->element_count = header->element_count;
+  next += sizeof(GumboPackedElement) * header->element_count;
+  tree->texts = (const GumboPackedText*) next;
+  tree->text_count = header->text_count;
+  next += sizeof(GumboPackedText) * header->text_count;
+  tree->attributes = (const GumboPackedAttribute*) next;
+  tree->attribute_count = header->attribute_count;
+  next += sizeof(GumboPackedAttribute) * header->attribute_count;
+  tree->strings = next;
+  tree->strings_length = header->strings_length;
+  next += header->strings_length;
+
+  tree->root = header->root;
+  tree->has_doctype = header->has_doctype != 0;
+  tree->doctype_name = header->doctype_name;
+  tree->doctype_public_identifier = header->doctype_public_identifier;
+  tree->doctype_system_identifier = header->doctype_system_identifier;
+  tree->doc_type_quirks_mode = header->doc_type_quirks_mode;
+  tree->status = header->status;
+  if (!is_valid_tree(tree, header->input_length, header->has_input)) {
+    return false;
+  }
+
+  if (input) {
+    *input = header->has_input ? next : NULL;
+  }
+  if (input_length) {
+    *input_length = header->input_length;
+  }
+  return true;
+}
@@ -37,17 +37,17 @@ static void maybe_resize_string_buffer(
     new_capacity *= 2;
   }
   if (new_capacity != buffer->capacity) {
-    char* new_data = gumbo_parser_allocate(parser, new_capacity);
-    memcpy(new_data, buffer->data, buffer->length);
-    gumbo_parser_deallocate(parser, buffer->data);
-    buffer->data = new_data;
+    buffer->data = gumbo_parser_reallocate(
+        parser, buffer->data, buffer->length, new_capacity,
+        GUMBO_ALLOCATION_STRING_BUFFER);
     buffer->capacity = new_capacity;
   }
 }
 
 void gumbo_string_buffer_init(
     struct _GumboParser* parser, GumboStringBuffer* output) {
-  output->data = gumbo_parser_allocate(parser, kDefaultStringBufferSize);
+  output->data = gumbo_parser_allocate(
+      parser, kDefaultStringBufferSize, GUMBO_ALLOCATION_STRING_BUFFER);
   output->length = 0;
   output->capacity = kDefaultStringBufferSize;
 }
@@ -94,12 +94,18 @@ void gumbo_string_buffer_append_string(
 
 char* gumbo_string_buffer_to_string(
     struct _GumboParser* parser, GumboStringBuffer* input) {
-  char* buffer = gumbo_parser_allocate(parser, input->length + 1);
+  char* buffer = gumbo_parser_allocate(
+      parser, input->length + 1, GUMBO_ALLOCATION_TEXT);
   memcpy(buffer, input->data, input->length);
   buffer[input->length] = '\0';
   return buffer;
 }
 
+void gumbo_string_buffer_clear(
+    struct _GumboParser* parser, GumboStringBuffer* input) {
+  input->length = 0;
+}
+
 void gumbo_string_buffer_destroy(
     struct _GumboParser* parser, GumboStringBuffer* buffer) {
   gumbo_parser_deallocate(parser, buffer->data);
@@ -71,6 +71,11 @@ void gumbo_string_buffer_append_string(
 char* gumbo_string_buffer_to_string(
     struct _GumboParser* parser, GumboStringBuffer* input);
 
+// Empties the buffer while keeping its capacity, so that it can be refilled
+// without reallocating.
+void gumbo_string_buffer_clear(
+    struct _GumboParser* parser, GumboStringBuffer* input);
+
 // Deallocates this GumboStringBuffer.
 void gumbo_string_buffer_destroy(
     struct _GumboParser* parser, GumboStringBuffer* buffer);
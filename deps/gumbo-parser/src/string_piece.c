@@ -43,7 +43,8 @@ void gumbo_string_copy(
     struct _GumboParser* parser, GumboStringPiece* dest,
     const GumboStringPiece* source) {
   dest->length = source->length;
-  char* buffer = gumbo_parser_allocate(parser, source->length);
+  char* buffer =
+      gumbo_parser_allocate(parser, source->length, GUMBO_ALLOCATION_TEXT);
   memcpy(buffer, source->data, source->length);
   dest->data = buffer;
 }
@@ -54,6 +54,7 @@
 #include "error.h"
 #include "gumbo.h"
 #include "parser.h"
+#include "profile.h"
 #include "string_buffer.h"
 #include "string_piece.h"
 #include "token_type.h"
@@ -66,6 +67,11 @@
 // script mode.
 const GumboStringPiece kScriptTag = { "script", 6 };
 
+// Tags with at least this many attributes look for duplicate names through a
+// hash index rather than by comparing against every earlier attribute, which
+// is quadratic in the number of attributes.
+static const int kAttributeIndexThreshold = 16;
+
 // An enum for the return value of each individual state.
 typedef enum {
   RETURN_ERROR,         // Return false (error) from the tokenizer.
@@ -96,6 +102,11 @@ typedef struct _GumboTagState {
   // values are filled in by operating on _attributes.data[attributes.length-1].
   GumboVector /* GumboAttribute */ _attributes;
 
+  // Hash index over the names in _attributes, used to find duplicates once a
+  // tag has more than kAttributeIndexThreshold attributes.  Cleared for each
+  // new tag.
+  GumboAttributeIndex _attribute_index;
+
   // If true, the next attribute value to be finished should be dropped.  This
   // happens if a duplicate attribute name is encountered - we want to consume
   // the attribute value, but shouldn't overwrite the existing value.
@@ -348,12 +359,10 @@ static void clear_temporary_buffer(GumboParser* parser) {
   GumboTokenizerState* tokenizer = parser->_tokenizer_state;
   assert(!tokenizer->_temporary_buffer_emit);
   utf8iterator_mark(&tokenizer->_input);
-  gumbo_string_buffer_destroy(parser, &tokenizer->_temporary_buffer);
-  gumbo_string_buffer_init(parser, &tokenizer->_temporary_buffer);
+  gumbo_string_buffer_clear(parser, &tokenizer->_temporary_buffer);
   // The temporary buffer and script data buffer are the same object in the
   // spec, so the script data buffer should be cleared as well.
-  gumbo_string_buffer_destroy(parser, &tokenizer->_script_data_buffer);
-  gumbo_string_buffer_init(parser, &tokenizer->_script_data_buffer);
+  gumbo_string_buffer_clear(parser, &tokenizer->_script_data_buffer);
 }
 
 // Appends a codepoint to the temporary buffer.
@@ -547,7 +556,6 @@ static StateResult emit_current_tag(GumboParser* parser, GumboToken* output) {
     gumbo_debug("Emitted end tag %s.\n",
                gumbo_normalized_tagname(tag_state->_tag));
   }
-  gumbo_string_buffer_destroy(parser, &tag_state->_buffer);
   finish_token(parser, output);
   gumbo_debug("Original text = %.*s.\n", output->original_text.length, output->original_text.data);
   assert(output->original_text.length >= 2);
@@ -567,7 +575,6 @@ static void abandon_current_tag(GumboParser* parser) {
   }
   gumbo_parser_deallocate(parser, tag_state->_attributes.data);
   mark_tag_state_as_empty(tag_state);
-  gumbo_string_buffer_destroy(parser, &tag_state->_buffer);
   gumbo_debug("Abandoning current tag.\n");
 }
 
@@ -664,12 +671,13 @@ static void append_char_to_tag_buffer(GumboParser* parser, int codepoint,
 }
 
 // (Re-)initialize the tag buffer.  This also resets the original_text pointer
-// and _start_pos field to point to the current position.
+// and _start_pos field to point to the current position.  The buffer itself
+// lives as long as the tokenizer, so this only empties it.
 static void initialize_tag_buffer(GumboParser* parser) {
   GumboTokenizerState* tokenizer = parser->_tokenizer_state;
   GumboTagState* tag_state = &tokenizer->_tag_state;
 
-  gumbo_string_buffer_init(parser, &tag_state->_buffer);
+  gumbo_string_buffer_clear(parser, &tag_state->_buffer);
   reset_tag_buffer_start_point(parser);
 }
 
@@ -688,7 +696,10 @@ static void start_new_tag(GumboParser* parser, bool is_start_tag) {
   gumbo_string_buffer_append_codepoint(parser, c, &tag_state->_buffer);
 
   assert(tag_state->_attributes.data == NULL);
-  gumbo_vector_init(parser, 4, &tag_state->_attributes);
+  // Most tags have no attributes, so the vector is only allocated once the
+  // first one is added.
+  gumbo_vector_init(parser, 0, &tag_state->_attributes);
+  gumbo_attribute_index_clear(&tag_state->_attribute_index);
   tag_state->_drop_next_attr_value = false;
   tag_state->_is_start_tag = is_start_tag;
   tag_state->_is_self_closing = false;
@@ -729,13 +740,6 @@ static void copy_over_original_tag_text(
   utf8iterator_get_position(&tokenizer->_input, end_pos);
 }
 
-// Releases and then re-initializes the tag buffer.
-static void reinitialize_tag_buffer(GumboParser* parser) {
-  gumbo_parser_deallocate(
-      parser, parser->_tokenizer_state->_tag_state._buffer.data);
-  initialize_tag_buffer(parser);
-}
-
 // Moves some data from the temporary buffer over the the tag-based fields in
 // TagState.
 static void finish_tag_name(GumboParser* parser) {
@@ -745,7 +749,7 @@ static void finish_tag_name(GumboParser* parser) {
   const char* temp;
   copy_over_tag_buffer(parser, &temp);
   tag_state->_tag = gumbo_tag_enum(temp);
-  reinitialize_tag_buffer(parser);
+  initialize_tag_buffer(parser);
   gumbo_parser_deallocate(parser, (void*) temp);
 }
 
@@ -763,7 +767,7 @@ static void add_duplicate_attr_error(GumboParser* parser, const char* attr_name,
   error->v.duplicate_attr.original_index = original_index;
   error->v.duplicate_attr.new_index = new_index;
   copy_over_tag_buffer(parser, &error->v.duplicate_attr.name);
-  reinitialize_tag_buffer(parser);
+  initialize_tag_buffer(parser);
 }
 
 // Creates a new attribute in the current tag, copying the current tag buffer to
@@ -777,33 +781,55 @@ static bool finish_attribute_name(GumboParser* parser) {
   GumboTagState* tag_state = &tokenizer->_tag_state;
   // May've been set by a previous attribute without a value; reset it here.
   tag_state->_drop_next_attr_value = false;
-  assert(tag_state->_attributes.data);
-  assert(tag_state->_attributes.capacity);
 
+  GumboAttributeAtom atom = gumbo_attribute_atom(
+      tag_state->_buffer.data, tag_state->_buffer.length);
   GumboVector* /* GumboAttribute* */ attributes = &tag_state->_attributes;
-  for (int i = 0; i < attributes->length; ++i) {
-    GumboAttribute* attr = attributes->data[i];
-    if (strlen(attr->name) == tag_state->_buffer.length &&
-        memcmp(attr->name, tag_state->_buffer.data,
-               tag_state->_buffer.length) == 0) {
-      // Identical attribute; bail.
-      add_duplicate_attr_error(
-          parser, attr->name, i, attributes->length);
-      tag_state->_drop_next_attr_value = true;
-      return false;
+  int duplicate = -1;
+  if (attributes->length < kAttributeIndexThreshold) {
+    // The tag buffer is already lowercase, so two names are the same exactly
+    // when their atoms are, or when neither has one and their text matches.
+    for (int i = 0; i < attributes->length; ++i) {
+      GumboAttribute* attr = attributes->data[i];
+      if (atom != GUMBO_ATTR_UNKNOWN ? attr->atom == atom :
+          attr->atom == GUMBO_ATTR_UNKNOWN &&
+          strlen(attr->name) == tag_state->_buffer.length &&
+          memcmp(attr->name, tag_state->_buffer.data,
+                 tag_state->_buffer.length) == 0) {
+        duplicate = i;
+        break;
+      }
     }
+  } else {
+    duplicate = gumbo_attribute_index_find(
+        parser, &tag_state->_attribute_index, attributes,
+        tag_state->_buffer.data, tag_state->_buffer.length);
+  }
+  if (duplicate >= 0) {
+    // Identical attribute; bail.
+    const GumboAttribute* attr = attributes->data[duplicate];
+    add_duplicate_attr_error(
+        parser, attr->name, duplicate, attributes->length);
+    tag_state->_drop_next_attr_value = true;
+    return false;
   }
 
-  GumboAttribute* attr = gumbo_parser_allocate(parser, sizeof(GumboAttribute));
+  GumboAttribute* attr = gumbo_parser_allocate(
+      parser, sizeof(GumboAttribute), GUMBO_ALLOCATION_ATTRIBUTE);
   attr->attr_namespace = GUMBO_ATTR_NAMESPACE_NONE;
-  copy_over_tag_buffer(parser, &attr->name);
+  attr->name = NULL;
+  attr->name_ownership = GUMBO_STRING_OWNED;
+  gumbo_attribute_set_name(parser, attr, atom, tag_state->_buffer.data,
+                           tag_state->_buffer.length);
   copy_over_original_tag_text(parser, &attr->original_name,
                               &attr->name_start, &attr->name_end);
   attr->value = gumbo_copy_stringz(parser, "");
+  attr->value_length = 0;
+  attr->value_ownership = GUMBO_STRING_OWNED;
   copy_over_original_tag_text(parser, &attr->original_value,
                               &attr->name_start, &attr->name_end);
   gumbo_vector_add(parser, attr, attributes);
-  reinitialize_tag_buffer(parser);
+  initialize_tag_buffer(parser);
   return true;
 }
 
@@ -813,18 +839,37 @@ static void finish_attribute_value(GumboParser* parser) {
   GumboTagState* tag_state = &parser->_tokenizer_state->_tag_state;
   if (tag_state->_drop_next_attr_value) {
     // Duplicate attribute name detected in an earlier state, so we have to
-    // ignore the value.
+    // ignore the value, which mustn't be left in the buffer for the next name.
     tag_state->_drop_next_attr_value = false;
+    initialize_tag_buffer(parser);
     return;
   }
 
   GumboAttribute* attr =
       tag_state->_attributes.data[tag_state->_attributes.length - 1];
   gumbo_parser_deallocate(parser, (void*) attr->value);
-  copy_over_tag_buffer(parser, &attr->value);
   copy_over_original_tag_text(parser, &attr->original_value,
                               &attr->value_start, &attr->value_end);
-  reinitialize_tag_buffer(parser);
+  attr->value_length = tag_state->_buffer.length;
+
+  // If the value is exactly its source text, less any quotes, it can point
+  // into the input rather than being copied.
+  GumboStringPiece source = attr->original_value;
+  if (source.length >= 2 && (source.data[0] == '"' || source.data[0] == '\'') &&
+      source.data[source.length - 1] == source.data[0]) {
+    ++source.data;
+    source.length -= 2;
+  }
+  if (parser->_options->borrow_input_strings &&
+      source.length == tag_state->_buffer.length &&
+      memcmp(source.data, tag_state->_buffer.data, source.length) == 0) {
+    attr->value = source.data;
+    attr->value_ownership = GUMBO_STRING_BORROWED;
+  } else {
+    copy_over_tag_buffer(parser, &attr->value);
+    attr->value_ownership = GUMBO_STRING_OWNED;
+  }
+  initialize_tag_buffer(parser);
 }
 
 // Returns true if the current end tag matches the last start tag emitted.
@@ -843,20 +888,32 @@ static bool is_appropriate_end_tag(GumboParser* parser) {
 void gumbo_tokenizer_state_init(
     GumboParser* parser, const char* text, size_t text_length) {
   GumboTokenizerState* tokenizer =
-      gumbo_parser_allocate(parser, sizeof(GumboTokenizerState));
+      gumbo_parser_allocate(parser, sizeof(GumboTokenizerState),
+                            GUMBO_ALLOCATION_OTHER);
   parser->_tokenizer_state = tokenizer;
+  gumbo_string_buffer_init(parser, &tokenizer->_temporary_buffer);
+  gumbo_string_buffer_init(parser, &tokenizer->_script_data_buffer);
+  gumbo_string_buffer_init(parser, &tokenizer->_tag_state._buffer);
+  gumbo_attribute_index_init(&tokenizer->_tag_state._attribute_index);
+  gumbo_tokenizer_state_reset(parser, text, text_length);
+}
+
+void gumbo_tokenizer_state_reset(
+    GumboParser* parser, const char* text, size_t text_length) {
+  GumboTokenizerState* tokenizer = parser->_tokenizer_state;
   gumbo_tokenizer_set_state(parser, GUMBO_LEX_DATA);
   tokenizer->_reconsume_current_input = false;
   tokenizer->_is_current_node_foreign = false;
   tokenizer->_tag_state._last_start_tag = GUMBO_TAG_LAST;
 
   tokenizer->_buffered_emit_char = kGumboNoChar;
-  gumbo_string_buffer_init(parser, &tokenizer->_temporary_buffer);
+  gumbo_string_buffer_clear(parser, &tokenizer->_temporary_buffer);
   tokenizer->_temporary_buffer_emit = NULL;
 
   mark_tag_state_as_empty(&tokenizer->_tag_state);
+  gumbo_string_buffer_clear(parser, &tokenizer->_tag_state._buffer);
 
-  gumbo_string_buffer_init(parser, &tokenizer->_script_data_buffer);
+  gumbo_string_buffer_clear(parser, &tokenizer->_script_data_buffer);
   tokenizer->_token_start = text;
   utf8iterator_init(parser, text, text_length, &tokenizer->_input);
   utf8iterator_get_position(&tokenizer->_input, &tokenizer->_token_start_pos);
@@ -870,6 +927,9 @@ void gumbo_tokenizer_state_destroy(GumboParser* parser) {
   assert(tokenizer->_doc_type_state.system_identifier == NULL);
   gumbo_string_buffer_destroy(parser, &tokenizer->_temporary_buffer);
   gumbo_string_buffer_destroy(parser, &tokenizer->_script_data_buffer);
+  gumbo_string_buffer_destroy(parser, &tokenizer->_tag_state._buffer);
+  gumbo_attribute_index_destroy(
+      parser, &tokenizer->_tag_state._attribute_index);
   gumbo_parser_deallocate(parser, tokenizer);
 }
 
@@ -1586,8 +1646,7 @@ static StateResult handle_script_double_escaped_lt_state(
     int c, GumboToken* output) {
   if (c == '/') {
     gumbo_tokenizer_set_state(parser, GUMBO_LEX_SCRIPT_DOUBLE_ESCAPED_END);
-    gumbo_string_buffer_destroy(parser, &tokenizer->_script_data_buffer);
-    gumbo_string_buffer_init(parser, &tokenizer->_script_data_buffer);
+    gumbo_string_buffer_clear(parser, &tokenizer->_script_data_buffer);
     return emit_current_char(parser, output);
   } else {
     gumbo_tokenizer_set_state(parser, GUMBO_LEX_SCRIPT_DOUBLE_ESCAPED);
@@ -2928,8 +2987,16 @@ bool gumbo_lex(GumboParser* parser, GumboToken* output) {
     assert(tokenizer->_buffered_emit_char == kGumboNoChar);
     int c = utf8iterator_current(&tokenizer->_input);
     gumbo_debug("Lexing character '%c' in state %d.\n", c, tokenizer->_state);
+#ifdef GUMBO_PROFILE
+    GumboProfileCounter* counter = parser->_profile ?
+        &parser->_profile->tokenizer_states[tokenizer->_state] : NULL;
+    uint64_t start = gumbo_profile_ticks();
+#endif
     StateResult result =
         dispatch_table[tokenizer->_state](parser, tokenizer, c, output);
+#ifdef GUMBO_PROFILE
+    gumbo_profile_count(counter, start);
+#endif
     // We need to clear reconsume_current_input before returning to prevent
     // certain infinite loop states.
     bool should_advance = !tokenizer->_reconsume_current_input;
@@ -74,6 +74,11 @@ typedef struct _GumboToken {
 void gumbo_tokenizer_state_init(
     struct _GumboParser* parser, const char* text, size_t text_length);
 
+// Points an existing tokenizer state at a new piece of text, as if it had just
+// been initialized but keeping the capacity of its internal buffers.
+void gumbo_tokenizer_state_reset(
+    struct _GumboParser* parser, const char* text, size_t text_length);
+
 // Destroys the tokenizer state within the GumboParser object, freeing any
 // dynamically-allocated structures within it.
 void gumbo_tokenizer_state_destroy(struct _GumboParser* parser);
@@ -0,0 +1,61 @@
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Static tracepoints (USDT probes) at the boundaries of a parse, so that perf,
+// bpftrace or SystemTap can be attached to a running process:
+//
+//   bpftrace -e 'usdt:./build/Release/gumbo.node:gumbo:parse__end
+//                { printf("%d bytes, %d nodes\n", arg0, arg1); }'
+//
+// Every probe's first two arguments are the length of the input in bytes and
+// the number of nodes created so far (counted as for GumboOptions.max_nodes).
+// The probes in provider "gumbo" are:
+//
+//   parse__start       A parse is starting.
+//   tokenizer__eof     The tokenizer reached the end of the input.
+//   insertion__mode    The tree builder switched insertion mode; the third
+//                      argument is the new GumboInsertionMode.
+//   error__limit       The recorded errors reached GumboOptions.max_errors, so
+//                      later ones are only counted; the third argument is
+//                      max_errors.  Fires at most once per parse.
+//   limit__hit         A resource limit stopped the parse; the third argument
+//                      is the GumboOutputStatus.
+//   parse__end         The parse is done; the third argument is its status.
+//   convert__start     The Node binding is starting to build the JS tree.
+//   convert__end       The JS tree is built.
+//
+// The probes are compiled in where <sys/sdt.h> is available (from
+// systemtap-sdt-dev or systemtap-sdt-devel), and cost a single nop each until
+// something attaches to them.  Elsewhere, or when built with -DGUMBO_NO_TRACE,
+// they compile to nothing.
+
+#ifndef GUMBO_TRACE_H_
+#define GUMBO_TRACE_H_
+
+#if !defined(GUMBO_NO_TRACE) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define GUMBO_TRACE_ENABLED 1
+#endif
+#endif
+
+#ifdef GUMBO_TRACE_ENABLED
+#define GUMBO_TRACE2(name, length, nodes) \
+  DTRACE_PROBE2(gumbo, name, length, nodes)
+#define GUMBO_TRACE3(name, length, nodes, arg) \
+  DTRACE_PROBE3(gumbo, name, length, nodes, arg)
+#else
+#define GUMBO_TRACE2(name, length, nodes) do {} while (0)
+#define GUMBO_TRACE3(name, length, nodes, arg) do {} while (0)
+#endif
+
+#endif  // GUMBO_TRACE_H_
@@ -22,6 +22,11 @@
 #include <strings.h>
 #include <stdarg.h>
 #include <stdio.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
 
 #include "gumbo.h"
 #include "parser.h"
@@ -31,20 +36,151 @@
 // as any.
 const GumboSourcePosition kGumboEmptySourcePosition = { 0, 0, 0 };
 
-void* gumbo_parser_allocate(GumboParser* parser, size_t num_bytes) {
-  return parser->_options->allocator(parser->_options->userdata, num_bytes);
+// Prepended to every allocation while statistics are being collected, so that
+// the size and category of a block are known when it's freed.  The union keeps
+// the memory that follows it suitably aligned for any type.
+typedef union {
+  struct {
+    size_t size;
+    GumboAllocationCategory category;
+  } block;
+  long double alignment;
+} AllocationHeader;
+
+static const char* kAllocationCategoryNames[] = {
+  "node",
+  "attribute",
+  "text",
+  "vector",
+  "string buffer",
+  "error",
+  "other",
+};
+
+const char* gumbo_allocation_category_name(GumboAllocationCategory category) {
+  if (category < 0 || category >= GUMBO_ALLOCATION_LAST) {
+    return NULL;
+  }
+  return kAllocationCategoryNames[category];
+}
+
+static void count_allocation(GumboParseStats* stats, AllocationHeader* header,
+                             size_t num_bytes,
+                             GumboAllocationCategory category) {
+  header->block.size = num_bytes;
+  header->block.category = category;
+  ++stats->allocations;
+  stats->bytes_allocated += num_bytes;
+  stats->current_bytes += num_bytes;
+  if (stats->current_bytes > stats->peak_bytes) {
+    stats->peak_bytes = stats->current_bytes;
+  }
+  GumboAllocationCounts* counts = &stats->by_category[category];
+  ++counts->allocations;
+  counts->bytes_allocated += num_bytes;
+  counts->current_bytes += num_bytes;
+  if (counts->current_bytes > counts->peak_bytes) {
+    counts->peak_bytes = counts->current_bytes;
+  }
+}
+
+static void count_deallocation(
+    GumboParseStats* stats, const AllocationHeader* header) {
+  GumboAllocationCounts* counts = &stats->by_category[header->block.category];
+  assert(stats->current_bytes >= header->block.size);
+  assert(counts->current_bytes >= header->block.size);
+  stats->current_bytes -= header->block.size;
+  counts->current_bytes -= header->block.size;
+}
+
+void* gumbo_parser_allocate(GumboParser* parser, size_t num_bytes,
+                            GumboAllocationCategory category) {
+  parser->_allocated_bytes += num_bytes;
+  GumboParseStats* stats = parser->_stats;
+  if (!stats) {
+    return parser->_options->allocator(parser->_options->userdata, num_bytes);
+  }
+
+  AllocationHeader* header = parser->_options->allocator(
+      parser->_options->userdata, sizeof(AllocationHeader) + num_bytes);
+  count_allocation(stats, header, num_bytes, category);
+  return header + 1;
 }
 
 void gumbo_parser_deallocate(GumboParser* parser, void* ptr) {
-  return parser->_options->deallocator(parser->_options->userdata, ptr);
+  GumboParseStats* stats = parser->_stats;
+  if (!stats || !ptr) {
+    return parser->_options->deallocator(parser->_options->userdata, ptr);
+  }
+
+  AllocationHeader* header = (AllocationHeader*) ptr - 1;
+  count_deallocation(stats, header);
+  return parser->_options->deallocator(parser->_options->userdata, header);
+}
+
+// Returns the reallocator to grow blocks with, or NULL if they have to be
+// copied.  The default reallocator can only grow blocks from the default
+// allocator.
+static GumboReallocatorFunction get_reallocator(const GumboOptions* options) {
+  if (options->reallocator == kGumboDefaultOptions.reallocator &&
+      (options->allocator != kGumboDefaultOptions.allocator ||
+       options->deallocator != kGumboDefaultOptions.deallocator)) {
+    return NULL;
+  }
+  return options->reallocator;
+}
+
+void* gumbo_parser_reallocate(GumboParser* parser, void* ptr,
+                              size_t old_num_bytes, size_t num_bytes,
+                              GumboAllocationCategory category) {
+  GumboReallocatorFunction reallocator = get_reallocator(parser->_options);
+  if (!reallocator || !ptr) {
+    void* new_ptr = gumbo_parser_allocate(parser, num_bytes, category);
+    if (ptr) {
+      memcpy(new_ptr, ptr,
+             old_num_bytes < num_bytes ? old_num_bytes : num_bytes);
+      gumbo_parser_deallocate(parser, ptr);
+    }
+    return new_ptr;
+  }
+
+  parser->_allocated_bytes += num_bytes;
+  GumboParseStats* stats = parser->_stats;
+  if (!stats) {
+    return reallocator(parser->_options->userdata, ptr, num_bytes);
+  }
+
+  AllocationHeader* header = (AllocationHeader*) ptr - 1;
+  count_deallocation(stats, header);
+  header = reallocator(parser->_options->userdata, header,
+                       sizeof(AllocationHeader) + num_bytes);
+  count_allocation(stats, header, num_bytes, category);
+  return header + 1;
 }
 
 char* gumbo_copy_stringz(GumboParser* parser, const char* str) {
-  char* buffer = gumbo_parser_allocate(parser, strlen(str) + 1);
+  char* buffer =
+      gumbo_parser_allocate(parser, strlen(str) + 1, GUMBO_ALLOCATION_TEXT);
   strcpy(buffer, str);
   return buffer;
 }
 
+uint64_t gumbo_monotonic_time_ns() {
+#ifdef _WIN32
+  static LARGE_INTEGER frequency;
+  LARGE_INTEGER now;
+  if (frequency.QuadPart == 0) {
+    QueryPerformanceFrequency(&frequency);
+  }
+  QueryPerformanceCounter(&now);
+  return (uint64_t) ((double) now.QuadPart * 1e9 / frequency.QuadPart);
+#else
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+#endif
+}
+
 // Debug function to trace operation of the parser.  Pass --copts=-DGUMBO_DEBUG
 // to use.
 void gumbo_debug(const char* format, ...) {
@@ -22,6 +22,9 @@
 
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
+
+#include "gumbo.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -39,13 +42,26 @@ struct _GumboParser;
 char* gumbo_copy_stringz(struct _GumboParser* parser, const char* str);
 
 // Allocate a chunk of memory, using the allocator specified in the Parser's
-// config options.
-void* gumbo_parser_allocate(struct _GumboParser* parser, size_t num_bytes);
+// config options.  The category says what it's for, for the statistics.
+void* gumbo_parser_allocate(struct _GumboParser* parser, size_t num_bytes,
+                            GumboAllocationCategory category);
 
 // Deallocate a chunk of memory, using the deallocator specified in the Parser's
 // config options.
 void gumbo_parser_deallocate(struct _GumboParser* parser, void* ptr);
 
+// Grow (or shrink) a chunk of memory from gumbo_parser_allocate to num_bytes,
+// keeping its first old_num_bytes bytes, and return the new chunk.  This uses
+// the reallocator from the Parser's config options when there's a suitable
+// one, and otherwise allocates a new chunk and copies.
+void* gumbo_parser_reallocate(struct _GumboParser* parser, void* ptr,
+                              size_t old_num_bytes, size_t num_bytes,
+                              GumboAllocationCategory category);
+
+// Returns a monotonic timestamp in nanoseconds, for deadlines and timing.  Only
+// differences between two timestamps are meaningful.
+uint64_t gumbo_monotonic_time_ns();
+
 // Debug wrapper for printf, to make it easier to turn off debugging info when
 // required.
 void gumbo_debug(const char* format, ...);
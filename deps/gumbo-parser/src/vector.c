@@ -25,22 +25,32 @@
 
 struct _GumboParser;
 
-const GumboVector kGumboEmptyVector = { NULL, 0, 0 };
+const GumboVector kGumboEmptyVector = { NULL, 0, 0, 0 };
 
 void gumbo_vector_init(
     struct _GumboParser* parser, size_t initial_capacity, GumboVector* vector) {
   vector->length = 0;
   vector->capacity = initial_capacity;
+  vector->_is_inline = false;
   if (initial_capacity > 0) {
     vector->data = gumbo_parser_allocate(
-        parser, sizeof(void*) * initial_capacity);
+        parser, sizeof(void*) * initial_capacity, GUMBO_ALLOCATION_VECTOR);
   } else {
     vector->data = NULL;
   }
 }
 
+void gumbo_vector_init_inline(
+    void** storage, size_t capacity, GumboVector* vector) {
+  assert(capacity > 0);
+  vector->data = storage;
+  vector->length = 0;
+  vector->capacity = capacity;
+  vector->_is_inline = true;
+}
+
 void gumbo_vector_destroy(struct _GumboParser* parser, GumboVector* vector) {
-  if (vector->capacity > 0) {
+  if (vector->capacity > 0 && !vector->_is_inline) {
     gumbo_parser_deallocate(parser, vector->data);
   }
 }
@@ -52,15 +62,22 @@ static void enlarge_vector_if_full(
       size_t old_num_bytes = sizeof(void*) * vector->capacity;
       vector->capacity *= 2;
       size_t num_bytes = sizeof(void*) * vector->capacity;
-      void** temp = gumbo_parser_allocate(parser, num_bytes);
-      memcpy(temp, vector->data, old_num_bytes);
-      gumbo_parser_deallocate(parser, vector->data);
-      vector->data = temp;
+      if (vector->_is_inline) {
+        void** temp =
+            gumbo_parser_allocate(parser, num_bytes, GUMBO_ALLOCATION_VECTOR);
+        memcpy(temp, vector->data, old_num_bytes);
+        vector->data = temp;
+        vector->_is_inline = false;
+      } else {
+        vector->data = gumbo_parser_reallocate(
+            parser, vector->data, old_num_bytes, num_bytes,
+            GUMBO_ALLOCATION_VECTOR);
+      }
     } else {
       // 0-capacity vector; no previous array to deallocate.
       vector->capacity = 2;
       vector->data = gumbo_parser_allocate(
-          parser, sizeof(void*) * vector->capacity);
+          parser, sizeof(void*) * vector->capacity, GUMBO_ALLOCATION_VECTOR);
     }
   }
 }
@@ -31,6 +31,12 @@ struct _GumboParser;
 void gumbo_vector_init(
     struct _GumboParser* parser, size_t initial_capacity, GumboVector* vector);
 
+// Initializes a GumboVector that uses storage, an array of capacity slots that
+// outlives the vector, until it needs more room.  The storage is never freed
+// by the vector.
+void gumbo_vector_init_inline(
+    void** storage, size_t capacity, GumboVector* vector);
+
 // Frees the memory used by an GumboVector.  Does not free the contained
 // pointers.
 void gumbo_vector_destroy(struct _GumboParser* parser, GumboVector* vector);
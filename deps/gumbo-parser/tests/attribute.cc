@@ -16,6 +16,7 @@
 
 #include "attribute.h"
 
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -50,4 +51,94 @@ TEST_F(GumboAttributeTest, GetAttribute) {
   EXPECT_EQ(NULL, gumbo_get_attribute(&vector_, "bar"));
 }
 
+TEST_F(GumboAttributeTest, AtomNamesRoundTrip) {
+  for (int i = 0; i < GUMBO_ATTR_UNKNOWN; ++i) {
+    GumboAttributeAtom atom = static_cast<GumboAttributeAtom>(i);
+    const char* name = gumbo_normalized_attribute_name(atom);
+    EXPECT_EQ(atom, gumbo_attribute_atom(name, strlen(name))) << name;
+    if (i > 0) {
+      // The lookup is a binary search, so the table must stay sorted.
+      EXPECT_LT(strcmp(gumbo_normalized_attribute_name(
+          static_cast<GumboAttributeAtom>(i - 1)), name), 0) << name;
+    }
+  }
+}
+
+TEST_F(GumboAttributeTest, AtomLookup) {
+  EXPECT_EQ(GUMBO_ATTR_HREF, gumbo_attribute_atom("href", 4));
+  EXPECT_EQ(GUMBO_ATTR_HREF, gumbo_attribute_atom("HRef", 4));
+  EXPECT_EQ(GUMBO_ATTR_HREF, gumbo_attribute_atom("hreflang", 4));
+  EXPECT_EQ(GUMBO_ATTR_HTTP_EQUIV, gumbo_attribute_atom("http-equiv", 10));
+  EXPECT_EQ(GUMBO_ATTR_UNKNOWN, gumbo_attribute_atom("hre", 3));
+  EXPECT_EQ(GUMBO_ATTR_UNKNOWN, gumbo_attribute_atom("data-foo", 8));
+  EXPECT_EQ(GUMBO_ATTR_UNKNOWN, gumbo_attribute_atom("", 0));
+}
+
+TEST_F(GumboAttributeTest, GetAttributeByAtom) {
+  GumboAttribute attr1;
+  GumboAttribute attr2;
+  attr1.name = "data-x";
+  attr1.atom = GUMBO_ATTR_UNKNOWN;
+  attr2.name = "class";
+  attr2.atom = GUMBO_ATTR_CLASS;
+
+  gumbo_vector_add(&parser_, &attr1, &vector_);
+  gumbo_vector_add(&parser_, &attr2, &vector_);
+  EXPECT_EQ(&attr2, gumbo_get_attribute_by_atom(&vector_, GUMBO_ATTR_CLASS));
+  EXPECT_EQ(NULL, gumbo_get_attribute_by_atom(&vector_, GUMBO_ATTR_ID));
+  EXPECT_EQ(&attr2, gumbo_get_attribute(&vector_, "CLASS"));
+  EXPECT_EQ(&attr1, gumbo_get_attribute(&vector_, "data-X"));
+}
+
+TEST_F(GumboAttributeTest, AttributeIndex) {
+  GumboAttribute attrs[3];
+  attrs[0].name = "foo";
+  attrs[1].name = "bar";
+  attrs[2].name = "foobar";
+  GumboAttributeIndex index;
+  gumbo_attribute_index_init(&index);
+
+  gumbo_vector_add(&parser_, &attrs[0], &vector_);
+  gumbo_vector_add(&parser_, &attrs[1], &vector_);
+  EXPECT_EQ(1, gumbo_attribute_index_find(&parser_, &index, &vector_,
+                                          "bar", 3));
+  EXPECT_EQ(-1, gumbo_attribute_index_find(&parser_, &index, &vector_,
+                                           "foobar", 6));
+  // Attributes appended after the first lookup are picked up too.
+  gumbo_vector_add(&parser_, &attrs[2], &vector_);
+  EXPECT_EQ(2, gumbo_attribute_index_find(&parser_, &index, &vector_,
+                                          "foobar", 6));
+  EXPECT_EQ(0, gumbo_attribute_index_find(&parser_, &index, &vector_,
+                                          "foobarbaz", 3));
+
+  gumbo_attribute_index_clear(&index);
+  gumbo_attribute_index_destroy(&parser_, &index);
+}
+
+TEST_F(GumboAttributeTest, AttributeIndexIsBuiltOnce) {
+  // A power of two, which fills the table exactly half full.
+  const int kCount = 256;
+  GumboAttribute attrs[kCount];
+  char names[kCount][8];
+  for (int i = 0; i < kCount; ++i) {
+    snprintf(names[i], sizeof(names[i]), "a%d", i);
+    attrs[i].name = names[i];
+    gumbo_vector_add(&parser_, &attrs[i], &vector_);
+  }
+  GumboAttributeIndex index;
+  gumbo_attribute_index_init(&index);
+
+  EXPECT_EQ(0, gumbo_attribute_index_find(&parser_, &index, &vector_,
+                                          "a0", 2));
+  // Later lookups use the same table rather than rebuilding it.
+  uint64_t allocations = malloc_stats_.objects_allocated;
+  for (int i = 0; i < kCount; ++i) {
+    EXPECT_EQ(i, gumbo_attribute_index_find(&parser_, &index, &vector_,
+                                            names[i], strlen(names[i])));
+  }
+  EXPECT_EQ(allocations, malloc_stats_.objects_allocated);
+
+  gumbo_attribute_index_destroy(&parser_, &index);
+}
+
 }  // namespace
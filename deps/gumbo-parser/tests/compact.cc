@@ -0,0 +1,387 @@
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "gumbo.h"
+
+#include <string.h>
+#include <string>
+#include <vector>
+
+#include "test_utils.h"
+#include "gtest/gtest.h"
+
+namespace {
+
+static const GumboVector* Children(const GumboNode* node) {
+  if (node->type == GUMBO_NODE_DOCUMENT) {
+    return &node->v.document.children;
+  } else if (node->type == GUMBO_NODE_ELEMENT) {
+    return &node->v.element.children;
+  }
+  return NULL;
+}
+
+// Appends the nodes of a tree to nodes in preorder.
+static void Flatten(const GumboNode* node,
+                    std::vector<const GumboNode*>* nodes) {
+  nodes->push_back(node);
+  const GumboVector* children = Children(node);
+  for (int i = 0; children && i < children->length; ++i) {
+    Flatten(static_cast<const GumboNode*>(children->data[i]), nodes);
+  }
+}
+
+class GumboCompactTest : public ::testing::Test {
+ protected:
+  GumboCompactTest() : options_(kGumboDefaultOptions), output_(NULL) {
+    InitLeakDetection(&options_, &malloc_stats_);
+  }
+
+  virtual ~GumboCompactTest() {
+    if (output_) {
+      gumbo_destroy_output(&options_, output_);
+    }
+    EXPECT_EQ(malloc_stats_.objects_allocated, malloc_stats_.objects_freed);
+  }
+
+  // Parses input and compacts the result, destroying the original tree so
+  // that the compacted one can't rely on it.  Before that, checks that the
+  // two trees match.
+  void ParseAndCompact(const std::string& input) {
+    GumboOutput* original = gumbo_parse_with_options(
+        &options_, input.data(), input.length());
+    uint64_t allocations = malloc_stats_.objects_allocated;
+    output_ = gumbo_compact_output(&options_, original);
+    EXPECT_EQ(allocations + 1, malloc_stats_.objects_allocated);
+    EXPECT_TRUE(output_->is_compact);
+    EXPECT_EQ(0, output_->errors.length);
+    EXPECT_EQ(original->status, output_->status);
+    if (original->stats) {
+      ASSERT_TRUE(output_->stats != NULL);
+      EXPECT_NE(original->stats, output_->stats);
+      EXPECT_EQ(0, memcmp(original->stats, output_->stats,
+                          sizeof(GumboParseStats)));
+    }
+
+    std::vector<const GumboNode*> expected;
+    std::vector<const GumboNode*> actual;
+    Flatten(original->document, &expected);
+    Flatten(output_->document, &actual);
+    ASSERT_EQ(expected.size(), actual.size());
+    for (size_t i = 0; i < expected.size(); ++i) {
+      ExpectSameNode(expected[i], actual[i]);
+      if (expected[i] == original->root) {
+        EXPECT_EQ(actual[i], output_->root);
+      }
+      // Document order is memory order.
+      if (i > 0) {
+        EXPECT_LT(actual[i - 1], actual[i]);
+      }
+    }
+    gumbo_destroy_output(&options_, original);
+  }
+
+  static void ExpectSameNode(const GumboNode* expected,
+                             const GumboNode* actual) {
+    ASSERT_EQ(expected->type, actual->type);
+    EXPECT_EQ(expected->index_within_parent, actual->index_within_parent);
+    EXPECT_EQ(expected->parse_flags, actual->parse_flags);
+    const GumboVector* children = Children(actual);
+    for (int i = 0; children && i < children->length; ++i) {
+      EXPECT_EQ(actual, static_cast<GumboNode*>(children->data[i])->parent);
+    }
+    if (children) {
+      EXPECT_EQ(Children(expected)->length, children->length);
+      EXPECT_EQ(children->length, children->capacity);
+    }
+    switch (expected->type) {
+      case GUMBO_NODE_DOCUMENT:
+        EXPECT_EQ(expected->v.document.has_doctype,
+                  actual->v.document.has_doctype);
+        break;
+      case GUMBO_NODE_ELEMENT: {
+        const GumboVector* expected_attrs = &expected->v.element.attributes;
+        const GumboVector* actual_attrs = &actual->v.element.attributes;
+        EXPECT_EQ(expected->v.element.tag, actual->v.element.tag);
+        ASSERT_EQ(expected_attrs->length, actual_attrs->length);
+        EXPECT_EQ(actual_attrs->length, actual_attrs->capacity);
+        for (int i = 0; i < expected_attrs->length; ++i) {
+          const GumboAttribute* expected_attr =
+              static_cast<const GumboAttribute*>(expected_attrs->data[i]);
+          const GumboAttribute* actual_attr =
+              static_cast<const GumboAttribute*>(actual_attrs->data[i]);
+          EXPECT_STREQ(expected_attr->name, actual_attr->name);
+          EXPECT_EQ(expected_attr->atom, actual_attr->atom);
+          EXPECT_EQ(std::string(expected_attr->value,
+                                expected_attr->value_length),
+                    actual_attr->value);
+          EXPECT_EQ(expected_attr->value_length, actual_attr->value_length);
+        }
+        break;
+      }
+      default:
+        EXPECT_EQ(std::string(expected->v.text.text,
+                              expected->v.text.text_length),
+                  actual->v.text.text);
+        EXPECT_EQ(GUMBO_STRING_OWNED, actual->v.text.text_ownership);
+        break;
+    }
+  }
+
+  MallocStats malloc_stats_;
+  GumboOptions options_;
+  GumboOutput* output_;
+};
+
+TEST_F(GumboCompactTest, Empty) {
+  ParseAndCompact("");
+  ASSERT_EQ(1, GetChildCount(output_->document));
+  EXPECT_EQ(GetChild(output_->document, 0), output_->root);
+}
+
+TEST_F(GumboCompactTest, Document) {
+  ParseAndCompact(
+      "<!DOCTYPE html PUBLIC \"-//W3C//DTD HTML 4.01//EN\">"
+      "<!-- comment --><title>Title</title>"
+      "<p class=a id=\"b c\" data-x>Text &amp; more<b>bold<i>both</b>italic"
+      "</i></p><table><tr><td>cell</table><svg viewBox='0 0 1 1'><path/></svg>"
+      "<script>var x = '<p>';</script>");
+  const GumboDocument* doc = &output_->document->v.document;
+  EXPECT_STREQ("html", doc->name);
+  EXPECT_STREQ("-//W3C//DTD HTML 4.01//EN", doc->public_identifier);
+  EXPECT_STREQ("", doc->system_identifier);
+}
+
+TEST_F(GumboCompactTest, BorrowedStringsAreCopied) {
+  options_.borrow_input_strings = true;
+  std::string input("<p title=hello>text</p>");
+  ParseAndCompact(input);
+  input.assign(input.length(), 'x');
+
+  GumboNode* body;
+  GetAndAssertBody(output_->document, &body);
+  GumboNode* p = GetChild(body, 0);
+  GumboAttribute* title = GetAttribute(p, 0);
+  EXPECT_EQ(GUMBO_STRING_OWNED, title->value_ownership);
+  EXPECT_STREQ("hello", title->value);
+  EXPECT_STREQ("text", GetChild(p, 0)->v.text.text);
+}
+
+TEST_F(GumboCompactTest, Stats) {
+  options_.collect_stats = true;
+  ParseAndCompact("<p>One<p>Two");
+  ASSERT_TRUE(output_->stats != NULL);
+  EXPECT_LT(reinterpret_cast<char*>(output_),
+            reinterpret_cast<char*>(output_->stats));
+  EXPECT_LT(reinterpret_cast<char*>(output_->stats),
+            reinterpret_cast<char*>(output_->document));
+}
+
+TEST_F(GumboCompactTest, DeeplyNested) {
+  // Compaction mustn't recurse; the original tree is walked iteratively too.
+  const int kDepth = 100000;
+  std::string input;
+  for (int i = 0; i < kDepth; ++i) {
+    input += "<span>";
+  }
+  GumboOutput* original = gumbo_parse_with_options(
+      &options_, input.data(), input.length());
+  output_ = gumbo_compact_output(&options_, original);
+  gumbo_destroy_output(&options_, original);
+
+  GumboNode* body;
+  GetAndAssertBody(output_->document, &body);
+  int depth = 0;
+  for (GumboNode* node = body; GetChildCount(node) > 0;
+       node = GetChild(node, 0)) {
+    ++depth;
+  }
+  EXPECT_EQ(kDepth, depth);
+}
+
+class GumboPackTest : public ::testing::Test {
+ protected:
+  GumboPackTest() : options_(kGumboDefaultOptions), output_(NULL),
+                    tree_(NULL) {
+    InitLeakDetection(&options_, &malloc_stats_);
+  }
+
+  virtual ~GumboPackTest() {
+    if (output_) {
+      gumbo_destroy_output(&options_, output_);
+    }
+    if (tree_) {
+      gumbo_destroy_packed_tree(&options_, tree_);
+    }
+    EXPECT_EQ(malloc_stats_.objects_allocated, malloc_stats_.objects_freed);
+  }
+
+  // Parses and packs input, checking that the packed tree matches the original
+  // one, and returns the number of bytes the packed tree takes up.
+  uint64_t ParseAndPack(const std::string& input) {
+    output_ = gumbo_parse_with_options(
+        &options_, input.data(), input.length());
+    uint64_t allocations = malloc_stats_.objects_allocated;
+    uint64_t bytes = malloc_stats_.bytes_allocated;
+    tree_ = gumbo_pack_output(&options_, output_);
+    EXPECT_EQ(allocations + 1, malloc_stats_.objects_allocated);
+    EXPECT_EQ(output_->status, tree_->status);
+
+    std::vector<const GumboNode*> nodes;
+    Flatten(output_->document, &nodes);
+    EXPECT_EQ(nodes.size(), tree_->node_count);
+    for (size_t i = 0; i < nodes.size() && i < tree_->node_count; ++i) {
+      ExpectSameNode(nodes[i], i);
+      if (nodes[i] == output_->root) {
+        EXPECT_EQ(i, tree_->root);
+      }
+    }
+    return malloc_stats_.bytes_allocated - bytes;
+  }
+
+  const char* String(uint32_t offset) {
+    EXPECT_LT(offset, tree_->strings_length);
+    return tree_->strings + offset;
+  }
+
+  void ExpectSameNode(const GumboNode* expected, uint32_t index) {
+    const GumboPackedNode* actual = &tree_->nodes[index];
+    ASSERT_EQ(expected->type, actual->type);
+    EXPECT_EQ(expected->parse_flags, actual->parse_flags);
+    if (expected->parent) {
+      const GumboPackedNode* parent = &tree_->nodes[actual->parent];
+      EXPECT_EQ(expected->parent->type, parent->type);
+      const GumboVector* siblings = Children(expected->parent);
+      if (expected->index_within_parent == 0) {
+        EXPECT_EQ(actual->parent + 1, index);
+      }
+      if (expected->index_within_parent == siblings->length - 1) {
+        EXPECT_EQ(GUMBO_PACKED_NONE, actual->next_sibling);
+      } else {
+        ASSERT_LT(actual->next_sibling, tree_->node_count);
+        EXPECT_EQ(actual->parent,
+                  tree_->nodes[actual->next_sibling].parent);
+      }
+    } else {
+      EXPECT_EQ(0, index);
+      EXPECT_EQ(GUMBO_PACKED_NONE, actual->parent);
+    }
+    const GumboVector* children = Children(expected);
+    EXPECT_EQ(children ? children->length : 0, actual->child_count);
+
+    switch (expected->type) {
+      case GUMBO_NODE_DOCUMENT:
+        break;
+      case GUMBO_NODE_ELEMENT: {
+        const GumboElement* element = &expected->v.element;
+        ASSERT_LT(actual->data, tree_->element_count);
+        const GumboPackedElement* packed = &tree_->elements[actual->data];
+        EXPECT_EQ(element->tag, packed->tag);
+        EXPECT_EQ(element->tag_namespace, packed->tag_namespace);
+        EXPECT_EQ(element->start_pos.offset, actual->offset);
+        EXPECT_EQ(element->original_tag.length, packed->original_tag_length);
+        EXPECT_EQ(element->end_pos.offset, packed->end_offset);
+        ASSERT_EQ(element->attributes.length, packed->attribute_count);
+        for (int i = 0; i < element->attributes.length; ++i) {
+          const GumboAttribute* attr =
+              static_cast<const GumboAttribute*>(element->attributes.data[i]);
+          const GumboPackedAttribute* packed_attr =
+              &tree_->attributes[packed->first_attribute + i];
+          EXPECT_STREQ(attr->name, String(packed_attr->name));
+          EXPECT_EQ(attr->atom, packed_attr->atom);
+          EXPECT_EQ(attr->attr_namespace, packed_attr->attr_namespace);
+          EXPECT_EQ(attr->name_start.offset, packed_attr->offset);
+          EXPECT_EQ(attr->value_length, packed_attr->value_length);
+          EXPECT_EQ(std::string(attr->value, attr->value_length),
+                    std::string(String(packed_attr->value),
+                                packed_attr->value_length));
+        }
+        break;
+      }
+      default: {
+        ASSERT_LT(actual->data, tree_->text_count);
+        const GumboPackedText* packed = &tree_->texts[actual->data];
+        EXPECT_EQ(expected->v.text.start_pos.offset, actual->offset);
+        EXPECT_EQ(std::string(expected->v.text.text,
+                              expected->v.text.text_length),
+                  std::string(String(packed->text), packed->length));
+        break;
+      }
+    }
+  }
+
+  MallocStats malloc_stats_;
+  GumboOptions options_;
+  GumboOutput* output_;
+  GumboPackedTree* tree_;
+};
+
+TEST_F(GumboPackTest, Empty) {
+  ParseAndPack("");
+  ASSERT_EQ(4, tree_->node_count);
+  EXPECT_EQ(1, tree_->root);
+  EXPECT_FALSE(tree_->has_doctype);
+  EXPECT_STREQ("", String(tree_->doctype_name));
+}
+
+TEST_F(GumboPackTest, Document) {
+  ParseAndPack(
+      "<!DOCTYPE html PUBLIC \"-//W3C//DTD HTML 4.01//EN\">"
+      "<!-- comment --><title>Title</title>"
+      "<p class=a id=\"b c\" data-x>Text &amp; more<b>bold<i>both</b>italic"
+      "</i></p><table><tr><td>cell</table><svg viewBox='0 0 1 1'><path/></svg>"
+      "<foo-bar>custom</foo-bar><script>var x = '<p>';</script>");
+  EXPECT_TRUE(tree_->has_doctype);
+  EXPECT_STREQ("html", String(tree_->doctype_name));
+  EXPECT_STREQ("-//W3C//DTD HTML 4.01//EN",
+               String(tree_->doctype_public_identifier));
+  EXPECT_STREQ("", String(tree_->doctype_system_identifier));
+  EXPECT_EQ(output_->document->v.document.doc_type_quirks_mode,
+            tree_->doc_type_quirks_mode);
+}
+
+TEST_F(GumboPackTest, AtomNamesAreShared) {
+  ParseAndPack("<p class=a><p class=b><p data-x=c><p data-x=d>");
+  ASSERT_EQ(4, tree_->attribute_count);
+  EXPECT_EQ(tree_->attributes[0].name, tree_->attributes[1].name);
+  EXPECT_NE(tree_->attributes[2].name, tree_->attributes[3].name);
+}
+
+TEST_F(GumboPackTest, SmallerThanCompactTree) {
+  std::string input;
+  for (int i = 0; i < 1000; ++i) {
+    input += "<div class=item><a href=#>link</a> text</div>";
+  }
+  uint64_t packed_bytes = ParseAndPack(input);
+  uint64_t bytes = malloc_stats_.bytes_allocated;
+  GumboOutput* compact = gumbo_compact_output(&options_, output_);
+  uint64_t compact_bytes = malloc_stats_.bytes_allocated - bytes;
+  gumbo_destroy_output(&options_, compact);
+  EXPECT_LT(packed_bytes * 3, compact_bytes);
+}
+
+TEST_F(GumboPackTest, DeeplyNested) {
+  const int kDepth = 100000;
+  std::string input;
+  for (int i = 0; i < kDepth; ++i) {
+    input += "<span>";
+  }
+  output_ = gumbo_parse_with_options(&options_, input.data(), input.length());
+  tree_ = gumbo_pack_output(&options_, output_);
+  // <html>, <head>, <body>, then the spans.
+  ASSERT_EQ(4 + kDepth, tree_->node_count);
+  for (uint32_t i = 4; i < tree_->node_count; ++i) {
+    EXPECT_EQ(i - 1, tree_->nodes[i].parent);
+  }
+}
+
+}  // namespace
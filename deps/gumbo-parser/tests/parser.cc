@@ -16,8 +16,14 @@
 
 #include "gumbo.h"
 
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <set>
 #include <string>
+#include <vector>
 
+#include "error.h"
 #include "test_utils.h"
 #include "gtest/gtest.h"
 
@@ -58,6 +64,23 @@ class GumboParserTest : public ::testing::Test {
     SanityCheckPointers(input.data(), input.length(), output_->root, 1000);
   }
 
+  // Parses input as the contents of a context element, leaving root_ pointing
+  // at the <html> element that holds the fragment.
+  void ParseFragment(const char* input, GumboTag context,
+                     GumboNamespaceEnum context_namespace) {
+    if (output_) {
+      gumbo_destroy_output(&options_, output_);
+    }
+
+    output_ = gumbo_parse_fragment(
+        &options_, input, strlen(input), context, context_namespace);
+    ASSERT_EQ(1, GetChildCount(output_->document));
+    root_ = output_->root;
+    ASSERT_EQ(GetChild(output_->document, 0), root_);
+    ASSERT_EQ(GUMBO_TAG_HTML, GetTag(root_));
+    SanityCheckPointers(input, strlen(input), root_, 1000);
+  }
+
   GumboOptions options_;
   GumboOutput* output_;
   GumboNode* root_;
@@ -319,6 +342,55 @@ TEST_F(GumboParserTest, DuplicateAttributes) {
   // TODO(jdtang): Run some assertions on the parse error that's added.
 }
 
+TEST_F(GumboParserTest, ManyDuplicateAttributes) {
+  // Enough attributes that duplicates are found through the hash index.
+  std::string text("<div");
+  for (int i = 0; i < 200; ++i) {
+    text += " data-a" + std::to_string(i) + "=" + std::to_string(i);
+  }
+  text += " data-a7=dup DATA-A150=dup id=x id=y>";
+  Parse(text);
+
+  GumboNode* body;
+  GetAndAssertBody(root_, &body);
+  GumboNode* div = GetChild(body, 0);
+  ASSERT_EQ(201, GetAttributeCount(div));
+  EXPECT_STREQ("7", GetAttribute(div, 7)->value);
+  EXPECT_STREQ("150", GetAttribute(div, 150)->value);
+  EXPECT_STREQ("x", GetAttribute(div, 200)->value);
+
+  std::vector<int> duplicates;
+  for (int i = 0; i < output_->errors.length; ++i) {
+    const GumboError* error =
+        static_cast<const GumboError*>(output_->errors.data[i]);
+    if (error->type == GUMBO_ERR_DUPLICATE_ATTR) {
+      duplicates.push_back(error->v.duplicate_attr.original_index);
+    }
+  }
+  ASSERT_EQ(3, duplicates.size());
+  EXPECT_EQ(7, duplicates[0]);
+  EXPECT_EQ(150, duplicates[1]);
+  EXPECT_EQ(200, duplicates[2]);
+}
+
+TEST_F(GumboParserTest, MergeManyAttributes) {
+  std::string first("<body");
+  std::string second("<body");
+  for (int i = 0; i < 50; ++i) {
+    first += " a" + std::to_string(i) + "=1";
+    second += " a" + std::to_string(i * 2) + "=2";
+  }
+  Parse(first + ">" + second + ">");
+
+  GumboNode* body;
+  GetAndAssertBody(root_, &body);
+  // a0..a49 from the first tag, plus the 25 even names from a50 to a98.
+  ASSERT_EQ(75, GetAttributeCount(body));
+  EXPECT_STREQ("1", GetAttribute(body, 48)->value);
+  EXPECT_STREQ("a50", GetAttribute(body, 50)->name);
+  EXPECT_STREQ("2", GetAttribute(body, 50)->value);
+}
+
 TEST_F(GumboParserTest, LinkTagsInHead) {
   Parse("<html>\n"
         "  <head>\n"
@@ -1308,6 +1380,55 @@ TEST_F(GumboParserTest, NoahsArkClause) {
   ASSERT_EQ(1, GetChildCount(red2));
 }
 
+TEST_F(GumboParserTest, ManyUnclosedFormattingElements) {
+  // Distinct attributes, so the Noah's Ark clause never applies and every
+  // <font> is reconstructed inside the second paragraph.
+  std::string text("<p>");
+  for (int i = 0; i < 1000; ++i) {
+    text += "<font size=" + std::to_string(i) + ">";
+  }
+  Parse(text + "<p>X");
+
+  GumboNode* body;
+  GetAndAssertBody(root_, &body);
+  ASSERT_EQ(2, GetChildCount(body));
+  GumboNode* node = GetChild(body, 1);
+  for (int i = 0; i < 1000; ++i) {
+    ASSERT_EQ(1, GetChildCount(node));
+    node = GetChild(node, 0);
+    ASSERT_EQ(GUMBO_NODE_ELEMENT, node->type);
+    ASSERT_EQ(GUMBO_TAG_FONT, node->v.element.tag);
+    ASSERT_EQ(std::to_string(i), GetAttribute(node, 0)->value);
+    EXPECT_EQ(GUMBO_INSERTION_RECONSTRUCTED_FORMATTING_ELEMENT,
+              node->parse_flags &
+              GUMBO_INSERTION_RECONSTRUCTED_FORMATTING_ELEMENT);
+  }
+  ASSERT_EQ(1, GetChildCount(node));
+  EXPECT_EQ(GUMBO_NODE_TEXT, GetChild(node, 0)->type);
+}
+
+TEST_F(GumboParserTest, ManyIdenticalFormattingElements) {
+  std::string text("<p>");
+  for (int i = 0; i < 1000; ++i) {
+    text += "<b class=x>";
+  }
+  Parse(text + "<p>X");
+
+  GumboNode* body;
+  GetAndAssertBody(root_, &body);
+  ASSERT_EQ(2, GetChildCount(body));
+  // Only the last three survive the Noah's Ark clause.
+  GumboNode* node = GetChild(body, 1);
+  for (int i = 0; i < 3; ++i) {
+    ASSERT_EQ(1, GetChildCount(node));
+    node = GetChild(node, 0);
+    ASSERT_EQ(GUMBO_NODE_ELEMENT, node->type);
+    ASSERT_EQ(GUMBO_TAG_B, node->v.element.tag);
+  }
+  ASSERT_EQ(1, GetChildCount(node));
+  EXPECT_EQ(GUMBO_NODE_TEXT, GetChild(node, 0)->type);
+}
+
 TEST_F(GumboParserTest, AdoptionAgency1) {
   // http://www.whatwg.org/specs/web-apps/current-work/multipage/the-end.html#misnested-tags:-b-i-/b-/i
   Parse("<p>1<b>2<i>3</b>4</i>5</p>");
@@ -1653,4 +1774,778 @@ TEST_F(GumboParserTest, DoubleBody) {
   EXPECT_STREQ("Text", text->v.text.text);
 }
 
+TEST_F(GumboParserTest, FragmentInDiv) {
+  ParseFragment("<p>Hello</p>world<!--c-->", GUMBO_TAG_DIV,
+                GUMBO_NAMESPACE_HTML);
+  EXPECT_TRUE(root_->parse_flags & GUMBO_INSERTION_IMPLIED);
+  // No <head> or <body>, just the fragment.
+  ASSERT_EQ(3, GetChildCount(root_));
+  GumboNode* p = GetChild(root_, 0);
+  EXPECT_EQ(GUMBO_TAG_P, GetTag(p));
+  ASSERT_EQ(1, GetChildCount(p));
+  EXPECT_STREQ("Hello", GetChild(p, 0)->v.text.text);
+  EXPECT_STREQ("world", GetChild(root_, 1)->v.text.text);
+  EXPECT_EQ(GUMBO_NODE_COMMENT, GetChild(root_, 2)->type);
+  EXPECT_FALSE(output_->document->v.document.has_doctype);
+  // The document, <html>, the context element, <p> and three more children.
+  EXPECT_EQ(7, output_->node_count);
+}
+
+TEST_F(GumboParserTest, FragmentInTableRow) {
+  ParseFragment("<td>a<td>b</td>c", GUMBO_TAG_TR, GUMBO_NAMESPACE_HTML);
+  ASSERT_EQ(3, GetChildCount(root_));
+  GumboNode* td = GetChild(root_, 1);
+  EXPECT_EQ(GUMBO_TAG_TD, GetTag(GetChild(root_, 0)));
+  EXPECT_EQ(GUMBO_TAG_TD, GetTag(td));
+  ASSERT_EQ(1, GetChildCount(td));
+  EXPECT_STREQ("b", GetChild(td, 0)->v.text.text);
+  // Stray text in a row would be foster parented out of the table, but
+  // there's no table here, so it stays where it is.
+  EXPECT_STREQ("c", GetChild(root_, 2)->v.text.text);
+
+  // Without the context, the cells are just text.
+  ParseFragment("<td>a<td>b", GUMBO_TAG_DIV, GUMBO_NAMESPACE_HTML);
+  ASSERT_EQ(1, GetChildCount(root_));
+  EXPECT_STREQ("ab", GetChild(root_, 0)->v.text.text);
+}
+
+TEST_F(GumboParserTest, FragmentInSelect) {
+  ParseFragment("<option>a<option>b<p>c", GUMBO_TAG_SELECT,
+                GUMBO_NAMESPACE_HTML);
+  ASSERT_EQ(2, GetChildCount(root_));
+  EXPECT_EQ(GUMBO_TAG_OPTION, GetTag(GetChild(root_, 0)));
+  GumboNode* option = GetChild(root_, 1);
+  EXPECT_EQ(GUMBO_TAG_OPTION, GetTag(option));
+  ASSERT_EQ(1, GetChildCount(option));
+  EXPECT_STREQ("bc", GetChild(option, 0)->v.text.text);
+}
+
+TEST_F(GumboParserTest, FragmentInRawTextContexts) {
+  ParseFragment("<b>&amp;</title>", GUMBO_TAG_TITLE, GUMBO_NAMESPACE_HTML);
+  ASSERT_EQ(1, GetChildCount(root_));
+  EXPECT_STREQ("<b>&</title>", GetChild(root_, 0)->v.text.text);
+
+  ParseFragment("if (a<b) {}", GUMBO_TAG_SCRIPT, GUMBO_NAMESPACE_HTML);
+  ASSERT_EQ(1, GetChildCount(root_));
+  EXPECT_STREQ("if (a<b) {}", GetChild(root_, 0)->v.text.text);
+
+  ParseFragment("<b>&amp;", GUMBO_TAG_STYLE, GUMBO_NAMESPACE_HTML);
+  ASSERT_EQ(1, GetChildCount(root_));
+  EXPECT_STREQ("<b>&amp;", GetChild(root_, 0)->v.text.text);
+
+  // Outside the HTML namespace, a <title> is ordinary.
+  ParseFragment("<b>x</b>", GUMBO_TAG_TITLE, GUMBO_NAMESPACE_SVG);
+  ASSERT_EQ(1, GetChildCount(root_));
+  EXPECT_EQ(GUMBO_TAG_B, GetTag(GetChild(root_, 0)));
+}
+
+TEST_F(GumboParserTest, FragmentInSvg) {
+  ParseFragment("<foreignObject/><path/><![CDATA[x]]><p>y", GUMBO_TAG_SVG,
+                GUMBO_NAMESPACE_SVG);
+  ASSERT_EQ(4, GetChildCount(root_));
+  GumboNode* foreign_object = GetChild(root_, 0);
+  EXPECT_EQ(GUMBO_TAG_FOREIGNOBJECT, GetTag(foreign_object));
+  EXPECT_EQ(GUMBO_NAMESPACE_SVG, foreign_object->v.element.tag_namespace);
+  EXPECT_EQ(GUMBO_NAMESPACE_SVG,
+            GetChild(root_, 1)->v.element.tag_namespace);
+  // CDATA sections are only recognized in foreign content; elsewhere they'd
+  // be bogus comments.
+  EXPECT_EQ(GUMBO_NODE_TEXT, GetChild(root_, 2)->type);
+  EXPECT_STREQ("x", GetChild(root_, 2)->v.text.text);
+  // <p> breaks out into HTML, even though there's no foreign element on the
+  // stack to pop.
+  GumboNode* p = GetChild(root_, 3);
+  EXPECT_EQ(GUMBO_TAG_P, GetTag(p));
+  EXPECT_EQ(GUMBO_NAMESPACE_HTML, p->v.element.tag_namespace);
+}
+
+TEST_F(GumboParserTest, FragmentFosterParenting) {
+  // The <table> is directly under <html>, with no <body> in between.
+  ParseFragment("<table>x<tr><td>y</table>", GUMBO_TAG_DIV,
+                GUMBO_NAMESPACE_HTML);
+  ASSERT_EQ(2, GetChildCount(root_));
+  GumboNode* text = GetChild(root_, 0);
+  EXPECT_STREQ("x", text->v.text.text);
+  EXPECT_TRUE(text->parse_flags & GUMBO_INSERTION_FOSTER_PARENTED);
+  EXPECT_EQ(GUMBO_TAG_TABLE, GetTag(GetChild(root_, 1)));
+}
+
+TEST_F(GumboParserTest, FragmentIgnoresDocumentLevelTags) {
+  ParseFragment("a</body></html><body class=x>b<html lang=en>",
+                GUMBO_TAG_SPAN, GUMBO_NAMESPACE_HTML);
+  ASSERT_EQ(1, GetChildCount(root_));
+  EXPECT_STREQ("ab", GetChild(root_, 0)->v.text.text);
+
+  // A <form> context means a nested <form> is dropped.
+  ParseFragment("<form><input></form>", GUMBO_TAG_FORM, GUMBO_NAMESPACE_HTML);
+  ASSERT_EQ(1, GetChildCount(root_));
+  EXPECT_EQ(GUMBO_TAG_INPUT, GetTag(GetChild(root_, 0)));
+
+  // While an <html> context parses like a whole document.
+  ParseFragment("<title>t</title>b", GUMBO_TAG_HTML, GUMBO_NAMESPACE_HTML);
+  ASSERT_EQ(2, GetChildCount(root_));
+  EXPECT_EQ(GUMBO_TAG_HEAD, GetTag(GetChild(root_, 0)));
+  EXPECT_EQ(GUMBO_TAG_BODY, GetTag(GetChild(root_, 1)));
+}
+
+TEST_F(GumboParserTest, FragmentFreesContextElement) {
+  options_.collect_stats = true;
+  ParseFragment("<b>x", GUMBO_TAG_TD, GUMBO_NAMESPACE_HTML);
+  EXPECT_EQ(0, gumbo_destroy_output_checked(&options_, output_, NULL));
+  output_ = NULL;
+}
+
+static bool AlwaysCancelled(void* userdata) {
+  return true;
+}
+
+// Asserts that the parse stopped early but still produced a complete
+// html/head/body skeleton with every element closed.
+static void ExpectTruncatedButWellFormed(GumboOutput* output, int max_depth) {
+  ASSERT_TRUE(output->root);
+  EXPECT_EQ(GUMBO_TAG_HTML, output->root->v.element.tag);
+  int depth = 0;
+  GumboNode* node = output->root;
+  while (node->type == GUMBO_NODE_ELEMENT &&
+         node->v.element.children.length > 0) {
+    node = static_cast<GumboNode*>(
+        node->v.element.children.data[node->v.element.children.length - 1]);
+    ++depth;
+  }
+  EXPECT_LE(depth, max_depth);
+}
+
+TEST_F(GumboParserTest, NodeLimit) {
+  options_.max_nodes = 20;
+  Parse("<ul><li>1<li>2<li>3<li>4<li>5<li>6<li>7<li>8<li>9<li>10</ul>");
+  EXPECT_EQ(GUMBO_STATUS_TOO_MANY_NODES, output_->status);
+  ExpectTruncatedButWellFormed(output_, 20);
+
+  GumboNode* body;
+  GetAndAssertBody(root_, &body);
+  GumboNode* ul = GetChild(body, 0);
+  EXPECT_GT(10, GetChildCount(ul));
+  // The limit is only checked between tokens, so the count overshoots it.
+  EXPECT_LT(20, output_->node_count);
+}
+
+TEST_F(GumboParserTest, NodeCount) {
+  // The document, html, head, body, p, text and a second text node for the
+  // trailing whitespace.
+  Parse("<p>Hello</p> ");
+  EXPECT_EQ(7, output_->node_count);
+}
+
+TEST_F(GumboParserTest, DepthLimit) {
+  options_.max_tree_depth = 10;
+  Parse("<div><div><div><div><div><div><div><div><div><div><div><div>x");
+  EXPECT_EQ(GUMBO_STATUS_TREE_TOO_DEEP, output_->status);
+  // html, body and the divs that fit within the limit.
+  ExpectTruncatedButWellFormed(output_, 11);
+  EXPECT_STREQ("Tree too deep", gumbo_status_to_string(output_->status));
+}
+
+TEST_F(GumboParserTest, MemoryLimit) {
+  options_.max_allocated_bytes = 4096;
+  std::string input;
+  for (int i = 0; i < 1000; ++i) {
+    input += "<p class=para>Paragraph</p>";
+  }
+  Parse(input);
+  EXPECT_EQ(GUMBO_STATUS_TOO_MUCH_MEMORY, output_->status);
+  GumboNode* body;
+  GetAndAssertBody(root_, &body);
+  EXPECT_LT(0, GetChildCount(body));
+  EXPECT_GT(1000, GetChildCount(body));
+}
+
+TEST_F(GumboParserTest, TimeLimitAndCancellation) {
+  std::string input;
+  for (int i = 0; i < 1000; ++i) {
+    input += "<b>bold</b>";
+  }
+  options_.max_parse_time_ms = 0;
+  Parse(input);
+  EXPECT_EQ(GUMBO_STATUS_TIMED_OUT, output_->status);
+
+  options_.max_parse_time_ms = -1;
+  options_.is_cancelled = AlwaysCancelled;
+  Parse(input);
+  EXPECT_EQ(GUMBO_STATUS_CANCELLED, output_->status);
+  GumboNode* body;
+  GetAndAssertBody(root_, &body);
+  EXPECT_GT(1000, GetChildCount(body));
+}
+
+TEST_F(GumboParserTest, NoLimitsByDefault) {
+  Parse("<div><div><div>x</div></div></div>");
+  EXPECT_EQ(GUMBO_STATUS_OK, output_->status);
+}
+
+TEST_F(GumboParserTest, NoStatsByDefault) {
+  Parse("<p>x</p>");
+  EXPECT_TRUE(output_->stats == NULL);
+}
+
+TEST_F(GumboParserTest, Stats) {
+  options_.collect_stats = true;
+  Parse("<!doctype html><table><td>cell</td>foster</table>"
+        "<p><b>bold<i>both</b>italic</p><!-- c -->");
+  const GumboParseStats* stats = output_->stats;
+  ASSERT_TRUE(stats);
+
+  EXPECT_EQ(1, stats->doctype_tokens);
+  EXPECT_EQ(5, stats->start_tag_tokens);
+  EXPECT_EQ(4, stats->end_tag_tokens);
+  EXPECT_EQ(1, stats->comment_tokens);
+  EXPECT_EQ(24, stats->character_tokens);
+
+  EXPECT_EQ(1, stats->nodes[GUMBO_NODE_DOCUMENT]);
+  // html, head, body, table, tbody, tr, td, p, b, i, and the clone of i.
+  EXPECT_EQ(11, stats->nodes[GUMBO_NODE_ELEMENT]);
+  EXPECT_EQ(1, stats->nodes[GUMBO_NODE_COMMENT]);
+  EXPECT_EQ(5, stats->nodes[GUMBO_NODE_TEXT]);
+  // html > body > table > tbody > tr > td
+  EXPECT_EQ(6, stats->max_tree_depth);
+
+  EXPECT_EQ(1, stats->adoption_agency_runs);
+  EXPECT_EQ(1, stats->foster_parent_insertions);
+  EXPECT_LT(0, stats->reconstruct_formatting_calls);
+  EXPECT_EQ(output_->errors.length, stats->errors);
+
+  EXPECT_LT(0, stats->allocations);
+  EXPECT_LT(0, stats->current_bytes);
+  EXPECT_LE(stats->current_bytes, stats->peak_bytes);
+  EXPECT_LE(stats->peak_bytes, stats->bytes_allocated);
+  EXPECT_LE(stats->tokenizer_time_ns + stats->tree_construction_time_ns,
+            stats->total_time_ns);
+}
+
+TEST_F(GumboParserTest, AttributeAtoms) {
+  Parse("<a HREF=x data-id=1 Class=y><svg viewbox='0 0 1 1' xlink:href=z>");
+  GumboNode* body;
+  GetAndAssertBody(root_, &body);
+  GumboNode* a = GetChild(body, 0);
+  ASSERT_EQ(3, GetAttributeCount(a));
+
+  GumboAttribute* href = GetAttribute(a, 0);
+  EXPECT_EQ(GUMBO_ATTR_HREF, href->atom);
+  EXPECT_EQ(GUMBO_STRING_STATIC, href->name_ownership);
+  EXPECT_STREQ("href", href->name);
+  EXPECT_EQ(href->name, gumbo_normalized_attribute_name(GUMBO_ATTR_HREF));
+
+  GumboAttribute* data = GetAttribute(a, 1);
+  EXPECT_EQ(GUMBO_ATTR_UNKNOWN, data->atom);
+  EXPECT_EQ(GUMBO_STRING_OWNED, data->name_ownership);
+  EXPECT_STREQ("data-id", data->name);
+
+  EXPECT_EQ(GUMBO_ATTR_CLASS, GetAttribute(a, 2)->atom);
+  EXPECT_EQ(GetAttribute(a, 2),
+            gumbo_get_attribute_by_atom(&a->v.element.attributes,
+                                        GUMBO_ATTR_CLASS));
+
+  GumboNode* svg = GetChild(a, 0);
+  ASSERT_EQ(2, GetAttributeCount(svg));
+  GumboAttribute* viewbox = GetAttribute(svg, 0);
+  EXPECT_STREQ("viewBox", viewbox->name);
+  EXPECT_EQ(GUMBO_STRING_OWNED, viewbox->name_ownership);
+  GumboAttribute* xlink_href = GetAttribute(svg, 1);
+  EXPECT_EQ(GUMBO_ATTR_NAMESPACE_XLINK, xlink_href->attr_namespace);
+  EXPECT_EQ(GUMBO_ATTR_HREF, xlink_href->atom);
+  EXPECT_STREQ("href", xlink_href->name);
+}
+
+TEST_F(GumboParserTest, StringsAreCopiedByDefault) {
+  Parse("<div class=foo>text</div>");
+  GumboNode* body;
+  GetAndAssertBody(root_, &body);
+  GumboNode* div = GetChild(body, 0);
+  GumboAttribute* clas = GetAttribute(div, 0);
+  EXPECT_EQ(GUMBO_STRING_OWNED, clas->value_ownership);
+  EXPECT_EQ(3, clas->value_length);
+  EXPECT_STREQ("foo", clas->value);
+  GumboNode* text = GetChild(div, 0);
+  EXPECT_EQ(GUMBO_STRING_OWNED, text->v.text.text_ownership);
+  EXPECT_EQ(4, text->v.text.text_length);
+  EXPECT_STREQ("text", text->v.text.text);
+}
+
+TEST_F(GumboParserTest, BorrowInputStrings) {
+  options_.borrow_input_strings = true;
+  const std::string input =
+      "<div class=\"a b\" id=x title='&lt;' data-x=''>plain text"
+      "<p>a &amp; b</p>one\r\ntwo</div>";
+  Parse(input);
+  GumboNode* body;
+  GetAndAssertBody(root_, &body);
+  GumboNode* div = GetChild(body, 0);
+  ASSERT_EQ(4, GetAttributeCount(div));
+
+  GumboAttribute* clas = GetAttribute(div, 0);
+  EXPECT_EQ(GUMBO_STRING_BORROWED, clas->value_ownership);
+  EXPECT_EQ(clas->original_value.data + 1, clas->value);
+  EXPECT_EQ("a b", std::string(clas->value, clas->value_length));
+
+  GumboAttribute* id = GetAttribute(div, 1);
+  EXPECT_EQ(GUMBO_STRING_BORROWED, id->value_ownership);
+  EXPECT_EQ("x", std::string(id->value, id->value_length));
+
+  GumboAttribute* title = GetAttribute(div, 2);
+  EXPECT_EQ(GUMBO_STRING_OWNED, title->value_ownership);
+  EXPECT_STREQ("<", title->value);
+
+  GumboAttribute* empty = GetAttribute(div, 3);
+  EXPECT_EQ(0, empty->value_length);
+
+  GumboNode* plain = GetChild(div, 0);
+  EXPECT_EQ(GUMBO_STRING_BORROWED, plain->v.text.text_ownership);
+  EXPECT_EQ(plain->v.text.original_text.data, plain->v.text.text);
+  EXPECT_EQ("plain text",
+            std::string(plain->v.text.text, plain->v.text.text_length));
+
+  GumboNode* entity = GetChild(GetChild(div, 1), 0);
+  EXPECT_EQ(GUMBO_STRING_OWNED, entity->v.text.text_ownership);
+  EXPECT_STREQ("a & b", entity->v.text.text);
+
+  // Carriage returns are normalized away, so this can't be borrowed.
+  GumboNode* newline = GetChild(div, 2);
+  EXPECT_EQ(GUMBO_STRING_OWNED, newline->v.text.text_ownership);
+  EXPECT_STREQ("one\ntwo", newline->v.text.text);
+}
+
+TEST_F(GumboParserTest, BorrowedAttributesSurviveCloning) {
+  options_.borrow_input_strings = true;
+  // The <b> is cloned by the adoption agency, sharing the borrowed value.
+  Parse("<b class=bold><p>1</b>2");
+  GumboNode* body;
+  GetAndAssertBody(root_, &body);
+  ASSERT_EQ(2, GetChildCount(body));
+  GumboNode* clone = GetChild(GetChild(body, 1), 0);
+  ASSERT_EQ(GUMBO_TAG_B, GetTag(clone));
+  GumboAttribute* clas = GetAttribute(clone, 0);
+  EXPECT_EQ(GUMBO_STRING_BORROWED, clas->value_ownership);
+  EXPECT_EQ("bold", std::string(clas->value, clas->value_length));
+}
+
+TEST_F(GumboParserTest, ClonedAttributesShareStrings) {
+  // The <b> is reconstructed inside each later paragraph.
+  Parse("<p><b class=bold></p><p>1</p><p>2</p>");
+  GumboNode* body;
+  GetAndAssertBody(root_, &body);
+  ASSERT_EQ(3, GetChildCount(body));
+  GumboAttribute* original = GetAttribute(GetChild(GetChild(body, 0), 0), 0);
+  EXPECT_EQ(GUMBO_STRING_SHARED, original->value_ownership);
+  EXPECT_EQ(GUMBO_STRING_STATIC, original->name_ownership);
+  for (int i = 1; i < 3; ++i) {
+    GumboNode* clone = GetChild(GetChild(body, i), 0);
+    ASSERT_EQ(GUMBO_TAG_B, GetTag(clone));
+    GumboAttribute* clas = GetAttribute(clone, 0);
+    EXPECT_EQ(GUMBO_STRING_SHARED, clas->value_ownership);
+    EXPECT_EQ(original->value, clas->value);
+    EXPECT_STREQ("bold", clas->value);
+  }
+}
+
+TEST_F(GumboParserTest, AdoptionAgencyMovesInlineAndAllocatedChildren) {
+  // The first <div> fits its children in its inline slots, the second doesn't.
+  Parse("<b><div>1<i></i>2</b></div><b><div>1<i></i>2<i></i>3</b></div>");
+  GumboNode* body;
+  GetAndAssertBody(root_, &body);
+  ASSERT_EQ(4, GetChildCount(body));
+  for (int i = 0; i < 2; ++i) {
+    GumboNode* div = GetChild(body, 2 * i + 1);
+    ASSERT_EQ(GUMBO_TAG_DIV, GetTag(div));
+    ASSERT_EQ(1, GetChildCount(div));
+    GumboNode* b = GetChild(div, 0);
+    ASSERT_EQ(GUMBO_TAG_B, GetTag(b));
+    ASSERT_EQ(3 + 2 * i, GetChildCount(b));
+    for (int j = 0; j < GetChildCount(b); ++j) {
+      EXPECT_EQ(b, GetChild(b, j)->parent);
+      EXPECT_EQ(j, GetChild(b, j)->index_within_parent);
+    }
+  }
+}
+
+TEST(GumboAllocationTest, LargeScriptWithStats) {
+  // The script's buffer is grown through realloc, which has to keep the stats'
+  // accounting of the block straight.
+  const size_t kLength = 1 << 20;
+  std::string input =
+      "<script>" + std::string(kLength, 'x') + "</script>";
+  GumboOptions options = kGumboDefaultOptions;
+  options.collect_stats = true;
+  GumboOutput* output =
+      gumbo_parse_with_options(&options, input.data(), input.length());
+  GumboNode* head = GetChild(output->root, 0);
+  ASSERT_EQ(1, GetChildCount(head));
+  GumboNode* script = GetChild(head, 0);
+  ASSERT_EQ(1, GetChildCount(script));
+  EXPECT_EQ(kLength, strlen(GetChild(script, 0)->v.text.text));
+  ASSERT_TRUE(output->stats != NULL);
+  EXPECT_LT(output->stats->peak_bytes, 4 * kLength);
+  gumbo_destroy_output(&options, output);
+}
+
+TEST(GumboAllocationTest, SmallElementsNeedNoArrays) {
+  // Each <span> keeps its node, a text node, the text itself and a <br> node
+  // alive; neither element needs a children or attributes array.
+  MallocStats stats;
+  GumboOptions options = kGumboDefaultOptions;
+  InitLeakDetection(&options, &stats);
+  uint64_t live[2];
+  for (int i = 0; i < 2; ++i) {
+    std::string input;
+    for (int j = 0; j < (i + 1) * 100; ++j) {
+      input += "<span>x<br></span>";
+    }
+    GumboOutput* output =
+        gumbo_parse_with_options(&options, input.data(), input.length());
+    live[i] = stats.objects_allocated - stats.objects_freed;
+    gumbo_destroy_output(&options, output);
+  }
+  EXPECT_EQ(100 * 4, live[1] - live[0]);
+  EXPECT_EQ(stats.objects_allocated, stats.objects_freed);
+}
+
+TEST(GumboAllocationTest, Categories) {
+  GumboOptions options = kGumboDefaultOptions;
+  options.collect_stats = true;
+  const char* html = "<p class=a id=b>text</p></i><table>foster</table>";
+  GumboOutput* output =
+      gumbo_parse_with_options(&options, html, strlen(html));
+  const GumboParseStats* stats = output->stats;
+  ASSERT_TRUE(stats != NULL);
+
+  unsigned int allocations = 0;
+  size_t bytes_allocated = 0;
+  size_t current_bytes = 0;
+  for (int i = 0; i < GUMBO_ALLOCATION_LAST; ++i) {
+    const GumboAllocationCounts* counts = &stats->by_category[i];
+    EXPECT_LT(0, counts->allocations)
+        << gumbo_allocation_category_name(static_cast<GumboAllocationCategory>(i));
+    EXPECT_LE(counts->current_bytes, counts->peak_bytes);
+    EXPECT_LE(counts->peak_bytes, counts->bytes_allocated);
+    allocations += counts->allocations;
+    bytes_allocated += counts->bytes_allocated;
+    current_bytes += counts->current_bytes;
+  }
+  EXPECT_EQ(stats->allocations, allocations);
+  EXPECT_EQ(stats->bytes_allocated, bytes_allocated);
+  EXPECT_EQ(stats->current_bytes, current_bytes);
+  // The tokenizer's buffers are gone by the end of the parse.
+  EXPECT_EQ(0, stats->by_category[GUMBO_ALLOCATION_STRING_BUFFER].current_bytes);
+  EXPECT_LT(0, stats->by_category[GUMBO_ALLOCATION_ERROR].current_bytes);
+  EXPECT_STREQ("string buffer",
+               gumbo_allocation_category_name(GUMBO_ALLOCATION_STRING_BUFFER));
+
+  size_t leaked[GUMBO_ALLOCATION_LAST];
+  EXPECT_EQ(0, gumbo_destroy_output_checked(&options, output, leaked));
+  for (int i = 0; i < GUMBO_ALLOCATION_LAST; ++i) {
+    EXPECT_EQ(0, leaked[i]);
+  }
+}
+
+// Keeps every live block, so that anything the parser leaks can still be freed
+// at the end of the test.
+void* TrackingMalloc(void* userdata, size_t size) {
+  void* ptr = malloc(size);
+  static_cast<std::set<void*>*>(userdata)->insert(ptr);
+  return ptr;
+}
+
+void TrackingFree(void* userdata, void* ptr) {
+  static_cast<std::set<void*>*>(userdata)->erase(ptr);
+  free(ptr);
+}
+
+TEST(GumboAllocationTest, LeakCheck) {
+  std::set<void*> live;
+  GumboOptions options = kGumboDefaultOptions;
+  options.allocator = TrackingMalloc;
+  options.deallocator = TrackingFree;
+  options.userdata = &live;
+  options.collect_stats = true;
+  const char* html = "<p>text</p>";
+  GumboOutput* output =
+      gumbo_parse_with_options(&options, html, strlen(html));
+  GumboNode* body;
+  GetAndAssertBody(output->document, &body);
+  GumboNode* p = GetChild(body, 0);
+  ASSERT_EQ(GUMBO_NODE_TEXT, GetChild(p, 0)->type);
+  // Unlink the text node, so that destroying the tree misses it.
+  p->v.element.children.length = 0;
+
+  size_t leaked[GUMBO_ALLOCATION_LAST];
+  EXPECT_EQ(sizeof(GumboNode) + strlen("text") + 1,
+            gumbo_destroy_output_checked(&options, output, leaked));
+  EXPECT_EQ(sizeof(GumboNode), leaked[GUMBO_ALLOCATION_NODE]);
+  EXPECT_EQ(strlen("text") + 1, leaked[GUMBO_ALLOCATION_TEXT]);
+  EXPECT_EQ(0, leaked[GUMBO_ALLOCATION_VECTOR]);
+
+  EXPECT_EQ(2, live.size());
+  for (std::set<void*>::iterator it = live.begin(); it != live.end(); ++it) {
+    free(*it);
+  }
+}
+
+// Checks that two trees have the same shape, tags and text.
+static void ExpectSameTree(const GumboNode* expected, const GumboNode* actual) {
+  ASSERT_EQ(expected->type, actual->type);
+  const GumboVector* expected_children;
+  const GumboVector* actual_children;
+  switch (expected->type) {
+    case GUMBO_NODE_DOCUMENT:
+      expected_children = &expected->v.document.children;
+      actual_children = &actual->v.document.children;
+      break;
+    case GUMBO_NODE_ELEMENT:
+      EXPECT_EQ(expected->v.element.tag, actual->v.element.tag);
+      EXPECT_EQ(expected->v.element.attributes.length,
+                actual->v.element.attributes.length);
+      expected_children = &expected->v.element.children;
+      actual_children = &actual->v.element.children;
+      break;
+    default:
+      EXPECT_STREQ(expected->v.text.text, actual->v.text.text);
+      return;
+  }
+  ASSERT_EQ(expected_children->length, actual_children->length);
+  for (int i = 0; i < expected_children->length; ++i) {
+    ExpectSameTree(static_cast<const GumboNode*>(expected_children->data[i]),
+                   static_cast<const GumboNode*>(actual_children->data[i]));
+  }
+}
+
+TEST(GumboParserContextTest, ReusedAcrossDocuments) {
+  const char* documents[] = {
+    "<!doctype html><title>a &amp; b</title><table><td>x</table>"
+        "<script>if (a < b) {}</script><p><b>1<i>2</b>3</p>",
+    // Ends in the middle of a tag and an attribute value.
+    "<div class=\"unterminated",
+    "<svg><![CDATA[x]]></svg><textarea>\n</textarea><!-- done -->",
+    "plain text",
+  };
+  GumboParserContext* context =
+      gumbo_create_parser_context(&kGumboDefaultOptions);
+  for (int round = 0; round < 2; ++round) {
+    for (size_t i = 0; i < sizeof(documents) / sizeof(documents[0]); ++i) {
+      const char* html = documents[i];
+      GumboOutput* expected = gumbo_parse(html);
+      GumboOutput* actual = gumbo_parse_with_context(
+          context, &kGumboDefaultOptions, html, strlen(html));
+      ExpectSameTree(expected->document, actual->document);
+      EXPECT_EQ(expected->errors.length, actual->errors.length);
+      gumbo_destroy_output(&kGumboDefaultOptions, expected);
+      gumbo_destroy_output(&kGumboDefaultOptions, actual);
+    }
+  }
+  gumbo_destroy_parser_context(&kGumboDefaultOptions, context);
+}
+
+TEST(GumboParserContextTest, Fragments) {
+  GumboParserContext* context =
+      gumbo_create_parser_context(&kGumboDefaultOptions);
+  const char* html = "<td>a<b>b<svg><path/></svg></b>";
+  for (int round = 0; round < 2; ++round) {
+    GumboOutput* expected = gumbo_parse_fragment(
+        &kGumboDefaultOptions, html, strlen(html), GUMBO_TAG_TR,
+        GUMBO_NAMESPACE_HTML);
+    GumboOutput* actual = gumbo_parse_fragment_with_context(
+        context, &kGumboDefaultOptions, html, strlen(html), GUMBO_TAG_TR,
+        GUMBO_NAMESPACE_HTML);
+    ExpectSameTree(expected->document, actual->document);
+    gumbo_destroy_output(&kGumboDefaultOptions, expected);
+    gumbo_destroy_output(&kGumboDefaultOptions, actual);
+
+    // A fragment parse leaves nothing behind to affect the next document.
+    expected = gumbo_parse(html);
+    actual = gumbo_parse_with_context(
+        context, &kGumboDefaultOptions, html, strlen(html));
+    ExpectSameTree(expected->document, actual->document);
+    gumbo_destroy_output(&kGumboDefaultOptions, expected);
+    gumbo_destroy_output(&kGumboDefaultOptions, actual);
+  }
+  gumbo_destroy_parser_context(&kGumboDefaultOptions, context);
+}
+
+TEST(GumboParserContextTest, LimitsAndStats) {
+  GumboParserContext* context =
+      gumbo_create_parser_context(&kGumboDefaultOptions);
+  GumboOptions options = kGumboDefaultOptions;
+  options.max_nodes = 5;
+  const char* html = "<ul><li>1<li>2<li>3</ul>";
+  GumboOutput* output =
+      gumbo_parse_with_context(context, &options, html, strlen(html));
+  EXPECT_EQ(GUMBO_STATUS_TOO_MANY_NODES, output->status);
+  gumbo_destroy_output(&options, output);
+
+  // A parse that stopped early mustn't leave anything behind for the next.
+  options = kGumboDefaultOptions;
+  options.collect_stats = true;
+  output = gumbo_parse_with_context(context, &options, html, strlen(html));
+  EXPECT_EQ(GUMBO_STATUS_OK, output->status);
+  ASSERT_TRUE(output->stats);
+  EXPECT_EQ(3, output->stats->nodes[GUMBO_NODE_TEXT]);
+  gumbo_destroy_output(&options, output);
+
+  output = gumbo_parse_with_context(
+      context, &kGumboDefaultOptions, html, strlen(html));
+  GumboNode* body;
+  GetAndAssertBody(output->document, &body);
+  ASSERT_EQ(1, GetChildCount(body));
+  EXPECT_EQ(3, GetChildCount(GetChild(body, 0)));
+  gumbo_destroy_output(&kGumboDefaultOptions, output);
+  gumbo_destroy_parser_context(&kGumboDefaultOptions, context);
+}
+
+// Parses (and frees) a document with 1M nested elements on a thread with a
+// deliberately small stack, so that any per-level recursion in the parser or in
+// tree destruction overflows and crashes the test.
+static void* ParseDeeplyNested(void* arg) {
+  const std::string* input = static_cast<const std::string*>(arg);
+  GumboOutput* output = gumbo_parse_with_options(
+      &kGumboDefaultOptions, input->data(), input->length());
+  GumboNode* node = output->root;
+  int depth = 0;
+  while (node->type == GUMBO_NODE_ELEMENT &&
+         node->v.element.children.length > 0) {
+    node = static_cast<GumboNode*>(
+        node->v.element.children.data[node->v.element.children.length - 1]);
+    ++depth;
+  }
+  gumbo_destroy_output(&kGumboDefaultOptions, output);
+  return reinterpret_cast<void*>(static_cast<intptr_t>(depth));
+}
+
+TEST(GumboDeepNestingTest, MillionLevelsInBoundedStack) {
+  const int kDepth = 1000000;
+  std::string input;
+  input.reserve(kDepth * 6);
+  for (int i = 0; i < kDepth; ++i) {
+    input += "<span>";
+  }
+
+  pthread_attr_t attr;
+  pthread_attr_init(&attr);
+  pthread_attr_setstacksize(&attr, 256 * 1024);
+  pthread_t thread;
+  ASSERT_EQ(0, pthread_create(&thread, &attr, &ParseDeeplyNested, &input));
+  pthread_attr_destroy(&attr);
+  void* result;
+  ASSERT_EQ(0, pthread_join(thread, &result));
+  // <html> -> <body> -> kDepth spans.
+  EXPECT_EQ(kDepth + 1, static_cast<int>(reinterpret_cast<intptr_t>(result)));
+}
+
+// Records the events from gumbo_tokenize as strings so that tests can compare
+// them against an expected stream.
+class GumboTokenizeTest : public ::testing::Test {
+ protected:
+  GumboTokenizeTest() : options_(kGumboDefaultOptions), stop_after_(-1) {
+    InitLeakDetection(&options_, &malloc_stats_);
+  }
+
+  virtual ~GumboTokenizeTest() {
+    EXPECT_EQ(malloc_stats_.objects_allocated, malloc_stats_.objects_freed);
+  }
+
+  bool Tokenize(const char* input) {
+    events_.clear();
+    return gumbo_tokenize_with_options(
+        &options_, input, strlen(input), &RecordEvent, this);
+  }
+
+  static bool RecordEvent(const GumboTokenEvent* event, void* userdata) {
+    GumboTokenizeTest* test = static_cast<GumboTokenizeTest*>(userdata);
+    std::string description;
+    switch (event->type) {
+      case GUMBO_TOKEN_EVENT_DOCTYPE:
+        description = "doctype:" + std::string(event->text);
+        break;
+      case GUMBO_TOKEN_EVENT_START_TAG:
+        description = "<" + ToString(event->tag_name);
+        for (int i = 0; i < event->attributes->length; ++i) {
+          GumboAttribute* attr =
+              static_cast<GumboAttribute*>(event->attributes->data[i]);
+          description += std::string(" ") + attr->name + "=" + attr->value;
+        }
+        description += event->is_self_closing ? "/>" : ">";
+        break;
+      case GUMBO_TOKEN_EVENT_END_TAG:
+        description = "</" + ToString(event->tag_name) + ">";
+        break;
+      case GUMBO_TOKEN_EVENT_COMMENT:
+        description = "comment:" + std::string(event->text);
+        break;
+      case GUMBO_TOKEN_EVENT_TEXT:
+        EXPECT_EQ(strlen(event->text), event->text_length);
+        description = "text:" + std::string(event->text);
+        break;
+    }
+    test->events_.push_back(description);
+    test->originals_.push_back(ToString(event->original_text));
+    return test->stop_after_ < 0 ||
+        test->events_.size() < static_cast<size_t>(test->stop_after_);
+  }
+
+  MallocStats malloc_stats_;
+  GumboOptions options_;
+  int stop_after_;
+  std::vector<std::string> events_;
+  std::vector<std::string> originals_;
+};
+
+TEST_F(GumboTokenizeTest, Empty) {
+  EXPECT_TRUE(Tokenize(""));
+  EXPECT_EQ(0, events_.size());
+}
+
+TEST_F(GumboTokenizeTest, TagsTextAndComments) {
+  EXPECT_TRUE(Tokenize(
+      "<!DOCTYPE html><P class=x ID='y'>Hello &amp; <b>bye</b><!-- c --><br/>"));
+  ASSERT_EQ(8, events_.size());
+  EXPECT_EQ("doctype:html", events_[0]);
+  EXPECT_EQ("<P class=x id=y>", events_[1]);
+  EXPECT_EQ("text:Hello & ", events_[2]);
+  EXPECT_EQ("Hello &amp; ", originals_[2]);
+  EXPECT_EQ("<b>", events_[3]);
+  EXPECT_EQ("text:bye", events_[4]);
+  EXPECT_EQ("</b>", events_[5]);
+  EXPECT_EQ("comment: c ", events_[6]);
+  EXPECT_EQ("<br/>", events_[7]);
+}
+
+TEST_F(GumboTokenizeTest, RawTextElements) {
+  EXPECT_TRUE(Tokenize(
+      "<title>a <b> c</title><script>if (a<b) x='</p>';</script>"
+      "<style>p > a {}</style>"));
+  ASSERT_EQ(9, events_.size());
+  EXPECT_EQ("<title>", events_[0]);
+  EXPECT_EQ("text:a <b> c", events_[1]);
+  EXPECT_EQ("</title>", events_[2]);
+  EXPECT_EQ("<script>", events_[3]);
+  EXPECT_EQ("text:if (a<b) x='</p>';", events_[4]);
+  EXPECT_EQ("</script>", events_[5]);
+  EXPECT_EQ("<style>", events_[6]);
+  EXPECT_EQ("text:p > a {}", events_[7]);
+  EXPECT_EQ("</style>", events_[8]);
+}
+
+TEST_F(GumboTokenizeTest, CdataInForeignContent) {
+  EXPECT_TRUE(Tokenize("<svg><![CDATA[<x>]]></svg><![CDATA[y]]>"));
+  ASSERT_EQ(4, events_.size());
+  EXPECT_EQ("<svg>", events_[0]);
+  EXPECT_EQ("text:<x>", events_[1]);
+  EXPECT_EQ("</svg>", events_[2]);
+  EXPECT_EQ("comment:[CDATA[y]]", events_[3]);
+}
+
+TEST_F(GumboTokenizeTest, StopEarly) {
+  stop_after_ = 2;
+  EXPECT_FALSE(Tokenize("<a href=1>x</a><a href=2>y</a>"));
+  ASSERT_EQ(2, events_.size());
+  EXPECT_EQ("<a href=1>", events_[0]);
+  EXPECT_EQ("text:x", events_[1]);
+}
+
 }  // namespace
@@ -0,0 +1,329 @@
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Complexity regression tests.  Each family below generates documents of a
+// shape that has made (or could make) the parser superlinear; every family is
+// parsed at a base scale and at 2, 4 and 8 times that, and the growth in time
+// and allocations must stay within the family's bound.  test/pathological.js
+// in the Node binding generates the same families, apart from the ones that go
+// through gumbo_parse_matching.
+
+#include "gumbo.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+#include <sstream>
+#include <string>
+
+#include "gtest/gtest.h"
+
+namespace {
+
+std::string Repeat(const std::string& pattern, int count) {
+  std::string result;
+  result.reserve(pattern.length() * count);
+  for (int i = 0; i < count; ++i) {
+    result += pattern;
+  }
+  return result;
+}
+
+std::string DeepNesting(int n) {
+  return Repeat("<div>", n);
+}
+
+std::string NestedLists(int n) {
+  return Repeat("<li><ul>", n);
+}
+
+std::string ManyAttributes(int n) {
+  std::ostringstream html;
+  html << "<p";
+  for (int i = 0; i < n; ++i) {
+    html << " a" << i << "=x";
+  }
+  html << ">";
+  return html.str();
+}
+
+std::string DuplicateAttributes(int n) {
+  return "<p" + Repeat(" a=x", n) + ">";
+}
+
+std::string MisnestedFormatting(int n) {
+  return Repeat("<b><p>x</b>", n);
+}
+
+// Leaves each <div> open, so that every adoption agency run starts from a
+// deeper stack.
+std::string MisnestedAroundBlocks(int n) {
+  return Repeat("<a><div>x</a>", n);
+}
+
+// Every </b> removes a <b> from under a <div>, which stays open, so none of
+// the removed elements is finished until the end of the document.
+std::string MisnestedWhileMatching(int n) {
+  return Repeat("<b><div>x</b>", n);
+}
+
+std::string FosterParentedText(int n) {
+  return "<table>" + Repeat("x<div>y</div>", n);
+}
+
+std::string FosterParentedFormatting(int n) {
+  return "<table><tr>" + Repeat("<b>x", n);
+}
+
+std::string ReconstructedFormatting(int n) {
+  return Repeat("<b><i><u>", n) + Repeat("<p>x", n);
+}
+
+std::string EntityRun(int n) {
+  return Repeat("&amp;", n);
+}
+
+std::string UnterminatedEntities(int n) {
+  return Repeat("&notin", n);
+}
+
+std::string LongEntityName(int n) {
+  return "&" + std::string(n, 'a');
+}
+
+std::string UnclosedComment(int n) {
+  return "<!--" + Repeat("x-", n);
+}
+
+std::string ScriptDoubleEscaped(int n) {
+  return "<script><!--<script>" + Repeat("x</script", n);
+}
+
+std::string ScriptEscapeToggling(int n) {
+  return "<script><!--" + Repeat("<script>x</script>", n);
+}
+
+// Every </p> is a parse error raised with the whole stack open.
+std::string StrayEndTags(int n) {
+  return Repeat("<div>", n) + Repeat("</p>", n);
+}
+
+// The few families that raise an error at every step with the whole stack open
+// record only this many of them.  Every recorded error keeps a copy of the
+// stack of open elements, so recording all of them is quadratic by design; the
+// other families record every error, as the default options do.
+const int kErrorCap = 100;
+
+struct Family {
+  const char* name;
+  std::string (*generate)(int scale);
+  // The smallest scale measured, large enough that the parse takes around a
+  // millisecond and timer noise doesn't dominate.
+  int base_scale;
+  // The largest allowed exponent k for cost ~ scale^k; 1 for linear.
+  double max_exponent;
+  // GumboOptions.max_errors for the parse: -1, or kErrorCap.
+  int max_errors;
+  // If set, the documents are parsed with gumbo_parse_matching and this
+  // selector rather than with gumbo_parse_with_options.
+  const char* selector;
+};
+
+const Family kFamilies[] = {
+  {"deep nesting", DeepNesting, 1000, 1, -1},
+  {"nested lists", NestedLists, 1000, 1, -1},
+  {"many attributes", ManyAttributes, 2000, 1, -1},
+  {"duplicate attributes", DuplicateAttributes, 2000, 1, -1},
+  {"misnested formatting", MisnestedFormatting, 500, 1, -1},
+  {"misnested around blocks", MisnestedAroundBlocks, 500, 1, kErrorCap},
+  {"misnested while matching", MisnestedWhileMatching, 500, 1,
+   kErrorCap, "div"},
+  {"foster-parented text", FosterParentedText, 500, 1, -1},
+  {"foster-parented formatting", FosterParentedFormatting, 500, 1, kErrorCap},
+  {"reconstructed formatting", ReconstructedFormatting, 500, 1, -1},
+  {"entity run", EntityRun, 2000, 1, -1},
+  {"unterminated entities", UnterminatedEntities, 1000, 1, -1},
+  {"long entity name", LongEntityName, 10000, 1, -1},
+  {"unclosed comment", UnclosedComment, 10000, 1, -1},
+  {"script double-escaped", ScriptDoubleEscaped, 2000, 1, -1},
+  {"script escape toggling", ScriptEscapeToggling, 1000, 1, -1},
+  {"stray end tags", StrayEndTags, 500, 1, kErrorCap},
+};
+
+// The allocation counts are exact, so they're what the tests check; a quadratic
+// family measures an exponent near 2.  Timings are too noisy on a loaded
+// machine to fail on, so their exponents are only printed, unless
+// GUMBO_COMPLEXITY_TIME_SLACK is set to the headroom to allow them over the
+// bound (0.35 is about right on an idle machine).
+const double kAllocationSlack = 0.1;
+const int kDoublings = 3;
+
+struct Cost {
+  double seconds;
+  double allocations;
+  double bytes_allocated;
+};
+
+bool CountMatch(GumboNode* node, void* userdata) {
+  ++*static_cast<int*>(userdata);
+  return true;
+}
+
+// Parses input a few times, with gumbo_parse_matching if selector_text is set,
+// and returns the fastest time along with the allocations.
+Cost MeasureParse(
+    const std::string& input, int max_errors, const char* selector_text) {
+  GumboOptions options = kGumboDefaultOptions;
+  options.collect_stats = true;
+  options.max_errors = max_errors;
+
+  GumboSelector* selector = NULL;
+  if (selector_text) {
+    selector = gumbo_compile_selector(&options, selector_text);
+    EXPECT_TRUE(selector != NULL);
+  }
+
+  Cost cost = {0, 0, 0};
+  for (int i = 0; i < 3; ++i) {
+    int matches = 0;
+    std::chrono::steady_clock::time_point start =
+        std::chrono::steady_clock::now();
+    GumboOutput* output = selector ?
+        gumbo_parse_matching(&options, input.data(), input.length(), selector,
+                             CountMatch, &matches) :
+        gumbo_parse_with_options(&options, input.data(), input.length());
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+    if (i == 0 || elapsed.count() < cost.seconds) {
+      cost.seconds = elapsed.count();
+    }
+    cost.allocations = output->stats->allocations;
+    cost.bytes_allocated = output->stats->bytes_allocated;
+    gumbo_destroy_output(&options, output);
+  }
+  if (selector) {
+    gumbo_destroy_selector(&options, selector);
+  }
+  return cost;
+}
+
+// The exponent k for which cost(large) = cost(small) * ratio^k.
+double GrowthExponent(double small, double large, double ratio) {
+  if (small <= 0) {
+    return large <= 0 ? 0 : INFINITY;
+  }
+  return log(large / small) / log(ratio);
+}
+
+// Checks the growth exponent of the parse time against max_exponent if
+// GUMBO_COMPLEXITY_TIME_SLACK is set, and otherwise just reports it.
+void CheckTimeExponent(
+    double exponent, double max_exponent, const std::string& detail) {
+  const char* slack = getenv("GUMBO_COMPLEXITY_TIME_SLACK");
+  if (slack) {
+    EXPECT_LE(exponent, max_exponent + atof(slack)) << detail;
+  } else {
+    printf("time exponent %.2f (bound %g): %s\n",
+           exponent, max_exponent, detail.c_str());
+  }
+}
+
+TEST(GumboPathologicalTest, FamiliesScaleWithinBounds) {
+  for (size_t i = 0; i < sizeof(kFamilies) / sizeof(kFamilies[0]); ++i) {
+    const Family& family = kFamilies[i];
+    SCOPED_TRACE(family.name);
+    int scale = family.base_scale;
+    Cost first = MeasureParse(
+        family.generate(scale), family.max_errors, family.selector);
+    Cost previous = first;
+    for (int j = 0; j < kDoublings; ++j) {
+      scale *= 2;
+      Cost current = MeasureParse(
+          family.generate(scale), family.max_errors, family.selector);
+      // The allocation counts are checked at every step, since they're exact.
+      EXPECT_LE(GrowthExponent(previous.allocations, current.allocations, 2),
+                family.max_exponent + kAllocationSlack) << "at scale " << scale;
+      EXPECT_LE(
+          GrowthExponent(previous.bytes_allocated, current.bytes_allocated, 2),
+          family.max_exponent + kAllocationSlack) << "at scale " << scale;
+      previous = current;
+    }
+    // Time is only compared end to end, to average out the noise.
+    std::ostringstream detail;
+    detail << family.name << ", " << first.seconds * 1000 << "ms at scale "
+           << family.base_scale << ", " << previous.seconds * 1000
+           << "ms at scale " << scale;
+    CheckTimeExponent(
+        GrowthExponent(first.seconds, previous.seconds, 1 << kDoublings),
+        family.max_exponent, detail.str());
+  }
+}
+
+TEST(GumboPathologicalTest, AdoptionAgencyPatternsScaleLinearly) {
+  // Each of these runs the adoption agency algorithm once or more per repeat.
+  const char* kPatterns[] = {
+    "<b><p>x</b></p>",
+    "<a><p>x</a>y</p>",
+    "<b><i><u><p>x</b>y</i>z</u></p>",
+    "<b>x<i>y<p>z</b>w</i></p>",
+    "<a href=x><div>x</a></div>",
+    "<table><b><tr><td>x</b></td></tr></table>",
+  };
+  const int kRatio = 8;
+  for (size_t i = 0; i < sizeof(kPatterns) / sizeof(kPatterns[0]); ++i) {
+    SCOPED_TRACE(kPatterns[i]);
+    Cost small = MeasureParse(Repeat(kPatterns[i], 1000), -1, NULL);
+    Cost large = MeasureParse(Repeat(kPatterns[i], 1000 * kRatio), -1, NULL);
+    EXPECT_LE(GrowthExponent(small.allocations, large.allocations, kRatio),
+              1 + kAllocationSlack);
+    EXPECT_LE(
+        GrowthExponent(small.bytes_allocated, large.bytes_allocated, kRatio),
+        1 + kAllocationSlack);
+    CheckTimeExponent(GrowthExponent(small.seconds, large.seconds, kRatio), 1,
+                      kPatterns[i]);
+  }
+}
+
+TEST(GumboPathologicalTest, ReconstructedAttributesAreNotCopied) {
+  // Every paragraph reconstructs the <b>, with its 10KB attribute.
+  const int kParagraphs = 1000;
+  std::string input =
+      "<p><b title=" + std::string(10000, 'x') + "></p>" +
+      Repeat("<p>x</p>", kParagraphs);
+  GumboOptions options = kGumboDefaultOptions;
+  options.collect_stats = true;
+  GumboOutput* output =
+      gumbo_parse_with_options(&options, input.data(), input.length());
+  ASSERT_TRUE(output->stats != NULL);
+  EXPECT_LT(output->stats->peak_bytes, kParagraphs * 1000u);
+  gumbo_destroy_output(&options, output);
+}
+
+TEST(GumboPathologicalTest, MaxErrorsBoundsRecordedErrors) {
+  std::string input = StrayEndTags(500);
+  GumboOptions options = kGumboDefaultOptions;
+  options.collect_stats = true;
+  options.max_errors = 10;
+  GumboOutput* output =
+      gumbo_parse_with_options(&options, input.data(), input.length());
+  EXPECT_EQ(10, output->errors.length);
+  EXPECT_LE(500, output->stats->errors);
+  gumbo_destroy_output(&options, output);
+
+  options.max_errors = -1;
+  output = gumbo_parse_with_options(&options, input.data(), input.length());
+  EXPECT_EQ(output->stats->errors, output->errors.length);
+  gumbo_destroy_output(&options, output);
+}
+
+}  // namespace
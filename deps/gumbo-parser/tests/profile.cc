@@ -0,0 +1,102 @@
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "gumbo.h"
+
+#include <string.h>
+#include <string>
+
+#include "insertion_mode.h"
+#include "tokenizer_states.h"
+#include "gtest/gtest.h"
+
+namespace {
+
+TEST(GumboProfileTest, Names) {
+  EXPECT_STREQ("data", gumbo_profile_tokenizer_state_name(GUMBO_LEX_DATA));
+  EXPECT_STREQ("attr value double quoted",
+               gumbo_profile_tokenizer_state_name(
+                   GUMBO_LEX_ATTR_VALUE_DOUBLE_QUOTED));
+  EXPECT_STREQ("cdata", gumbo_profile_tokenizer_state_name(GUMBO_LEX_CDATA));
+  EXPECT_EQ(NULL, gumbo_profile_tokenizer_state_name(
+      GUMBO_PROFILE_TOKENIZER_STATES));
+
+  EXPECT_STREQ("initial",
+               gumbo_profile_insertion_mode_name(GUMBO_INSERTION_MODE_INITIAL));
+  EXPECT_STREQ("in table body", gumbo_profile_insertion_mode_name(
+      GUMBO_INSERTION_MODE_IN_TABLE_BODY));
+  EXPECT_STREQ("after after frameset", gumbo_profile_insertion_mode_name(
+      GUMBO_INSERTION_MODE_AFTER_AFTER_FRAMESET));
+  EXPECT_EQ(NULL, gumbo_profile_insertion_mode_name(-1));
+}
+
+TEST(GumboProfileTest, Report) {
+  GumboProfile profile;
+  memset(&profile, 0, sizeof(profile));
+  profile.tokenizer_states[GUMBO_LEX_DATA].entries = 10;
+  profile.tokenizer_states[GUMBO_LEX_DATA].ticks = 100;
+  profile.tokenizer_states[GUMBO_LEX_TAG_NAME].entries = 4;
+  profile.tokenizer_states[GUMBO_LEX_TAG_NAME].ticks = 300;
+  profile.insertion_modes[GUMBO_INSERTION_MODE_IN_BODY].entries = 2;
+  profile.insertion_modes[GUMBO_INSERTION_MODE_IN_BODY].ticks = 50;
+
+  char buffer[4096];
+  size_t length = gumbo_profile_report(&profile, buffer, sizeof(buffer));
+  ASSERT_LT(length, sizeof(buffer));
+  EXPECT_EQ(length, strlen(buffer));
+  std::string report(buffer);
+
+  // Busiest first, and states that were never entered are left out.
+  size_t tag_name = report.find("tag name");
+  size_t data = report.find("data ");
+  ASSERT_NE(std::string::npos, tag_name);
+  ASSERT_NE(std::string::npos, data);
+  EXPECT_LT(tag_name, data);
+  EXPECT_NE(std::string::npos, report.find("75.0%"));
+  EXPECT_NE(std::string::npos, report.find("in body"));
+  EXPECT_EQ(std::string::npos, report.find("in table"));
+  EXPECT_EQ(std::string::npos, report.find("comment"));
+
+  // A short buffer is truncated but still terminated, and the full length is
+  // returned as with snprintf.
+  char small[16];
+  EXPECT_EQ(length, gumbo_profile_report(&profile, small, sizeof(small)));
+  EXPECT_EQ(sizeof(small) - 1, strlen(small));
+  EXPECT_EQ(length, gumbo_profile_report(&profile, NULL, 0));
+}
+
+TEST(GumboProfileTest, CollectedOnlyInProfilingBuilds) {
+  const char* kInput = "<table><tr><td><svg><path/></svg>x</table>";
+  GumboOutput* output = gumbo_parse(kInput);
+#ifdef GUMBO_PROFILE
+  ASSERT_TRUE(output->profile != NULL);
+  const GumboProfile* profile = output->profile;
+  EXPECT_LT(0u, profile->tokenizer_states[GUMBO_LEX_DATA].entries);
+  EXPECT_LT(0u, profile->tokenizer_states[GUMBO_LEX_TAG_NAME].entries);
+  EXPECT_LT(0u, profile->insertion_modes[GUMBO_INSERTION_MODE_INITIAL].entries);
+  EXPECT_LT(0u, profile->insertion_modes[GUMBO_INSERTION_MODE_IN_ROW].entries);
+  EXPECT_LT(0u, profile->insertion_modes[GUMBO_INSERTION_MODE_IN_CELL].entries);
+  EXPECT_LT(0u, profile->foreign_content.entries);
+
+  // The profile is carried over into compacted output.
+  GumboOutput* compact = gumbo_compact_output(&kGumboDefaultOptions, output);
+  ASSERT_TRUE(compact->profile != NULL);
+  EXPECT_EQ(profile->tokenizer_states[GUMBO_LEX_DATA].entries,
+            compact->profile->tokenizer_states[GUMBO_LEX_DATA].entries);
+  gumbo_destroy_output(&kGumboDefaultOptions, compact);
+#else
+  EXPECT_TRUE(output->profile == NULL);
+#endif
+  gumbo_destroy_output(&kGumboDefaultOptions, output);
+}
+
+}  // namespace
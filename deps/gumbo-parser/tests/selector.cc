@@ -0,0 +1,364 @@
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "gumbo.h"
+
+#include <string.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "test_utils.h"
+
+namespace {
+
+// Returns the text of node and everything in it.
+std::string TextContent(const GumboNode* node) {
+  if (node->type != GUMBO_NODE_ELEMENT) {
+    return node->type == GUMBO_NODE_COMMENT ? "" : node->v.text.text;
+  }
+  std::string text;
+  const GumboVector* children = &node->v.element.children;
+  for (int i = 0; i < children->length; ++i) {
+    text += TextContent(static_cast<GumboNode*>(children->data[i]));
+  }
+  return text;
+}
+
+class GumboSelectorTest : public ::testing::Test {
+ protected:
+  GumboSelectorTest() : selector_(NULL), output_(NULL) {}
+
+  virtual ~GumboSelectorTest() {
+    if (selector_) {
+      gumbo_destroy_selector(&kGumboDefaultOptions, selector_);
+    }
+    if (output_) {
+      gumbo_destroy_output(&kGumboDefaultOptions, output_);
+    }
+  }
+
+  void Compile(const char* selector) {
+    if (selector_) {
+      gumbo_destroy_selector(&kGumboDefaultOptions, selector_);
+    }
+    selector_ = gumbo_compile_selector(&kGumboDefaultOptions, selector);
+    ASSERT_TRUE(selector_ != NULL) << selector;
+  }
+
+  // Parses html into a full tree, and returns the text of every element that
+  // the selector matches, in document order.
+  std::vector<std::string> Select(const char* html) {
+    if (output_) {
+      gumbo_destroy_output(&kGumboDefaultOptions, output_);
+    }
+    output_ = gumbo_parse(html);
+    std::vector<std::string> matches;
+    Collect(output_->root, &matches);
+    return matches;
+  }
+
+  void Collect(const GumboNode* node, std::vector<std::string>* matches) {
+    if (node->type != GUMBO_NODE_ELEMENT) {
+      return;
+    }
+    if (gumbo_selector_matches(selector_, node)) {
+      matches->push_back(TextContent(node));
+    }
+    const GumboVector* children = &node->v.element.children;
+    for (int i = 0; i < children->length; ++i) {
+      Collect(static_cast<GumboNode*>(children->data[i]), matches);
+    }
+  }
+
+  GumboSelector* selector_;
+  GumboOutput* output_;
+};
+
+TEST_F(GumboSelectorTest, CompilesValidSelectors) {
+  const char* kValid[] = {
+    "div", "*", "#main", ".row", "DIV.a.b", "[href]", "[ type = text ]",
+    "[class~=a]", "[lang|=en]", "[src^=\"http:\"]", "[src$='.png']",
+    "[title*=x]", "div p", "div > p", "div>p", "ul li > a[href]",
+    "h1, h2 ,h3", "  p  ", "my-element", "*.a",
+  };
+  for (size_t i = 0; i < sizeof(kValid) / sizeof(kValid[0]); ++i) {
+    GumboSelector* selector =
+        gumbo_compile_selector(&kGumboDefaultOptions, kValid[i]);
+    EXPECT_TRUE(selector != NULL) << kValid[i];
+    if (selector) {
+      gumbo_destroy_selector(&kGumboDefaultOptions, selector);
+    }
+  }
+}
+
+TEST_F(GumboSelectorTest, RejectsInvalidSelectors) {
+  const char* kInvalid[] = {
+    "", " ", "#", ".", "div,", ",div", "div >", "> div", "[", "[href",
+    "[=x]", "[a=]", "[a~x]", "[a='x]", "[a=\"x\\\"\"]", "p:first-child",
+    "p + q", "p ~ q", "div >> p", "a b,,c",
+  };
+  for (size_t i = 0; i < sizeof(kInvalid) / sizeof(kInvalid[0]); ++i) {
+    EXPECT_TRUE(gumbo_compile_selector(&kGumboDefaultOptions, kInvalid[i]) ==
+                NULL) << kInvalid[i];
+  }
+}
+
+TEST_F(GumboSelectorTest, TypeSelectors) {
+  Compile("P");
+  EXPECT_EQ(std::vector<std::string>({"a", "b"}),
+            Select("<p>a<div>x</div><P>b"));
+  Compile("my-element");
+  EXPECT_EQ(std::vector<std::string>({"y"}),
+            Select("<my-other>x</my-other><My-Element>y</my-element>"));
+  Compile("*");
+  EXPECT_EQ(4, Select("<p>a").size());
+}
+
+TEST_F(GumboSelectorTest, IdAndClassSelectors) {
+  Compile("#main");
+  EXPECT_EQ(std::vector<std::string>({"a"}),
+            Select("<p id=main>a<p id=Main>b<p id='main x'>c"));
+  Compile(".row.wide");
+  EXPECT_EQ(std::vector<std::string>({"a", "c"}),
+            Select("<p class='wide row'>a<p class=row>b"
+                   "<p class=\"\trow  wide\">c<p class=row-wide>d"));
+  Compile("p.x");
+  EXPECT_EQ(std::vector<std::string>({"b"}),
+            Select("<div class=x>a</div><p class=x>b"));
+}
+
+TEST_F(GumboSelectorTest, AttributeSelectors) {
+  const char* html =
+      "<p lang=en>1<p lang=en-GB>2<p lang=eng>3<p data-X=''>4"
+      "<p title='one two'>5<p title=''>6";
+  Compile("[lang]");
+  EXPECT_EQ(std::vector<std::string>({"1", "2", "3"}), Select(html));
+  Compile("[lang=en]");
+  EXPECT_EQ(std::vector<std::string>({"1"}), Select(html));
+  Compile("[lang|=en]");
+  EXPECT_EQ(std::vector<std::string>({"1", "2"}), Select(html));
+  Compile("[lang^=en]");
+  EXPECT_EQ(std::vector<std::string>({"1", "2", "3"}), Select(html));
+  Compile("[lang$=GB]");
+  EXPECT_EQ(std::vector<std::string>({"2"}), Select(html));
+  Compile("[lang*=n-]");
+  EXPECT_EQ(std::vector<std::string>({"2"}), Select(html));
+  Compile("[title~=two]");
+  EXPECT_EQ(std::vector<std::string>({"5"}), Select(html));
+  // An attribute that's not one of the known ones.
+  Compile("[DATA-x]");
+  EXPECT_EQ(std::vector<std::string>({"4"}), Select(html));
+  Compile("[title='']");
+  EXPECT_EQ(std::vector<std::string>({"6"}), Select(html));
+  // Empty values never match the substring operators.
+  Compile("[title^='']");
+  EXPECT_TRUE(Select(html).empty());
+  Compile("[title*=\"\"]");
+  EXPECT_TRUE(Select(html).empty());
+}
+
+TEST_F(GumboSelectorTest, Combinators) {
+  const char* html =
+      "<div class=a><p>1</p><section><p>2</p></section></div><p>3</p>";
+  Compile("div p");
+  EXPECT_EQ(std::vector<std::string>({"1", "2"}), Select(html));
+  Compile(".a > p");
+  EXPECT_EQ(std::vector<std::string>({"1"}), Select(html));
+  Compile("body > p");
+  EXPECT_EQ(std::vector<std::string>({"3"}), Select(html));
+  Compile("html div section > p");
+  EXPECT_EQ(std::vector<std::string>({"2"}), Select(html));
+  Compile("section > div p");
+  EXPECT_TRUE(Select(html).empty());
+  Compile("section p, body > p");
+  EXPECT_EQ(std::vector<std::string>({"2", "3"}), Select(html));
+}
+
+TEST_F(GumboSelectorTest, DeepDescendantsDontBacktrackForever) {
+  std::string html;
+  for (int i = 0; i < 2000; ++i) {
+    html += "<div>";
+  }
+  html += "<p>x";
+  Compile("section div div div p");
+  EXPECT_TRUE(Select(html.c_str()).empty());
+  Compile("body div div div p");
+  EXPECT_EQ(std::vector<std::string>({"x"}), Select(html.c_str()));
+}
+
+struct MatchRecorder {
+  MatchRecorder() : limit(-1) {}
+
+  std::vector<std::string> matches;
+  std::vector<std::string> tags;
+  int limit;
+};
+
+bool RecordMatch(GumboNode* element, void* userdata) {
+  MatchRecorder* recorder = static_cast<MatchRecorder*>(userdata);
+  recorder->matches.push_back(TextContent(element));
+  recorder->tags.push_back(gumbo_normalized_tagname(element->v.element.tag));
+  return recorder->limit < 0 ||
+         recorder->matches.size() < static_cast<size_t>(recorder->limit);
+}
+
+class GumboParseMatchingTest : public GumboSelectorTest {
+ protected:
+  GumboParseMatchingTest() {
+    options_ = kGumboDefaultOptions;
+    options_.collect_stats = true;
+  }
+
+  GumboOutput* Parse(const std::string& html) {
+    if (output_) {
+      gumbo_destroy_output(&options_, output_);
+    }
+    output_ = gumbo_parse_matching(&options_, html.data(), html.length(),
+                                   selector_, RecordMatch, &recorder_);
+    return output_;
+  }
+
+  virtual ~GumboParseMatchingTest() {
+    if (output_) {
+      // Fails if anything that was set aside during the parse was lost.
+      size_t leaked = gumbo_destroy_output_checked(&options_, output_, NULL);
+      EXPECT_EQ(0, leaked);
+      output_ = NULL;
+    }
+  }
+
+  GumboOptions options_;
+  MatchRecorder recorder_;
+};
+
+TEST_F(GumboParseMatchingTest, DeliversMatchesWhenFinished) {
+  Compile("li");
+  Parse("<ul><li>one<li>two <b>bold</b></ul><p>after<li>three");
+  EXPECT_EQ(std::vector<std::string>({"one", "two bold", "three"}),
+            recorder_.matches);
+  EXPECT_EQ(GUMBO_STATUS_OK, output_->status);
+}
+
+TEST_F(GumboParseMatchingTest, InnerMatchesComeFirst) {
+  Compile("div");
+  Parse("<div>a<div>b</div>c</div>");
+  EXPECT_EQ(std::vector<std::string>({"b", "abc"}), recorder_.matches);
+}
+
+TEST_F(GumboParseMatchingTest, SameMatchesAsFullTree) {
+  const char* kSelectors[] = {
+    "p", "b", "i", "td", "table p", "div > b", "body > *", "a[href]",
+  };
+  const char* html =
+      "<!DOCTYPE html><title>t</title><p>1<b>2<p>3</b>4<table><tr><td>5"
+      "<p>6</table><div><b><i>7</b>8</i></div><a href=x>9<a>10</a>"
+      "<table>11<tr>12</table><form><div>13</form>14</div>";
+  for (size_t i = 0; i < sizeof(kSelectors) / sizeof(kSelectors[0]); ++i) {
+    Compile(kSelectors[i]);
+    std::vector<std::string> expected = Select(html);
+    recorder_.matches.clear();
+    Parse(html);
+    std::vector<std::string> streamed = recorder_.matches;
+    std::sort(expected.begin(), expected.end());
+    std::sort(streamed.begin(), streamed.end());
+    EXPECT_EQ(expected, streamed) << kSelectors[i];
+  }
+}
+
+TEST_F(GumboParseMatchingTest, FreesWhatsFinished) {
+  Compile("span");
+  Parse("<head><title>x</title><body><p>a<!--c-->b</p><div><p>c</p></div>"
+        "<span>s</span>text");
+  EXPECT_EQ(std::vector<std::string>({"s"}), recorder_.matches);
+  // The <head> is still referred to by the tree builder, and so it's kept,
+  // but the <body> is gone.
+  ASSERT_EQ(GUMBO_NODE_ELEMENT, output_->root->type);
+  ASSERT_EQ(1, GetChildCount(output_->root));
+  EXPECT_EQ(GUMBO_TAG_HEAD, GetChild(output_->root, 0)->v.element.tag);
+}
+
+TEST_F(GumboParseMatchingTest, MemoryDoesntGrowWithTheDocument) {
+  Compile("span");
+  std::string html = "<div>";
+  for (int i = 0; i < 200; ++i) {
+    html += "<p class=x>Some text <b>and <i>more</i></b> text</p>";
+  }
+  html += "<span>found</span></div>";
+  Parse(html);
+  size_t small_peak = output_->stats->peak_bytes;
+
+  html = "<div>";
+  for (int i = 0; i < 20000; ++i) {
+    html += "<p class=x>Some text <b>and <i>more</i></b> text</p>";
+  }
+  html += "<span>found</span></div>";
+  recorder_.matches.clear();
+  Parse(html);
+  EXPECT_EQ(std::vector<std::string>({"found"}), recorder_.matches);
+  // The tokenizer's and parser's own buffers don't grow either, so a hundred
+  // times more input takes nowhere near a hundred times more memory.
+  EXPECT_LT(output_->stats->peak_bytes, small_peak * 3);
+}
+
+TEST_F(GumboParseMatchingTest, FormattingElementsSurvive) {
+  // The <b> is still in the list of active formatting elements after the
+  // <p> that contains it is closed, so it's reconstructed in each of the
+  // following ones.
+  Compile("b");
+  std::string html = "<p><b>";
+  for (int i = 0; i < 200; ++i) {
+    html += "<p>x";
+  }
+  Parse(html);
+  ASSERT_EQ(201, recorder_.matches.size());
+  EXPECT_EQ("", recorder_.matches[0]);
+  EXPECT_EQ("x", recorder_.matches[200]);
+  Compile("i");
+  recorder_.matches.clear();
+  Parse("<p><i>a<p>b</i>c<div>d</div>");
+  EXPECT_EQ(std::vector<std::string>({"a", "b"}), recorder_.matches);
+}
+
+TEST_F(GumboParseMatchingTest, CallbackCanStop) {
+  Compile("li");
+  recorder_.limit = 2;
+  std::string html;
+  for (int i = 0; i < 100; ++i) {
+    html += "<li>x";
+  }
+  Parse(html);
+  EXPECT_EQ(2, recorder_.matches.size());
+  EXPECT_EQ(GUMBO_STATUS_CANCELLED, output_->status);
+}
+
+TEST_F(GumboParseMatchingTest, DeepNesting) {
+  Compile("div div > span");
+  std::string html;
+  for (int i = 0; i < 100000; ++i) {
+    html += "<div>";
+  }
+  html += "<span>deep</span>";
+  Parse(html);
+  EXPECT_EQ(std::vector<std::string>({"deep"}), recorder_.matches);
+}
+
+TEST_F(GumboParseMatchingTest, MatchesTheRoot) {
+  Compile("html");
+  Parse("<p>x");
+  EXPECT_EQ(std::vector<std::string>({"x"}), recorder_.matches);
+  // The root is never freed, but the rest can be once it's been delivered.
+  EXPECT_EQ(GUMBO_TAG_HTML, output_->root->v.element.tag);
+}
+
+}  // namespace
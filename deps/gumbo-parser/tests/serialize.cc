@@ -0,0 +1,308 @@
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "gumbo.h"
+
+#include <string.h>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace {
+
+static const char kInput[] =
+    "<!DOCTYPE html><title>Title</title><p class=a id='b c'>Text &amp; more"
+    "<b>bold</b><!-- comment --><foo-bar>custom</foo-bar><svg><path/></svg>";
+
+class GumboSerializeTest : public ::testing::Test {
+ protected:
+  GumboSerializeTest() {
+    GumboOutput* output = gumbo_parse(kInput);
+    tree_ = gumbo_pack_output(&kGumboDefaultOptions, output);
+    gumbo_destroy_output(&kGumboDefaultOptions, output);
+  }
+
+  virtual ~GumboSerializeTest() {
+    gumbo_destroy_packed_tree(&kGumboDefaultOptions, tree_);
+  }
+
+  // Serializes tree_ into data_, which is made of uint32_t so that it's
+  // aligned as loading requires, and returns the size in bytes.
+  size_t Serialize(const char* input, size_t input_length) {
+    size_t size = gumbo_serialize_packed_tree(
+        tree_, input, input_length, NULL, 0);
+    data_.assign((size + 3) / 4, 0);
+    EXPECT_EQ(size, gumbo_serialize_packed_tree(
+        tree_, input, input_length, &data_[0], size));
+    return size;
+  }
+
+  char* Bytes() {
+    return reinterpret_cast<char*>(&data_[0]);
+  }
+
+  bool Load(size_t size, GumboPackedTree* loaded) {
+    return gumbo_deserialize_packed_tree(Bytes(), size, loaded, NULL, NULL);
+  }
+
+  GumboPackedTree* tree_;
+  std::vector<uint32_t> data_;
+};
+
+TEST_F(GumboSerializeTest, RoundTrip) {
+  size_t size = Serialize(kInput, strlen(kInput));
+  GumboPackedTree loaded;
+  const char* input;
+  size_t input_length;
+  ASSERT_TRUE(gumbo_deserialize_packed_tree(
+      Bytes(), size, &loaded, &input, &input_length));
+
+  // The tables are used in place rather than copied.
+  EXPECT_LT(Bytes(), reinterpret_cast<const char*>(loaded.nodes));
+  EXPECT_GE(Bytes() + size, loaded.strings + loaded.strings_length);
+
+  ASSERT_EQ(tree_->node_count, loaded.node_count);
+  ASSERT_EQ(tree_->element_count, loaded.element_count);
+  ASSERT_EQ(tree_->text_count, loaded.text_count);
+  ASSERT_EQ(tree_->attribute_count, loaded.attribute_count);
+  ASSERT_EQ(tree_->strings_length, loaded.strings_length);
+  EXPECT_EQ(0, memcmp(tree_->nodes, loaded.nodes,
+                      sizeof(GumboPackedNode) * tree_->node_count));
+  EXPECT_EQ(0, memcmp(tree_->elements, loaded.elements,
+                      sizeof(GumboPackedElement) * tree_->element_count));
+  EXPECT_EQ(0, memcmp(tree_->texts, loaded.texts,
+                      sizeof(GumboPackedText) * tree_->text_count));
+  EXPECT_EQ(0, memcmp(tree_->attributes, loaded.attributes,
+                      sizeof(GumboPackedAttribute) * tree_->attribute_count));
+  EXPECT_EQ(0, memcmp(tree_->strings, loaded.strings, tree_->strings_length));
+  EXPECT_EQ(tree_->root, loaded.root);
+  EXPECT_TRUE(loaded.has_doctype);
+  EXPECT_STREQ("html", loaded.strings + loaded.doctype_name);
+  EXPECT_EQ(tree_->doc_type_quirks_mode, loaded.doc_type_quirks_mode);
+  EXPECT_EQ(tree_->status, loaded.status);
+
+  // The stored input gives back the names of unknown elements.
+  ASSERT_EQ(strlen(kInput), input_length);
+  EXPECT_EQ(0, memcmp(kInput, input, input_length));
+  for (uint32_t i = 0; i < loaded.node_count; ++i) {
+    const GumboPackedNode* node = &loaded.nodes[i];
+    if (node->type == GUMBO_NODE_ELEMENT &&
+        loaded.elements[node->data].tag == GUMBO_TAG_UNKNOWN &&
+        loaded.elements[node->data].tag_namespace == GUMBO_NAMESPACE_HTML) {
+      EXPECT_EQ("<foo-bar>",
+                std::string(input + node->offset,
+                            loaded.elements[node->data].original_tag_length));
+    }
+  }
+}
+
+TEST_F(GumboSerializeTest, WithoutInput) {
+  size_t size = Serialize(NULL, 0);
+  EXPECT_GT(Serialize(kInput, strlen(kInput)), size);
+  size = Serialize(NULL, 0);
+
+  GumboPackedTree loaded;
+  const char* input = kInput;
+  size_t input_length = 1;
+  ASSERT_TRUE(gumbo_deserialize_packed_tree(
+      Bytes(), size, &loaded, &input, &input_length));
+  EXPECT_EQ(NULL, input);
+  EXPECT_EQ(0, input_length);
+  EXPECT_EQ(tree_->node_count, loaded.node_count);
+}
+
+TEST_F(GumboSerializeTest, ShortBufferIsLeftAlone) {
+  size_t size = gumbo_serialize_packed_tree(tree_, NULL, 0, NULL, 0);
+  std::vector<char> buffer(size, 'x');
+  EXPECT_EQ(size, gumbo_serialize_packed_tree(
+      tree_, NULL, 0, &buffer[0], size - 1));
+  EXPECT_EQ(std::vector<char>(size, 'x'), buffer);
+}
+
+TEST_F(GumboSerializeTest, Deterministic) {
+  size_t size = Serialize(kInput, strlen(kInput));
+  std::vector<uint32_t> first = data_;
+
+  GumboOutput* output = gumbo_parse(kInput);
+  gumbo_destroy_packed_tree(&kGumboDefaultOptions, tree_);
+  tree_ = gumbo_pack_output(&kGumboDefaultOptions, output);
+  gumbo_destroy_output(&kGumboDefaultOptions, output);
+  EXPECT_EQ(size, Serialize(kInput, strlen(kInput)));
+  EXPECT_EQ(first, data_);
+}
+
+TEST_F(GumboSerializeTest, RejectsTruncated) {
+  size_t size = Serialize(kInput, strlen(kInput));
+  GumboPackedTree loaded;
+  for (size_t length = 0; length < size; ++length) {
+    EXPECT_FALSE(Load(length, &loaded)) << length;
+  }
+  EXPECT_TRUE(Load(size, &loaded));
+}
+
+TEST_F(GumboSerializeTest, RejectsMisaligned) {
+  size_t size = Serialize(NULL, 0);
+  data_.push_back(0);
+  memmove(Bytes() + 1, Bytes(), size);
+  GumboPackedTree loaded;
+  EXPECT_FALSE(
+      gumbo_deserialize_packed_tree(Bytes() + 1, size, &loaded, NULL, NULL));
+}
+
+TEST_F(GumboSerializeTest, RejectsBadHeader) {
+  size_t size = Serialize(NULL, 0);
+  const std::vector<uint32_t> good = data_;
+  GumboPackedTree loaded;
+
+  Bytes()[0] = 'g';
+  EXPECT_FALSE(Load(size, &loaded));
+  data_ = good;
+  // The version follows the 8-byte magic.
+  data_[2] = GUMBO_SERIALIZED_TREE_VERSION + 1;
+  EXPECT_FALSE(Load(size, &loaded));
+  data_ = good;
+  // Then the byte order mark.
+  std::swap(Bytes()[12], Bytes()[15]);
+  EXPECT_FALSE(Load(size, &loaded));
+  data_ = good;
+  EXPECT_TRUE(Load(size, &loaded));
+}
+
+TEST_F(GumboSerializeTest, RejectsBadIndexes) {
+  size_t size = Serialize(NULL, 0);
+  const std::vector<uint32_t> good = data_;
+  GumboPackedTree loaded;
+  ASSERT_TRUE(Load(size, &loaded));
+  // The tables in loaded point into data_, so they can be corrupted through
+  // it.
+  GumboPackedNode* nodes = const_cast<GumboPackedNode*>(loaded.nodes);
+  GumboPackedText* texts = const_cast<GumboPackedText*>(loaded.texts);
+
+  // A cycle through the parent links.
+  nodes[1].parent = 2;
+  EXPECT_FALSE(Load(size, &loaded));
+  data_ = good;
+  // A cycle through the sibling links.
+  nodes[2].next_sibling = 1;
+  EXPECT_FALSE(Load(size, &loaded));
+  data_ = good;
+  nodes[2].type = GUMBO_NODE_WHITESPACE + 1;
+  EXPECT_FALSE(Load(size, &loaded));
+  data_ = good;
+  nodes[1].data = loaded.element_count;
+  EXPECT_FALSE(Load(size, &loaded));
+  data_ = good;
+  texts[0].length = loaded.strings_length;
+  EXPECT_FALSE(Load(size, &loaded));
+  data_ = good;
+  const_cast<char*>(loaded.strings)[loaded.strings_length - 1] = 'x';
+  EXPECT_FALSE(Load(size, &loaded));
+  data_ = good;
+  EXPECT_TRUE(Load(size, &loaded));
+}
+
+TEST_F(GumboSerializeTest, RejectsInconsistentLinks) {
+  size_t size = Serialize(NULL, 0);
+  const std::vector<uint32_t> good = data_;
+  GumboPackedTree loaded;
+  ASSERT_TRUE(Load(size, &loaded));
+  GumboPackedNode* nodes = const_cast<GumboPackedNode*>(loaded.nodes);
+  // <html> is node 1, with <head> (2) and <body> (5); <title> (3) holds the
+  // text node 4; and the last node is the <path> inside the <svg>.
+  ASSERT_EQ(2, nodes[1].child_count);
+  ASSERT_EQ(GUMBO_NODE_TEXT, nodes[4].type);
+  ASSERT_EQ(5, nodes[2].next_sibling);
+  uint32_t last = loaded.node_count - 1;
+  ASSERT_EQ(last - 1, nodes[last].parent);
+
+  // The document isn't the first node.
+  nodes[0].type = GUMBO_NODE_ELEMENT;
+  nodes[0].data = 0;
+  EXPECT_FALSE(Load(size, &loaded));
+  data_ = good;
+  // A child count that doesn't match the children.
+  ++nodes[1].child_count;
+  EXPECT_FALSE(Load(size, &loaded));
+  data_ = good;
+  --nodes[1].child_count;
+  EXPECT_FALSE(Load(size, &loaded));
+  data_ = good;
+  // A child past the end of the nodes.
+  nodes[last].child_count = 1;
+  EXPECT_FALSE(Load(size, &loaded));
+  data_ = good;
+  // A text node with children.
+  nodes[4].child_count = 1;
+  nodes[5].parent = 4;
+  EXPECT_FALSE(Load(size, &loaded));
+  data_ = good;
+  // A sibling under another parent.
+  nodes[3].next_sibling = 5;
+  EXPECT_FALSE(Load(size, &loaded));
+  data_ = good;
+  // A last child with a sibling.
+  nodes[last - 1].next_sibling = last;
+  EXPECT_FALSE(Load(size, &loaded));
+  data_ = good;
+  EXPECT_TRUE(Load(size, &loaded));
+}
+
+// Whatever damage is done to the data, anything that loads is safe to walk.
+TEST_F(GumboSerializeTest, CorruptDataIsSafeToWalk) {
+  size_t size = Serialize(kInput, strlen(kInput));
+  const std::vector<uint32_t> good = data_;
+  unsigned int seed = 1;
+  int loaded_count = 0;
+  for (int i = 0; i < 2000; ++i) {
+    data_ = good;
+    for (int j = 0; j < 1 + i % 4; ++j) {
+      seed = seed * 1103515245 + 12345;
+      Bytes()[(seed >> 8) % size] ^= 1 << (seed >> 4) % 8;
+    }
+    GumboPackedTree loaded;
+    const char* input;
+    size_t input_length;
+    if (!gumbo_deserialize_packed_tree(
+            Bytes(), size, &loaded, &input, &input_length)) {
+      continue;
+    }
+    ++loaded_count;
+    size_t bytes = 0;
+    for (uint32_t n = 0; n < loaded.node_count; ++n) {
+      const GumboPackedNode* node = &loaded.nodes[n];
+      if (node->type == GUMBO_NODE_ELEMENT) {
+        const GumboPackedElement* element = &loaded.elements[node->data];
+        if (input) {
+          bytes += std::string(input + node->offset,
+                               element->original_tag_length).length();
+        }
+        for (uint32_t a = 0; a < element->attribute_count; ++a) {
+          const GumboPackedAttribute* attr =
+              &loaded.attributes[element->first_attribute + a];
+          bytes += strlen(loaded.strings + attr->name);
+          bytes += std::string(loaded.strings + attr->value,
+                               attr->value_length).length();
+        }
+      } else if (node->type != GUMBO_NODE_DOCUMENT) {
+        const GumboPackedText* text = &loaded.texts[node->data];
+        bytes += std::string(loaded.strings + text->text, text->length)
+            .length();
+      }
+    }
+    EXPECT_GE(size, bytes);
+  }
+  // Flips in the text and in most of the flags still load.
+  EXPECT_LT(0, loaded_count);
+}
+
+}  // namespace
@@ -55,6 +55,39 @@ TEST_F(GumboStringBufferTest, Reserve) {
   EXPECT_STREQ("01234567890123456789", buffer_.data);
 }
 
+static int num_reallocations = 0;
+
+static void* CountingRealloc(void* userdata, void* ptr, size_t size) {
+  ++num_reallocations;
+  return realloc(ptr, size);
+}
+
+TEST_F(GumboStringBufferTest, ReserveWithReallocator) {
+  // The leak detector's allocator is malloc underneath, so realloc matches.
+  options_.reallocator = CountingRealloc;
+  num_reallocations = 0;
+  strcpy(buffer_.data, "0123");
+  buffer_.length = 4;
+  uint64_t allocations = malloc_stats_.objects_allocated;
+  gumbo_string_buffer_reserve(&parser_, 1000, &buffer_);
+  EXPECT_EQ(1, num_reallocations);
+  EXPECT_EQ(allocations, malloc_stats_.objects_allocated);
+  EXPECT_LE(1000, buffer_.capacity);
+  NullTerminateBuffer();
+  EXPECT_STREQ("0123", buffer_.data);
+}
+
+TEST_F(GumboStringBufferTest, ReserveWithoutReallocator) {
+  // A custom allocator with the default reallocator falls back to copying.
+  strcpy(buffer_.data, "0123");
+  buffer_.length = 4;
+  uint64_t allocations = malloc_stats_.objects_allocated;
+  gumbo_string_buffer_reserve(&parser_, 1000, &buffer_);
+  EXPECT_EQ(allocations + 1, malloc_stats_.objects_allocated);
+  NullTerminateBuffer();
+  EXPECT_STREQ("0123", buffer_.data);
+}
+
 TEST_F(GumboStringBufferTest, AppendString) {
   INIT_GUMBO_STRING(str, "01234567");
   gumbo_string_buffer_append_string(&parser_, &str, &buffer_);
@@ -70,6 +103,20 @@ TEST_F(GumboStringBufferTest, AppendStringWithResize) {
   EXPECT_STREQ("0123456701234567", buffer_.data);
 }
 
+TEST_F(GumboStringBufferTest, ClearKeepsCapacity) {
+  INIT_GUMBO_STRING(str, "0123456789012345678901234567890123456789");
+  gumbo_string_buffer_append_string(&parser_, &str, &buffer_);
+  size_t capacity = buffer_.capacity;
+  gumbo_string_buffer_clear(&parser_, &buffer_);
+  EXPECT_EQ(0, buffer_.length);
+  EXPECT_EQ(capacity, buffer_.capacity);
+
+  INIT_GUMBO_STRING(short_str, "abc");
+  gumbo_string_buffer_append_string(&parser_, &short_str, &buffer_);
+  NullTerminateBuffer();
+  EXPECT_STREQ("abc", buffer_.data);
+}
+
 TEST_F(GumboStringBufferTest, AppendCodepoint_1Byte) {
   gumbo_string_buffer_append_codepoint(&parser_, 'a', &buffer_);
   NullTerminateBuffer();
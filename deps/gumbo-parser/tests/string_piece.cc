@@ -76,6 +76,9 @@ TEST_F(GumboStringPieceTest, CaseNotEqual_Str2Shorter) {
 TEST_F(GumboStringPieceTest, Copy) {
   GumboParser parser;
   parser._options = &kGumboDefaultOptions;
+  parser._allocated_bytes = 0;
+  parser._stats = NULL;
+  parser._profile = NULL;
   INIT_GUMBO_STRING(str1, "bar");
   GumboStringPiece str2;
   gumbo_string_copy(&parser, &str2, &str1);
@@ -188,8 +188,11 @@ GumboTest::GumboTest() :
   InitLeakDetection(&options_, &malloc_stats_);
   options_.max_errors = 100;
   parser_._options = &options_;
-  parser_._output = static_cast<GumboOutput*>(
-      gumbo_parser_allocate(&parser_, sizeof(GumboOutput)));
+  parser_._allocated_bytes = 0;
+  parser_._stats = NULL;
+  parser_._profile = NULL;
+  parser_._output = static_cast<GumboOutput*>(gumbo_parser_allocate(
+      &parser_, sizeof(GumboOutput), GUMBO_ALLOCATION_OTHER));
   gumbo_init_errors(&parser_);
 }
 
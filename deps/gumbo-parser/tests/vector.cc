@@ -75,6 +75,25 @@ TEST_F(GumboVectorTest, InitZeroCapacity) {
   EXPECT_EQ(1, *(static_cast<int*>(vector_.data[0])));
 }
 
+TEST_F(GumboVectorTest, Inline) {
+  gumbo_vector_destroy(&parser_, &vector_);
+  void* storage[2];
+  gumbo_vector_init_inline(storage, 2, &vector_);
+  gumbo_vector_add(&parser_, &one_, &vector_);
+  gumbo_vector_add(&parser_, &two_, &vector_);
+  EXPECT_EQ(storage, vector_.data);
+  EXPECT_EQ(&two_, storage[1]);
+
+  // Growing moves the elements to an allocated array, leaving storage alone.
+  gumbo_vector_add(&parser_, &three_, &vector_);
+  EXPECT_NE(storage, vector_.data);
+  EXPECT_FALSE(vector_._is_inline);
+  EXPECT_EQ(3, vector_.length);
+  EXPECT_EQ(4, vector_.capacity);
+  EXPECT_EQ(&one_, vector_.data[0]);
+  EXPECT_EQ(&three_, vector_.data[2]);
+}
+
 TEST_F(GumboVectorTest, Add) {
   gumbo_vector_add(&parser_, &one_, &vector_);
   EXPECT_EQ(1, vector_.length);
@@ -1,7 +1,17 @@
 #include <node.h>
+#include <node_buffer.h>
+#include <uv.h>
 #include <v8.h>
 
+#include <string.h>
+#include <strings.h>
+
+#include <atomic>
+#include <string>
+#include <vector>
+
 #include "deps/gumbo-parser/src/gumbo.h"
+#include "deps/gumbo-parser/src/trace.h"
 
 
 #ifdef __DEBUG__
@@ -15,7 +25,6 @@ using namespace v8;
 
 
 Handle<Value> create_parse_tree(GumboNode* root, Handle<Value> parent);
-Local<Array> get_children(GumboVector* children);
 Local<Object> consume_document(GumboDocument* document);
 Local<Object> consume_element(GumboElement* element, Handle<Value> parent);
 Local<Object> consume_text(GumboText* text);
@@ -33,19 +42,6 @@ void record_location(Local<Object> node, GumboSourcePosition* pos, const char* n
 }
 
 
-Local<Array> get_children(GumboVector* children, Handle<Value> parent) {
-    Local<Array> node_children = Array::New();
-
-    for (uint i=0; i < children->length; i++) {
-	GumboNode* node_child = (GumboNode* )children->data[i];
-	Handle<Value> child = create_parse_tree(node_child, parent);
-	node_children->Set(Number::New(i), child);
-    }
-
-    return node_children;
-}
-
-
 Handle<Value> get_quirks_mode(GumboQuirksModeEnum mode) {
     const char* mode_name;
     switch (mode) {
@@ -84,9 +80,6 @@ Local<Object> consume_document(GumboDocument* document) {
     document_node->Set(String::NewSymbol("docTypeQuirksMode"),
 		       get_quirks_mode(document->doc_type_quirks_mode));
 
-    document_node->Set(String::NewSymbol("children"),
-		       get_children(&document->children, document_node));
-
     return document_node;
 }
 
@@ -132,7 +125,7 @@ Local<Object> get_attribute(GumboAttribute* attr) {
 			       attr->original_name.length));
 
     attribute->Set(String::NewSymbol("value"),
-		   String::New(attr->value));
+		   String::New(attr->value, attr->value_length));
     attribute->Set(String::NewSymbol("originalValue"),
 		   String::New(attr->original_value.data,
 			       attr->original_value.length));
@@ -203,10 +196,6 @@ Local<Object> consume_element(GumboElement* element, Handle<Value> parent) {
     element_node->Set(String::NewSymbol("attributes"),
 		      get_attributes(&element->attributes));
 
-
-    element_node->Set(String::NewSymbol("children"),
-		      get_children(&element->children, element_node));
-
     record_location(element_node, &element->start_pos, "startPos");
     record_location(element_node, &element->end_pos, "endPos");
     return element_node;
@@ -216,7 +205,7 @@ Local<Object> consume_element(GumboElement* element, Handle<Value> parent) {
 Local<Object> consume_text(GumboText* text) {
     Local<Object> text_node = Object::New();
     text_node->Set(String::NewSymbol("text"),
-		   String::New(text->text));
+		   String::New(text->text, text->text_length));
     text_node->Set(String::NewSymbol("originalText"),
 		   String::New(text->original_text.data,
 			       text->original_text.length));
@@ -312,7 +301,8 @@ Handle<Value> get_node_type(GumboNodeType node_type) {
 }
 
 
-Handle<Value> create_parse_tree(GumboNode* node, Handle<Value> parent) {
+// Converts a single node, without its children, into a JS object.
+Handle<Value> consume_node(GumboNode* node, Handle<Value> parent) {
     Local<Object> parsed;
 
     switch (node->type) {
@@ -350,12 +340,326 @@ Handle<Value> create_parse_tree(GumboNode* node, Handle<Value> parent) {
 }
 
 
+GumboVector* get_node_children(GumboNode* node) {
+    switch (node->type) {
+    case GUMBO_NODE_DOCUMENT:
+	return &node->v.document.children;
+    case GUMBO_NODE_ELEMENT:
+	return &node->v.element.children;
+    default:
+	return NULL;
+    }
+}
+
+
+// One level of the explicit stack used by create_parse_tree: a node whose
+// children are being converted, and the index of the next one to convert.
+struct ConversionFrame {
+    GumboVector* children;
+    Local<Object> object;
+    Local<Array> js_children;
+    uint next;
+};
+
+
+// Converts a whole subtree.  This is a preorder walk driven by an explicit
+// stack rather than recursion, so that pathologically deep documents can't
+// overflow the native stack.
+Handle<Value> create_parse_tree(GumboNode* root, Handle<Value> parent) {
+    std::vector<ConversionFrame> stack;
+
+    Handle<Value> tree = consume_node(root, parent);
+    if (tree.IsEmpty() || !tree->IsObject()) {
+	return tree;
+    }
+
+    GumboNode* node = root;
+    Local<Object> object = tree->ToObject();
+    while (true) {
+	GumboVector* children = get_node_children(node);
+	if (children) {
+	    Local<Array> js_children = Array::New(children->length);
+	    object->Set(String::NewSymbol("children"), js_children);
+	    if (children->length > 0) {
+		ConversionFrame frame;
+		frame.children = children;
+		frame.object = object;
+		frame.js_children = js_children;
+		frame.next = 0;
+		stack.push_back(frame);
+	    }
+	}
+
+	while (!stack.empty() &&
+	       stack.back().next == stack.back().children->length) {
+	    stack.pop_back();
+	}
+	if (stack.empty()) {
+	    break;
+	}
+
+	ConversionFrame& top = stack.back();
+	uint index = top.next++;
+	node = (GumboNode* )top.children->data[index];
+	Handle<Value> child = consume_node(node, top.object);
+	if (child.IsEmpty() || !child->IsObject()) {
+	    return child;
+	}
+	top.js_children->Set(index, child);
+	object = child->ToObject();
+    }
+
+    return tree;
+}
+
+
+Handle<Value> get_output_status(GumboOutputStatus status) {
+    const char* status_name;
+
+    switch (status) {
+    case GUMBO_STATUS_OK:
+	status_name = "ok";
+	break;
+    case GUMBO_STATUS_TOO_MANY_NODES:
+	status_name = "tooManyNodes";
+	break;
+    case GUMBO_STATUS_TREE_TOO_DEEP:
+	status_name = "treeTooDeep";
+	break;
+    case GUMBO_STATUS_TOO_MUCH_MEMORY:
+	status_name = "tooMuchMemory";
+	break;
+    case GUMBO_STATUS_TIMED_OUT:
+	status_name = "timedOut";
+	break;
+    case GUMBO_STATUS_CANCELLED:
+	status_name = "cancelled";
+	break;
+    default:
+	ThrowException(Exception::TypeError(String::New("Unknown parse status")));
+	return Undefined();
+    }
+
+    return String::NewSymbol(status_name);
+}
+
+
+Handle<Value> get_parse_stats(const GumboParseStats* stats) {
+    Local<Object> js_stats = Object::New();
+
+    js_stats->Set(String::NewSymbol("tokenizerTime"),
+		  Number::New((double) stats->tokenizer_time_ns / 1e6));
+    js_stats->Set(String::NewSymbol("treeConstructionTime"),
+		  Number::New((double) stats->tree_construction_time_ns / 1e6));
+    js_stats->Set(String::NewSymbol("totalTime"),
+		  Number::New((double) stats->total_time_ns / 1e6));
+
+    Local<Object> tokens = Object::New();
+    tokens->Set(String::NewSymbol("doctype"),
+		Integer::NewFromUnsigned(stats->doctype_tokens));
+    tokens->Set(String::NewSymbol("startTag"),
+		Integer::NewFromUnsigned(stats->start_tag_tokens));
+    tokens->Set(String::NewSymbol("endTag"),
+		Integer::NewFromUnsigned(stats->end_tag_tokens));
+    tokens->Set(String::NewSymbol("comment"),
+		Integer::NewFromUnsigned(stats->comment_tokens));
+    tokens->Set(String::NewSymbol("whitespace"),
+		Integer::NewFromUnsigned(stats->whitespace_tokens));
+    tokens->Set(String::NewSymbol("character"),
+		Integer::NewFromUnsigned(stats->character_tokens));
+    tokens->Set(String::NewSymbol("null"),
+		Integer::NewFromUnsigned(stats->null_tokens));
+    js_stats->Set(String::NewSymbol("tokens"), tokens);
+
+    Local<Object> nodes = Object::New();
+    nodes->Set(String::NewSymbol("document"),
+	       Integer::NewFromUnsigned(stats->nodes[GUMBO_NODE_DOCUMENT]));
+    nodes->Set(String::NewSymbol("element"),
+	       Integer::NewFromUnsigned(stats->nodes[GUMBO_NODE_ELEMENT]));
+    nodes->Set(String::NewSymbol("text"),
+	       Integer::NewFromUnsigned(stats->nodes[GUMBO_NODE_TEXT]));
+    nodes->Set(String::NewSymbol("cdata"),
+	       Integer::NewFromUnsigned(stats->nodes[GUMBO_NODE_CDATA]));
+    nodes->Set(String::NewSymbol("comment"),
+	       Integer::NewFromUnsigned(stats->nodes[GUMBO_NODE_COMMENT]));
+    nodes->Set(String::NewSymbol("whitespace"),
+	       Integer::NewFromUnsigned(stats->nodes[GUMBO_NODE_WHITESPACE]));
+    js_stats->Set(String::NewSymbol("nodes"), nodes);
+    js_stats->Set(String::NewSymbol("maxTreeDepth"),
+		  Integer::NewFromUnsigned(stats->max_tree_depth));
+
+    js_stats->Set(String::NewSymbol("allocations"),
+		  Integer::NewFromUnsigned(stats->allocations));
+    js_stats->Set(String::NewSymbol("bytesAllocated"),
+		  Number::New((double) stats->bytes_allocated));
+    js_stats->Set(String::NewSymbol("peakBytes"),
+		  Number::New((double) stats->peak_bytes));
+    js_stats->Set(String::NewSymbol("currentBytes"),
+		  Number::New((double) stats->current_bytes));
+
+    // In the order of GumboAllocationCategory.
+    static const char* category_names[GUMBO_ALLOCATION_LAST] = {
+	"node", "attribute", "text", "vector", "stringBuffer", "error", "other"
+    };
+    Local<Object> by_category = Object::New();
+    for (int i = 0; i < GUMBO_ALLOCATION_LAST; ++i) {
+	const GumboAllocationCounts* counts = &stats->by_category[i];
+	Local<Object> js_counts = Object::New();
+	js_counts->Set(String::NewSymbol("allocations"),
+		       Integer::NewFromUnsigned(counts->allocations));
+	js_counts->Set(String::NewSymbol("bytesAllocated"),
+		       Number::New((double) counts->bytes_allocated));
+	js_counts->Set(String::NewSymbol("peakBytes"),
+		       Number::New((double) counts->peak_bytes));
+	js_counts->Set(String::NewSymbol("currentBytes"),
+		       Number::New((double) counts->current_bytes));
+	by_category->Set(String::NewSymbol(category_names[i]), js_counts);
+    }
+    js_stats->Set(String::NewSymbol("byCategory"), by_category);
+
+    js_stats->Set(String::NewSymbol("errors"),
+		  Integer::NewFromUnsigned(stats->errors));
+    js_stats->Set(String::NewSymbol("adoptionAgencyRuns"),
+		  Integer::NewFromUnsigned(stats->adoption_agency_runs));
+    js_stats->Set(String::NewSymbol("fosterParentInsertions"),
+		  Integer::NewFromUnsigned(stats->foster_parent_insertions));
+    js_stats->Set(String::NewSymbol("reconstructFormattingCalls"),
+		  Integer::NewFromUnsigned(stats->reconstruct_formatting_calls));
+
+    return js_stats;
+}
+
+
+Handle<Value> get_profile_counter(const GumboProfileCounter* counter) {
+    Local<Object> js_counter = Object::New();
+    js_counter->Set(String::NewSymbol("entries"),
+		    Number::New((double) counter->entries));
+    js_counter->Set(String::NewSymbol("ticks"),
+		    Number::New((double) counter->ticks));
+    return js_counter;
+}
+
+
+// Only present when the parser was built with GUMBO_PROFILE.  The counters are
+// keyed by name, and only those that were entered at all are included.
+Handle<Value> get_profile(const GumboProfile* profile) {
+    Local<Object> js_profile = Object::New();
+
+    Local<Object> states = Object::New();
+    for (int i = 0; i < GUMBO_PROFILE_TOKENIZER_STATES; i++) {
+	if (profile->tokenizer_states[i].entries) {
+	    states->Set(String::New(gumbo_profile_tokenizer_state_name(i)),
+			get_profile_counter(&profile->tokenizer_states[i]));
+	}
+    }
+    js_profile->Set(String::NewSymbol("tokenizerStates"), states);
+
+    Local<Object> modes = Object::New();
+    for (int i = 0; i < GUMBO_PROFILE_INSERTION_MODES; i++) {
+	if (profile->insertion_modes[i].entries) {
+	    modes->Set(String::New(gumbo_profile_insertion_mode_name(i)),
+		       get_profile_counter(&profile->insertion_modes[i]));
+	}
+    }
+    js_profile->Set(String::NewSymbol("insertionModes"), modes);
+
+    js_profile->Set(String::NewSymbol("foreignContent"),
+		    get_profile_counter(&profile->foreign_content));
+    js_profile->Set(String::NewSymbol("ticksAreNs"),
+		    Boolean::New(profile->ticks_are_ns));
+
+    std::string report(gumbo_profile_report(profile, NULL, 0), '\0');
+    gumbo_profile_report(profile, &report[0], report.size() + 1);
+    js_profile->Set(String::NewSymbol("report"), String::New(report.c_str()));
+
+    return js_profile;
+}
+
+
+// Hangs the per-parse results that aren't part of the tree itself off the
+// document object: the status, the stats if they were requested, and the
+// profile in profiling builds.
+void set_output_properties(Handle<Value> tree, const GumboOutput* output) {
+    if (!tree->IsObject()) {
+	return;
+    }
+    Local<Object> document = tree->ToObject();
+    document->Set(String::NewSymbol("status"),
+		  get_output_status(output->status));
+    if (output->stats) {
+	document->Set(String::NewSymbol("stats"),
+		      get_parse_stats(output->stats));
+    }
+    if (output->profile) {
+	document->Set(String::NewSymbol("profile"),
+		      get_profile(output->profile));
+    }
+}
+
+
+// Copies the resource limits and the stats flag from a JS options object
+// into GumboOptions.  Missing or non-numeric properties leave the
+// corresponding limit disabled.
+void read_parse_options(Handle<Value> value, GumboOptions* options) {
+    if (!value->IsObject()) {
+	return;
+    }
+    Local<Object> js_options = value->ToObject();
+
+    Local<Value> max_nodes = js_options->Get(String::NewSymbol("maxNodes"));
+    if (max_nodes->IsNumber()) {
+	options->max_nodes = max_nodes->Int32Value();
+    }
+
+    Local<Value> max_depth = js_options->Get(String::NewSymbol("maxDepth"));
+    if (max_depth->IsNumber()) {
+	options->max_tree_depth = max_depth->Int32Value();
+    }
+
+    Local<Value> max_bytes = js_options->Get(String::NewSymbol("maxBytes"));
+    if (max_bytes->IsNumber()) {
+	options->max_allocated_bytes = (size_t) max_bytes->IntegerValue();
+    }
+
+    Local<Value> timeout = js_options->Get(String::NewSymbol("timeout"));
+    if (timeout->IsNumber()) {
+	options->max_parse_time_ms = timeout->Int32Value();
+    }
+
+    options->collect_stats =
+	js_options->Get(String::NewSymbol("stats"))->BooleanValue();
+}
+
+
+// Every parse from the binding uses the default allocator, so each thread
+// (the main one and the libuv pool threads) keeps a single parser context
+// around and reuses its buffers for every document it parses.
+class ThreadParserContext {
+public:
+    ThreadParserContext()
+	: context_(gumbo_create_parser_context(&kGumboDefaultOptions)) {}
+    ~ThreadParserContext() {
+	gumbo_destroy_parser_context(&kGumboDefaultOptions, context_);
+    }
+    GumboParserContext* get() { return context_; }
+
+private:
+    GumboParserContext* context_;
+};
+
+
+GumboParserContext* get_thread_parser_context() {
+    static thread_local ThreadParserContext context;
+    return context.get();
+}
+
+
 Handle<Value> Method(const Arguments& args) {
     HandleScope scope;
 
-    if (args.Length() != 1) {
+    if (args.Length() < 1 || args.Length() > 2) {
 	ThrowException(Exception::TypeError
-		       (String::New("Please give Gumbo a single HTML string")));
+		       (String::New("Please give Gumbo an HTML string and optional options")));
 	return scope.Close(Undefined());
     }
 
@@ -365,25 +669,727 @@ Handle<Value> Method(const Arguments& args) {
 	return scope.Close(Undefined());
     }
 
+    GumboOptions options = kGumboDefaultOptions;
+    if (args.Length() > 1) {
+	read_parse_options(args[1], &options);
+    }
+    // Every string is copied into V8 (by length) before str goes away, so
+    // there's no need for the parser to make its own copies first.
+    options.borrow_input_strings = true;
+    // Only the error count is passed on (in the stats, which count errors
+    // whether or not they are recorded), so don't record any: each one keeps a
+    // copy of the stack of open elements.
+    options.max_errors = 0;
+
     String::Utf8Value str(args[0]->ToString());
     char* c_str = *str;
+    size_t length = args[0]->ToString()->Utf8Length();
 
-    GumboOutput* output = gumbo_parse_with_options(
-			      &kGumboDefaultOptions,
+    GumboOutput* output = gumbo_parse_with_context(
+			      get_thread_parser_context(),
+			      &options,
 			      c_str,
-			      args[0]->ToString()->Utf8Length());
+			      length);
 
+    GUMBO_TRACE2(convert__start, length, output->node_count);
     Handle<Value> tree = create_parse_tree(output->document, Null());
+    set_output_properties(tree, output);
+    GUMBO_TRACE2(convert__end, length, output->node_count);
 
-    gumbo_destroy_output(&kGumboDefaultOptions, output);
+    gumbo_destroy_output(&options, output);
 
     return scope.Close(tree);
 }
 
 
+// Reads a namespace name as reported in tagNamespace ("HTML", "SVG" or
+// "MATHML", in any case).  Returns false if it's none of them.
+bool read_tag_namespace(Handle<Value> value, GumboNamespaceEnum* result) {
+    String::Utf8Value name(value->ToString());
+    if (!strcasecmp(*name, "html")) {
+	*result = GUMBO_NAMESPACE_HTML;
+    } else if (!strcasecmp(*name, "svg")) {
+	*result = GUMBO_NAMESPACE_SVG;
+    } else if (!strcasecmp(*name, "mathml")) {
+	*result = GUMBO_NAMESPACE_MATHML;
+    } else {
+	return false;
+    }
+    return true;
+}
+
+
+// Parses html as the contents of a context element, as for innerHTML.  The
+// Document returned holds a single <html> element, whose children are the
+// fragment's nodes.
+Handle<Value> ParseFragment(const Arguments& args) {
+    HandleScope scope;
+
+    if (args.Length() < 2 || args.Length() > 3 ||
+	!args[0]->IsString() || !args[1]->IsString()) {
+	ThrowException(Exception::TypeError
+		       (String::New("Usage: parseFragment(html, contextTag[, options])")));
+	return scope.Close(Undefined());
+    }
+
+    GumboOptions options = kGumboDefaultOptions;
+    GumboNamespaceEnum context_namespace = GUMBO_NAMESPACE_HTML;
+    if (args.Length() > 2) {
+	read_parse_options(args[2], &options);
+	if (args[2]->IsObject()) {
+	    Local<Value> js_namespace =
+		args[2]->ToObject()->Get(String::NewSymbol("contextNamespace"));
+	    if (!js_namespace->IsUndefined() &&
+		!read_tag_namespace(js_namespace, &context_namespace)) {
+		ThrowException(Exception::TypeError
+			       (String::New("Unknown tag namespace")));
+		return scope.Close(Undefined());
+	    }
+	}
+    }
+    // As in parse().
+    options.borrow_input_strings = true;
+    options.max_errors = 0;
+
+    String::Utf8Value context_tag(args[1]->ToString());
+    String::Utf8Value str(args[0]->ToString());
+    size_t length = str.length();
+
+    GumboOutput* output = gumbo_parse_fragment_with_context(
+	get_thread_parser_context(), &options, *str, length,
+	gumbo_tag_enum(*context_tag), context_namespace);
+
+    GUMBO_TRACE2(convert__start, length, output->node_count);
+    Handle<Value> tree = create_parse_tree(output->document, Null());
+    set_output_properties(tree, output);
+    GUMBO_TRACE2(convert__end, length, output->node_count);
+
+    gumbo_destroy_output(&options, output);
+
+    return scope.Close(tree);
+}
+
+
+// Parses html and returns it packed and serialized, input included, in a
+// Buffer that can be cached on disk and turned back into a tree by loadTree()
+// without parsing again.
+Handle<Value> SerializeTree(const Arguments& args) {
+    HandleScope scope;
+
+    if (args.Length() < 1 || args.Length() > 2 || !args[0]->IsString()) {
+	ThrowException(Exception::TypeError
+		       (String::New("Usage: serializeTree(html[, options])")));
+	return scope.Close(Undefined());
+    }
+
+    GumboOptions options = kGumboDefaultOptions;
+    if (args.Length() > 1) {
+	read_parse_options(args[1], &options);
+    }
+    // Packing copies every string the tree keeps.
+    options.borrow_input_strings = true;
+    options.max_errors = 0;
+
+    String::Utf8Value str(args[0]->ToString());
+    GumboOutput* output = gumbo_parse_with_context(
+	get_thread_parser_context(), &options, *str, str.length());
+    GumboPackedTree* tree = gumbo_pack_output(&options, output);
+    gumbo_destroy_output(&options, output);
+
+    size_t size =
+	gumbo_serialize_packed_tree(tree, *str, str.length(), NULL, 0);
+    node::Buffer* buffer = node::Buffer::New(size);
+    gumbo_serialize_packed_tree(tree, *str, str.length(),
+				node::Buffer::Data(buffer), size);
+    gumbo_destroy_packed_tree(&options, tree);
+
+    return scope.Close(buffer->handle_);
+}
+
+
+// Packed trees only keep byte offsets, so loaded positions have no line or
+// column.
+void record_offset(Local<Object> node, uint32_t offset, const char* name) {
+    Local<Object> position = Object::New();
+    position->Set(String::NewSymbol("offset"),
+		  Integer::NewFromUnsigned(offset));
+    node->Set(String::NewSymbol(name), position);
+}
+
+
+Local<Object> consume_packed_element(const GumboPackedTree* tree,
+				     const GumboPackedNode* node,
+				     const char* input) {
+    const GumboPackedElement* element = &tree->elements[node->data];
+    Local<Object> element_node = Object::New();
+    element_node->Set(String::NewSymbol("tag"),
+		      String::New(gumbo_normalized_tagname(
+			  (GumboTag) element->tag)));
+
+    element_node->Set(String::NewSymbol("tagNamespace"),
+		      get_tag_namespace(
+			  (GumboNamespaceEnum) element->tag_namespace));
+
+    element_node->Set(String::NewSymbol("originalTag"),
+		      input ? String::New(input + node->offset,
+					  element->original_tag_length)
+			    : String::Empty());
+
+    Local<Object> attributes = Object::New();
+    for (uint32_t i = 0; i < element->attribute_count; i++) {
+	const GumboPackedAttribute* attr =
+	    &tree->attributes[element->first_attribute + i];
+	Local<Object> attribute = Object::New();
+	attribute->Set(String::NewSymbol("namespace"),
+		       get_attribute_namespace(
+			   (GumboAttributeNamespaceEnum) attr->attr_namespace));
+	Local<String> name = String::New(tree->strings + attr->name);
+	attribute->Set(String::NewSymbol("name"), name);
+	attribute->Set(String::NewSymbol("value"),
+		       String::New(tree->strings + attr->value,
+				   attr->value_length));
+	record_offset(attribute, attr->offset, "nameStart");
+	attributes->Set(name, attribute);
+    }
+    element_node->Set(String::NewSymbol("attributes"), attributes);
+
+    record_offset(element_node, node->offset, "startPos");
+    record_offset(element_node, element->end_offset, "endPos");
+    return element_node;
+}
+
+
+Local<Object> consume_packed_document(const GumboPackedTree* tree) {
+    Local<Object> document_node = Object::New();
+    document_node->Set(String::NewSymbol("hasDoctype"),
+		       Boolean::New(tree->has_doctype));
+    document_node->Set(String::NewSymbol("name"),
+		       String::New(tree->strings + tree->doctype_name));
+    document_node->Set(String::NewSymbol("publicIdentifier"),
+		       String::New(tree->strings +
+				   tree->doctype_public_identifier));
+    document_node->Set(String::NewSymbol("systemIdentifier"),
+		       String::New(tree->strings +
+				   tree->doctype_system_identifier));
+    document_node->Set(String::NewSymbol("docTypeQuirksMode"),
+		       get_quirks_mode(tree->doc_type_quirks_mode));
+    document_node->Set(String::NewSymbol("status"),
+		       get_output_status(tree->status));
+    return document_node;
+}
+
+
+// Builds the JS tree for a loaded packed tree.  Nodes are in document order
+// and every parent comes before its children, so one pass over the node table
+// suffices, with no recursion.
+Handle<Value> create_packed_tree(const GumboPackedTree* tree,
+				 const char* input) {
+    // The object and children array of each node that can have children, and
+    // how many children have been added to it so far.
+    std::vector<Local<Object> > objects(tree->node_count);
+    std::vector<Local<Array> > children(tree->node_count);
+    std::vector<uint32_t> child_counts(tree->node_count, 0);
+
+    for (uint32_t i = 0; i < tree->node_count; i++) {
+	const GumboPackedNode* node = &tree->nodes[i];
+	Local<Object> parsed;
+	switch (node->type) {
+	case GUMBO_NODE_DOCUMENT:
+	    parsed = consume_packed_document(tree);
+	    break;
+	case GUMBO_NODE_ELEMENT:
+	    parsed = consume_packed_element(tree, node, input);
+	    break;
+	default: {
+	    const GumboPackedText* text = &tree->texts[node->data];
+	    parsed = Object::New();
+	    parsed->Set(String::NewSymbol("text"),
+			String::New(tree->strings + text->text, text->length));
+	    record_offset(parsed, node->offset, "startPos");
+	    break;
+	}
+	}
+
+	parsed->Set(String::NewSymbol("type"),
+		    get_node_type((GumboNodeType) node->type));
+	parsed->Set(String::NewSymbol("parseFlags"),
+		    get_parse_flags((GumboParseFlags) node->parse_flags));
+	if (node->type == GUMBO_NODE_DOCUMENT ||
+	    node->type == GUMBO_NODE_ELEMENT) {
+	    objects[i] = parsed;
+	    children[i] = Array::New(node->child_count);
+	    parsed->Set(String::NewSymbol("children"), children[i]);
+	}
+
+	if (i == 0) {
+	    // As in parse(), where the document's index is (size_t) -1.
+	    parsed->Set(String::NewSymbol("parent"), Null());
+	    parsed->Set(String::NewSymbol("indexWithinParent"),
+			Number::New((double) (size_t) -1));
+	    continue;
+	}
+	// gumbo_deserialize_packed_tree has checked that parents come first
+	// and that only the document and elements have children, so this
+	// never fails; it's kept in case a tree gets here some other way.
+	if (children[node->parent].IsEmpty()) {
+	    ThrowException(Exception::TypeError
+			   (String::New("Invalid serialized tree")));
+	    return Undefined();
+	}
+	uint32_t index = child_counts[node->parent]++;
+	parsed->Set(String::NewSymbol("parent"), objects[node->parent]);
+	parsed->Set(String::NewSymbol("indexWithinParent"),
+		    Number::New(index));
+	children[node->parent]->Set(index, parsed);
+    }
+
+    return objects[0];
+}
+
+
+// Turns a Buffer from serializeTree() back into a Document, without parsing.
+// The tables are read in place unless the Buffer isn't 4-byte aligned (as
+// slices of Node's shared pool may not be), when they're copied first.
+Handle<Value> LoadTree(const Arguments& args) {
+    HandleScope scope;
+
+    if (args.Length() != 1 || !node::Buffer::HasInstance(args[0])) {
+	ThrowException(Exception::TypeError
+		       (String::New("Usage: loadTree(buffer)")));
+	return scope.Close(Undefined());
+    }
+
+    const char* data = node::Buffer::Data(args[0]);
+    size_t size = node::Buffer::Length(args[0]);
+    std::vector<uint32_t> aligned;
+    if ((uintptr_t) data % sizeof(uint32_t) != 0) {
+	aligned.resize(size / sizeof(uint32_t) + 1);
+	memcpy(&aligned[0], data, size);
+	data = (const char*) &aligned[0];
+    }
+
+    GumboPackedTree tree;
+    const char* input;
+    size_t input_length;
+    if (!gumbo_deserialize_packed_tree(data, size, &tree,
+				       &input, &input_length)) {
+	ThrowException(Exception::TypeError
+		       (String::New("Invalid serialized tree")));
+	return scope.Close(Undefined());
+    }
+
+    return scope.Close(create_packed_tree(&tree, input));
+}
+
+
+// State for one gumbo.parseAsync() call.  The parse itself runs on the libuv
+// thread pool against a private copy of the input; everything touching V8
+// happens back on the main thread in after_parse_async.
+struct ParseJob {
+    uv_work_t request;
+    Persistent<Function> callback;
+    Persistent<Object> handle;
+    // The parse tree points into this, so it must outlive the output.
+    std::string html;
+    GumboOptions options;
+    GumboOutput* output;
+    GumboOutputStatus status;
+    // Set from the JS thread by handle.cancel(), polled by the parse loop.
+    std::atomic<bool> cancelled;
+};
+
+
+Persistent<ObjectTemplate> parse_handle_template;
+
+
+bool is_job_cancelled(void* userdata) {
+    return static_cast<ParseJob*>(userdata)->cancelled.load();
+}
+
+
+void run_parse_async(uv_work_t* request) {
+    ParseJob* job = static_cast<ParseJob*>(request->data);
+    if (job->cancelled.load()) {
+	job->status = GUMBO_STATUS_CANCELLED;
+	return;
+    }
+
+    job->output = gumbo_parse_with_context(
+	get_thread_parser_context(), &job->options,
+	job->html.data(), job->html.length());
+    job->status = job->output->status;
+    if (job->status == GUMBO_STATUS_CANCELLED ||
+	job->status == GUMBO_STATUS_TIMED_OUT) {
+	// Nobody will ever see this tree, so free it here rather than waiting
+	// for the main thread to get around to it.
+	gumbo_destroy_output(&job->options, job->output);
+	job->output = NULL;
+	return;
+    }
+    // Lay the tree out in document order while still off the main thread, so
+    // that after_parse_async's walk over it is mostly sequential.
+    GumboOutput* compact = gumbo_compact_output(&job->options, job->output);
+    gumbo_destroy_output(&job->options, job->output);
+    job->output = compact;
+}
+
+
+Local<Value> make_parse_error(const char* message, const char* code) {
+    Local<Value> error = Exception::Error(String::New(message));
+    error->ToObject()->Set(String::NewSymbol("code"), String::New(code));
+    return error;
+}
+
+
+void after_parse_async(uv_work_t* request, int status) {
+    HandleScope scope;
+    ParseJob* job = static_cast<ParseJob*>(request->data);
+
+    Handle<Value> argv[2] = { Null(), Undefined() };
+    if (job->cancelled.load() || job->status == GUMBO_STATUS_CANCELLED) {
+	argv[0] = make_parse_error("Parse cancelled", "ECANCELED");
+    } else if (job->status == GUMBO_STATUS_TIMED_OUT) {
+	argv[0] = make_parse_error("Parse timed out", "ETIMEDOUT");
+    } else {
+	GUMBO_TRACE2(convert__start, job->html.length(),
+		     job->output->node_count);
+	Handle<Value> tree = create_parse_tree(job->output->document, Null());
+	set_output_properties(tree, job->output);
+	GUMBO_TRACE2(convert__end, job->html.length(),
+		     job->output->node_count);
+	argv[1] = tree;
+    }
+    if (job->output) {
+	gumbo_destroy_output(&job->options, job->output);
+    }
+
+    job->handle->SetAlignedPointerInInternalField(0, NULL);
+    Persistent<Function> callback = job->callback;
+    job->handle.Dispose();
+    delete job;
+
+    TryCatch try_catch;
+    callback->Call(Context::GetCurrent()->Global(), 2, argv);
+    callback.Dispose();
+    if (try_catch.HasCaught()) {
+	node::FatalException(try_catch);
+    }
+}
+
+
+Handle<Value> CancelParse(const Arguments& args) {
+    HandleScope scope;
+    ParseJob* job = static_cast<ParseJob*>(
+	args.This()->GetAlignedPointerFromInternalField(0));
+    if (job) {
+	job->cancelled.store(true);
+    }
+    return scope.Close(Boolean::New(job != NULL));
+}
+
+
+Handle<Value> ParseAsync(const Arguments& args) {
+    HandleScope scope;
+
+    if (args.Length() != 3 || !args[0]->IsString() || !args[2]->IsFunction()) {
+	ThrowException(Exception::TypeError
+		       (String::New("Usage: parseAsync(html, options, callback)")));
+	return scope.Close(Undefined());
+    }
+
+    ParseJob* job = new ParseJob;
+    String::Utf8Value str(args[0]->ToString());
+    job->html.assign(*str, str.length());
+    job->options = kGumboDefaultOptions;
+    read_parse_options(args[1], &job->options);
+    // job->html is kept until after_parse_async has built the JS tree.
+    job->options.borrow_input_strings = true;
+    job->options.max_errors = 0;
+    job->options.is_cancelled = is_job_cancelled;
+    job->options.userdata = job;
+    job->output = NULL;
+    job->status = GUMBO_STATUS_OK;
+    job->cancelled.store(false);
+    job->callback = Persistent<Function>::New(Local<Function>::Cast(args[2]));
+    job->handle = Persistent<Object>::New(parse_handle_template->NewInstance());
+    job->handle->SetAlignedPointerInInternalField(0, job);
+    job->request.data = job;
+
+    uv_queue_work(uv_default_loop(), &job->request,
+		  run_parse_async, after_parse_async);
+
+    return scope.Close(job->handle);
+}
+
+
+// Accumulates tokenizer events for gumbo.tokenize().  Events are collected
+// into a JS array and handed to the callback a batch at a time, so the cost of
+// calling into JS is paid once per batch rather than once per token.
+struct TokenizeBatch {
+    Persistent<Function> callback;
+    Persistent<Array> events;
+    uint32_t length;
+    uint32_t batch_size;
+    bool threw;
+};
+
+
+Handle<Value> get_token_event_type(GumboTokenEventType type) {
+    const char* type_name;
+
+    switch (type) {
+    case GUMBO_TOKEN_EVENT_DOCTYPE:
+	type_name = "doctype";
+	break;
+    case GUMBO_TOKEN_EVENT_START_TAG:
+	type_name = "startTag";
+	break;
+    case GUMBO_TOKEN_EVENT_END_TAG:
+	type_name = "endTag";
+	break;
+    case GUMBO_TOKEN_EVENT_COMMENT:
+	type_name = "comment";
+	break;
+    case GUMBO_TOKEN_EVENT_TEXT:
+	type_name = "text";
+	break;
+    default:
+	ThrowException(Exception::TypeError(String::New("Unknown token type")));
+	return Undefined();
+    }
+
+    return String::NewSymbol(type_name);
+}
+
+
+Local<Object> consume_token_event(const GumboTokenEvent* event) {
+    Local<Object> token = Object::New();
+    token->Set(String::NewSymbol("type"), get_token_event_type(event->type));
+
+    switch (event->type) {
+    case GUMBO_TOKEN_EVENT_START_TAG:
+	token->Set(String::NewSymbol("attributes"),
+		   get_attributes(const_cast<GumboVector*>(event->attributes)));
+	token->Set(String::NewSymbol("selfClosing"),
+		   Boolean::New(event->is_self_closing));
+	// Fall through.
+    case GUMBO_TOKEN_EVENT_END_TAG:
+	if (event->tag == GUMBO_TAG_UNKNOWN) {
+	    token->Set(String::NewSymbol("tag"),
+		       String::New(event->tag_name.data,
+				   event->tag_name.length));
+	} else {
+	    token->Set(String::NewSymbol("tag"),
+		       String::New(gumbo_normalized_tagname(event->tag)));
+	}
+	break;
+
+    case GUMBO_TOKEN_EVENT_DOCTYPE:
+	token->Set(String::NewSymbol("name"),
+		   String::New(event->text, event->text_length));
+	token->Set(String::NewSymbol("publicIdentifier"),
+		   String::New(event->public_identifier));
+	token->Set(String::NewSymbol("systemIdentifier"),
+		   String::New(event->system_identifier));
+	break;
+
+    case GUMBO_TOKEN_EVENT_COMMENT:
+    case GUMBO_TOKEN_EVENT_TEXT:
+	token->Set(String::NewSymbol("text"),
+		   String::New(event->text, event->text_length));
+	break;
+    }
+
+    token->Set(String::NewSymbol("originalText"),
+	       String::New(event->original_text.data,
+			   event->original_text.length));
+
+    GumboSourcePosition position = event->position;
+    record_location(token, &position, "startPos");
+    return token;
+}
+
+
+// Hands the pending events to the JS callback.  Returns false if the callback
+// threw or returned false, either of which stops the tokenizer.
+bool flush_token_batch(TokenizeBatch* batch) {
+    if (batch->length == 0) {
+	return true;
+    }
+
+    HandleScope scope;
+    Handle<Value> argv[] = { batch->events };
+    Handle<Value> result =
+	batch->callback->Call(Context::GetCurrent()->Global(), 1, argv);
+
+    batch->events.Dispose();
+    batch->events = Persistent<Array>::New(Array::New());
+    batch->length = 0;
+
+    if (result.IsEmpty()) {
+	batch->threw = true;
+	return false;
+    }
+    return !(result->IsFalse());
+}
+
+
+bool on_token_event(const GumboTokenEvent* event, void* userdata) {
+    TokenizeBatch* batch = static_cast<TokenizeBatch*>(userdata);
+    HandleScope scope;
+
+    batch->events->Set(batch->length++, consume_token_event(event));
+    if (batch->length < batch->batch_size) {
+	return true;
+    }
+    return flush_token_batch(batch);
+}
+
+
+Handle<Value> Tokenize(const Arguments& args) {
+    HandleScope scope;
+
+    if (args.Length() < 2 || !args[0]->IsString() || !args[1]->IsFunction()) {
+	ThrowException(Exception::TypeError
+		       (String::New("Usage: tokenize(html, callback[, batchSize])")));
+	return scope.Close(Undefined());
+    }
+
+    uint32_t batch_size = 256;
+    if (args.Length() > 2 && args[2]->IsNumber()) {
+	batch_size = args[2]->Uint32Value();
+	if (batch_size == 0) {
+	    batch_size = 1;
+	}
+    }
+
+    String::Utf8Value str(args[0]->ToString());
+
+    TokenizeBatch batch;
+    batch.callback = Persistent<Function>::New(Local<Function>::Cast(args[1]));
+    batch.events = Persistent<Array>::New(Array::New());
+    batch.length = 0;
+    batch.batch_size = batch_size;
+    batch.threw = false;
+
+    bool completed = gumbo_tokenize(*str, str.length(), on_token_event, &batch);
+    if (completed) {
+	flush_token_batch(&batch);
+    }
+
+    batch.events.Dispose();
+    batch.callback.Dispose();
+
+    if (batch.threw) {
+	// The exception from the callback is still pending; let it propagate.
+	return scope.Close(Undefined());
+    }
+    return scope.Close(Boolean::New(completed));
+}
+
+
+struct ExtractState {
+    Persistent<Function> callback;
+    bool threw;
+};
+
+
+// Converts a match to a tree for the JS callback while it's still alive.
+// Returns false if the callback threw or returned false, either of which stops
+// the parse.
+bool on_match(GumboNode* element, void* userdata) {
+    ExtractState* state = static_cast<ExtractState*>(userdata);
+    HandleScope scope;
+
+    Handle<Value> argv[] = { create_parse_tree(element, Null()) };
+    Handle<Value> result =
+	state->callback->Call(Context::GetCurrent()->Global(), 1, argv);
+    if (result.IsEmpty()) {
+	state->threw = true;
+	return false;
+    }
+    return !(result->IsFalse());
+}
+
+
+// Parses html, calling back with each element that selector matches as soon as
+// it's finished, and freeing the rest of the document as it goes.  Returns
+// true if the whole input was parsed.
+Handle<Value> Extract(const Arguments& args) {
+    HandleScope scope;
+
+    if (args.Length() < 3 || args.Length() > 4 ||
+	!args[0]->IsString() || !args[1]->IsString() || !args[2]->IsFunction()) {
+	ThrowException(Exception::TypeError
+		       (String::New("Usage: extract(html, selector, callback[, options])")));
+	return scope.Close(Undefined());
+    }
+
+    String::Utf8Value selector_text(args[1]->ToString());
+    GumboSelector* selector =
+	gumbo_compile_selector(&kGumboDefaultOptions, *selector_text);
+    if (!selector) {
+	ThrowException(Exception::TypeError
+		       (String::New("Invalid selector")));
+	return scope.Close(Undefined());
+    }
+
+    GumboOptions options = kGumboDefaultOptions;
+    if (args.Length() > 3) {
+	read_parse_options(args[3], &options);
+    }
+    // As in parse().
+    options.borrow_input_strings = true;
+    options.max_errors = 0;
+
+    String::Utf8Value str(args[0]->ToString());
+
+    ExtractState state;
+    state.callback = Persistent<Function>::New(Local<Function>::Cast(args[2]));
+    state.threw = false;
+
+    GumboOutput* output = gumbo_parse_matching(
+	&options, *str, str.length(), selector, on_match, &state);
+    bool completed = output->status == GUMBO_STATUS_OK;
+
+    gumbo_destroy_output(&options, output);
+    gumbo_destroy_selector(&kGumboDefaultOptions, selector);
+    state.callback.Dispose();
+
+    if (state.threw) {
+	// The exception from the callback is still pending; let it propagate.
+	return scope.Close(Undefined());
+    }
+    return scope.Close(Boolean::New(completed));
+}
+
+
 void init(Handle<Object> exports) {
     exports->Set(String::NewSymbol("parse"),
 		 FunctionTemplate::New(Method)->GetFunction());
+
+    exports->Set(String::NewSymbol("parseFragment"),
+		 FunctionTemplate::New(ParseFragment)->GetFunction());
+
+    exports->Set(String::NewSymbol("tokenize"),
+		 FunctionTemplate::New(Tokenize)->GetFunction());
+
+    exports->Set(String::NewSymbol("extract"),
+		 FunctionTemplate::New(Extract)->GetFunction());
+
+    exports->Set(String::NewSymbol("serializeTree"),
+		 FunctionTemplate::New(SerializeTree)->GetFunction());
+
+    exports->Set(String::NewSymbol("loadTree"),
+		 FunctionTemplate::New(LoadTree)->GetFunction());
+
+    Local<ObjectTemplate> handle_template = ObjectTemplate::New();
+    handle_template->SetInternalFieldCount(1);
+    handle_template->Set(String::NewSymbol("cancel"),
+			 FunctionTemplate::New(CancelParse));
+    parse_handle_template = Persistent<ObjectTemplate>::New(handle_template);
+    exports->Set(String::NewSymbol("parseAsync"),
+		 FunctionTemplate::New(ParseAsync)->GetFunction());
 }
 
 
@@ -1,2 +1,53 @@
 var gumbo = require('./build/Release/gumbo');
-module.exports = gumbo;
+
+
+function abortError() {
+    var error = new Error('Parse cancelled');
+    error.code = 'ECANCELED';
+    return error;
+}
+
+
+// Parses html on the libuv thread pool and calls back with (err, document).
+// options takes the same limits as parse(), plus an optional AbortSignal as
+// `signal`.  Returns a handle whose cancel() aborts the parse; a cancelled or
+// timed-out parse calls back with an error and never builds a tree.
+function parseAsync(html, options, callback) {
+    if (typeof options == 'function') {
+        callback = options;
+        options = {};
+    }
+    options = options || {};
+
+    var signal = options.signal;
+    if (signal && signal.aborted) {
+        process.nextTick(function() { callback(abortError()); });
+        return { cancel: function() { return false; } };
+    }
+
+    var handle = gumbo.parseAsync(html, options, function(err, document) {
+        if (signal) {
+            signal.removeEventListener('abort', onAbort);
+        }
+        callback(err, document);
+    });
+
+    function onAbort() {
+        handle.cancel();
+    }
+    if (signal) {
+        signal.addEventListener('abort', onAbort);
+    }
+    return handle;
+}
+
+
+module.exports = {
+    parse: gumbo.parse,
+    parseAsync: parseAsync,
+    parseFragment: gumbo.parseFragment,
+    tokenize: gumbo.tokenize,
+    extract: gumbo.extract,
+    serializeTree: gumbo.serializeTree,
+    loadTree: gumbo.loadTree
+};
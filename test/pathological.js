@@ -0,0 +1,64 @@
+// Families of documents that have made (or could make) parsing superlinear,
+// each generated at any scale.  These mirror the families in the C library's
+// deps/gumbo-parser/tests/pathological.cc.
+//
+// baseScale is the smallest scale worth timing, and maxExponent the largest
+// allowed exponent k for cost ~ scale^k (1 for linear).
+
+
+function repeat(text, count) {
+    return new Array(count + 1).join(text);
+}
+
+
+var families = [
+    {name: 'deep nesting', baseScale: 1000, maxExponent: 1,
+     generate: function(n) { return repeat('<div>', n); }},
+    {name: 'nested lists', baseScale: 1000, maxExponent: 1,
+     generate: function(n) { return repeat('<li><ul>', n); }},
+    {name: 'many attributes', baseScale: 2000, maxExponent: 1,
+     generate: function(n) {
+         var html = '<p';
+         for (var i = 0; i < n; i++) {
+             html += ' a' + i + '=x';
+         }
+         return html + '>';
+     }},
+    {name: 'duplicate attributes', baseScale: 2000, maxExponent: 1,
+     generate: function(n) { return '<p' + repeat(' a=x', n) + '>'; }},
+    {name: 'misnested formatting', baseScale: 500, maxExponent: 1,
+     generate: function(n) { return repeat('<b><p>x</b>', n); }},
+    {name: 'misnested around blocks', baseScale: 500, maxExponent: 1,
+     generate: function(n) { return repeat('<a><div>x</a>', n); }},
+    {name: 'foster-parented text', baseScale: 500, maxExponent: 1,
+     generate: function(n) { return '<table>' + repeat('x<div>y</div>', n); }},
+    {name: 'foster-parented formatting', baseScale: 500, maxExponent: 1,
+     generate: function(n) { return '<table><tr>' + repeat('<b>x', n); }},
+    {name: 'reconstructed formatting', baseScale: 500, maxExponent: 1,
+     generate: function(n) {
+         return repeat('<b><i><u>', n) + repeat('<p>x', n);
+     }},
+    {name: 'entity run', baseScale: 2000, maxExponent: 1,
+     generate: function(n) { return repeat('&amp;', n); }},
+    {name: 'unterminated entities', baseScale: 1000, maxExponent: 1,
+     generate: function(n) { return repeat('&notin', n); }},
+    {name: 'long entity name', baseScale: 10000, maxExponent: 1,
+     generate: function(n) { return '&' + repeat('a', n); }},
+    {name: 'unclosed comment', baseScale: 10000, maxExponent: 1,
+     generate: function(n) { return '<!--' + repeat('x-', n); }},
+    {name: 'script double-escaped', baseScale: 2000, maxExponent: 1,
+     generate: function(n) {
+         return '<script><!--<script>' + repeat('x</script', n);
+     }},
+    {name: 'script escape toggling', baseScale: 1000, maxExponent: 1,
+     generate: function(n) {
+         return '<script><!--' + repeat('<script>x</script>', n);
+     }},
+    {name: 'stray end tags', baseScale: 500, maxExponent: 1,
+     generate: function(n) { return repeat('<div>', n) + repeat('</p>', n); }}
+];
+
+
+module.exports = {
+    families: families
+};
@@ -1,4 +1,5 @@
-var gumbo = require('../build/Release/gumbo');
+var gumbo = require('../gumbo');
+var pathological = require('./pathological');
 var fs = require('fs');
 var assert = require('assert');
 
@@ -23,6 +24,241 @@ function testParse(err, text) {
     assert(tree.children[2].children[1].text == ' hark, a comment! ');
     assert(tree.children[2].children[3].attributes['class'].value == 'waffle');
     assert(tree.children[2].children[5].parseFlags[0] == 'implicitEndTag');
+
+    var tokens = [];
+    var batches = 0;
+    var completed = gumbo.tokenize(text, function(batch) {
+        batches++;
+        tokens.push.apply(tokens, batch);
+    }, 4);
+    assert(completed, "Tokenized the whole document");
+    assert(batches > 1, "Delivered tokens in batches");
+    var waffle = tokens.filter(function(token) {
+        return token.type == 'startTag' && token.attributes['class'];
+    });
+    assert(waffle[0].attributes['class'].value == 'waffle');
+    assert(tokens.some(function(token) {
+        return token.type == 'comment' && token.text == ' hark, a comment! ';
+    }));
+
+    var seen = 0;
+    completed = gumbo.tokenize(text, function(batch) {
+        seen += batch.length;
+        return false;
+    }, 2);
+    assert(!completed && seen == 2, "Stops when the callback returns false");
+
+    testDeepNesting();
+    testLimits(text);
+    testParseAsync(text);
+    testStats(text);
+    testSerializeTree(text);
+    testParseFragment();
+    testExtract(text);
+    testPathological();
+}
+
+
+function testLimits(text) {
+    assert(gumbo.parse(text).status == 'ok');
+
+    var limited = gumbo.parse(text, {maxNodes: 5});
+    assert(limited.status == 'tooManyNodes', "Stops at the node limit");
+    assert(limited.children[0].tag == 'html', "Still returns a tree");
+
+    var shallow = gumbo.parse(new Array(100).join('<div>'), {maxDepth: 10});
+    assert(shallow.status == 'treeTooDeep', "Stops at the depth limit");
+}
+
+
+function testStats(text) {
+    assert(gumbo.parse(text).stats === undefined, "No stats unless asked");
+
+    var stats = gumbo.parse(text, {stats: true}).stats;
+    assert(stats.nodes.document == 1);
+    assert(stats.nodes.element > 0 && stats.tokens.startTag > 0);
+    assert(stats.maxTreeDepth > 1);
+    assert(stats.peakBytes > 0 && stats.peakBytes <= stats.bytesAllocated);
+    var categoryBytes = 0;
+    for (var category in stats.byCategory) {
+        categoryBytes += stats.byCategory[category].bytesAllocated;
+    }
+    assert(categoryBytes == stats.bytesAllocated);
+    assert(stats.byCategory.node.currentBytes > 0);
+    assert(stats.byCategory.stringBuffer.currentBytes == 0);
+    assert(stats.tokenizerTime + stats.treeConstructionTime <= stats.totalTime);
+}
+
+
+// Parses each pathological family at its base scale and at 2, 4 and 8 times
+// that.  Allocations are exact, so they must grow within the family's bound at
+// every step.  Parse times (including conversion to JS) are too noisy on a
+// loaded machine to fail on, so their growth is only compared end to end, and
+// only checked if GUMBO_COMPLEXITY_TIME_SLACK gives the headroom to allow over
+// the bound (0.35 is about right on an idle machine); otherwise it's printed.
+function testPathological() {
+    var timeSlack = process.env.GUMBO_COMPLEXITY_TIME_SLACK;
+
+    function measure(html) {
+        var best = Infinity;
+        var stats;
+        for (var i = 0; i < 3; i++) {
+            var start = process.hrtime();
+            stats = gumbo.parse(html, {stats: true}).stats;
+            var diff = process.hrtime(start);
+            best = Math.min(best, diff[0] * 1e3 + diff[1] / 1e6);
+        }
+        return {ms: best, allocations: stats.allocations,
+                bytes: stats.bytesAllocated};
+    }
+
+    function exponent(small, large, ratio) {
+        return Math.log(large / small) / Math.log(ratio);
+    }
+
+    pathological.families.forEach(function(family) {
+        var scale = family.baseScale;
+        var first = measure(family.generate(scale));
+        var previous = first;
+        for (var i = 0; i < 3; i++) {
+            scale *= 2;
+            var current = measure(family.generate(scale));
+            assert(exponent(previous.allocations, current.allocations, 2) <=
+                   family.maxExponent + 0.1,
+                   family.name + ": allocations grow too fast at " + scale);
+            assert(exponent(previous.bytes, current.bytes, 2) <=
+                   family.maxExponent + 0.1,
+                   family.name + ": bytes allocated grow too fast at " + scale);
+            previous = current;
+        }
+        var timeExponent = exponent(first.ms, previous.ms, 8);
+        var detail = family.name + ": " + first.ms.toFixed(2) + "ms at " +
+            family.baseScale + " but " + previous.ms.toFixed(2) + "ms at " +
+            scale;
+        if (timeSlack) {
+            assert(timeExponent <= family.maxExponent + Number(timeSlack),
+                   detail);
+        } else {
+            console.log('time exponent ' + timeExponent.toFixed(2) +
+                        ' (bound ' + family.maxExponent + '), ' + detail);
+        }
+    });
+}
+
+
+function testSerializeTree(text) {
+    var parsed = gumbo.parse(text);
+    var buffer = gumbo.serializeTree(text);
+    assert(Buffer.isBuffer(buffer));
+
+    var loaded = gumbo.loadTree(buffer);
+    assert(loaded.status == parsed.status);
+    assert(loaded.hasDoctype == parsed.hasDoctype);
+    var body = loaded.children[0].children[2];
+    assert(body.tag == 'body' && body.parent.tag == 'html');
+    assert(body.children[1].text == ' hark, a comment! ');
+    assert(body.children[3].attributes['class'].value == 'waffle');
+    assert(body.children[3].originalTag ==
+           parsed.children[0].children[2].children[3].originalTag);
+
+    // A misaligned copy loads too; damaged data doesn't.
+    var shifted = new Buffer(buffer.length + 1);
+    buffer.copy(shifted, 1);
+    assert(gumbo.loadTree(shifted.slice(1)).children[0].tag == 'html');
+    assert.throws(function() {
+        gumbo.loadTree(buffer.slice(0, buffer.length - 1));
+    }, TypeError);
+}
+
+
+function testParseFragment() {
+    var row = gumbo.parseFragment('<td>a<td>b', 'tr').children[0];
+    assert(row.tag == 'html' && row.children.length == 2,
+           "Parses fragments without head and body");
+    assert(row.children[1].tag == 'td');
+    assert(row.children[1].children[0].text == 'b');
+
+    var title = gumbo.parseFragment('<b>&amp;', 'title').children[0];
+    assert(title.children[0].text == '<b>&', "Uses the context's text mode");
+
+    var svg = gumbo.parseFragment('<path/>', 'svg', {contextNamespace: 'SVG'});
+    assert(svg.children[0].children[0].tagNamespace == 'SVG');
+    assert.throws(function() {
+        gumbo.parseFragment('', 'div', {contextNamespace: 'xul'});
+    }, TypeError);
+}
+
+
+function testExtract(text) {
+    var found = [];
+    var completed = gumbo.extract(text, 'body > p', function(element) {
+        found.push(element);
+    });
+    assert(completed, "Extracted from the whole document");
+    assert(found.length == 2, "Calls back with every match");
+    assert(found[0].attributes['class'].value == 'waffle');
+    assert(found[0].children[0].text == 'Limbo', "Matches come with content");
+    assert(found[0].parent === null);
+
+    var classes = [];
+    completed = gumbo.extract(text, '.waffle, title', function(element) {
+        classes.push(element.tag);
+        return false;
+    });
+    assert(!completed && classes.length == 1,
+           "Stops when the callback returns false");
+    assert(classes[0] == 'title');
+
+    assert.throws(function() {
+        gumbo.extract(text, 'p:first-child', function() {});
+    }, TypeError);
+    assert.throws(function() {
+        gumbo.extract(text, 'p', function() {
+            throw new Error('stop');
+        });
+    }, /stop/);
+}
+
+
+function testDeepNesting() {
+    var depth = 100000;
+    var nested = gumbo.parse(new Array(depth + 1).join('<span>'));
+    var node = nested.children[0];
+    var levels = 0;
+    while (node.children && node.children.length) {
+        node = node.children[node.children.length - 1];
+        levels++;
+    }
+    // <html> -> <body> -> spans
+    assert(levels == depth + 1, "Converts deeply nested trees");
+}
+
+
+function testParseAsync(text) {
+    gumbo.parseAsync(text, function(err, document) {
+        assert(!err);
+        assert(document.children[0].tag == 'html', "Parses off-thread");
+        assert(document.status == 'ok');
+    });
+
+    var big = new Array(100000).join('<p>x</p>');
+    var handle = gumbo.parseAsync(big, {}, function(err, document) {
+        assert(err && err.code == 'ECANCELED', "Cancelled parses fail");
+        assert(document === undefined, "Cancelled parses build no tree");
+    });
+    handle.cancel();
+
+    gumbo.parseAsync(big, {timeout: 0}, function(err) {
+        assert(err && err.code == 'ETIMEDOUT', "Parses respect the timeout");
+    });
+
+    if (typeof AbortController != 'undefined') {
+        var controller = new AbortController();
+        gumbo.parseAsync(big, {signal: controller.signal}, function(err) {
+            assert(err && err.code == 'ECANCELED', "Honours AbortSignal");
+        });
+        controller.abort();
+    }
 }
 
 